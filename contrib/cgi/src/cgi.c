@@ -1,6 +1,9 @@
 #include <config.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <gio/gio.h>
@@ -548,44 +551,117 @@ out:
 }
 
 /*
- * Wrapper around fread() that writes upload progress information to status
- * file.
+ * Size of the chunks moved from stdin to the bundle file at once
+ */
+#define UPLOAD_CHUNK_SIZE (1024 * 1024)
+
+/*
+ * Minimum interval between two upload status file updates in microseconds
  */
-static gint64 fread_chunked(char *ptr, size_t size, FILE *stream, GError **error)
+#define UPLOAD_STATUS_INTERVAL (500 * 1000)
+
+/*
+ * Moves up to 'len' bytes from fd_in to fd_out. splice() is used as long as
+ * it works (i.e. fd_in is a pipe), otherwise the data is copied via 'buf'
+ * which must hold at least UPLOAD_CHUNK_SIZE bytes.
+ *
+ * Returns the number of bytes moved, 0 on end of input or -1 on error.
+ */
+static gssize move_chunk(int fd_in, int fd_out, gsize len, gboolean *use_splice, gchar *buf)
 {
-	gint64 items_read = 0;
-	gint64 bytes_read = 0;
-	gint percentage = 0;
-	gint last_percentage = -1;
+	gssize bytes_read;
+	gssize written = 0;
+
+	len = MIN(len, UPLOAD_CHUNK_SIZE);
+
+	if (*use_splice) {
+		bytes_read = splice(fd_in, NULL, fd_out, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (bytes_read >= 0)
+			return bytes_read;
+		if (errno != EINVAL && errno != ENOSYS)
+			return -1;
+		/* not supported for these file descriptors, fall back to copying */
+		*use_splice = FALSE;
+	}
 
-	while (bytes_read < (gint64) size) {
-		items_read = fread(ptr + bytes_read, 1, 1024, stream);
-		bytes_read += items_read;
-		percentage = (bytes_read * 100) / size;
+	do {
+		bytes_read = read(fd_in, buf, len);
+	} while (bytes_read < 0 && errno == EINTR);
+	if (bytes_read <= 0)
+		return bytes_read;
+
+	while (written < bytes_read) {
+		gssize ret = write(fd_out, buf + written, bytes_read - written);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		written += ret;
+	}
 
-		/* update upload status only if percentage changed */
-		if (percentage != last_percentage) {
+	return bytes_read;
+}
+
+/*
+ * Streams 'size' bytes from fd_in to fd_out and writes upload progress
+ * information to status file at most every UPLOAD_STATUS_INTERVAL.
+ *
+ * Returns the number of bytes moved, or -1 on error.
+ */
+static gint64 stream_chunked(int fd_in, int fd_out, gint64 size, GError **error)
+{
+	gint64 bytes_moved = 0;
+	gint64 last_update = g_get_monotonic_time();
+	gint last_percentage = 0;
+	gboolean use_splice = TRUE;
+	gchar *buf = g_malloc(UPLOAD_CHUNK_SIZE);
+
+	while (bytes_moved < size) {
+		gint64 now;
+		gint percentage;
+		gssize ret;
+
+		ret = move_chunk(fd_in, fd_out, size - bytes_moved, &use_splice, buf);
+		if (ret < 0) {
+			g_set_error(error, CGI_ERROR, CGI_ERROR_FAILED, "Failed to store upload: %s", g_strerror(errno));
+			bytes_moved = -1;
+			goto out;
+		}
+		if (ret == 0)
+			break;
+		bytes_moved += ret;
+
+		/* update upload status only if percentage changed and the last
+		 * update is long enough ago */
+		percentage = (bytes_moved * 100) / size;
+		now = g_get_monotonic_time();
+		if (percentage != last_percentage &&
+		    (now - last_update >= UPLOAD_STATUS_INTERVAL || percentage == 100)) {
 			last_percentage = percentage;
+			last_update = now;
 			if (!write_upload_status(percentage, error)) {
-				bytes_read = -1;
+				bytes_moved = -1;
 				goto out;
 			}
 		}
 	}
 
 out:
-	return bytes_read;
+	g_free(buf);
+	return bytes_moved;
 }
 
 /*
- * Reads stdin and writes to temporary bundle file.
+ * Streams stdin to the bundle file without keeping the upload in memory.
  */
 static gboolean stdin_to_file(GError **error)
 {
 	gint ret = FALSE;
 	gint64 read_len = 0;
 	gint64 bytes_read = 0;
-	gchar *file_buf = NULL;
+	gint fd = -1;
+	gchar *tmp_location = g_strdup_printf("%s.part", BUNDLE_TARGET_LOCATION);
 	gchar *content_length = g_strdup(g_getenv("CONTENT_LENGTH"));
 
 	if (!content_length) {
@@ -604,37 +680,57 @@ static gboolean stdin_to_file(GError **error)
 		goto out;
 
 	read_len = g_ascii_strtoll(content_length, NULL, 10);
-	if (read_len == 0) {
+	if (read_len <= 0) {
 		g_set_error(error, CGI_ERROR, CGI_ERROR_BAD_REQUEST, "Content-Length header invalid.");
 		write_upload_status(-1, NULL);
 		goto error;
 	}
 
-	/* read 'read_len' bytes from stdin ... */
-	file_buf = (char *) g_malloc(read_len);
-	bytes_read = fread_chunked(file_buf, read_len, stdin, error);
+	fd = g_open(tmp_location, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		g_set_error(error, CGI_ERROR, CGI_ERROR_FAILED, "Failed to create %s: %s", tmp_location, g_strerror(errno));
+		write_upload_status(-1, NULL);
+		goto error;
+	}
+
+	/* reserve space upfront to fail early if the upload does not fit */
+	if (posix_fallocate(fd, 0, read_len) == ENOSPC) {
+		g_set_error(error, CGI_ERROR, CGI_ERROR_FAILED, "Not enough space for bundle of %" G_GINT64_FORMAT " bytes", read_len);
+		write_upload_status(-1, NULL);
+		goto error;
+	}
+
+	/* move 'read_len' bytes from stdin ... */
+	bytes_read = stream_chunked(STDIN_FILENO, fd, read_len, error);
 	if (bytes_read == -1 || bytes_read != read_len) {
-		if (!error && !*error)
+		if (error && !*error)
 			g_set_error(error, CGI_ERROR, CGI_ERROR_BAD_REQUEST, "Content-Length header incorrect.");
 		write_upload_status(-1, NULL);
 		goto error;
 	}
 
-	if (!g_file_set_contents(BUNDLE_TARGET_LOCATION, file_buf, read_len, error)) {
+	if (close(fd) != 0 || g_rename(tmp_location, BUNDLE_TARGET_LOCATION) != 0) {
+		fd = -1;
+		g_set_error(error, CGI_ERROR, CGI_ERROR_FAILED, "Failed to store bundle: %s", g_strerror(errno));
 		write_upload_status(-1, NULL);
 		goto error;
 	}
+	fd = -1;
 
 	ret = TRUE;
 
 error:
-	if (*error)
+	if (fd >= 0)
+		close(fd);
+	if (*error) {
+		g_remove(tmp_location);
 		/* try to remove status/lock file */
 		g_remove(STATUS_FILE_LOCATION);
+	}
 
 out:
-	g_free(file_buf);
 	g_free(content_length);
+	g_free(tmp_location);
 
 	return ret;
 }
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <glib.h>
+
+/* Default amount of data processed by each benchmark */
+#define R_BENCH_DEFAULT_SIZE (256*1024*1024)
+
+typedef struct {
+	/** name of the benchmarked engine */
+	gchar *name;
+	/** number of bytes processed */
+	guint64 bytes;
+	/** elapsed wall clock time in seconds */
+	gdouble seconds;
+	/** user and system CPU time in seconds, including child processes */
+	gdouble cpu_seconds;
+	/** read and write system calls of the rauc process (-1 if unknown) */
+	gint64 syscalls;
+	/** peak resident set size in bytes so far */
+	guint64 peak_rss;
+} RaucBenchResult;
+
+/**
+ * Runs the benchmarks for the install I/O paths.
+ *
+ * The engines for hashing, copying, read-back verification, hash tree
+ * computation and archive extraction are run against files in a temporary
+ * directory below dir, so dir determines the storage that is measured (e.g.
+ * tmpfs or a mounted loop device). If url is given, downloading it is
+ * measured as well.
+ *
+ * @param dir directory for the temporary files
+ * @param size number of bytes to process per engine
+ * @param url URL to download, or NULL
+ * @param results return location for a newly allocated array of
+ *        RaucBenchResult
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE if all benchmarks were run, FALSE if an error occurred
+ */
+gboolean r_bench_run(const gchar *dir, guint64 size, const gchar *url,
+		GPtrArray **results, GError **error);
+
+/**
+ * Returns the throughput of a benchmark result in MB/s.
+ */
+gdouble r_bench_result_throughput(const RaucBenchResult *result);
+
+void r_bench_result_free(RaucBenchResult *result);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(RaucBenchResult, r_bench_result_free);
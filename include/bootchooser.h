@@ -52,3 +52,32 @@ RaucSlot* r_boot_get_primary(GError **error);
  * @return TRUE if successful, FALSE if failed
  */
 gboolean r_boot_get_state(RaucSlot* slot, gboolean *good, GError **error);
+
+/**
+ * Start a bootloader transaction for the calling thread.
+ *
+ * Until the transaction is committed or aborted, bootloader variables are
+ * read only once and then served from a cache, and changes made by
+ * r_boot_set_state() and r_boot_set_primary() are only staged in memory.
+ * This avoids running the bootloader tool (or rewriting the environment)
+ * once per variable and slot.
+ *
+ * Applies to the barebox, U-Boot and GRUB backends. EFI variables are
+ * always read and written directly.
+ */
+void r_boot_transaction_begin(void);
+
+/**
+ * Write all changes staged in the current transaction to the bootloader
+ * with a single update and end the transaction.
+ *
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE if successful, FALSE if failed
+ */
+gboolean r_boot_transaction_commit(GError **error);
+
+/**
+ * Discard all changes staged in the current transaction and end it.
+ */
+void r_boot_transaction_abort(void);
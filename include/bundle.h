@@ -9,7 +9,8 @@ GQuark r_bundle_error_quark(void);
 typedef enum {
 	R_BUNDLE_ERROR_SIGNATURE,
 	R_BUNDLE_ERROR_KEYRING,
-	R_BUNDLE_ERROR_IDENTIFIER
+	R_BUNDLE_ERROR_IDENTIFIER,
+	R_BUNDLE_ERROR_FS_IMAGE
 } RBundleError;
 
 typedef struct {
@@ -108,6 +109,22 @@ gboolean extract_file_from_bundle(RaucBundle *bundle, const gchar *outputdir, co
  */
 gboolean create_casync_bundle(RaucBundle *bundle, const gchar *outbundle, GError **error);
 
+/**
+ * Create bundle with filesystem images instead of tar archives.
+ *
+ * Each tar archive image of a slot class listed in fs_sizes is converted to
+ * an ext4 image of the given size, so that it can be written to the slot
+ * as-is. All other images are kept unchanged.
+ *
+ * @param bundle RaucBundle struct as returned by check_bundle()
+ * @param outbundle output location for converted bundle
+ * @param fs_sizes NULL-terminated list of "<slotclass>:<size>[K|M|G]" entries
+ * @param error Return location for a GError
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean create_fs_image_bundle(RaucBundle *bundle, const gchar *outbundle, gchar **fs_sizes, GError **error);
+
 /**
  * Mount a bundle.
  *
@@ -39,3 +39,18 @@ gboolean update_checksum(RaucChecksum *checksum, const gchar *filename, GError *
  * @return TRUE on success, FALSE if an error occurred
  */
 gboolean verify_checksum(const RaucChecksum *checksum, const gchar *filename, GError **error);
+
+/**
+ * Verifies the checksum of data written to a device, bypassing the page cache.
+ *
+ * Only the first checksum->size bytes of the device are hashed. The device is
+ * read with O_DIRECT if supported, otherwise its cached pages are dropped
+ * first. Reading is done in a separate thread, so that reading the next chunk
+ * and hashing the current one overlap.
+ *
+ * @param checksum expected checksum of the written data
+ * @param device path to the device (or file) to read back
+ * @param error return location for a GError, or NULL
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean verify_device_checksum(const RaucChecksum *checksum, const gchar *device, GError **error);
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <glib.h>
+
+typedef enum {
+	R_CHUNK_CACHE_ERROR_FAILED = 0,
+	R_CHUNK_CACHE_ERROR_INVALID_INDEX,
+	R_CHUNK_CACHE_ERROR_MISSING_CHUNK,
+} RChunkCacheError;
+
+#define R_CHUNK_CACHE_ERROR (r_chunk_cache_error_quark())
+GQuark r_chunk_cache_error_quark(void);
+
+typedef struct {
+	/* number of distinct chunks referenced by the index */
+	guint total;
+	/* number of chunks already present in the cache */
+	guint hits;
+	/* number of chunks expected to be provided by seeds */
+	guint seeded;
+	/* number of chunks fetched from the store into the cache */
+	guint fetched;
+	/* number of chunks not cached because the size limit was reached */
+	guint uncached;
+} RChunkCacheStats;
+
+/**
+ * Parses a casync index file (.caibx/.caidx) for the chunks it references.
+ *
+ * @param indexfile path to the casync index file
+ * @param error return location for a GError, or NULL
+ *
+ * @return array of distinct chunk ids (hex strings, in index order),
+ *         NULL if an error occurred
+ */
+GPtrArray *r_chunk_cache_parse_index(const gchar *indexfile, GError **error);
+
+/**
+ * Returns the path of a chunk inside a casync chunk store.
+ *
+ * @param store path or URL of the chunk store
+ * @param chunk_id hex chunk id
+ *
+ * @return newly allocated chunk path
+ */
+gchar *r_chunk_cache_chunk_path(const gchar *store, const gchar *chunk_id);
+
+/**
+ * Fetches the chunks referenced by an index into the cache.
+ *
+ * Cached chunks are verified against the digest recorded when they were
+ * added and have their modification time updated (for LRU eviction). Chunks
+ * failing verification are dropped and fetched again. Chunks listed in seeded
+ * are expected to be found in a seed by casync and are not fetched. Missing
+ * chunks are fetched from the given store (local path or, with network
+ * support, remote URL) as long as the cache stays below max_size, evicting
+ * least recently used chunks not referenced by the index if needed.
+ *
+ * As not all chunks may end up in the cache, the original store must still
+ * be used as a fallback when extracting.
+ *
+ * @param cachedir chunk cache directory
+ * @param indexfile casync index file of the image to install
+ * @param store chunk store to fetch missing chunks from
+ * @param seeded set of chunk ids provided by seeds, or NULL
+ * @param max_size maximum cache size in bytes
+ * @param stats return location for hit/miss statistics, or NULL
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE if the cache was populated, FALSE if an error occurred
+ */
+gboolean r_chunk_cache_populate(const gchar *cachedir, const gchar *indexfile,
+		const gchar *store, GHashTable *seeded, guint64 max_size,
+		RChunkCacheStats *stats, GError **error);
+
+/**
+ * Removes all chunks referenced by an index from the cache.
+ *
+ * Used to drop entries that failed verification during extraction.
+ *
+ * @param cachedir chunk cache directory
+ * @param indexfile casync index file
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_chunk_cache_purge(const gchar *cachedir, const gchar *indexfile, GError **error);
+
+/**
+ * Evicts least recently used chunks until cache size is below max_size.
+ *
+ * @param cachedir chunk cache directory
+ * @param max_size maximum cache size in bytes
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_chunk_cache_trim(const gchar *cachedir, guint64 max_size, GError **error);
+
+/**
+ * Remembers the index of an image installed to a slot.
+ *
+ * This allows to determine which chunks the slot can provide when it is used
+ * as a seed later on (see r_chunk_cache_load_slot_index()). Previously saved
+ * indexes of the slot are replaced.
+ *
+ * @param cachedir chunk cache directory
+ * @param slotname name of the slot the image was installed to
+ * @param digest digest of the installed image
+ * @param indexfile casync index file of the image
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_chunk_cache_save_slot_index(const gchar *cachedir, const gchar *slotname,
+		const gchar *digest, const gchar *indexfile, GError **error);
+
+/**
+ * Returns the chunks contained in a slot according to its saved index.
+ *
+ * @param cachedir chunk cache directory
+ * @param slotname name of the slot
+ * @param digest digest of the image the slot currently contains
+ *
+ * @return array of chunk ids as returned by r_chunk_cache_parse_index(), NULL
+ *         if no valid index was saved for this slot and digest
+ */
+GPtrArray *r_chunk_cache_load_slot_index(const gchar *cachedir, const gchar *slotname,
+		const gchar *digest);
@@ -3,10 +3,16 @@
 #include <glib.h>
 
 #include <checksum.h>
+#include "hash_tree.h"
 #include "manifest.h"
 
 /* Default maximum downloadable bundle size (8 MiB) */
 #define DEFAULT_MAX_BUNDLE_DOWNLOAD_SIZE 8*1024*1024
+/* Default maximum size of the local casync chunk cache (256 MiB) */
+#define DEFAULT_CHUNK_CACHE_MAX_SIZE 256*1024*1024
+
+/* Number of threads mounting slots concurrently to load their status */
+#define SLOT_STATUS_LOAD_THREADS 4
 
 typedef enum {
 	R_CONFIG_ERROR_INVALID_FORMAT,
@@ -37,7 +43,19 @@ typedef struct {
 	/* path prefix where rauc may create mount directories */
 	gchar *mount_prefix;
 	gchar *store_path;
+	/* local directory for caching casync chunks across installs */
+	gchar *chunk_cache_path;
+	/* maximum size of chunk cache in bytes */
+	guint64 chunk_cache_max_size;
+	/* additional seeds for casync extraction */
+	gchar **casync_seeds;
 	gchar *grubenv_path;
+	/* edit GRUB environment block directly instead of using grub-editenv */
+	gboolean grubenv_native;
+	/* fw_env.config for native U-Boot environment access */
+	gchar *uboot_env_config;
+	/* efivarfs mount point for native EFI variable access */
+	gchar *efivarfs_path;
 	gboolean activate_installed;
 	gchar *statusfile_path;
 	gchar *keyring_path;
@@ -80,6 +98,9 @@ typedef struct {
 	guint32 installed_count;
 	gchar *activated_timestamp;
 	guint32 activated_count;
+	gchar *hashtree_root;
+	guint32 hashtree_leaf_size;
+	gchar *discarded_timestamp;
 } RaucSlotStatus;
 
 typedef struct _RaucSlot {
@@ -99,6 +120,10 @@ typedef struct _RaucSlot {
 	gboolean readonly;
 	/** flag indicating if the slot update may be forced */
 	gboolean force_install_same;
+	/** flag indicating if written images are read back and verified */
+	gboolean verify_after_write;
+	/** minimum number of days between two discards when formatting */
+	guint discard_interval;
 	/** extra mount options for this slot */
 	gchar *extra_mount_opts;
 
@@ -109,6 +134,8 @@ typedef struct _RaucSlot {
 	gchar *mount_point;
 	gchar *ext_mount_point;
 	RaucSlotStatus *status;
+	/** hash tree of the image just written to the slot, NULL if unknown (runtime) */
+	RaucHashTree *hash_tree;
 } RaucSlot;
 
 typedef struct {
@@ -186,23 +213,35 @@ void free_slot_status(RaucSlotStatus *slotstatus);
  *
  * Takes care to fill in slot status information into the designated component
  * of the slot data structure. If the user configured a global status file in
- * the system.conf they are read from this file. Otherwise mount the given slot,
- * read the status information from its local status file and unmount the slot
- * afterwards. If a problem occurs the stored slot status consists of default
+ * the system.conf they are read from this file. Otherwise mount the given slot
+ * read-only, read the status information from its local status file and
+ * unmount the slot afterwards. If a problem occurs the stored slot status consists of default
  * values. Do nothing if the status information have already been loaded before.
  *
  * @param dest_slot Slot to load status information for
  */
 void load_slot_status(RaucSlot *dest_slot);
 
+/**
+ * Load slot status of several slots.
+ *
+ * Same as load_slot_status(), but slots that need to be mounted to read their
+ * local status file are mounted and read concurrently by up to
+ * SLOT_STATUS_LOAD_THREADS threads.
+ *
+ * @param slots list of slots (RaucSlot) to load status information for
+ */
+void load_slot_status_multi(GList *slots);
+
 /**
  * Save slot status.
  *
  * This persists the status information from the designated component of the
  * given slot data structure. If the user configured a global status file in the
- * system.conf they are written to this file. Otherwise mount the given slot,
- * transfer the status information to the local status file and unmount the slot
- * afterwards.
+ * system.conf they are appended to its journal (see commit_slot_status()).
+ * Otherwise mount the given slot, transfer the status information to the local
+ * status file and unmount the slot afterwards. If the slot is already mounted by RAUC, that mount is used and
+ * left in place.
  *
  * @param dest_slot Slot to write status information for
  * @param error return location for a GError, or NULL
@@ -211,6 +250,31 @@ void load_slot_status(RaucSlot *dest_slot);
  */
 gboolean save_slot_status(RaucSlot *dest_slot, GError **error);
 
+/**
+ * Commit slot status.
+ *
+ * Merges the slot status saved to the journal of the global status file into
+ * the status file itself. Does nothing if no global status file is
+ * configured.
+ *
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE if committing succeeded or was not needed, FALSE otherwise
+ */
+gboolean commit_slot_status(GError **error);
+
+/**
+ * Get the path of the hash tree file of a slot.
+ *
+ * Hash trees are only recorded if a global status file is configured, as
+ * they are stored next to it (<statusfile>.<slotname>.hashtree).
+ *
+ * @param slot slot to get the hash tree path for
+ *
+ * @return newly allocated path, NULL if no global status file is configured
+ */
+gchar *get_slot_hash_tree_path(const RaucSlot *slot);
+
 /**
  * Frees the memory allocated by a RaucSlot
  */
@@ -2,6 +2,7 @@
 
 #include <glib.h>
 #include <glib-object.h>
+#include <gio/gio.h>
 #include <glib/gprintf.h>
 
 
@@ -11,9 +12,70 @@
 typedef void (*progress_callback) (gint percentage, const gchar *message,
 		gint nesting_depth);
 
+typedef void (*progress_bytes_callback) (guint64 bytes_done, guint64 bytes_total,
+		guint64 throughput, gint64 eta);
+
+typedef struct {
+	/* "step", "subprocess" or "bootloader" */
+	const gchar *category;
+	gchar *name;
+	/* step description or command line */
+	gchar *description;
+	/* monotonic time in microseconds, end is 0 while running */
+	gint64 start;
+	gint64 end;
+	/* bytes accounted to the step with r_context_add_bytes() */
+	guint64 bytes;
+	gboolean success;
+} RaucTraceEvent;
+
+typedef struct {
+	/* name identifying progress step */
+	gchar *name;
+	gchar *description;
+
+	gint substeps_total;
+	gint substeps_done;
+
+	gfloat percent_total;
+	gfloat percent_done;
+	gint last_explicit_percent;
+
+	/* trace event of this step, NULL if no trace is recorded */
+	RaucTraceEvent *trace_event;
+} RaucProgressStep;
+
+/* maximum nesting depth of progress steps */
+#define PROGRESS_MAX_DEPTH 16
+
+typedef struct {
+	/* TRUE between r_context_begin_bytes() and r_context_end_bytes() */
+	gboolean active;
+	guint64 done;
+	/* 0 if unknown */
+	guint64 total;
+	/* depth of the step the bytes are accounted to */
+	guint step_depth;
+	/* time and bytes done at the last notification */
+	gint64 last_time;
+	guint64 last_done;
+	/* smoothed throughput in bytes per second */
+	gdouble throughput;
+} RaucProgressBytes;
+
 typedef struct {
 	/* The bundle currently mounted by RAUC */
 	RaucBundle *mounted_bundle;
+	/* protects cancellable and paused */
+	GMutex control_mutex;
+	GCond control_cond;
+	/* cancellable of the running installation, NULL if none is running */
+	GCancellable *cancellable;
+	gboolean paused;
+	/* environment shared by all hooks of the running installation */
+	gchar **hook_env;
+	/* hook server of the running installation, if the bundle uses one */
+	struct _RaucHookServer *hook_server;
 } RContextInstallationInfo;
 
 typedef struct {
@@ -25,8 +87,25 @@ typedef struct {
 	gchar *configpath;
 	RaucConfig *config;
 
-	GList *progress;
+	/* stack of running progress steps, the current one is
+	 * progress[progress_depth - 1] */
+	RaucProgressStep progress[PROGRESS_MAX_DEPTH];
+	guint progress_depth;
+	/* sum of percent_done of all steps below the current one */
+	gfloat progress_parents_done;
+	/* last percentage passed to progress_callback */
+	gint progress_last_percent;
 	progress_callback progress_callback;
+	RaucProgressBytes progress_bytes;
+	progress_bytes_callback progress_bytes_callback;
+
+	/* timeline of the running or last installation, NULL if none was
+	 * recorded. Written by the install thread, protected by trace_mutex. */
+	GPtrArray *trace;
+	gint64 trace_start;
+	/* TRUE between r_context_trace_start() and r_context_trace_stop() */
+	gboolean trace_recording;
+	GMutex trace_mutex;
 
 	/* signing data */
 	gchar *certpath;
@@ -48,19 +127,6 @@ typedef struct {
 	RContextInstallationInfo *install_info;
 } RaucContext;
 
-typedef struct {
-	/* name identifying progress step */
-	gchar *name;
-	gchar *description;
-
-	gint substeps_total;
-	gint substeps_done;
-
-	gfloat percent_total;
-	gfloat percent_done;
-	gint last_explicit_percent;
-} RaucProgressStep;
-
 gboolean r_context_get_busy(void);
 void r_context_set_busy(gboolean busy);
 
@@ -103,21 +169,115 @@ void r_context_end_step(const gchar *name, gboolean success);
  * Sets explicit percentage for the given step. This is useful for long lasting
  * operations, e.g. file copying.
  *
+ * Updates that do not change the overall percentage are not passed to the
+ * progress callback, so this is cheap enough to be called per block.
+ *
  * @param name identifying the step
  * @param percentage explicit step percentage
  */
 void r_context_set_step_percentage(const gchar *name, gint percentage);
 
 /**
- * Frees the memory allocated by the RaucProgressStep.
+ * Changes the description of the given step and emits it with the current
+ * percentage, e.g. when a long lasting step enters a new phase.
  *
- * @param step a RaucProgressStep to free
+ * @param name identifying the step
+ * @param description new description that is emitted via DBus
  */
-void r_context_free_progress_step(RaucProgressStep *step);
-
-G_DEFINE_AUTOPTR_CLEANUP_FUNC(RaucProgressStep, r_context_free_progress_step);
+void r_context_set_step_description(const gchar *name, const gchar *description);
 
 void r_context_register_progress_callback(progress_callback progress_cb);
 
+/**
+ * Starts byte-level progress accounting for a long lasting operation, e.g.
+ * writing, hashing or downloading an image.
+ *
+ * If the current step has no substeps, its percentage is derived from the
+ * bytes processed until r_context_end_bytes() is called.
+ *
+ * @param total number of bytes to process, 0 if not known yet
+ */
+void r_context_begin_bytes(guint64 total);
+
+/**
+ * Updates the number of bytes to process, e.g. once a download reports its
+ * size.
+ *
+ * @param total number of bytes to process
+ */
+void r_context_set_bytes_total(guint64 total);
+
+/**
+ * Accounts processed bytes. Does nothing if no byte-level progress
+ * accounting is active.
+ *
+ * Notifications are rate-limited to two per second.
+ *
+ * @param bytes number of bytes processed since the last call
+ */
+void r_context_add_bytes(guint64 bytes);
+
+/**
+ * Stops byte-level progress accounting and sends a final notification.
+ */
+void r_context_end_bytes(void);
+
+void r_context_register_progress_bytes_callback(progress_bytes_callback progress_bytes_cb);
+
+/**
+ * Starts recording a new timeline, dropping the previous one.
+ *
+ * From now on, all steps record their start and end time and the bytes
+ * accounted to them. Helper processes and bootloader accesses are recorded
+ * with r_context_trace_begin().
+ */
+void r_context_trace_start(void);
+
+/**
+ * Stops recording the timeline. It stays available until the next call of
+ * r_context_trace_start().
+ */
+void r_context_trace_stop(void);
+
+/**
+ * Records the start of an event that is no progress step.
+ *
+ * @param category category of the event, e.g. "subprocess"
+ * @param name short name of the event
+ * @param description details, e.g. the command line, or NULL
+ *
+ * @return event to pass to r_context_trace_end(), NULL if no timeline is
+ *         recorded
+ */
+RaucTraceEvent *r_context_trace_begin(const gchar *category, const gchar *name,
+		const gchar *description);
+
+/**
+ * Records the start of a helper process.
+ *
+ * @param args NULL-terminated arguments of the process
+ *
+ * @return event to pass to r_context_trace_end(), NULL if no timeline is
+ *         recorded
+ */
+RaucTraceEvent *r_context_trace_subprocess(GPtrArray *args);
+
+/**
+ * Records the end of an event started with r_context_trace_begin().
+ *
+ * @param event event to end, may be NULL
+ * @param success TRUE if the event completed successfully
+ */
+void r_context_trace_end(RaucTraceEvent *event, gboolean success);
+
+/**
+ * Returns the recorded timeline in Chrome trace event format, which can be
+ * loaded into chrome://tracing or Perfetto. Events that are still running end
+ * at the current time.
+ *
+ * @return newly allocated JSON string, NULL if no timeline was recorded
+ */
+gchar *r_context_trace_to_json(void);
+
 RaucContext *r_context_conf(void);
 const RaucContext *r_context(void);
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <glib.h>
+
+#define R_EFIVARS_ERROR r_efivars_error_quark()
+GQuark r_efivars_error_quark(void);
+
+typedef enum {
+	R_EFIVARS_ERROR_FAILED = 0,
+	R_EFIVARS_ERROR_INVALID,
+} REfivarsError;
+
+/**
+ * Reads an EFI global variable from efivarfs.
+ *
+ * @param efivarfs efivarfs mount point (usually /sys/firmware/efi/efivars)
+ * @param name variable name without GUID (e.g. 'BootOrder')
+ * @param error return location for a GError, or NULL
+ *
+ * @return variable data without attributes, NULL if an error occurred
+ *         (G_FILE_ERROR_NOENT if the variable does not exist)
+ */
+GBytes *r_efivars_read(const gchar *efivarfs, const gchar *name, GError **error);
+
+/**
+ * Writes an EFI global variable to efivarfs as non-volatile, boot service
+ * and runtime accessible variable.
+ *
+ * @param efivarfs efivarfs mount point
+ * @param name variable name without GUID
+ * @param data variable data
+ * @param len length of data
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_efivars_write(const gchar *efivarfs, const gchar *name,
+		const guint8 *data, gsize len, GError **error);
+
+/**
+ * Lists the numbers of all 'Boot####' load option variables.
+ *
+ * @param efivarfs efivarfs mount point
+ * @param error return location for a GError, or NULL
+ *
+ * @return sorted array of 4-digit uppercase hex boot numbers,
+ *         NULL if an error occurred
+ */
+GPtrArray *r_efivars_list_boot_entries(const gchar *efivarfs, GError **error);
+
+/**
+ * Parses the description of an EFI_LOAD_OPTION ('Boot####' content).
+ *
+ * @param option load option data
+ * @param active return location for the LOAD_OPTION_ACTIVE attribute, or NULL
+ * @param error return location for a GError, or NULL
+ *
+ * @return newly allocated UTF-8 description, NULL if an error occurred
+ */
+gchar *r_efivars_load_option_description(GBytes *option, gboolean *active, GError **error);
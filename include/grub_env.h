@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glib.h>
+
+#define R_GRUB_ENV_ERROR r_grub_env_error_quark()
+GQuark r_grub_env_error_quark(void);
+
+typedef enum {
+	R_GRUB_ENV_ERROR_FAILED = 0,
+	R_GRUB_ENV_ERROR_INVALID,
+	R_GRUB_ENV_ERROR_TOO_LARGE,
+} RGrubEnvError;
+
+typedef struct _RGrubEnv RGrubEnv;
+
+/**
+ * Loads a GRUB environment block file (as managed by grub-editenv).
+ *
+ * @param path path to the environment block file
+ * @param error return location for a GError, or NULL
+ *
+ * @return newly allocated RGrubEnv, NULL if an error occurred
+ */
+RGrubEnv *r_grub_env_load(const gchar *path, GError **error);
+
+/**
+ * Returns the value of an environment variable.
+ *
+ * @param env environment
+ * @param key variable name
+ *
+ * @return value (owned by env), or NULL if not set
+ */
+const gchar *r_grub_env_get(RGrubEnv *env, const gchar *key);
+
+/**
+ * Sets or removes an environment variable in memory.
+ *
+ * Changes are written by r_grub_env_save().
+ *
+ * @param env environment
+ * @param key variable name
+ * @param value new value, or NULL to remove the variable
+ */
+void r_grub_env_set(RGrubEnv *env, const gchar *key, const gchar *value);
+
+/**
+ * Writes the environment block back.
+ *
+ * The block keeps its size and is written to a temporary file which is
+ * synced and then renamed over the original one.
+ *
+ * @param env environment
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_grub_env_save(RGrubEnv *env, GError **error);
+
+void r_grub_env_free(RGrubEnv *env);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(RGrubEnv, r_grub_env_free);
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <glib.h>
+
+/* Default size of the data blocks hashed into a leaf */
+#define R_HASH_TREE_LEAF_SIZE (1024*1024)
+
+typedef struct _RaucHashTree {
+	/** size of the data covered by the tree */
+	guint64 size;
+	/** size of the data blocks hashed into a leaf */
+	guint32 leaf_size;
+	/** SHA-256 digests of all leaves, concatenated */
+	GBytes *leaves;
+} RaucHashTree;
+
+/**
+ * Computes a hash tree over the first size bytes of a file or device.
+ *
+ * Each leaf is the SHA-256 digest of a leaf_size block of data (the last one
+ * may be shorter), the root is the SHA-256 digest over all leaves. Leaves are
+ * hashed in parallel.
+ *
+ * @param filename file or device to read
+ * @param size number of bytes to cover
+ * @param leaf_size size of the data blocks hashed into a leaf
+ * @param error return location for a GError, or NULL
+ *
+ * @return newly allocated RaucHashTree, NULL if an error occurred
+ */
+RaucHashTree *r_hash_tree_compute(const gchar *filename, guint64 size,
+		guint32 leaf_size, GError **error);
+
+typedef struct _RaucHashTreeBuilder RaucHashTreeBuilder;
+
+/**
+ * Starts computing a hash tree over data as it is streamed, e.g. while an
+ * image is written, so that it does not need to be read a second time.
+ *
+ * @param leaf_size size of the data blocks hashed into a leaf
+ *
+ * @return newly allocated RaucHashTreeBuilder
+ */
+RaucHashTreeBuilder *r_hash_tree_builder_new(guint32 leaf_size);
+
+/**
+ * Feeds the next len bytes of data into a hash tree builder.
+ *
+ * Data may be passed in blocks of any size, leaf boundaries are tracked by
+ * the builder.
+ */
+void r_hash_tree_builder_update(RaucHashTreeBuilder *builder, const guint8 *data, gsize len);
+
+/**
+ * Completes the hash tree over all data fed into a builder.
+ *
+ * The builder must not be updated afterwards.
+ *
+ * @return newly allocated RaucHashTree
+ */
+RaucHashTree *r_hash_tree_builder_end(RaucHashTreeBuilder *builder);
+
+void r_hash_tree_builder_free(RaucHashTreeBuilder *builder);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(RaucHashTreeBuilder, r_hash_tree_builder_free);
+
+/**
+ * Returns the number of leaves of a hash tree.
+ */
+guint r_hash_tree_leaf_count(const RaucHashTree *tree);
+
+/**
+ * Returns the root digest of a hash tree.
+ *
+ * @return newly allocated hex string
+ */
+gchar *r_hash_tree_get_root(const RaucHashTree *tree);
+
+/**
+ * Checks a file or device against a hash tree.
+ *
+ * @param tree hash tree to check against
+ * @param filename file or device to read
+ * @param mismatches return location for a newly allocated array of the
+ *        indices (guint) of leaves that do not match
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE if the check was done (even with mismatches), FALSE if an error
+ *         occurred
+ */
+gboolean r_hash_tree_check(const RaucHashTree *tree, const gchar *filename,
+		GArray **mismatches, GError **error);
+
+/**
+ * Saves the leaves of a hash tree to a file.
+ *
+ * @param tree hash tree to save
+ * @param path file to write
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_hash_tree_save(const RaucHashTree *tree, const gchar *path, GError **error);
+
+/**
+ * Loads the leaves of a hash tree from a file and checks them against the
+ * root digest.
+ *
+ * @param path file to read
+ * @param size size of the data covered by the tree
+ * @param leaf_size size of the data blocks hashed into a leaf
+ * @param root expected root digest
+ * @param error return location for a GError, or NULL
+ *
+ * @return newly allocated RaucHashTree, NULL if an error occurred
+ */
+RaucHashTree *r_hash_tree_load(const gchar *path, guint64 size, guint32 leaf_size,
+		const gchar *root, GError **error);
+
+void r_hash_tree_free(RaucHashTree *tree);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(RaucHashTree, r_hash_tree_free);
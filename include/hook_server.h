@@ -0,0 +1,57 @@
+#pragma once
+
+#include <glib.h>
+
+#define R_HOOK_ERROR r_hook_error_quark()
+GQuark r_hook_error_quark(void);
+
+typedef enum {
+	R_HOOK_ERROR_FAILED = 0,
+	R_HOOK_ERROR_REJECTED,
+	R_HOOK_ERROR_PROTOCOL,
+} RHookError;
+
+typedef struct _RaucHookServer RaucHookServer;
+
+/**
+ * Starts a hook executable as persistent hook server ('<hook> server').
+ *
+ * Instead of starting the hook executable for each hook, it is started once
+ * and receives the hooks to run as requests on its standard input (see
+ * r_hook_server_call()).
+ *
+ * @param hook_name path to the hook executable
+ * @param env environment of the hook process, or NULL to inherit it
+ * @param error return location for a GError, or NULL
+ *
+ * @return newly allocated RaucHookServer, NULL if an error occurred
+ */
+RaucHookServer *r_hook_server_start(const gchar *hook_name, gchar **env, GError **error);
+
+/**
+ * Runs a hook in a hook server.
+ *
+ * Sends a request consisting of the hook command line, one 'NAME=value' line
+ * for each variable and an empty line. Waits for the reply line, which is
+ * 'ok', 'reject <message>' or 'error <message>'.
+ *
+ * @param server hook server
+ * @param hook_cmd hook to run (e.g. 'slot-post-install')
+ * @param vars NULL-terminated array of 'NAME=value' variables for this hook
+ * @param error return location for a GError, or NULL. R_HOOK_ERROR_REJECTED if
+ *        the hook rejected the bundle.
+ *
+ * @return TRUE if the hook succeeded, FALSE otherwise
+ */
+gboolean r_hook_server_call(RaucHookServer *server, const gchar *hook_cmd, gchar **vars, GError **error);
+
+/**
+ * Closes the request pipe of a hook server, waits for it to exit and frees
+ * it.
+ *
+ * @param server hook server to stop
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE if the hook server exited successfully, FALSE otherwise
+ */
+gboolean r_hook_server_stop(RaucHookServer *server, GError **error);
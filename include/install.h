@@ -1,6 +1,7 @@
 #pragma once
 
 #include <glib.h>
+#include <gio/gio.h>
 
 #include "manifest.h"
 
@@ -29,6 +30,7 @@ typedef struct {
 	GMutex status_mutex;
 	GQueue status_messages;
 	gint status_result;
+	GCancellable *cancellable;
 } RaucInstallArgs;
 
 /**
@@ -107,6 +109,54 @@ void install_args_free(RaucInstallArgs *args);
  */
 gboolean install_run(RaucInstallArgs *args);
 
+/**
+ * Requests cancellation of the running installation.
+ *
+ * The installation stops at the next checkpoint (e.g. the next block written
+ * to a slot) and fails with G_IO_ERROR_CANCELLED. Running helper processes
+ * are terminated. A paused installation is cancelled as well.
+ *
+ * @return TRUE if an installation was running, FALSE otherwise
+ */
+gboolean install_cancel(void);
+
+/**
+ * Pauses or resumes the running installation.
+ *
+ * A paused installation blocks at its next checkpoint until resumed.
+ * Helper processes that are already running (e.g. mkfs or casync) are not
+ * interrupted.
+ *
+ * @param paused TRUE to pause, FALSE to resume
+ *
+ * @return TRUE if an installation was running, FALSE otherwise
+ */
+gboolean install_set_paused(gboolean paused);
+
+/**
+ * Checkpoint for long running installation steps.
+ *
+ * Blocks while the running installation is paused.
+ *
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE to continue, FALSE if the installation was cancelled
+ */
+gboolean install_checkpoint(GError **error);
+
+/**
+ * Waits for a helper process of the running installation to finish, like
+ * g_subprocess_wait_check().
+ *
+ * If the installation is cancelled, the process is terminated.
+ *
+ * @param sproc subprocess to wait for
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE if the process exited successfully, FALSE otherwise
+ */
+gboolean install_subprocess_wait_check(GSubprocess *sproc, GError **error);
+
 /**
  * Checks and returns list of images to install
  *
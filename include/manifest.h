@@ -50,6 +50,8 @@ typedef struct {
 	gchar *handler_args;
 
 	gchar *hook_name;
+	/* run the hook executable once as hook server */
+	gboolean hook_persistent;
 	InstallHooks hooks;
 
 	GList *images;
@@ -2,8 +2,28 @@
 
 #include <glib.h>
 
+/**
+ * Makes the slot the primary boot target.
+ *
+ * Within a boot transaction, the change is only staged until
+ * r_boot_transaction_commit() is called.
+ *
+ * @param slot slot to activate
+ * @param error return location for a GError (R_INSTALL_ERROR_MARK_BOOTABLE)
+ */
 void mark_active(RaucSlot *slot, GError **error);
 
+/**
+ * Records the activation of the slot in its status.
+ *
+ * Must only be called once the bootloader changes of mark_active() were
+ * written.
+ *
+ * @param slot activated slot
+ * @param error return location for a GError (R_INSTALL_ERROR_FAILED)
+ */
+void mark_active_save_status(RaucSlot *slot, GError **error);
+
 gboolean mark_run(const gchar *state,
 		const gchar *slot_identifier,
 		gchar **slot_name,
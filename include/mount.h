@@ -67,6 +67,18 @@ gchar* r_create_mount_point(const gchar *name, GError **error);
  */
 gboolean r_mount_slot(RaucSlot *slot, GError **error);
 
+/**
+ * Mount a slot read-only and with noatime, e.g. for reading its status.
+ *
+ * The mountpoint will be available as slot->mount_point.
+ *
+ * @param slot slot to mount
+ * @param error return location for a GError, or NULL
+ *
+ * @return True if succeeded, False if failed
+ */
+gboolean r_mount_slot_readonly(RaucSlot *slot, GError **error);
+
 /**
  * Unmount a slot.
  *
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <glib.h>
+
+#include "checksum.h"
+
+#define R_NAND_ERROR r_nand_error_quark()
+GQuark r_nand_error_quark(void);
+
+typedef enum {
+	R_NAND_ERROR_FAILED = 0,
+	R_NAND_ERROR_NOT_SUPPORTED,
+	R_NAND_ERROR_NO_SPACE,
+	R_NAND_ERROR_VERIFY,
+} RNandError;
+
+/**
+ * Writes an image to an MTD NAND device.
+ *
+ * Only the erase blocks needed for the image are erased, each one just before
+ * it is written. Bad blocks are skipped, blocks that fail to erase or write
+ * are marked bad. Each written block is read back and compared to the image
+ * data. The last page is padded with 0xff.
+ *
+ * Reports progress via r_context_add_bytes() and honors install_checkpoint()
+ * between blocks.
+ *
+ * @param image path to the image file
+ * @param device MTD character device (/dev/mtdX)
+ * @param checksum expected checksum of the image, or NULL
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_nand_write_image(const gchar *image, const gchar *device,
+		const RaucChecksum *checksum, GError **error);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <glib.h>
+
+/* Journal size that triggers compaction into the status file */
+#define R_STATUS_STORE_MAX_JOURNAL_SIZE 64*1024
+
+/**
+ * Loads a status key file and applies all records of its journal
+ * (<path>.journal) on top of it.
+ *
+ * Records that were only partially written (e.g. due to power loss) are
+ * skipped.
+ *
+ * @param path path to the status key file
+ * @param error return location for a GError, or NULL
+ *
+ * @return newly allocated GKeyFile (empty if neither file exists), NULL if an
+ *         error occurred
+ */
+GKeyFile *r_status_store_load(const gchar *path, GError **error);
+
+/**
+ * Appends a record to the journal of a status key file and syncs it to
+ * storage.
+ *
+ * Each group of the record replaces the group of the same name when loading.
+ * If the journal grows beyond R_STATUS_STORE_MAX_JOURNAL_SIZE, it is
+ * compacted using r_status_store_commit().
+ *
+ * @param path path to the status key file
+ * @param record key file containing the groups to replace
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_status_store_append(const gchar *path, GKeyFile *record, GError **error);
+
+/**
+ * Merges the journal into the status key file and removes the journal.
+ *
+ * The key file is replaced atomically and synced before the journal is
+ * removed, so the combined state is preserved if interrupted at any point.
+ * Does nothing if there is no journal.
+ *
+ * @param path path to the status key file
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_status_store_commit(const gchar *path, GError **error);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <glib.h>
+
+#define R_UBOOT_ENV_ERROR r_uboot_env_error_quark()
+GQuark r_uboot_env_error_quark(void);
+
+typedef enum {
+	R_UBOOT_ENV_ERROR_FAILED = 0,
+	R_UBOOT_ENV_ERROR_CONFIG,
+	R_UBOOT_ENV_ERROR_NOT_SUPPORTED,
+	R_UBOOT_ENV_ERROR_TOO_LARGE,
+	R_UBOOT_ENV_ERROR_BAD_CRC,
+} RUbootEnvError;
+
+typedef struct _RUbootEnv RUbootEnv;
+
+/**
+ * Loads the U-Boot environment described by a fw_env.config file.
+ *
+ * Both copies of a redundant environment are read and the valid one with the
+ * most recent flags is used. A copy with a bad CRC is ignored, but if no copy
+ * is valid, R_UBOOT_ENV_ERROR_BAD_CRC is returned. Read errors are always
+ * reported.
+ *
+ * @param config_path path to fw_env.config
+ * @param error return location for a GError, or NULL
+ *
+ * @return newly allocated RUbootEnv, NULL if an error occurred
+ */
+RUbootEnv *r_uboot_env_load(const gchar *config_path, GError **error);
+
+/**
+ * Returns the value of an environment variable.
+ *
+ * @param env environment
+ * @param key variable name
+ *
+ * @return value (owned by env), or NULL if not set
+ */
+const gchar *r_uboot_env_get(RUbootEnv *env, const gchar *key);
+
+/**
+ * Returns the names of all environment variables.
+ *
+ * @param env environment
+ *
+ * @return list of names (owned by env), free the list with g_list_free()
+ */
+GList *r_uboot_env_get_keys(RUbootEnv *env);
+
+/**
+ * Sets or removes an environment variable in memory.
+ *
+ * Changes are written to storage by r_uboot_env_save().
+ *
+ * @param env environment
+ * @param key variable name
+ * @param value new value, or NULL to remove the variable
+ */
+void r_uboot_env_set(RUbootEnv *env, const gchar *key, const gchar *value);
+
+/**
+ * Writes the environment back to storage.
+ *
+ * For redundant environments, the currently inactive copy is written with
+ * increased flags, so that an interrupted write leaves the old copy intact.
+ *
+ * @param env environment
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_uboot_env_save(RUbootEnv *env, GError **error);
+
+void r_uboot_env_free(RUbootEnv *env);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(RUbootEnv, r_uboot_env_free);
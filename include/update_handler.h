@@ -17,3 +17,18 @@ typedef enum {
 typedef gboolean (*img_to_slot_handler) (RaucImage *image, RaucSlot *dest_slot, const gchar *hook_name, GError **error);
 
 img_to_slot_handler get_update_handler(RaucImage *mfimage, RaucSlot  *dest_slot, GError **error);
+
+/**
+ * Returns whether an update handler writes an image unmodified to the slot
+ * device.
+ *
+ * This is only the case for the raw copy handlers. Archives, casync images
+ * and special slot types (such as NAND with skipped bad blocks or eMMC boot
+ * partitions written to a different device) are not stored as-is.
+ *
+ * @param handler update handler as returned by get_update_handler()
+ * @param image image to write
+ *
+ * @return TRUE if the slot device contains the image after writing
+ */
+gboolean update_handler_writes_as_is(img_to_slot_handler handler, RaucImage *image);
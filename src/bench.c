@@ -0,0 +1,413 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "checksum.h"
+#include "hash_tree.h"
+#include "network.h"
+#include "update_handler.h"
+#include "utils.h"
+
+#define BENCH_BLOCK_SIZE (1024*1024)
+/* size of the files in the extraction benchmark, similar to a root
+ * filesystem */
+#define BENCH_ARCHIVE_FILE_SIZE (64*1024)
+#define BENCH_ARCHIVE_FILES_PER_DIR 256
+
+typedef struct {
+	gchar *dir;
+	gchar *source;
+	gchar *dest;
+	gchar *archive;
+	guint64 size;
+	RaucChecksum checksum;
+	const gchar *url;
+} BenchData;
+
+typedef gboolean (*BenchFunc)(BenchData *data, guint64 *bytes, GError **error);
+
+typedef struct {
+	gint64 time;
+	gdouble cpu_seconds;
+	gint64 syscalls;
+} BenchSnapshot;
+
+/* Returns the number of read and write system calls of this process */
+static gint64 count_syscalls(void)
+{
+	g_autofree gchar *contents = NULL;
+	g_auto(GStrv) lines = NULL;
+	gint64 count = 0;
+
+	if (!g_file_get_contents("/proc/self/io", &contents, NULL, NULL))
+		return -1;
+
+	lines = g_strsplit(contents, "\n", -1);
+	for (gchar **line = lines; *line; line++) {
+		if (g_str_has_prefix(*line, "syscr: ") || g_str_has_prefix(*line, "syscw: "))
+			count += g_ascii_strtoll(*line + 7, NULL, 10);
+	}
+
+	return count;
+}
+
+static gdouble timeval_seconds(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / (gdouble) G_USEC_PER_SEC;
+}
+
+static void take_snapshot(BenchSnapshot *snapshot)
+{
+	struct rusage self, children;
+
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &children);
+
+	snapshot->time = g_get_monotonic_time();
+	snapshot->cpu_seconds = timeval_seconds(&self.ru_utime) + timeval_seconds(&self.ru_stime)
+	                        + timeval_seconds(&children.ru_utime) + timeval_seconds(&children.ru_stime);
+	snapshot->syscalls = count_syscalls();
+}
+
+static guint64 peak_rss(void)
+{
+	struct rusage self, children;
+
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &children);
+
+	/* ru_maxrss is in KiB */
+	return (guint64) MAX(self.ru_maxrss, children.ru_maxrss) * 1024;
+}
+
+/* Writes back and drops the cached pages of a file, so the next engine
+ * reads from storage */
+static void drop_cache(const gchar *filename)
+{
+	int fd = g_open(filename, O_RDONLY | O_CLOEXEC, 0);
+
+	if (fd < 0)
+		return;
+
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static gboolean run_command(const gchar *const *argv, GError **error)
+{
+	g_autoptr(GSubprocess) sproc = NULL;
+	GError *ierror = NULL;
+
+	sproc = g_subprocess_newv(argv, G_SUBPROCESS_FLAGS_NONE, &ierror);
+	if (sproc == NULL || !g_subprocess_wait_check(sproc, NULL, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed to run %s: ", argv[0]);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Creates the source file from random data, so that no layer can compress
+ * or deduplicate it */
+static gboolean create_source(BenchData *data, GError **error)
+{
+	g_autofree guint32 *buf = g_malloc(BENCH_BLOCK_SIZE);
+	g_autoptr(GRand) rand = g_rand_new();
+	guint64 done = 0;
+	gboolean res = FALSE;
+	int fd;
+
+	fd = g_open(data->source, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to create %s: %s", data->source, g_strerror(errno));
+		return FALSE;
+	}
+
+	while (done < data->size) {
+		gsize len = MIN(BENCH_BLOCK_SIZE, data->size - done);
+
+		for (gsize i = 0; i < BENCH_BLOCK_SIZE / sizeof(guint32); i++)
+			buf[i] = g_rand_int(rand);
+
+		if (write(fd, buf, len) != (ssize_t) len) {
+			g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+					"Failed to write %s: %s", data->source, g_strerror(errno));
+			goto out;
+		}
+		done += len;
+	}
+
+	res = TRUE;
+out:
+	close(fd);
+	return res;
+}
+
+/* Splits the source file into a tree of small files and archives it */
+static gboolean create_archive(BenchData *data, GError **error)
+{
+	g_autofree gchar *tree = g_build_filename(data->dir, "tree", NULL);
+	g_autoptr(GMappedFile) source = NULL;
+	const gchar *contents;
+	gboolean res = FALSE;
+
+	source = g_mapped_file_new(data->source, FALSE, error);
+	if (!source)
+		return FALSE;
+	contents = g_mapped_file_get_contents(source);
+
+	for (guint64 offset = 0, i = 0; offset < data->size; offset += BENCH_ARCHIVE_FILE_SIZE, i++) {
+		g_autofree gchar *subdir = g_strdup_printf("%s/%" G_GUINT64_FORMAT, tree, i / BENCH_ARCHIVE_FILES_PER_DIR);
+		g_autofree gchar *file = g_strdup_printf("%s/%" G_GUINT64_FORMAT, subdir, i);
+
+		if (g_mkdir_with_parents(subdir, 0755) != 0) {
+			g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+					"Failed to create %s: %s", subdir, g_strerror(errno));
+			goto out;
+		}
+
+		if (!g_file_set_contents(file, contents + offset,
+				MIN(BENCH_ARCHIVE_FILE_SIZE, data->size - offset), error))
+			goto out;
+	}
+
+	res = run_command((const gchar *[]) {"tar", "cf", data->archive, "-C", tree, ".", NULL}, error);
+
+out:
+	rm_tree(tree, NULL);
+	return res;
+}
+
+static gboolean bench_hash(BenchData *data, guint64 *bytes, GError **error)
+{
+	drop_cache(data->source);
+
+	if (!update_checksum(&data->checksum, data->source, error))
+		return FALSE;
+
+	*bytes = data->checksum.size;
+	return TRUE;
+}
+
+static gboolean bench_copy(BenchData *data, guint64 *bytes, GError **error)
+{
+	g_autoptr(RaucImage) image = g_new0(RaucImage, 1);
+	g_autoptr(RaucSlot) slot = g_new0(RaucSlot, 1);
+	img_to_slot_handler handler;
+	int fd;
+
+	image->filename = g_strdup(data->source);
+	image->checksum.type = data->checksum.type;
+	image->checksum.digest = g_strdup(data->checksum.digest);
+	image->checksum.size = data->checksum.size;
+
+	slot->name = "bench";
+	slot->device = g_strdup(data->dest);
+	slot->type = g_strdup("raw");
+
+	/* the update handlers only write to existing devices */
+	if (!g_file_set_contents(data->dest, "", 0, error))
+		return FALSE;
+
+	drop_cache(data->source);
+
+	handler = get_update_handler(image, slot, error);
+	if (!handler)
+		return FALSE;
+
+	if (!handler(image, slot, NULL, error))
+		return FALSE;
+
+	/* include writing back the data */
+	fd = g_open(data->dest, O_RDONLY | O_CLOEXEC, 0);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+
+	*bytes = data->size;
+	return TRUE;
+}
+
+static gboolean bench_verify(BenchData *data, guint64 *bytes, GError **error)
+{
+	drop_cache(data->dest);
+
+	if (!verify_device_checksum(&data->checksum, data->dest, error))
+		return FALSE;
+
+	*bytes = data->size;
+	return TRUE;
+}
+
+static gboolean bench_hash_tree(BenchData *data, guint64 *bytes, GError **error)
+{
+	g_autoptr(RaucHashTree) tree = NULL;
+
+	drop_cache(data->dest);
+
+	tree = r_hash_tree_compute(data->dest, data->size, R_HASH_TREE_LEAF_SIZE, error);
+	if (!tree)
+		return FALSE;
+
+	*bytes = data->size;
+	return TRUE;
+}
+
+static gboolean bench_extract(BenchData *data, guint64 *bytes, GError **error)
+{
+	g_autofree gchar *outdir = g_build_filename(data->dir, "extract", NULL);
+	gboolean res;
+
+	drop_cache(data->archive);
+
+	if (g_mkdir(outdir, 0755) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to create %s: %s", outdir, g_strerror(errno));
+		return FALSE;
+	}
+
+	/* same as installing an archive to a slot */
+	res = run_command((const gchar *[]) {"tar", "xf", data->archive, "-C", outdir, "--numeric-owner", NULL}, error);
+	if (res) {
+		sync();
+		*bytes = data->size;
+	}
+
+	rm_tree(outdir, NULL);
+	return res;
+}
+
+static gboolean bench_download(BenchData *data, guint64 *bytes, GError **error)
+{
+#if ENABLE_NETWORK
+	g_autofree gchar *target = g_build_filename(data->dir, "download", NULL);
+	GStatBuf st;
+
+	if (!download_file(target, data->url, 0, error))
+		return FALSE;
+
+	if (g_stat(target, &st) == 0)
+		*bytes = st.st_size;
+	g_remove(target);
+
+	return TRUE;
+#else
+	g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+			"Compiled without network support");
+	return FALSE;
+#endif
+}
+
+static gboolean run_bench(const gchar *name, BenchFunc func, BenchData *data, GPtrArray *results, GError **error)
+{
+	GError *ierror = NULL;
+	BenchSnapshot before, after;
+	RaucBenchResult *result;
+	guint64 bytes = 0;
+
+	g_message("Running benchmark %s", name);
+
+	take_snapshot(&before);
+	if (!func(data, &bytes, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Benchmark %s failed: ", name);
+		return FALSE;
+	}
+	take_snapshot(&after);
+
+	result = g_new0(RaucBenchResult, 1);
+	result->name = g_strdup(name);
+	result->bytes = bytes;
+	result->seconds = (after.time - before.time) / (gdouble) G_USEC_PER_SEC;
+	result->cpu_seconds = after.cpu_seconds - before.cpu_seconds;
+	result->syscalls = (before.syscalls >= 0 && after.syscalls >= 0) ? after.syscalls - before.syscalls : -1;
+	result->peak_rss = peak_rss();
+	g_ptr_array_add(results, result);
+
+	return TRUE;
+}
+
+gboolean r_bench_run(const gchar *dir, guint64 size, const gchar *url,
+		GPtrArray **results, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GPtrArray) res_array = NULL;
+	g_autofree gchar *template = NULL;
+	BenchData data = {
+		.size = size,
+		.url = url,
+	};
+	gboolean res = FALSE;
+
+	g_return_val_if_fail(dir, FALSE);
+	g_return_val_if_fail(size > 0, FALSE);
+	g_return_val_if_fail(results != NULL && *results == NULL, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	template = g_build_filename(dir, "rauc-bench-XXXXXX", NULL);
+	data.dir = g_mkdtemp(template);
+	if (!data.dir) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to create directory in %s: %s", dir, g_strerror(errno));
+		return FALSE;
+	}
+	data.source = g_build_filename(data.dir, "source.img", NULL);
+	data.dest = g_build_filename(data.dir, "dest.img", NULL);
+	data.archive = g_build_filename(data.dir, "source.tar", NULL);
+
+	g_message("Preparing %" G_GUINT64_FORMAT " bytes of test data in %s", size, data.dir);
+	if (!create_source(&data, &ierror) || !create_archive(&data, &ierror)) {
+		g_propagate_error(error, ierror);
+		goto out;
+	}
+
+	res_array = g_ptr_array_new_with_free_func((GDestroyNotify) r_bench_result_free);
+
+	/* copy and verify use the digest computed by hash */
+	if (!run_bench("hash", bench_hash, &data, res_array, &ierror) ||
+	    !run_bench("copy", bench_copy, &data, res_array, &ierror) ||
+	    !run_bench("verify", bench_verify, &data, res_array, &ierror) ||
+	    !run_bench("hash-tree", bench_hash_tree, &data, res_array, &ierror) ||
+	    !run_bench("extract", bench_extract, &data, res_array, &ierror) ||
+	    (url && !run_bench("download", bench_download, &data, res_array, &ierror))) {
+		g_propagate_error(error, ierror);
+		goto out;
+	}
+
+	*results = g_steal_pointer(&res_array);
+	res = TRUE;
+
+out:
+	rm_tree(data.dir, NULL);
+	g_free(data.source);
+	g_free(data.dest);
+	g_free(data.archive);
+	g_free(data.checksum.digest);
+	return res;
+}
+
+gdouble r_bench_result_throughput(const RaucBenchResult *result)
+{
+	g_return_val_if_fail(result, 0);
+
+	if (result->seconds <= 0)
+		return 0;
+
+	return result->bytes / result->seconds / 1000000;
+}
+
+void r_bench_result_free(RaucBenchResult *result)
+{
+	if (!result)
+		return;
+
+	g_free(result->name);
+	g_free(result);
+}
@@ -5,7 +5,10 @@
 #include "bootchooser.h"
 #include "config_file.h"
 #include "context.h"
+#include "efivars.h"
+#include "grub_env.h"
 #include "install.h"
+#include "uboot_env.h"
 #include "utils.h"
 
 GQuark r_bootchooser_error_quark(void)
@@ -50,6 +53,90 @@ static GString *bootchooser_order_primay(RaucSlot *slot)
 	return order;
 }
 
+typedef struct {
+	/* bootloader variables as read from the bootloader */
+	GHashTable *cache;
+	/* TRUE if cache holds all variables of the bootloader */
+	gboolean cache_complete;
+	/* names of modified variables in order of first modification */
+	GPtrArray *staged_keys;
+	/* modified variables, names are owned by staged_keys */
+	GHashTable *staged;
+	/* trace event covering the transaction */
+	RaucTraceEvent *trace;
+} RBootTransaction;
+
+static void boot_transaction_free(RBootTransaction *transaction)
+{
+	if (!transaction)
+		return;
+
+	g_clear_pointer(&transaction->cache, g_hash_table_destroy);
+	g_clear_pointer(&transaction->staged, g_hash_table_destroy);
+	g_clear_pointer(&transaction->staged_keys, g_ptr_array_unref);
+	g_free(transaction);
+}
+
+/* transactions are per thread, so that e.g. D-Bus mark calls handled in the
+ * main thread do not end up in a transaction of the install thread */
+static GPrivate boot_transaction = G_PRIVATE_INIT((GDestroyNotify) boot_transaction_free);
+
+static RBootTransaction *boot_transaction_get(void)
+{
+	return g_private_get(&boot_transaction);
+}
+
+/* Returns the value of a variable as staged or read in the current
+ * transaction, or NULL if unknown */
+static const gchar *boot_transaction_lookup(const gchar *key)
+{
+	RBootTransaction *transaction = boot_transaction_get();
+	const gchar *value;
+
+	g_return_val_if_fail(transaction, NULL);
+
+	value = g_hash_table_lookup(transaction->staged, key);
+	if (value)
+		return value;
+
+	return g_hash_table_lookup(transaction->cache, key);
+}
+
+static void boot_transaction_cache(const gchar *key, const gchar *value)
+{
+	RBootTransaction *transaction = boot_transaction_get();
+
+	g_return_if_fail(transaction);
+
+	g_hash_table_insert(transaction->cache, g_strdup(key), g_strdup(value));
+}
+
+/* Stages 'key=value' pairs if a transaction is active.
+ *
+ * @return TRUE if the pairs were staged, FALSE if they need to be written
+ *         directly
+ */
+static gboolean boot_transaction_stage(GPtrArray *pairs)
+{
+	RBootTransaction *transaction = boot_transaction_get();
+
+	if (!transaction)
+		return FALSE;
+
+	for (guint i = 0; i < pairs->len; i++) {
+		g_auto(GStrv) pair = g_strsplit(g_ptr_array_index(pairs, i), "=", 2);
+		gchar *key = NULL;
+
+		if (!g_hash_table_lookup_extended(transaction->staged, pair[0], (gpointer *) &key, NULL)) {
+			key = g_strdup(pair[0]);
+			g_ptr_array_add(transaction->staged_keys, key);
+		}
+		g_hash_table_insert(transaction->staged, key, g_strdup(pair[1] ? pair[1] : ""));
+	}
+
+	return TRUE;
+}
+
 typedef struct {
 	guint32 prio;
 	guint32 attempts;
@@ -57,29 +144,43 @@ typedef struct {
 
 #define BOOTSTATE_PREFIX "bootstate"
 
-static gboolean barebox_state_get(const gchar* bootname, BareboxSlotState *bb_state, GError **error)
+/* Reads priority and remaining attempts of all given bootnames with a single
+ * barebox-state call.
+ *
+ * @param bootnames bootnames to read state for
+ * @param states hash table to insert BareboxSlotState elements into, keyed
+ *        by bootname
+ * @param error return location for a GError, or NULL
+ */
+static gboolean barebox_state_read(GPtrArray *bootnames, GHashTable *states, GError **error)
 {
 	g_autoptr(GSubprocess) sub = NULL;
 	GError *ierror = NULL;
 	GInputStream *instream;
-	GDataInputStream *datainstream;
-	gchar* outline;
-	guint64 result[2] = {};
-	g_autoptr(GPtrArray) args = g_ptr_array_new_full(6, g_free);
+	g_autoptr(GDataInputStream) datainstream = NULL;
+	g_autoptr(GArray) result = NULL;
+	g_autoptr(GPtrArray) args = NULL;
 
-	g_return_val_if_fail(bootname, FALSE);
-	g_return_val_if_fail(bb_state, FALSE);
+	g_return_val_if_fail(bootnames, FALSE);
+	g_return_val_if_fail(states, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
+	result = g_array_sized_new(FALSE, TRUE, sizeof(guint64), 2*bootnames->len);
+	args = g_ptr_array_new_full(4*bootnames->len+4, g_free);
+
 	g_ptr_array_add(args, g_strdup(BAREBOX_STATE_NAME));
 	if (r_context()->config->system_bb_statename) {
 		g_ptr_array_add(args, g_strdup("-n"));
 		g_ptr_array_add(args, g_strdup(r_context()->config->system_bb_statename));
 	}
-	g_ptr_array_add(args, g_strdup("-g"));
-	g_ptr_array_add(args, g_strdup_printf(BOOTSTATE_PREFIX ".%s.priority", bootname));
-	g_ptr_array_add(args, g_strdup("-g"));
-	g_ptr_array_add(args, g_strdup_printf(BOOTSTATE_PREFIX ".%s.remaining_attempts", bootname));
+	for (guint i = 0; i < bootnames->len; i++) {
+		const gchar *bootname = g_ptr_array_index(bootnames, i);
+
+		g_ptr_array_add(args, g_strdup("-g"));
+		g_ptr_array_add(args, g_strdup_printf(BOOTSTATE_PREFIX ".%s.priority", bootname));
+		g_ptr_array_add(args, g_strdup("-g"));
+		g_ptr_array_add(args, g_strdup_printf(BOOTSTATE_PREFIX ".%s.remaining_attempts", bootname));
+	}
 	g_ptr_array_add(args, NULL);
 
 	r_debug_subprocess(args);
@@ -96,8 +197,12 @@ static gboolean barebox_state_get(const gchar* bootname, BareboxSlotState *bb_st
 	instream = g_subprocess_get_stdout_pipe(sub);
 	datainstream = g_data_input_stream_new(instream);
 
-	for (int i = 0; i < 2; i++) {
+	/* values are printed in order of the -g arguments */
+	for (guint i = 0; i < 2*bootnames->len; i++) {
+		g_autofree gchar *outline = NULL;
 		gchar *endptr = NULL;
+		guint64 value;
+
 		outline = g_data_input_stream_read_line(datainstream, NULL, NULL, &ierror);
 		if (!outline) {
 			/* Having no error set there was means no content to read */
@@ -116,15 +221,16 @@ static gboolean barebox_state_get(const gchar* bootname, BareboxSlotState *bb_st
 			return FALSE;
 		}
 
-		result[i] = g_ascii_strtoull(outline, &endptr, 10);
-		if (result[i] == 0 && outline == endptr) {
+		errno = 0;
+		value = g_ascii_strtoull(outline, &endptr, 10);
+		if (value == 0 && outline == endptr) {
 			g_set_error(
 					error,
 					R_BOOTCHOOSER_ERROR,
 					R_BOOTCHOOSER_ERROR_PARSE_FAILED,
 					"Failed to parse value: '%s'", outline);
 			return FALSE;
-		} else if (result[i] == G_MAXUINT64 && errno != 0) {
+		} else if (value == G_MAXUINT64 && errno != 0) {
 			g_set_error(
 					error,
 					R_BOOTCHOOSER_ERROR,
@@ -132,6 +238,7 @@ static gboolean barebox_state_get(const gchar* bootname, BareboxSlotState *bb_st
 					"Return value overflow: '%s', error: %d", outline, errno);
 			return FALSE;
 		}
+		g_array_append_val(result, value);
 	}
 
 	if (!g_subprocess_wait_check(sub, NULL, &ierror)) {
@@ -142,12 +249,196 @@ static gboolean barebox_state_get(const gchar* bootname, BareboxSlotState *bb_st
 		return FALSE;
 	}
 
-	bb_state->prio = result[0];
-	bb_state->attempts = result[1];
+	for (guint i = 0; i < bootnames->len; i++) {
+		BareboxSlotState *bb_state = g_new0(BareboxSlotState, 1);
+
+		bb_state->prio = g_array_index(result, guint64, 2*i);
+		bb_state->attempts = g_array_index(result, guint64, 2*i+1);
+		g_hash_table_insert(states, g_strdup(g_ptr_array_index(bootnames, i)), bb_state);
+	}
+
+	return TRUE;
+}
+
+/* Looks up the state of a bootname in the current transaction */
+static gboolean barebox_transaction_lookup(const gchar *bootname, BareboxSlotState *bb_state)
+{
+	g_autofree gchar *prio_key = g_strdup_printf(BOOTSTATE_PREFIX ".%s.priority", bootname);
+	g_autofree gchar *attempts_key = g_strdup_printf(BOOTSTATE_PREFIX ".%s.remaining_attempts", bootname);
+	const gchar *prio = boot_transaction_lookup(prio_key);
+	const gchar *attempts = boot_transaction_lookup(attempts_key);
+
+	if (!prio || !attempts)
+		return FALSE;
+
+	if (bb_state) {
+		bb_state->prio = g_ascii_strtoull(prio, NULL, 10);
+		bb_state->attempts = g_ascii_strtoull(attempts, NULL, 10);
+	}
+
+	return TRUE;
+}
+
+static gboolean bootname_in_array(GPtrArray *bootnames, const gchar *bootname)
+{
+	for (guint i = 0; i < bootnames->len; i++) {
+		if (g_strcmp0(g_ptr_array_index(bootnames, i), bootname) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Fills the transaction cache with the states of the given bootnames. The
+ * states of all other slots not cached yet are read along with them, as
+ * they are likely to be requested next. */
+static gboolean barebox_transaction_fetch(GPtrArray *bootnames, GError **error)
+{
+	g_autoptr(GPtrArray) fetch = g_ptr_array_new();
+	g_autoptr(GHashTable) states = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	GError *ierror = NULL;
+	GHashTableIter iter;
+	RaucSlot *slot;
+	const gchar *bootname;
+	BareboxSlotState *bb_state;
+
+	for (guint i = 0; i < bootnames->len; i++) {
+		if (!barebox_transaction_lookup(g_ptr_array_index(bootnames, i), NULL))
+			g_ptr_array_add(fetch, g_ptr_array_index(bootnames, i));
+	}
+	if (fetch->len == 0)
+		return TRUE;
+
+	g_hash_table_iter_init(&iter, r_context()->config->slots);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer*) &slot)) {
+		if (!slot->bootname || barebox_transaction_lookup(slot->bootname, NULL))
+			continue;
+		if (!bootname_in_array(fetch, slot->bootname))
+			g_ptr_array_add(fetch, slot->bootname);
+	}
+
+	if (!barebox_state_read(fetch, states, &ierror)) {
+		/* retry with the requested bootnames only */
+		g_debug("Reading all boot states at once failed: %s", ierror->message);
+		g_clear_error(&ierror);
+		g_ptr_array_set_size(fetch, 0);
+		for (guint i = 0; i < bootnames->len; i++) {
+			if (!barebox_transaction_lookup(g_ptr_array_index(bootnames, i), NULL))
+				g_ptr_array_add(fetch, g_ptr_array_index(bootnames, i));
+		}
+		if (!barebox_state_read(fetch, states, &ierror)) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+	}
+
+	g_hash_table_iter_init(&iter, states);
+	while (g_hash_table_iter_next(&iter, (gpointer*) &bootname, (gpointer*) &bb_state)) {
+		g_autofree gchar *prio_key = g_strdup_printf(BOOTSTATE_PREFIX ".%s.priority", bootname);
+		g_autofree gchar *attempts_key = g_strdup_printf(BOOTSTATE_PREFIX ".%s.remaining_attempts", bootname);
+		g_autofree gchar *prio = g_strdup_printf("%u", bb_state->prio);
+		g_autofree gchar *attempts = g_strdup_printf("%u", bb_state->attempts);
+
+		boot_transaction_cache(prio_key, prio);
+		boot_transaction_cache(attempts_key, attempts);
+	}
 
 	return TRUE;
 }
 
+/* Reads priority and remaining attempts of all given bootnames, from the
+ * current transaction if one is active.
+ *
+ * @param bootnames bootnames to read state for
+ * @param states hash table to insert BareboxSlotState elements into, keyed
+ *        by bootname
+ * @param error return location for a GError, or NULL
+ */
+static gboolean barebox_state_get_multi(GPtrArray *bootnames, GHashTable *states, GError **error)
+{
+	GError *ierror = NULL;
+
+	g_return_val_if_fail(bootnames, FALSE);
+	g_return_val_if_fail(states, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (!boot_transaction_get())
+		return barebox_state_read(bootnames, states, error);
+
+	if (!barebox_transaction_fetch(bootnames, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	for (guint i = 0; i < bootnames->len; i++) {
+		BareboxSlotState *bb_state = g_new0(BareboxSlotState, 1);
+
+		barebox_transaction_lookup(g_ptr_array_index(bootnames, i), bb_state);
+		g_hash_table_insert(states, g_strdup(g_ptr_array_index(bootnames, i)), bb_state);
+	}
+
+	return TRUE;
+}
+
+static gboolean barebox_state_get(const gchar* bootname, BareboxSlotState *bb_state, GError **error)
+{
+	g_autoptr(GPtrArray) bootnames = g_ptr_array_new();
+	g_autoptr(GHashTable) states = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	GError *ierror = NULL;
+
+	g_return_val_if_fail(bootname, FALSE);
+	g_return_val_if_fail(bb_state, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	g_ptr_array_add(bootnames, (gpointer) bootname);
+	if (!barebox_state_get_multi(bootnames, states, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	*bb_state = *(BareboxSlotState *) g_hash_table_lookup(states, bootname);
+
+	return TRUE;
+}
+
+/* Returns a snapshot of the states of all slots with a bootname, read with
+ * a single barebox-state call if possible. Slots whose state cannot be read
+ * are missing in the returned table. */
+static GHashTable *barebox_state_snapshot(void)
+{
+	g_autoptr(GPtrArray) bootnames = g_ptr_array_new();
+	GHashTable *states = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	GError *ierror = NULL;
+	GHashTableIter iter;
+	RaucSlot *slot;
+
+	g_hash_table_iter_init(&iter, r_context()->config->slots);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer*) &slot)) {
+		if (slot->bootname)
+			g_ptr_array_add(bootnames, slot->bootname);
+	}
+
+	if (bootnames->len == 0 || barebox_state_get_multi(bootnames, states, &ierror))
+		return states;
+
+	/* fall back to reading slots individually to skip broken ones */
+	g_debug("Reading all boot states at once failed: %s", ierror->message);
+	g_clear_error(&ierror);
+	for (guint i = 0; i < bootnames->len; i++) {
+		const gchar *bootname = g_ptr_array_index(bootnames, i);
+		g_autofree BareboxSlotState *bb_state = g_new0(BareboxSlotState, 1);
+
+		if (!barebox_state_get(bootname, bb_state, &ierror)) {
+			g_debug("%s", ierror->message);
+			g_clear_error(&ierror);
+			continue;
+		}
+
+		g_hash_table_insert(states, g_strdup(bootname), g_steal_pointer(&bb_state));
+	}
+
+	return states;
+}
 
 /* names: list of gchar, values: list of gint */
 static gboolean barebox_state_set(GPtrArray *pairs, GError **error)
@@ -161,6 +452,9 @@ static gboolean barebox_state_set(GPtrArray *pairs, GError **error)
 
 	g_assert_cmpuint(pairs->len, >, 0);
 
+	if (boot_transaction_stage(pairs))
+		return TRUE;
+
 	g_ptr_array_add(args, g_strdup(BAREBOX_STATE_NAME));
 	if (r_context()->config->system_bb_statename) {
 		g_ptr_array_add(args, g_strdup("-n"));
@@ -231,28 +525,26 @@ static RaucSlot* barebox_get_primary(GError **error)
 	GHashTableIter iter;
 	RaucSlot *primary = NULL;
 	guint32 top_prio = 0;
-	GError *ierror = NULL;
+	g_autoptr(GHashTable) states = barebox_state_snapshot();
 
 	g_hash_table_iter_init(&iter, r_context()->config->slots);
 	while (g_hash_table_iter_next(&iter, NULL, (gpointer*) &slot)) {
-		BareboxSlotState state;
+		BareboxSlotState *state;
 
 		if (!slot->bootname)
 			continue;
 
-		if (!barebox_state_get(slot->bootname, &state, &ierror)) {
-			g_debug("%s", ierror->message);
-			g_clear_error(&ierror);
+		state = g_hash_table_lookup(states, slot->bootname);
+		if (!state)
 			continue;
-		}
 
-		if (state.attempts == 0)
+		if (state->attempts == 0)
 			continue;
 
 		/* We search for the slot with highest priority */
-		if (state.prio > top_prio) {
+		if (state->prio > top_prio) {
 			primary = slot;
-			top_prio = state.prio;
+			top_prio = state->prio;
 		}
 	}
 
@@ -291,6 +583,8 @@ static gboolean barebox_get_state(RaucSlot *slot, gboolean *good, GError **error
 static gboolean barebox_set_primary(RaucSlot *slot, GError **error)
 {
 	g_autoptr(GPtrArray) pairs = g_ptr_array_new_full(10, g_free);
+	g_autoptr(GPtrArray) bootnames = g_ptr_array_new();
+	g_autoptr(GHashTable) states = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
 	GError *ierror = NULL;
 	GList *slots;
 
@@ -299,6 +593,16 @@ static gboolean barebox_set_primary(RaucSlot *slot, GError **error)
 
 	/* Iterate over class members */
 	slots = g_hash_table_get_values(r_context()->config->slots);
+	for (GList *l = slots; l != NULL; l = l->next) {
+		if (((RaucSlot *) l->data)->bootname)
+			g_ptr_array_add(bootnames, ((RaucSlot *) l->data)->bootname);
+	}
+
+	if (bootnames->len && !barebox_state_get_multi(bootnames, states, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
 	for (GList *l = slots; l != NULL; l = l->next) {
 		RaucSlot *s = l->data;
 		int prio;
@@ -307,10 +611,7 @@ static gboolean barebox_set_primary(RaucSlot *slot, GError **error)
 		if (!s->bootname)
 			continue;
 
-		if (!barebox_state_get(s->bootname, &bb_state, &ierror)) {
-			g_propagate_error(error, ierror);
-			return FALSE;
-		}
+		bb_state = *(BareboxSlotState *) g_hash_table_lookup(states, s->bootname);
 
 		if (s == slot) {
 			prio = BAREBOX_STATE_PRIORITY_PRIMARY;
@@ -345,8 +646,40 @@ static gboolean grub_env_set(GPtrArray *pairs, GError **error)
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
 	g_assert_cmpuint(pairs->len, >, 0);
+
+	if (boot_transaction_stage(pairs))
+		return TRUE;
 	g_assert_nonnull(r_context()->config->grubenv_path);
 
+	if (r_context()->config->grubenv_native) {
+		g_autoptr(RGrubEnv) env = NULL;
+
+		env = r_grub_env_load(r_context()->config->grubenv_path, &ierror);
+		if (!env) {
+			g_propagate_prefixed_error(
+					error,
+					ierror,
+					"Failed to load GRUB environment: ");
+			return FALSE;
+		}
+
+		for (guint i = 0; i < pairs->len; i++) {
+			g_auto(GStrv) pair = g_strsplit(g_ptr_array_index(pairs, i), "=", 2);
+
+			r_grub_env_set(env, pair[0], pair[1]);
+		}
+
+		if (!r_grub_env_save(env, &ierror)) {
+			g_propagate_prefixed_error(
+					error,
+					ierror,
+					"Failed to write GRUB environment: ");
+			return FALSE;
+		}
+
+		return TRUE;
+	}
+
 	g_ptr_array_insert(pairs, 0, g_strdup(GRUB_EDITENV));
 	g_ptr_array_insert(pairs, 1, g_strdup(r_context()->config->grubenv_path));
 	g_ptr_array_insert(pairs, 2, g_strdup("set"));
@@ -429,11 +762,87 @@ static gboolean grub_set_primary(RaucSlot *slot, GError **error)
 	return TRUE;
 }
 
+/* Reads the complete environment into the cache of the current transaction */
+static gboolean uboot_env_fetch(GError **error)
+{
+	g_autoptr(GSubprocess) sub = NULL;
+	g_autoptr(GBytes) stdout_buf = NULL;
+	g_autofree gchar *output = NULL;
+	g_auto(GStrv) lines = NULL;
+	GError *ierror = NULL;
+	const char *data;
+	gsize size;
+
+	if (r_context()->config->uboot_env_config) {
+		g_autoptr(RUbootEnv) env = NULL;
+		g_autoptr(GList) keys = NULL;
+
+		env = r_uboot_env_load(r_context()->config->uboot_env_config, &ierror);
+		if (!env) {
+			g_propagate_prefixed_error(
+					error,
+					ierror,
+					"Failed to load U-Boot environment: ");
+			return FALSE;
+		}
+
+		keys = r_uboot_env_get_keys(env);
+		for (GList *l = keys; l != NULL; l = l->next)
+			boot_transaction_cache(l->data, r_uboot_env_get(env, l->data));
+
+		return TRUE;
+	}
+
+	/* without arguments, fw_printenv prints all variables */
+	sub = g_subprocess_new(G_SUBPROCESS_FLAGS_STDOUT_PIPE, &ierror,
+			UBOOT_FWPRINTENV_NAME, NULL);
+	if (!sub) {
+		g_propagate_prefixed_error(
+				error,
+				ierror,
+				"Failed to start " UBOOT_FWPRINTENV_NAME ": ");
+		return FALSE;
+	}
+
+	if (!g_subprocess_communicate(sub, NULL, NULL, &stdout_buf, NULL, &ierror)) {
+		g_propagate_prefixed_error(
+				error,
+				ierror,
+				"Failed to run " UBOOT_FWPRINTENV_NAME ": ");
+		return FALSE;
+	}
+
+	if (!g_subprocess_get_successful(sub)) {
+		g_set_error_literal(
+				error,
+				G_SPAWN_ERROR,
+				G_SPAWN_ERROR_FAILED,
+				UBOOT_FWPRINTENV_NAME " failed");
+		return FALSE;
+	}
+
+	data = g_bytes_get_data(stdout_buf, &size);
+	output = g_strndup(data, size);
+	lines = g_strsplit(output, "\n", -1);
+	for (gchar **line = lines; *line; line++) {
+		gchar *sep = strchr(*line, '=');
+
+		if (!sep)
+			continue;
+
+		*sep = '\0';
+		boot_transaction_cache(*line, sep + 1);
+	}
+
+	return TRUE;
+}
+
 static gboolean uboot_env_get(const gchar *key, GString **value, GError **error)
 {
 	g_autoptr(GSubprocess) sub = NULL;
 	GError *ierror = NULL;
 	g_autoptr(GBytes) stdout_buf = NULL;
+	RBootTransaction *transaction;
 	const char *data;
 	gsize offset;
 	gsize size;
@@ -443,6 +852,59 @@ static gboolean uboot_env_get(const gchar *key, GString **value, GError **error)
 	g_return_val_if_fail(value && *value == NULL, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
+	transaction = boot_transaction_get();
+	if (transaction) {
+		const gchar *envvalue = boot_transaction_lookup(key);
+
+		if (!envvalue && !transaction->cache_complete) {
+			if (!uboot_env_fetch(&ierror)) {
+				g_propagate_error(error, ierror);
+				return FALSE;
+			}
+			transaction->cache_complete = TRUE;
+			envvalue = boot_transaction_lookup(key);
+		}
+
+		if (!envvalue) {
+			g_set_error(
+					error,
+					R_BOOTCHOOSER_ERROR,
+					R_BOOTCHOOSER_ERROR_FAILED,
+					"U-Boot variable %s not defined", key);
+			return FALSE;
+		}
+
+		*value = g_string_new(envvalue);
+		return TRUE;
+	}
+
+	if (r_context()->config->uboot_env_config) {
+		g_autoptr(RUbootEnv) env = NULL;
+		const gchar *envvalue;
+
+		env = r_uboot_env_load(r_context()->config->uboot_env_config, &ierror);
+		if (!env) {
+			g_propagate_prefixed_error(
+					error,
+					ierror,
+					"Failed to load U-Boot environment: ");
+			return FALSE;
+		}
+
+		envvalue = r_uboot_env_get(env, key);
+		if (!envvalue) {
+			g_set_error(
+					error,
+					R_BOOTCHOOSER_ERROR,
+					R_BOOTCHOOSER_ERROR_FAILED,
+					"U-Boot variable %s not defined", key);
+			return FALSE;
+		}
+
+		*value = g_string_new(envvalue);
+		return TRUE;
+	}
+
 	sub = g_subprocess_new(G_SUBPROCESS_FLAGS_STDOUT_PIPE, &ierror,
 			UBOOT_FWPRINTENV_NAME, key, NULL);
 	if (!sub) {
@@ -489,31 +951,70 @@ static gboolean uboot_env_get(const gchar *key, GString **value, GError **error)
 	return TRUE;
 }
 
-static gboolean uboot_env_set(const gchar *key, const gchar *value, GError **error)
+/* Applies all 'key=value' pairs. With native environment access, the
+ * environment is loaded and written only once for all pairs. */
+static gboolean uboot_env_set(GPtrArray *pairs, GError **error)
 {
-	g_autoptr(GSubprocess) sub = NULL;
 	GError *ierror = NULL;
 
-	g_return_val_if_fail(key, FALSE);
-	g_return_val_if_fail(value, FALSE);
+	g_return_val_if_fail(pairs, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-	sub = g_subprocess_new(G_SUBPROCESS_FLAGS_NONE, &ierror, UBOOT_FWSETENV_NAME,
-			key, value, NULL);
-	if (!sub) {
-		g_propagate_prefixed_error(
-				error,
-				ierror,
-				"Failed to start " UBOOT_FWSETENV_NAME ": ");
-		return FALSE;
+	g_assert_cmpuint(pairs->len, >, 0);
+
+	if (boot_transaction_stage(pairs))
+		return TRUE;
+
+	if (r_context()->config->uboot_env_config) {
+		g_autoptr(RUbootEnv) env = NULL;
+
+		env = r_uboot_env_load(r_context()->config->uboot_env_config, &ierror);
+		if (!env) {
+			g_propagate_prefixed_error(
+					error,
+					ierror,
+					"Failed to load U-Boot environment: ");
+			return FALSE;
+		}
+
+		for (guint i = 0; i < pairs->len; i++) {
+			g_auto(GStrv) pair = g_strsplit(g_ptr_array_index(pairs, i), "=", 2);
+
+			r_uboot_env_set(env, pair[0], pair[1]);
+		}
+
+		if (!r_uboot_env_save(env, &ierror)) {
+			g_propagate_prefixed_error(
+					error,
+					ierror,
+					"Failed to write U-Boot environment: ");
+			return FALSE;
+		}
+
+		return TRUE;
 	}
 
-	if (!g_subprocess_wait_check(sub, NULL, &ierror)) {
-		g_propagate_prefixed_error(
-				error,
-				ierror,
-				"Failed to run " UBOOT_FWSETENV_NAME ": ");
-		return FALSE;
+	for (guint i = 0; i < pairs->len; i++) {
+		g_autoptr(GSubprocess) sub = NULL;
+		g_auto(GStrv) pair = g_strsplit(g_ptr_array_index(pairs, i), "=", 2);
+
+		sub = g_subprocess_new(G_SUBPROCESS_FLAGS_NONE, &ierror, UBOOT_FWSETENV_NAME,
+				pair[0], pair[1], NULL);
+		if (!sub) {
+			g_propagate_prefixed_error(
+					error,
+					ierror,
+					"Failed to start " UBOOT_FWSETENV_NAME ": ");
+			return FALSE;
+		}
+
+		if (!g_subprocess_wait_check(sub, NULL, &ierror)) {
+			g_propagate_prefixed_error(
+					error,
+					ierror,
+					"Failed to run " UBOOT_FWSETENV_NAME ": ");
+			return FALSE;
+		}
 	}
 
 	return TRUE;
@@ -566,8 +1067,8 @@ static gboolean uboot_get_state(RaucSlot* slot, gboolean *good, GError **error)
 /* Set slot status values */
 static gboolean uboot_set_state(RaucSlot *slot, gboolean good, GError **error)
 {
+	g_autoptr(GPtrArray) pairs = g_ptr_array_new_full(2, g_free);
 	GError *ierror = NULL;
-	g_autofree gchar *key = NULL;
 
 	g_return_val_if_fail(slot, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
@@ -601,17 +1102,14 @@ static gboolean uboot_set_state(RaucSlot *slot, gboolean good, GError **error)
 		g_ptr_array_add(order_new, NULL);
 
 		order = g_strjoinv(" ", (gchar**) order_new->pdata);
-		if (!uboot_env_set("BOOT_ORDER", order, &ierror)) {
-			g_propagate_error(error, ierror);
-			return FALSE;
-		}
+		g_ptr_array_add(pairs, g_strdup_printf("BOOT_ORDER=%s", order));
 	}
 
 set_left:
+	g_ptr_array_add(pairs, g_strdup_printf("BOOT_%s_LEFT=%s", slot->bootname,
+			good ? UBOOT_DEFAULT_ATTEMPTS : "0"));
 
-	key = g_strdup_printf("BOOT_%s_LEFT", slot->bootname);
-
-	if (!uboot_env_set(key, good ? UBOOT_DEFAULT_ATTEMPTS : "0", &ierror)) {
+	if (!uboot_env_set(pairs, &ierror)) {
 		g_propagate_error(error, ierror);
 		return FALSE;
 	}
@@ -682,9 +1180,9 @@ static gboolean uboot_set_primary(RaucSlot *slot, GError **error)
 {
 	g_autoptr(GString) order_new = NULL;
 	g_autoptr(GString) order_current = NULL;
+	g_autoptr(GPtrArray) pairs = g_ptr_array_new_full(2, g_free);
 	g_auto(GStrv) bootnames = NULL;
 	GError *ierror = NULL;
-	g_autofree gchar *key = NULL;
 
 	g_return_val_if_fail(slot, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
@@ -714,13 +1212,11 @@ static gboolean uboot_set_primary(RaucSlot *slot, GError **error)
 		g_string_append(order_new, *bootname);
 	}
 
-	key = g_strdup_printf("BOOT_%s_LEFT", slot->bootname);
+	g_ptr_array_add(pairs, g_strdup_printf("BOOT_%s_LEFT=%s", slot->bootname,
+			UBOOT_ATTEMPTS_PRIMARY));
+	g_ptr_array_add(pairs, g_strdup_printf("BOOT_ORDER=%s", order_new->str));
 
-	if (!uboot_env_set(key, UBOOT_ATTEMPTS_PRIMARY, &ierror)) {
-		g_propagate_error(error, ierror);
-		return FALSE;
-	}
-	if (!uboot_env_set("BOOT_ORDER", order_new->str, &ierror)) {
+	if (!uboot_env_set(pairs, &ierror)) {
 		g_propagate_error(error, ierror);
 		return FALSE;
 	}
@@ -742,6 +1238,27 @@ static gboolean efi_bootorder_set(gchar *order, GError **error)
 	g_return_val_if_fail(order, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
+	if (r_context()->config->efivarfs_path) {
+		g_auto(GStrv) nums = g_strsplit(order, ",", -1);
+		g_autoptr(GArray) bootorder = g_array_new(FALSE, FALSE, sizeof(guint16));
+
+		for (gchar **num = nums; *num; num++) {
+			guint16 value;
+
+			if (**num == '\0')
+				continue;
+			value = GUINT16_TO_LE(g_ascii_strtoull(*num, NULL, 16));
+			g_array_append_val(bootorder, value);
+		}
+
+		if (!r_efivars_write(r_context()->config->efivarfs_path, "BootOrder",
+				(const guint8 *) bootorder->data, bootorder->len * sizeof(guint16), &ierror)) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+
+		return TRUE;
+	}
 
 	sub = g_subprocess_new(G_SUBPROCESS_FLAGS_NONE, &ierror, EFIBOOTMGR_NAME,
 			"--bootorder", order, NULL);
@@ -774,6 +1291,18 @@ static gboolean efi_set_bootnext(gchar *bootnumber, GError **error)
 	g_return_val_if_fail(bootnumber, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
+	if (r_context()->config->efivarfs_path) {
+		guint16 value = GUINT16_TO_LE(g_ascii_strtoull(bootnumber, NULL, 16));
+
+		if (!r_efivars_write(r_context()->config->efivarfs_path, "BootNext",
+				(const guint8 *) &value, sizeof(value), &ierror)) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+
+		return TRUE;
+	}
+
 	sub = g_subprocess_new(G_SUBPROCESS_FLAGS_NONE, &ierror, EFIBOOTMGR_NAME,
 			"--bootnext", bootnumber, NULL);
 
@@ -815,6 +1344,90 @@ static efi_bootentry* get_efi_entry_by_bootnum(GList *entries, const gchar *boot
 	return found_entry;
 }
 
+/* Reads boot entries, 'BootOrder' and 'BootNext' directly from efivarfs.
+ * Arguments are the same as for efi_bootorder_get(). */
+static gboolean efi_bootorder_get_efivarfs(GList **bootorder_entries, GList **all_entries, efi_bootentry **bootnext, GError **error)
+{
+	const gchar *efivarfs = r_context()->config->efivarfs_path;
+	g_autoptr(GPtrArray) nums = NULL;
+	g_autoptr(GBytes) order = NULL;
+	g_autoptr(GBytes) next = NULL;
+	GError *ierror = NULL;
+	GList *entries = NULL;
+	GList *returnorder = NULL;
+	const guint8 *data;
+	gsize len;
+
+	nums = r_efivars_list_boot_entries(efivarfs, &ierror);
+	if (!nums) {
+		g_propagate_prefixed_error(error, ierror, "Failed to list EFI boot entries: ");
+		return FALSE;
+	}
+
+	for (guint i = 0; i < nums->len; i++) {
+		g_autofree gchar *varname = g_strconcat("Boot", g_ptr_array_index(nums, i), NULL);
+		g_autoptr(GBytes) option = NULL;
+		efi_bootentry *entry;
+		gchar *description;
+		gboolean active = FALSE;
+
+		option = r_efivars_read(efivarfs, varname, &ierror);
+		if (!option) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+
+		description = r_efivars_load_option_description(option, &active, &ierror);
+		if (!description) {
+			g_message("Ignoring EFI boot entry %s: %s", varname, ierror->message);
+			g_clear_error(&ierror);
+			continue;
+		}
+
+		entry = g_new0(efi_bootentry, 1);
+		entry->num = g_strdup(g_ptr_array_index(nums, i));
+		entry->name = description;
+		entry->active = active;
+		entries = g_list_append(entries, entry);
+	}
+
+	/* BootNext is optional */
+	next = r_efivars_read(efivarfs, "BootNext", &ierror);
+	if (next) {
+		data = g_bytes_get_data(next, &len);
+		if (len >= 2 && bootnext) {
+			g_autofree gchar *num = g_strdup_printf("%04X", data[0] | (data[1] << 8));
+			*bootnext = get_efi_entry_by_bootnum(entries, num);
+		}
+	} else if (g_error_matches(ierror, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+		g_clear_error(&ierror);
+	} else {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	order = r_efivars_read(efivarfs, "BootOrder", &ierror);
+	if (!order) {
+		g_propagate_prefixed_error(error, ierror, "unable to obtain boot order: ");
+		return FALSE;
+	}
+
+	data = g_bytes_get_data(order, &len);
+	for (gsize pos = 0; pos + 1 < len; pos += 2) {
+		g_autofree gchar *num = g_strdup_printf("%04X", data[pos] | (data[pos + 1] << 8));
+		efi_bootentry *bentry = get_efi_entry_by_bootnum(entries, num);
+		if (bentry)
+			returnorder = g_list_append(returnorder, bentry);
+	}
+
+	if (bootorder_entries)
+		*bootorder_entries = returnorder;
+	if (all_entries)
+		*all_entries = entries;
+
+	return TRUE;
+}
+
 /* Parses output of efibootmgr and returns information obtained.
  *
  * @param bootorder_entries Return location for List (of efi_bootentry
@@ -843,6 +1456,9 @@ static gboolean efi_bootorder_get(GList **bootorder_entries, GList **all_entries
 	g_return_val_if_fail(bootnext == NULL || *bootnext == NULL, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
+	if (r_context()->config->efivarfs_path)
+		return efi_bootorder_get_efivarfs(bootorder_entries, all_entries, bootnext, error);
+
 	sub = g_subprocess_new(G_SUBPROCESS_FLAGS_STDOUT_PIPE, &ierror,
 			EFIBOOTMGR_NAME, NULL);
 	if (!sub) {
@@ -1311,3 +1927,85 @@ gboolean r_boot_set_primary(RaucSlot *slot, GError **error)
 	return res;
 }
 
+
+void r_boot_transaction_begin(void)
+{
+	RBootTransaction *transaction;
+
+	g_return_if_fail(boot_transaction_get() == NULL);
+
+	transaction = g_new0(RBootTransaction, 1);
+	transaction->cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	transaction->staged_keys = g_ptr_array_new_with_free_func(g_free);
+	transaction->staged = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+	transaction->trace = r_context_trace_begin("bootloader", "transaction",
+			r_context()->config->system_bootloader);
+
+	g_private_set(&boot_transaction, transaction);
+}
+
+gboolean r_boot_transaction_commit(GError **error)
+{
+	RBootTransaction *transaction = boot_transaction_get();
+	g_autoptr(GPtrArray) pairs = NULL;
+	GError *ierror = NULL;
+	gboolean res = FALSE;
+
+	g_return_val_if_fail(transaction, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	/* end the transaction first, so that the setters below write to the
+	 * bootloader */
+	g_private_set(&boot_transaction, NULL);
+
+	pairs = g_ptr_array_new_full(transaction->staged_keys->len, g_free);
+	for (guint i = 0; i < transaction->staged_keys->len; i++) {
+		const gchar *key = g_ptr_array_index(transaction->staged_keys, i);
+
+		g_ptr_array_add(pairs, g_strdup_printf("%s=%s", key,
+				(const gchar *) g_hash_table_lookup(transaction->staged, key)));
+	}
+
+	if (pairs->len == 0) {
+		res = TRUE;
+		goto out;
+	}
+
+	if (g_strcmp0(r_context()->config->system_bootloader, "barebox") == 0) {
+		res = barebox_state_set(pairs, &ierror);
+	} else if (g_strcmp0(r_context()->config->system_bootloader, "grub") == 0) {
+		res = grub_env_set(pairs, &ierror);
+	} else if (g_strcmp0(r_context()->config->system_bootloader, "uboot") == 0) {
+		res = uboot_env_set(pairs, &ierror);
+	} else {
+		g_set_error(
+				&ierror,
+				R_BOOTCHOOSER_ERROR,
+				R_BOOTCHOOSER_ERROR_NOT_SUPPORTED,
+				"Bootloader type '%s' does not stage changes", r_context()->config->system_bootloader);
+	}
+
+	if (!res) {
+		g_propagate_prefixed_error(
+				error,
+				ierror,
+				"Failed to commit bootloader changes: ");
+	}
+
+out:
+	r_context_trace_end(transaction->trace, res);
+	boot_transaction_free(transaction);
+	return res;
+}
+
+void r_boot_transaction_abort(void)
+{
+	RBootTransaction *transaction = boot_transaction_get();
+
+	g_return_if_fail(transaction);
+
+	g_private_set(&boot_transaction, NULL);
+	/* nothing was written, so this is no failure of the bootloader */
+	r_context_trace_end(transaction->trace, TRUE);
+	boot_transaction_free(transaction);
+}
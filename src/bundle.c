@@ -1,7 +1,9 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <gio/gio.h>
 #include <glib/gstdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "bundle.h"
 #include "context.h"
@@ -640,6 +642,223 @@ out:
 	return res;
 }
 
+/* Parses a "<slotclass>:<size>[K|M|G]" filesystem image size hint */
+static gboolean parse_fs_image_size(const gchar *hint, const gchar *slotclass, guint64 *size, GError **error)
+{
+	const gchar *sep = strchr(hint, ':');
+	gchar *end = NULL;
+
+	if (!sep || sep == hint) {
+		g_set_error(error, R_BUNDLE_ERROR, R_BUNDLE_ERROR_FS_IMAGE,
+				"Invalid filesystem image size '%s', expected <slotclass>:<size>", hint);
+		return FALSE;
+	}
+
+	if (strncmp(hint, slotclass, sep - hint) != 0 || slotclass[sep - hint] != '\0')
+		return FALSE;
+
+	*size = g_ascii_strtoull(sep + 1, &end, 10);
+	if (g_ascii_strcasecmp(end, "K") == 0)
+		*size *= 1024;
+	else if (g_ascii_strcasecmp(end, "M") == 0)
+		*size *= 1024 * 1024;
+	else if (g_ascii_strcasecmp(end, "G") == 0)
+		*size *= 1024 * 1024 * 1024;
+	else if (*end != '\0')
+		*size = 0;
+
+	if (*size == 0) {
+		g_set_error(error, R_BUNDLE_ERROR, R_BUNDLE_ERROR_FS_IMAGE,
+				"Invalid filesystem image size '%s'", hint);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Features of converted ext4 images. They are pinned instead of taken from
+ * the build host's mke2fs.conf, as newer defaults (e.g. metadata_csum or
+ * orphan_file) cannot be mounted by older target kernels. */
+#define FS_IMAGE_EXT4_FEATURES "none,has_journal,ext_attr,resize_inode,dir_index,filetype,extent,flex_bg,sparse_super,large_file,huge_file,dir_nlink,extra_isize"
+
+/* Creates an ext4 filesystem image of the given size from a tar archive */
+static gboolean archive_to_ext4_image(const gchar *archive, const gchar *image, guint64 size, GError **error)
+{
+	g_autoptr(GSubprocess) sproc = NULL;
+	GError *ierror = NULL;
+	gboolean res = FALSE;
+	g_autofree gchar *rootdir = NULL;
+	int fd;
+
+	rootdir = g_dir_make_tmp("rauc-fsimage-XXXXXX", &ierror);
+	if (rootdir == NULL) {
+		g_propagate_prefixed_error(error, ierror,
+				"Failed to create tmp dir: ");
+		goto out;
+	}
+
+	/* keep ownership, this requires running as root (or in fakeroot) */
+	sproc = g_subprocess_new(G_SUBPROCESS_FLAGS_NONE, &ierror,
+			"tar", "xpf", archive, "-C", rootdir, "--numeric-owner", NULL);
+	if (sproc == NULL || !g_subprocess_wait_check(sproc, NULL, &ierror)) {
+		g_propagate_prefixed_error(error, ierror,
+				"Failed to extract %s: ", archive);
+		goto out;
+	}
+	g_clear_object(&sproc);
+
+	fd = g_open(image, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0 || ftruncate(fd, size) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to create %s: %s", image, g_strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		goto out;
+	}
+	close(fd);
+
+	sproc = g_subprocess_new(G_SUBPROCESS_FLAGS_STDOUT_SILENCE, &ierror,
+			"mkfs.ext4", "-F", "-q", "-O", FS_IMAGE_EXT4_FEATURES,
+			"-d", rootdir, image, NULL);
+	if (sproc == NULL || !g_subprocess_wait_check(sproc, NULL, &ierror)) {
+		g_propagate_prefixed_error(error, ierror,
+				"Failed to create filesystem image %s: ", image);
+		goto out;
+	}
+
+	res = TRUE;
+out:
+	if (rootdir)
+		rm_tree(rootdir, NULL);
+	if (!res)
+		g_remove(image);
+	return res;
+}
+
+gboolean create_fs_image_bundle(RaucBundle *bundle, const gchar *outbundle, gchar **fs_sizes, GError **error)
+{
+	GError *ierror = NULL;
+	gboolean res = FALSE;
+	g_autofree gchar *tmpdir = NULL;
+	g_autofree gchar *contentdir = NULL;
+	g_autofree gchar *mfpath = NULL;
+	g_autoptr(RaucManifest) manifest = NULL;
+	g_autofree gboolean *used = NULL;
+
+	g_return_val_if_fail(bundle, FALSE);
+	g_return_val_if_fail(outbundle, FALSE);
+	g_return_val_if_fail(fs_sizes, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (g_file_test(outbundle, G_FILE_TEST_EXISTS)) {
+		g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_EXIST, "Destination bundle '%s' already exists", outbundle);
+		goto out;
+	}
+
+	tmpdir = g_dir_make_tmp("rauc-convert-XXXXXX", &ierror);
+	if (tmpdir == NULL) {
+		g_propagate_prefixed_error(error, ierror,
+				"Failed to create tmp dir: ");
+		goto out;
+	}
+
+	contentdir = g_build_filename(tmpdir, "content", NULL);
+	mfpath = g_build_filename(contentdir, "manifest.raucm", NULL);
+
+	res = extract_bundle(bundle, contentdir, &ierror);
+	if (!res) {
+		g_propagate_error(error, ierror);
+		goto out;
+	}
+
+	res = load_manifest_file(mfpath, &manifest, &ierror);
+	if (!res) {
+		g_propagate_error(error, ierror);
+		goto out;
+	}
+
+	used = g_new0(gboolean, g_strv_length(fs_sizes));
+	for (GList *l = manifest->images; l != NULL; l = l->next) {
+		RaucImage *image = l->data;
+		g_autofree gchar *imgpath = NULL;
+		g_autofree gchar *fsfile = NULL;
+		g_autofree gchar *fspath = NULL;
+		const gchar *tarext;
+		guint64 size = 0;
+
+		tarext = g_strrstr(image->filename, ".tar");
+		if (!tarext)
+			continue;
+
+		for (guint i = 0; fs_sizes[i]; i++) {
+			if (parse_fs_image_size(fs_sizes[i], image->slotclass, &size, &ierror)) {
+				used[i] = TRUE;
+				break;
+			}
+			if (ierror) {
+				g_propagate_error(error, ierror);
+				res = FALSE;
+				goto out;
+			}
+		}
+		if (!size)
+			continue;
+
+		imgpath = g_build_filename(contentdir, image->filename, NULL);
+		fsfile = g_strdup_printf("%.*s.ext4", (int) (tarext - image->filename), image->filename);
+		fspath = g_build_filename(contentdir, fsfile, NULL);
+
+		g_message("Converting %s to ext4 image %s (%" G_GUINT64_FORMAT " bytes)",
+				image->filename, fsfile, size);
+
+		res = archive_to_ext4_image(imgpath, fspath, size, &ierror);
+		if (!res) {
+			g_propagate_error(error, ierror);
+			goto out;
+		}
+
+		res = update_checksum(&image->checksum, fspath, &ierror);
+		if (!res) {
+			g_propagate_error(error, ierror);
+			goto out;
+		}
+
+		g_free(image->filename);
+		image->filename = g_steal_pointer(&fsfile);
+
+		if (g_remove(imgpath) != 0)
+			g_message("Failed removing %s", imgpath);
+	}
+
+	/* a typo in the slot class must not silently leave an archive */
+	for (guint i = 0; fs_sizes[i]; i++) {
+		if (!used[i]) {
+			g_set_error(error, R_BUNDLE_ERROR, R_BUNDLE_ERROR_FS_IMAGE,
+					"Filesystem image size '%s' does not match any tar archive image", fs_sizes[i]);
+			res = FALSE;
+			goto out;
+		}
+	}
+
+	res = save_manifest_file(mfpath, manifest, &ierror);
+	if (!res) {
+		g_propagate_error(error, ierror);
+		goto out;
+	}
+
+	res = create_bundle(outbundle, contentdir, &ierror);
+	if (!res) {
+		g_propagate_error(error, ierror);
+		goto out;
+	}
+
+	res = TRUE;
+out:
+	if (tmpdir)
+		rm_tree(tmpdir, NULL);
+	return res;
+}
+
 static gboolean is_remote_scheme(const gchar *scheme)
 {
 	return (g_strcmp0(scheme, "http") == 0) ||
@@ -672,7 +891,9 @@ gboolean check_bundle(const gchar *bundlename, RaucBundle **bundle, gboolean ver
 		ibundle->path = g_build_filename(g_get_tmp_dir(), "_download.raucb", NULL);
 
 		g_message("Remote URI detected, downloading bundle to %s...", ibundle->path);
+		r_context_begin_bytes(0);
 		res = download_file(ibundle->path, ibundle->origpath, r_context()->config->max_bundle_download_size, &ierror);
+		r_context_end_bytes();
 		if (!res) {
 			g_propagate_prefixed_error(error, ierror, "Failed to download bundle %s: ", ibundle->origpath);
 			goto out;
@@ -1,9 +1,41 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
 #include "checksum.h"
+#include "context.h"
 
 #define RAUC_DEFAULT_CHECKSUM G_CHECKSUM_SHA256
+/* hash in chunks to be able to report progress */
+#define CHECKSUM_CHUNK_SIZE (1024*1024)
+
+/* read-back verification, chunks must be aligned for O_DIRECT */
+#define VERIFY_CHUNK_SIZE (4*1024*1024)
+#define VERIFY_ALIGNMENT 4096
+#define VERIFY_BUFFERS 3
 
 G_DEFINE_QUARK(r-checksum-error-quark, r_checksum_error)
 
+static gchar *compute_checksum(GChecksumType type, GBytes *content)
+{
+	g_autoptr(GChecksum) ctx = g_checksum_new(type);
+	const guchar *data;
+	gsize size, pos = 0;
+
+	data = g_bytes_get_data(content, &size);
+	while (pos < size) {
+		gsize len = MIN(size - pos, CHECKSUM_CHUNK_SIZE);
+
+		g_checksum_update(ctx, data + pos, len);
+		r_context_add_bytes(len);
+		pos += len;
+	}
+
+	return g_strdup(g_checksum_get_string(ctx));
+}
+
 gboolean update_checksum(RaucChecksum *checksum, const gchar *filename, GError **error)
 {
 	GError *ierror = NULL;
@@ -23,7 +55,7 @@ gboolean update_checksum(RaucChecksum *checksum, const gchar *filename, GError *
 	if (checksum->digest == NULL)
 		checksum->type = RAUC_DEFAULT_CHECKSUM;
 	g_clear_pointer(&checksum->digest, g_free);
-	checksum->digest = g_compute_checksum_for_bytes(checksum->type, content);
+	checksum->digest = compute_checksum(checksum->type, content);
 	checksum->size = g_bytes_get_size(content);
 
 	res = TRUE;
@@ -61,7 +93,7 @@ gboolean verify_checksum(const RaucChecksum *checksum, const gchar *filename, GE
 		goto out;
 	}
 
-	digest = g_compute_checksum_for_bytes(checksum->type, content);
+	digest = compute_checksum(checksum->type, content);
 	res = g_str_equal(checksum->digest, digest);
 	if (!res) {
 		g_set_error(error, R_CHECKSUM_ERROR, R_CHECKSUM_ERROR_DIGEST_MISMATCH, "Digests do not match");
@@ -71,3 +103,157 @@ gboolean verify_checksum(const RaucChecksum *checksum, const gchar *filename, GE
 out:
 	return res;
 }
+
+typedef struct {
+	guint8 *data;
+	gsize len;
+	/* errno of a failed read, 0 otherwise */
+	gint err;
+} VerifyChunk;
+
+typedef struct {
+	int fd;
+	guint64 size;
+	GAsyncQueue *free_chunks;
+	GAsyncQueue *full_chunks;
+} VerifyReader;
+
+/* Reads the device into free chunks and passes them on for hashing. Stops
+ * after the first failed or short read. */
+static gpointer verify_read_thread(gpointer data)
+{
+	VerifyReader *reader = data;
+	guint64 offset = 0;
+
+	while (offset < reader->size) {
+		VerifyChunk *chunk = g_async_queue_pop(reader->free_chunks);
+		gsize want = MIN(VERIFY_CHUNK_SIZE, reader->size - offset);
+		/* O_DIRECT requires aligned lengths, only the image part is hashed */
+		gsize aligned = (want + VERIFY_ALIGNMENT - 1) & ~((gsize) VERIFY_ALIGNMENT - 1);
+		ssize_t ret;
+
+		do {
+			ret = pread(reader->fd, chunk->data, aligned, offset);
+		} while (ret < 0 && errno == EINTR);
+
+		chunk->err = ret < 0 ? errno : 0;
+		chunk->len = ret < 0 ? 0 : MIN((gsize) ret, want);
+		g_async_queue_push(reader->full_chunks, chunk);
+
+		if (chunk->len < want)
+			break;
+		offset += want;
+	}
+
+	return NULL;
+}
+
+static int open_uncached(const gchar *device)
+{
+	int fd;
+
+	fd = g_open(device, O_RDONLY | O_DIRECT | O_CLOEXEC, 0);
+	if (fd >= 0 || errno != EINVAL)
+		return fd;
+
+	/* file system without O_DIRECT support, drop cached pages instead */
+	fd = g_open(device, O_RDONLY | O_CLOEXEC, 0);
+	if (fd >= 0)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+	return fd;
+}
+
+gboolean verify_device_checksum(const RaucChecksum *checksum, const gchar *device, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GChecksum) ctx = NULL;
+	g_autoptr(GAsyncQueue) free_chunks = NULL;
+	g_autoptr(GAsyncQueue) full_chunks = NULL;
+	VerifyChunk chunks[VERIFY_BUFFERS] = {};
+	VerifyReader reader = {};
+	GThread *thread;
+	guint64 done = 0;
+	gint64 start;
+	gboolean res = FALSE;
+
+	g_return_val_if_fail(checksum, FALSE);
+	g_return_val_if_fail(device, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (checksum->digest == NULL) {
+		g_set_error(error, R_CHECKSUM_ERROR, R_CHECKSUM_ERROR_FAILED, "No digest provided");
+		return FALSE;
+	}
+
+	reader.fd = open_uncached(device);
+	if (reader.fd < 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to open %s: %s", device, g_strerror(errno));
+		return FALSE;
+	}
+
+	free_chunks = g_async_queue_new();
+	full_chunks = g_async_queue_new();
+	for (guint i = 0; i < VERIFY_BUFFERS; i++) {
+		if (posix_memalign((void **) &chunks[i].data, VERIFY_ALIGNMENT, VERIFY_CHUNK_SIZE) != 0)
+			g_error("Failed to allocate %d bytes", VERIFY_CHUNK_SIZE);
+		g_async_queue_push(free_chunks, &chunks[i]);
+	}
+	reader.size = checksum->size;
+	reader.free_chunks = free_chunks;
+	reader.full_chunks = full_chunks;
+
+	ctx = g_checksum_new(checksum->type);
+	start = g_get_monotonic_time();
+	thread = g_thread_new("verify", verify_read_thread, &reader);
+
+	while (done < checksum->size) {
+		VerifyChunk *chunk = g_async_queue_pop(full_chunks);
+		gsize want = MIN(VERIFY_CHUNK_SIZE, checksum->size - done);
+
+		if (chunk->err) {
+			g_set_error(&ierror, G_FILE_ERROR, g_file_error_from_errno(chunk->err),
+					"Failed reading %s at offset %" G_GUINT64_FORMAT ": %s",
+					device, done, g_strerror(chunk->err));
+			break;
+		}
+
+		g_checksum_update(ctx, chunk->data, chunk->len);
+		r_context_add_bytes(chunk->len);
+		done += chunk->len;
+		g_async_queue_push(free_chunks, chunk);
+
+		/* the reader stops after a short read */
+		if (chunk->len < want)
+			break;
+	}
+
+	/* the reader is done once it passed on all data or a failed read */
+	g_thread_join(thread);
+
+	if (ierror) {
+		g_propagate_error(error, ierror);
+		goto out;
+	} else if (done < checksum->size) {
+		g_set_error(error, R_CHECKSUM_ERROR, R_CHECKSUM_ERROR_SIZE_MISMATCH,
+				"%s ended at offset %" G_GUINT64_FORMAT, device, done);
+		goto out;
+	}
+
+	if (g_strcmp0(g_checksum_get_string(ctx), checksum->digest) != 0) {
+		g_set_error(error, R_CHECKSUM_ERROR, R_CHECKSUM_ERROR_DIGEST_MISMATCH,
+				"Digest of data read back from %s does not match", device);
+		goto out;
+	}
+
+	g_message("Verified %s at %.1f MiB/s", device,
+			(gdouble) done / MAX(g_get_monotonic_time() - start, 1) * G_USEC_PER_SEC / (1024 * 1024));
+	res = TRUE;
+
+out:
+	for (guint i = 0; i < VERIFY_BUFFERS; i++)
+		free(chunks[i].data);
+	close(reader.fd);
+	return res;
+}
@@ -0,0 +1,612 @@
+#include <errno.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "chunk_cache.h"
+#include "context.h"
+#include "network.h"
+
+/* casync index format, see casync's caformat.h */
+#define CA_FORMAT_INDEX 0x96824d9c7b129ff9ULL
+#define CA_FORMAT_TABLE 0xe75b9e112f17417dULL
+#define CA_FORMAT_TABLE_TAIL_MARKER 0x4b4f050e5549ecd1ULL
+
+#define CA_INDEX_HEADER_SIZE 48
+#define CA_TABLE_HEADER_SIZE 16
+#define CA_TABLE_ITEM_SIZE 40
+#define CA_CHUNK_ID_SIZE 32
+
+G_DEFINE_QUARK(r-chunk-cache-error-quark, r_chunk_cache_error)
+
+static guint64 read_le64(const guint8 *data)
+{
+	guint64 value;
+
+	memcpy(&value, data, sizeof(value));
+	return GUINT64_FROM_LE(value);
+}
+
+GPtrArray *r_chunk_cache_parse_index(const gchar *indexfile, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GMappedFile) file = NULL;
+	g_autoptr(GHashTable) seen = NULL;
+	GPtrArray *ids = NULL;
+	const guint8 *data;
+	gsize len, offset, tail;
+
+	g_return_val_if_fail(indexfile, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	file = g_mapped_file_new(indexfile, FALSE, &ierror);
+	if (file == NULL) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+	data = (const guint8 *) g_mapped_file_get_contents(file);
+	len = g_mapped_file_get_length(file);
+
+	if (len < CA_INDEX_HEADER_SIZE + CA_TABLE_HEADER_SIZE + CA_TABLE_ITEM_SIZE ||
+	    (len - CA_INDEX_HEADER_SIZE - CA_TABLE_HEADER_SIZE) % CA_TABLE_ITEM_SIZE != 0) {
+		g_set_error(error, R_CHUNK_CACHE_ERROR, R_CHUNK_CACHE_ERROR_INVALID_INDEX,
+				"Invalid size of index file %s", indexfile);
+		return NULL;
+	}
+
+	if (read_le64(data) != CA_INDEX_HEADER_SIZE ||
+	    read_le64(data + 8) != CA_FORMAT_INDEX ||
+	    read_le64(data + CA_INDEX_HEADER_SIZE) != G_MAXUINT64 ||
+	    read_le64(data + CA_INDEX_HEADER_SIZE + 8) != CA_FORMAT_TABLE) {
+		g_set_error(error, R_CHUNK_CACHE_ERROR, R_CHUNK_CACHE_ERROR_INVALID_INDEX,
+				"Invalid header in index file %s", indexfile);
+		return NULL;
+	}
+
+	tail = len - CA_TABLE_ITEM_SIZE;
+	if (read_le64(data + tail + 32) != CA_FORMAT_TABLE_TAIL_MARKER) {
+		g_set_error(error, R_CHUNK_CACHE_ERROR, R_CHUNK_CACHE_ERROR_INVALID_INDEX,
+				"Invalid table tail in index file %s", indexfile);
+		return NULL;
+	}
+
+	ids = g_ptr_array_new_with_free_func(g_free);
+	seen = g_hash_table_new(g_str_hash, g_str_equal);
+	for (offset = CA_INDEX_HEADER_SIZE + CA_TABLE_HEADER_SIZE; offset < tail; offset += CA_TABLE_ITEM_SIZE) {
+		const guint8 *id = data + offset + 8;
+		gchar *hex = g_malloc(CA_CHUNK_ID_SIZE * 2 + 1);
+
+		for (guint i = 0; i < CA_CHUNK_ID_SIZE; i++)
+			g_snprintf(hex + i * 2, 3, "%02x", id[i]);
+
+		if (g_hash_table_contains(seen, hex)) {
+			g_free(hex);
+			continue;
+		}
+		g_hash_table_add(seen, hex);
+		g_ptr_array_add(ids, hex);
+	}
+
+	return ids;
+}
+
+gchar *r_chunk_cache_chunk_path(const gchar *store, const gchar *chunk_id)
+{
+	g_autofree gchar *prefix = NULL;
+	g_autofree gchar *name = NULL;
+
+	g_return_val_if_fail(store, NULL);
+	g_return_val_if_fail(chunk_id && strlen(chunk_id) > 4, NULL);
+
+	prefix = g_strndup(chunk_id, 4);
+	name = g_strconcat(chunk_id, ".cacnk", NULL);
+
+	return g_build_filename(store, prefix, name, NULL);
+}
+
+static gboolean is_remote_store(const gchar *store)
+{
+	g_autofree gchar *scheme = g_uri_parse_scheme(store);
+
+	return scheme != NULL && g_strcmp0(scheme, "file") != 0;
+}
+
+static gboolean fetch_chunk(const gchar *store, const gchar *chunk_id,
+		const gchar *target, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *source = r_chunk_cache_chunk_path(store, chunk_id);
+	g_autofree gchar *tmppath = g_strconcat(target, ".tmp", NULL);
+	g_autofree gchar *targetdir = g_path_get_dirname(target);
+	gboolean res = FALSE;
+
+	if (g_mkdir_with_parents(targetdir, 0755) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed creating %s: %s", targetdir, g_strerror(errno));
+		goto out;
+	}
+
+	if (is_remote_store(store)) {
+#if ENABLE_NETWORK
+		res = download_file(tmppath, source, r_context()->config->max_bundle_download_size, &ierror);
+		if (!res) {
+			g_propagate_error(error, ierror);
+			goto out;
+		}
+#else
+		g_set_error(error, R_CHUNK_CACHE_ERROR, R_CHUNK_CACHE_ERROR_FAILED,
+				"Remote chunk store %s requires network support", store);
+		goto out;
+#endif
+	} else {
+		g_autoptr(GFile) srcfile = g_file_new_for_path(source);
+		g_autoptr(GFile) tmpfile = g_file_new_for_path(tmppath);
+
+		res = g_file_copy(srcfile, tmpfile, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, &ierror);
+		if (!res) {
+			if (g_error_matches(ierror, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+				g_set_error(error, R_CHUNK_CACHE_ERROR, R_CHUNK_CACHE_ERROR_MISSING_CHUNK,
+						"Chunk %s not found in store %s", chunk_id, store);
+				g_clear_error(&ierror);
+			} else {
+				g_propagate_error(error, ierror);
+			}
+			goto out;
+		}
+	}
+
+	/* only complete chunks may appear under their final name */
+	if (g_rename(tmppath, target) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed renaming %s: %s", tmppath, g_strerror(errno));
+		res = FALSE;
+		goto out;
+	}
+
+	res = TRUE;
+out:
+	if (!res)
+		g_remove(tmppath);
+	return res;
+}
+
+/* The digests of the chunk files are recorded when they are added to the
+ * cache, so that cached chunks can be verified before they are used again. */
+#define CHUNK_DIGESTS_FILE "chunks.digests"
+#define CHUNK_DIGESTS_GROUP "digests"
+
+static GKeyFile *load_chunk_digests(const gchar *cachedir)
+{
+	g_autofree gchar *path = g_build_filename(cachedir, CHUNK_DIGESTS_FILE, NULL);
+	GKeyFile *digests = g_key_file_new();
+	GError *ierror = NULL;
+
+	if (!g_key_file_load_from_file(digests, path, G_KEY_FILE_NONE, &ierror)) {
+		if (!g_error_matches(ierror, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_message("Ignoring chunk digests %s: %s", path, ierror->message);
+		g_clear_error(&ierror);
+	}
+
+	return digests;
+}
+
+static gboolean save_chunk_digests(const gchar *cachedir, GKeyFile *digests, GError **error)
+{
+	g_autofree gchar *path = g_build_filename(cachedir, CHUNK_DIGESTS_FILE, NULL);
+
+	if (g_mkdir_with_parents(cachedir, 0755) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed creating %s: %s", cachedir, g_strerror(errno));
+		return FALSE;
+	}
+
+	return g_key_file_save_to_file(digests, path, error);
+}
+
+static gchar *compute_chunk_digest(const gchar *path)
+{
+	g_autoptr(GMappedFile) file = NULL;
+
+	file = g_mapped_file_new(path, FALSE, NULL);
+	/* empty files can only result from interrupted writes */
+	if (!file || g_mapped_file_get_length(file) == 0)
+		return NULL;
+
+	return g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+			(const guchar *) g_mapped_file_get_contents(file),
+			g_mapped_file_get_length(file));
+}
+
+/* Returns the chunk id of a cached chunk file */
+static gchar *chunk_id_from_path(const gchar *path)
+{
+	g_autofree gchar *name = g_path_get_basename(path);
+
+	return g_strndup(name, strlen(name) - strlen(".cacnk"));
+}
+
+static gboolean verify_cached_chunk(GKeyFile *digests, const gchar *chunk_id, const gchar *path)
+{
+	g_autofree gchar *expected = g_key_file_get_string(digests, CHUNK_DIGESTS_GROUP, chunk_id, NULL);
+	g_autofree gchar *actual = NULL;
+
+	if (!expected)
+		return FALSE;
+
+	actual = compute_chunk_digest(path);
+
+	return g_strcmp0(expected, actual) == 0;
+}
+
+static void remove_cached_chunk(GKeyFile *digests, const gchar *path)
+{
+	g_autofree gchar *chunk_id = chunk_id_from_path(path);
+
+	g_remove(path);
+	g_key_file_remove_key(digests, CHUNK_DIGESTS_GROUP, chunk_id, NULL);
+}
+
+typedef struct {
+	gchar *path;
+	guint64 size;
+	gint64 mtime;
+} CacheEntry;
+
+static void cache_entry_free(gpointer data)
+{
+	CacheEntry *entry = data;
+
+	g_free(entry->path);
+	g_free(entry);
+}
+
+static gint cache_entry_compare(gconstpointer a, gconstpointer b)
+{
+	const CacheEntry *ea = *(CacheEntry **) a;
+	const CacheEntry *eb = *(CacheEntry **) b;
+
+	if (ea->mtime < eb->mtime)
+		return -1;
+	return ea->mtime > eb->mtime;
+}
+
+/* Returns all cached chunks, least recently used first */
+static GPtrArray *scan_cache(const gchar *cachedir, guint64 *total, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GDir) dir = NULL;
+	GPtrArray *entries = g_ptr_array_new_with_free_func(cache_entry_free);
+	const gchar *subname;
+
+	*total = 0;
+
+	dir = g_dir_open(cachedir, 0, &ierror);
+	if (!dir) {
+		if (g_error_matches(ierror, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+			g_clear_error(&ierror);
+			return entries;
+		}
+		g_propagate_error(error, ierror);
+		g_ptr_array_unref(entries);
+		return NULL;
+	}
+
+	while ((subname = g_dir_read_name(dir))) {
+		g_autofree gchar *subpath = g_build_filename(cachedir, subname, NULL);
+		g_autoptr(GDir) subdir = NULL;
+		const gchar *name;
+
+		subdir = g_dir_open(subpath, 0, NULL);
+		if (!subdir)
+			continue;
+
+		while ((name = g_dir_read_name(subdir))) {
+			CacheEntry *entry;
+			GStatBuf st;
+
+			if (!g_str_has_suffix(name, ".cacnk"))
+				continue;
+
+			entry = g_new0(CacheEntry, 1);
+			entry->path = g_build_filename(subpath, name, NULL);
+			if (g_stat(entry->path, &st) != 0) {
+				cache_entry_free(entry);
+				continue;
+			}
+			entry->size = st.st_size;
+			entry->mtime = st.st_mtime;
+			*total += entry->size;
+			g_ptr_array_add(entries, entry);
+		}
+	}
+
+	g_ptr_array_sort(entries, cache_entry_compare);
+
+	return entries;
+}
+
+gboolean r_chunk_cache_populate(const gchar *cachedir, const gchar *indexfile,
+		const gchar *store, GHashTable *seeded, guint64 max_size,
+		RChunkCacheStats *stats, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GPtrArray) ids = NULL;
+	g_autoptr(GPtrArray) missing = g_ptr_array_new();
+	g_autoptr(GPtrArray) entries = NULL;
+	g_autoptr(GHashTable) referenced = NULL;
+	g_autoptr(GKeyFile) digests = NULL;
+	RChunkCacheStats istats = {0};
+	guint64 total;
+	guint next = 0;
+	gboolean res = FALSE;
+
+	g_return_val_if_fail(cachedir, FALSE);
+	g_return_val_if_fail(indexfile, FALSE);
+	g_return_val_if_fail(store, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	ids = r_chunk_cache_parse_index(indexfile, &ierror);
+	if (!ids) {
+		g_propagate_error(error, ierror);
+		goto out;
+	}
+	istats.total = ids->len;
+
+	digests = load_chunk_digests(cachedir);
+	referenced = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	for (guint i = 0; i < ids->len; i++) {
+		const gchar *id = g_ptr_array_index(ids, i);
+		gchar *path = r_chunk_cache_chunk_path(cachedir, id);
+
+		g_hash_table_add(referenced, path);
+
+		if (g_file_test(path, G_FILE_TEST_EXISTS)) {
+			if (verify_cached_chunk(digests, id, path)) {
+				/* mark as recently used */
+				g_utime(path, NULL);
+				istats.hits++;
+				continue;
+			}
+			g_message("Dropping cached chunk %s which failed verification", id);
+			remove_cached_chunk(digests, path);
+		}
+
+		if (seeded && g_hash_table_contains(seeded, id)) {
+			istats.seeded++;
+			continue;
+		}
+
+		g_ptr_array_add(missing, (gpointer) id);
+	}
+
+	/* chunks used by this index were just touched and are evicted last */
+	entries = scan_cache(cachedir, &total, &ierror);
+	if (!entries) {
+		g_propagate_error(error, ierror);
+		goto out;
+	}
+
+	for (guint i = 0; i < missing->len; i++) {
+		const gchar *id = g_ptr_array_index(missing, i);
+		g_autofree gchar *path = r_chunk_cache_chunk_path(cachedir, id);
+		g_autofree gchar *digest = NULL;
+		GStatBuf st;
+
+		if (!fetch_chunk(store, id, path, &ierror)) {
+			g_propagate_prefixed_error(error, ierror, "Failed caching chunk: ");
+			goto out;
+		}
+
+		digest = compute_chunk_digest(path);
+		if (!digest || g_stat(path, &st) != 0) {
+			g_set_error(error, R_CHUNK_CACHE_ERROR, R_CHUNK_CACHE_ERROR_FAILED,
+					"Failed reading cached chunk %s", path);
+			g_remove(path);
+			goto out;
+		}
+		g_key_file_set_string(digests, CHUNK_DIGESTS_GROUP, id, digest);
+		total += st.st_size;
+
+		/* make room by evicting chunks not used by this index */
+		while (total > max_size && next < entries->len) {
+			CacheEntry *entry = g_ptr_array_index(entries, next++);
+
+			if (g_hash_table_contains(referenced, entry->path))
+				continue;
+
+			remove_cached_chunk(digests, entry->path);
+			total -= entry->size;
+		}
+
+		if (total > max_size) {
+			/* the remaining chunks are taken from the store directly */
+			remove_cached_chunk(digests, path);
+			istats.uncached = missing->len - i;
+			break;
+		}
+
+		istats.fetched++;
+	}
+
+	res = TRUE;
+out:
+	if (digests && !save_chunk_digests(cachedir, digests, &ierror)) {
+		if (res) {
+			g_propagate_error(error, ierror);
+			res = FALSE;
+		} else {
+			g_clear_error(&ierror);
+		}
+	}
+	if (stats)
+		*stats = istats;
+	return res;
+}
+
+gboolean r_chunk_cache_purge(const gchar *cachedir, const gchar *indexfile, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GPtrArray) ids = NULL;
+	g_autoptr(GKeyFile) digests = NULL;
+
+	g_return_val_if_fail(cachedir, FALSE);
+	g_return_val_if_fail(indexfile, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	ids = r_chunk_cache_parse_index(indexfile, &ierror);
+	if (!ids) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	digests = load_chunk_digests(cachedir);
+	for (guint i = 0; i < ids->len; i++) {
+		g_autofree gchar *path = r_chunk_cache_chunk_path(cachedir, g_ptr_array_index(ids, i));
+
+		if (g_remove(path) != 0 && errno != ENOENT) {
+			g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+					"Failed removing %s: %s", path, g_strerror(errno));
+			return FALSE;
+		}
+		g_key_file_remove_key(digests, CHUNK_DIGESTS_GROUP, g_ptr_array_index(ids, i), NULL);
+	}
+
+	return save_chunk_digests(cachedir, digests, error);
+}
+
+gboolean r_chunk_cache_trim(const gchar *cachedir, guint64 max_size, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GPtrArray) entries = NULL;
+	g_autoptr(GKeyFile) digests = NULL;
+	guint64 total = 0;
+
+	g_return_val_if_fail(cachedir, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	entries = scan_cache(cachedir, &total, &ierror);
+	if (!entries) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	if (total <= max_size)
+		return TRUE;
+
+	digests = load_chunk_digests(cachedir);
+	for (guint i = 0; i < entries->len && total > max_size; i++) {
+		CacheEntry *entry = g_ptr_array_index(entries, i);
+		g_autofree gchar *chunk_id = NULL;
+
+		if (g_remove(entry->path) != 0 && errno != ENOENT) {
+			g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+					"Failed removing %s: %s", entry->path, g_strerror(errno));
+			return FALSE;
+		}
+		chunk_id = chunk_id_from_path(entry->path);
+		g_key_file_remove_key(digests, CHUNK_DIGESTS_GROUP, chunk_id, NULL);
+		total -= entry->size;
+	}
+
+	g_debug("Trimmed chunk cache %s to %" G_GUINT64_FORMAT " bytes", cachedir, total);
+
+	return save_chunk_digests(cachedir, digests, error);
+}
+
+static gchar *slot_index_path(const gchar *cachedir, const gchar *slotname, const gchar *digest)
+{
+	g_autofree gchar *name = g_strdup_printf("%s.%s.index", slotname, digest);
+
+	return g_build_filename(cachedir, "indexes", name, NULL);
+}
+
+gboolean r_chunk_cache_save_slot_index(const gchar *cachedir, const gchar *slotname,
+		const gchar *digest, const gchar *indexfile, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = NULL;
+	g_autofree gchar *tmppath = NULL;
+	g_autofree gchar *indexdir = NULL;
+	g_autofree gchar *prefix = NULL;
+	g_autoptr(GDir) dir = NULL;
+	g_autoptr(GFile) srcfile = NULL;
+	g_autoptr(GFile) tmpfile = NULL;
+	const gchar *name;
+
+	g_return_val_if_fail(cachedir, FALSE);
+	g_return_val_if_fail(slotname, FALSE);
+	g_return_val_if_fail(digest, FALSE);
+	g_return_val_if_fail(indexfile, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	path = slot_index_path(cachedir, slotname, digest);
+	tmppath = g_strconcat(path, ".tmp", NULL);
+	indexdir = g_path_get_dirname(path);
+
+	if (g_mkdir_with_parents(indexdir, 0755) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed creating %s: %s", indexdir, g_strerror(errno));
+		return FALSE;
+	}
+
+	/* the slot does not contain the previously installed images anymore */
+	dir = g_dir_open(indexdir, 0, &ierror);
+	if (!dir) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+	prefix = g_strconcat(slotname, ".", NULL);
+	while ((name = g_dir_read_name(dir))) {
+		g_autofree gchar *oldpath = NULL;
+
+		if (!g_str_has_prefix(name, prefix))
+			continue;
+		oldpath = g_build_filename(indexdir, name, NULL);
+		if (g_remove(oldpath) != 0 && errno != ENOENT) {
+			g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+					"Failed removing %s: %s", oldpath, g_strerror(errno));
+			return FALSE;
+		}
+	}
+
+	srcfile = g_file_new_for_path(indexfile);
+	tmpfile = g_file_new_for_path(tmppath);
+	if (!g_file_copy(srcfile, tmpfile, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	if (g_rename(tmppath, path) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed renaming %s: %s", tmppath, g_strerror(errno));
+		g_remove(tmppath);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+GPtrArray *r_chunk_cache_load_slot_index(const gchar *cachedir, const gchar *slotname,
+		const gchar *digest)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = NULL;
+	GPtrArray *ids;
+
+	g_return_val_if_fail(cachedir, NULL);
+	g_return_val_if_fail(slotname, NULL);
+	g_return_val_if_fail(digest, NULL);
+
+	path = slot_index_path(cachedir, slotname, digest);
+	if (!g_file_test(path, G_FILE_TEST_EXISTS))
+		return NULL;
+
+	ids = r_chunk_cache_parse_index(path, &ierror);
+	if (!ids) {
+		g_message("Ignoring saved index of slot %s: %s", slotname, ierror->message);
+		g_clear_error(&ierror);
+	}
+
+	return ids;
+}
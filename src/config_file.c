@@ -5,6 +5,7 @@
 #include "context.h"
 #include "manifest.h"
 #include "mount.h"
+#include "status_store.h"
 #include "utils.h"
 
 G_DEFINE_QUARK(r-config-error-quark, r_config_error)
@@ -24,6 +25,7 @@ void r_free_slot(gpointer value)
 	g_free(slot->bootname);
 	g_free(slot->mount_point);
 	g_clear_pointer(&slot->status, free_slot_status);
+	g_clear_pointer(&slot->hash_tree, r_hash_tree_free);
 	g_free(slot);
 }
 
@@ -33,6 +35,7 @@ gboolean default_config(RaucConfig **config)
 
 	c->max_bundle_download_size = DEFAULT_MAX_BUNDLE_DOWNLOAD_SIZE;
 	c->mount_prefix = g_strdup("/mnt/rauc/");
+	c->chunk_cache_max_size = DEFAULT_CHUNK_CACHE_MAX_SIZE;
 
 	*config = c;
 	return TRUE;
@@ -166,6 +169,27 @@ gboolean load_config(const gchar *filename, RaucConfig **config, GError **error)
 			g_debug("No grubenv path provided, using /boot/grub/grubenv as default");
 			c->grubenv_path = g_strdup("/boot/grub/grubenv");
 		}
+
+		c->grubenv_native = g_key_file_get_boolean(key_file, "system", "grubenv-native", &ierror);
+		if (g_error_matches(ierror, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND)) {
+			c->grubenv_native = FALSE;
+			g_clear_error(&ierror);
+		} else if (ierror) {
+			g_propagate_error(error, ierror);
+			res = FALSE;
+			goto free;
+		}
+		g_key_file_remove_key(key_file, "system", "grubenv-native", NULL);
+	}
+
+	if (g_strcmp0(c->system_bootloader, "efi") == 0) {
+		c->efivarfs_path = resolve_path(filename,
+				key_file_consume_string(key_file, "system", "efivarfs", NULL));
+	}
+
+	if (g_strcmp0(c->system_bootloader, "uboot") == 0) {
+		c->uboot_env_config = resolve_path(filename,
+				key_file_consume_string(key_file, "system", "uboot-env-config", NULL));
 	}
 
 	c->activate_installed = g_key_file_get_boolean(key_file, "system", "activate-installed", &ierror);
@@ -279,6 +303,28 @@ gboolean load_config(const gchar *filename, RaucConfig **config, GError **error)
 
 	/* parse [casync] section */
 	c->store_path = key_file_consume_string(key_file, "casync", "storepath", NULL);
+	c->chunk_cache_path = resolve_path(filename,
+			key_file_consume_string(key_file, "casync", "cachepath", NULL));
+	c->chunk_cache_max_size = g_key_file_get_uint64(key_file, "casync", "cache-max-size", &ierror);
+	if (g_error_matches(ierror, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND) ||
+	    g_error_matches(ierror, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND)) {
+		c->chunk_cache_max_size = DEFAULT_CHUNK_CACHE_MAX_SIZE;
+		g_clear_error(&ierror);
+	} else if (ierror) {
+		g_propagate_error(error, ierror);
+		res = FALSE;
+		goto free;
+	}
+	g_key_file_remove_key(key_file, "casync", "cache-max-size", NULL);
+	c->casync_seeds = g_key_file_get_string_list(key_file, "casync", "seeds", NULL, NULL);
+	for (gchar **seed = c->casync_seeds; seed && *seed; seed++) {
+		gchar *resolved = resolve_path(filename, *seed);
+
+		if (resolved != *seed)
+			g_free(*seed);
+		*seed = resolved;
+	}
+	g_key_file_remove_key(key_file, "casync", "seeds", NULL);
 	if (!check_remaining_keys(key_file, "casync", &ierror)) {
 		g_propagate_error(error, ierror);
 		res = FALSE;
@@ -407,6 +453,33 @@ gboolean load_config(const gchar *filename, RaucConfig **config, GError **error)
 			g_key_file_remove_key(key_file, groups[i], "force-install-same", NULL);
 			g_key_file_remove_key(key_file, groups[i], "ignore-checksum", NULL);
 
+			slot->verify_after_write = g_key_file_get_boolean(key_file, groups[i], "verify-after-write", &ierror);
+			if (g_error_matches(ierror, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND)) {
+				slot->verify_after_write = FALSE;
+				g_clear_error(&ierror);
+			} else if (ierror) {
+				g_propagate_error(error, ierror);
+				res = FALSE;
+				goto free;
+			}
+			g_key_file_remove_key(key_file, groups[i], "verify-after-write", NULL);
+
+			slot->discard_interval = g_key_file_get_integer(key_file, groups[i], "discard-interval", &ierror);
+			if (g_error_matches(ierror, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND)) {
+				slot->discard_interval = 0;
+				g_clear_error(&ierror);
+			} else if (ierror) {
+				g_propagate_error(error, ierror);
+				res = FALSE;
+				goto free;
+			} else if ((gint) slot->discard_interval < 0) {
+				g_set_error(error, R_CONFIG_ERROR, R_CONFIG_ERROR_INVALID_FORMAT,
+						"Invalid value for key \"discard-interval\" in [%s]", groups[i]);
+				res = FALSE;
+				goto free;
+			}
+			g_key_file_remove_key(key_file, groups[i], "discard-interval", NULL);
+
 			slot->extra_mount_opts = key_file_consume_string(key_file, groups[i], "extra-mount-opts", NULL);
 
 			g_hash_table_insert(slots, (gchar*)slot->name, slot);
@@ -496,7 +569,11 @@ void free_config(RaucConfig *config)
 	g_free(config->system_bootloader);
 	g_free(config->mount_prefix);
 	g_free(config->store_path);
+	g_free(config->chunk_cache_path);
+	g_strfreev(config->casync_seeds);
 	g_free(config->grubenv_path);
+	g_free(config->uboot_env_config);
+	g_free(config->efivarfs_path);
 	g_free(config->statusfile_path);
 	g_free(config->keyring_path);
 	g_free(config->autoinstall_path);
@@ -524,6 +601,8 @@ static void status_file_get_slot_status(GKeyFile *key_file, const gchar *group,
 	g_clear_pointer(&slotstatus->checksum.digest, g_free);
 	g_free(slotstatus->installed_timestamp);
 	g_free(slotstatus->activated_timestamp);
+	g_free(slotstatus->hashtree_root);
+	g_free(slotstatus->discarded_timestamp);
 
 	slotstatus->bundle_compatible = key_file_consume_string(key_file, group, "bundle.compatible", NULL);
 	slotstatus->bundle_version = key_file_consume_string(key_file, group, "bundle.version", NULL);
@@ -569,6 +648,16 @@ static void status_file_get_slot_status(GKeyFile *key_file, const gchar *group,
 		count = 0;
 	}
 	slotstatus->activated_count = count;
+
+	slotstatus->hashtree_root = key_file_consume_string(key_file, group, "hashtree.root", NULL);
+	count = g_key_file_get_uint64(key_file, group, "hashtree.leaf-size", NULL);
+	if (!slotstatus->hashtree_root || count == 0 || count > G_MAXUINT32) {
+		g_clear_pointer(&slotstatus->hashtree_root, g_free);
+		count = 0;
+	}
+	slotstatus->hashtree_leaf_size = count;
+
+	slotstatus->discarded_timestamp = key_file_consume_string(key_file, group, "discarded.timestamp", NULL);
 }
 
 static void status_file_set_string_or_remove_key(GKeyFile *key_file, const gchar *group, const gchar *key, gchar *string)
@@ -611,6 +700,16 @@ static void status_file_set_slot_status(GKeyFile *key_file, const gchar *group,
 		g_key_file_remove_key(key_file, group, "activated.count", NULL);
 	}
 
+	if (slotstatus->hashtree_root) {
+		g_key_file_set_string(key_file, group, "hashtree.root", slotstatus->hashtree_root);
+		g_key_file_set_uint64(key_file, group, "hashtree.leaf-size", slotstatus->hashtree_leaf_size);
+	} else {
+		g_key_file_remove_key(key_file, group, "hashtree.root", NULL);
+		g_key_file_remove_key(key_file, group, "hashtree.leaf-size", NULL);
+	}
+
+	status_file_set_string_or_remove_key(key_file, group, "discarded.timestamp", slotstatus->discarded_timestamp);
+
 	return;
 }
 
@@ -677,7 +776,7 @@ static void load_slot_status_locally(RaucSlot *dest_slot)
 	/* read slot status */
 	if (!dest_slot->ext_mount_point) {
 		g_message("mounting slot %s", dest_slot->device);
-		if (!r_mount_slot(dest_slot, &ierror)) {
+		if (!r_mount_slot_readonly(dest_slot, &ierror)) {
 			g_message("Failed to mount slot %s: %s", dest_slot->device, ierror->message);
 			g_clear_error(&ierror);
 			return;
@@ -706,7 +805,7 @@ static void load_slot_status_globally(void)
 {
 	GError *ierror = NULL;
 	GHashTable *slots = r_context()->config->slots;
-	g_autoptr(GKeyFile) key_file = g_key_file_new();
+	g_autoptr(GKeyFile) key_file = NULL;
 	g_auto(GStrv) groups = NULL;
 	gchar **group, *slotname;
 	GHashTableIter iter;
@@ -714,10 +813,12 @@ static void load_slot_status_globally(void)
 
 	g_return_if_fail(r_context()->config->statusfile_path);
 
-	g_key_file_load_from_file(key_file, r_context()->config->statusfile_path, G_KEY_FILE_NONE, &ierror);
-	if (ierror && !g_error_matches(ierror, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+	key_file = r_status_store_load(r_context()->config->statusfile_path, &ierror);
+	if (!key_file) {
 		g_message("load_slot_status_globally: %s.", ierror->message);
-	g_clear_error(&ierror);
+		g_clear_error(&ierror);
+		key_file = g_key_file_new();
+	}
 
 	/* Load all slot states included in the statusfile */
 	groups = g_key_file_get_groups(key_file, NULL);
@@ -759,10 +860,66 @@ void load_slot_status(RaucSlot *dest_slot)
 		load_slot_status_locally(dest_slot);
 }
 
+static void load_slot_status_worker(gpointer data, gpointer user_data)
+{
+	load_slot_status_locally(data);
+}
+
+void load_slot_status_multi(GList *slots)
+{
+	GError *ierror = NULL;
+	GThreadPool *pool = NULL;
+	g_autoptr(GList) pending = NULL;
+
+	if (r_context()->config->statusfile_path) {
+		load_slot_status_globally();
+		return;
+	}
+
+	/* mounting is only needed for mountable slots without status */
+	for (GList *l = slots; l != NULL; l = l->next) {
+		RaucSlot *slot = l->data;
+
+		if (slot->status)
+			continue;
+
+		if (!is_slot_mountable(slot) || slot->ext_mount_point)
+			load_slot_status_locally(slot);
+		else
+			pending = g_list_prepend(pending, slot);
+	}
+
+	if (pending && pending->next)
+		pool = g_thread_pool_new(load_slot_status_worker, NULL,
+				SLOT_STATUS_LOAD_THREADS, FALSE, &ierror);
+	if (!pool && ierror) {
+		g_message("Failed to create status loader threads: %s", ierror->message);
+		g_clear_error(&ierror);
+	}
+
+	for (GList *l = pending; l != NULL; l = l->next) {
+		if (!pool) {
+			load_slot_status_locally(l->data);
+			continue;
+		}
+
+		if (!g_thread_pool_push(pool, l->data, &ierror)) {
+			g_message("Failed to queue status loading: %s", ierror->message);
+			g_clear_error(&ierror);
+			load_slot_status_locally(l->data);
+		}
+	}
+
+	/* waits for all queued slots */
+	if (pool)
+		g_thread_pool_free(pool, FALSE, TRUE);
+}
+
 static gboolean save_slot_status_locally(RaucSlot *dest_slot, GError **error)
 {
 	GError *ierror = NULL;
 	gboolean res = FALSE;
+	gboolean mounted;
 	g_autofree gchar *slotstatuspath = NULL;
 
 	g_return_val_if_fail(dest_slot, FALSE);
@@ -774,11 +931,16 @@ static gboolean save_slot_status_locally(RaucSlot *dest_slot, GError **error)
 		goto free;
 	}
 
-	g_debug("mounting slot %s", dest_slot->device);
-	res = r_mount_slot(dest_slot, &ierror);
-	if (!res) {
-		g_propagate_error(error, ierror);
-		goto free;
+	/* reuse a mount done by RAUC (e.g. for a hook) and leave it to its
+	 * owner */
+	mounted = dest_slot->mount_point == NULL;
+	if (mounted) {
+		g_debug("mounting slot %s", dest_slot->device);
+		res = r_mount_slot(dest_slot, &ierror);
+		if (!res) {
+			g_propagate_error(error, ierror);
+			goto free;
+		}
 	}
 
 	slotstatuspath = g_build_filename(dest_slot->mount_point, "slot.raucs", NULL);
@@ -787,11 +949,15 @@ static gboolean save_slot_status_locally(RaucSlot *dest_slot, GError **error)
 	res = write_slot_status(slotstatuspath, dest_slot->status, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
-		r_umount_slot(dest_slot, NULL);
+		if (mounted)
+			r_umount_slot(dest_slot, NULL);
 
 		goto free;
 	}
 
+	if (!mounted)
+		goto free;
+
 	res = r_umount_slot(dest_slot, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
@@ -802,32 +968,25 @@ free:
 	return res;
 }
 
-static gboolean save_slot_status_globally(GError **error)
+static gboolean save_slot_status_globally(RaucSlot *dest_slot, GError **error)
 {
 	g_autoptr(GKeyFile) key_file = g_key_file_new();
+	g_autofree gchar *group = NULL;
 	GError *ierror = NULL;
-	GHashTableIter iter;
-	RaucSlot *slot;
 	gboolean res;
 
+	g_return_val_if_fail(dest_slot, FALSE);
+	g_return_val_if_fail(dest_slot->status, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 	g_return_val_if_fail(r_context()->config->statusfile_path, FALSE);
 
-	g_debug("Saving global slot status");
-
-	/* Save all slot status information */
-	g_hash_table_iter_init(&iter, r_context()->config->slots);
-	while (g_hash_table_iter_next(&iter, NULL, (gpointer*) &slot)) {
-		g_autofree gchar *group;
+	g_debug("Saving global slot status of %s", dest_slot->name);
 
-		if (!slot->status) {
-			continue;
-		}
-		group = g_strdup_printf(RAUC_SLOT_PREFIX ".%s", slot->name);
-		status_file_set_slot_status(key_file, group, slot->status);
-	}
+	/* only the changed slot is appended to the journal */
+	group = g_strdup_printf(RAUC_SLOT_PREFIX ".%s", dest_slot->name);
+	status_file_set_slot_status(key_file, group, dest_slot->status);
 
-	res = g_key_file_save_to_file(key_file, r_context()->config->statusfile_path, &ierror);
+	res = r_status_store_append(r_context()->config->statusfile_path, key_file, &ierror);
 	if (!res)
 		g_propagate_error(error, ierror);
 
@@ -840,11 +999,38 @@ gboolean save_slot_status(RaucSlot *dest_slot, GError **error)
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
 	if (r_context()->config->statusfile_path)
-		return save_slot_status_globally(error);
+		return save_slot_status_globally(dest_slot, error);
 	else
 		return save_slot_status_locally(dest_slot, error);
 }
 
+gboolean commit_slot_status(GError **error)
+{
+	GError *ierror = NULL;
+
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (!r_context()->config->statusfile_path)
+		return TRUE;
+
+	if (!r_status_store_commit(r_context()->config->statusfile_path, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed to commit slot status: ");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+gchar *get_slot_hash_tree_path(const RaucSlot *slot)
+{
+	g_return_val_if_fail(slot, NULL);
+
+	if (!r_context()->config->statusfile_path)
+		return NULL;
+
+	return g_strdup_printf("%s.%s.hashtree", r_context()->config->statusfile_path, slot->name);
+}
+
 void free_slot_status(RaucSlotStatus *slotstatus)
 {
 	g_return_if_fail(slotstatus);
@@ -857,6 +1043,8 @@ void free_slot_status(RaucSlotStatus *slotstatus)
 	g_free(slotstatus->checksum.digest);
 	g_free(slotstatus->installed_timestamp);
 	g_free(slotstatus->activated_timestamp);
+	g_free(slotstatus->hashtree_root);
+	g_free(slotstatus->discarded_timestamp);
 	g_free(slotstatus);
 }
 
@@ -1,5 +1,6 @@
 #include <gio/gio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "config_file.h"
 #include "context.h"
@@ -289,59 +290,85 @@ void r_context_set_busy(gboolean busy)
 	context->busy = busy;
 }
 
-static void r_context_send_progress(gboolean op_finished, gboolean success)
+/* Sums up percent_done of all steps below the current one. Only needed when
+ * the stack changes, percentage updates keep the sum up to date. */
+static void r_context_update_parents_done(void)
 {
-	RaucProgressStep *step;
-	RaucProgressStep *iter_step;
-	gfloat percentage = 0;
+	gfloat sum = 0;
+
+	for (gint i = (gint) context->progress_depth - 2; i >= 0; i--)
+		sum = sum + context->progress[i].percent_done;
+
+	context->progress_parents_done = sum;
+}
 
-	/* last step already notified parent, ignore it */
-	GList *iter = g_list_next(context->progress);
+static void r_context_send_progress(const gchar *description, gboolean force)
+{
+	RaucProgressStep *step;
+	gfloat percentage;
 
-	/* "stack" should never be NULL at this point */
-	g_assert_nonnull(context->progress);
+	/* "stack" should never be empty at this point */
+	g_assert_cmpuint(context->progress_depth, >, 0);
 
-	step = context->progress->data;
+	step = &context->progress[context->progress_depth - 1];
 
-	/* no step in list left means operation complete */
-	if (!iter)
+	/* last step already notified parent, only count it if it is the
+	 * only one left */
+	if (context->progress_depth == 1)
 		percentage = step->percent_done;
-
-	/* sum up done percentages of all steps */
-	while (iter) {
-		iter_step = iter->data;
-		percentage = percentage + iter_step->percent_done;
-		iter = g_list_next(iter);
-	}
+	else
+		percentage = context->progress_parents_done;
 
 	g_assert_cmpint(percentage, <=, 100);
 
-	/* call installer callback with percentage and message */
-	if (op_finished) {
-		if (success)
-			step->description = g_strdup_printf("%s done.",
-					step->description);
-		else
-			step->description = g_strdup_printf("%s failed.",
-					step->description);
-	}
+	/* coalesce updates that would not change the reported percentage */
+	if (!force && (gint) percentage == context->progress_last_percent)
+		return;
+	context->progress_last_percent = percentage;
 
 	/* handle missing callback gracefully */
 	if (context->progress_callback)
-		context->progress_callback(percentage, step->description,
-				g_list_length(context->progress));
+		context->progress_callback(percentage,
+				description ? description : step->description,
+				context->progress_depth);
+}
+
+static RaucTraceEvent *r_context_trace_add(const gchar *category, const gchar *name,
+		const gchar *description)
+{
+	RaucTraceEvent *event;
+
+	if (!context || !context->trace_recording)
+		return NULL;
+
+	event = g_new0(RaucTraceEvent, 1);
+	event->category = category;
+	event->name = g_strdup(name);
+	event->description = g_strdup(description);
+	event->start = g_get_monotonic_time();
+
+	g_mutex_lock(&context->trace_mutex);
+	g_ptr_array_add(context->trace, event);
+	g_mutex_unlock(&context->trace_mutex);
+
+	return event;
 }
 
 void r_context_begin_step(const gchar *name, const gchar *description,
 		gint substeps)
 {
-
-	RaucProgressStep *step = g_new0(RaucProgressStep, 1);
+	RaucProgressStep *step;
 	RaucProgressStep *parent;
 
 	g_return_if_fail(name);
 	g_return_if_fail(description);
 
+	if (context->progress_depth == PROGRESS_MAX_DEPTH)
+		g_error("Step nesting too deep: %s exceeds %d levels",
+				name, PROGRESS_MAX_DEPTH);
+
+	step = &context->progress[context->progress_depth];
+
 	/* set properties */
 	step->name = g_strdup(name);
 	step->description = g_strdup(description);
@@ -349,10 +376,11 @@ void r_context_begin_step(const gchar *name, const gchar *description,
 	step->substeps_done = 0;
 	step->percent_done = 0;
 	step->last_explicit_percent = 0;
+	step->trace_event = r_context_trace_add("step", name, description);
 
 	/* calculate percentage */
-	if (context->progress) {
-		parent = context->progress->data;
+	if (context->progress_depth > 0) {
+		parent = &context->progress[context->progress_depth - 1];
 		g_assert_cmpint(parent->substeps_total, >, 0);
 
 		/* nesting check */
@@ -374,9 +402,10 @@ void r_context_begin_step(const gchar *name, const gchar *description,
 	}
 
 	/* add step to "stack" */
-	context->progress = g_list_prepend(context->progress, step);
+	context->progress_depth++;
+	r_context_update_parents_done();
 
-	r_context_send_progress(FALSE, FALSE);
+	r_context_send_progress(NULL, TRUE);
 }
 
 void r_context_begin_step_formatted(const gchar *name, gint substeps, const gchar *description, ...)
@@ -397,18 +426,16 @@ void r_context_begin_step_formatted(const gchar *name, gint substeps, const gcha
 void r_context_end_step(const gchar *name, gboolean success)
 {
 	RaucProgressStep *step;
-	GList *step_element;
 	RaucProgressStep *parent;
+	g_autofree gchar *description = NULL;
 
 	g_return_if_fail(name);
 
-	/* "stack" should never be NULL at this point */
-	g_assert_nonnull(context->progress);
+	/* "stack" should never be empty at this point */
+	g_assert_cmpuint(context->progress_depth, >, 0);
 
 	/* get element from "stack" */
-	step_element = context->progress;
-	step = step_element->data;
-	g_assert_nonnull(step);
+	step = &context->progress[context->progress_depth - 1];
 
 	step->percent_done = step->percent_total;
 
@@ -431,27 +458,36 @@ void r_context_end_step(const gchar *name, gboolean success)
 	g_assert_cmpstr(step->name, ==, name);
 
 	/* increment step count and percentage on parent step */
-	if (g_list_next(context->progress)) {
-		parent = g_list_next(context->progress)->data;
+	if (context->progress_depth > 1) {
+		parent = &context->progress[context->progress_depth - 2];
 		parent->substeps_done++;
 
 		/* clean up explicit percentage */
-		if (step->last_explicit_percent != 0)
+		if (step->last_explicit_percent != 0) {
 			r_context_set_step_percentage(step->name, 100);
-		else
+		} else {
 			parent->percent_done = parent->percent_done
 			                       + step->percent_done;
+			context->progress_parents_done = context->progress_parents_done
+			                                 + step->percent_done;
+		}
 
 		g_assert_cmpint(step->percent_done, <=,
 				parent->percent_done);
 	}
 
-	r_context_send_progress(TRUE, success);
-	context->progress = g_list_remove_link(context->progress,
-			step_element);
+	description = g_strdup_printf("%s %s.", step->description,
+			success ? "done" : "failed");
+	r_context_send_progress(description, TRUE);
 
-	g_list_free(step_element);
-	r_context_free_progress_step(step);
+	r_context_trace_end(step->trace_event, success);
+	step->trace_event = NULL;
+
+	/* remove step from "stack" */
+	g_clear_pointer(&step->name, g_free);
+	g_clear_pointer(&step->description, g_free);
+	context->progress_depth--;
+	r_context_update_parents_done();
 }
 
 void r_context_set_step_percentage(const gchar *name, gint custom_percent)
@@ -462,10 +498,10 @@ void r_context_set_step_percentage(const gchar *name, gint custom_percent)
 
 	g_return_if_fail(name);
 
-	g_assert_nonnull(context->progress);
+	g_assert_cmpuint(context->progress_depth, >, 1);
 
-	step = context->progress->data;
-	parent = g_list_next(context->progress)->data;
+	step = &context->progress[context->progress_depth - 1];
+	parent = &context->progress[context->progress_depth - 2];
 
 	/* ensure that progress step nesting is done correctly */
 	g_assert_cmpstr(step->name, ==, name);
@@ -479,24 +515,141 @@ void r_context_set_step_percentage(const gchar *name, gint custom_percent)
 	                     * (percent_difference / 100.0f);
 
 	/* pass to parent */
-	if (parent)
-		parent->percent_done = parent->percent_done
-		                       + step->percent_done;
+	parent->percent_done = parent->percent_done
+	                       + step->percent_done;
+	context->progress_parents_done = context->progress_parents_done
+	                                 + step->percent_done;
 
 	step->last_explicit_percent = custom_percent;
 
 	/* r_context_step_end sends 100% progress step */
 	if (custom_percent != 100)
-		r_context_send_progress(FALSE, FALSE);
+		r_context_send_progress(NULL, FALSE);
 }
 
-void r_context_free_progress_step(RaucProgressStep *step)
+void r_context_set_step_description(const gchar *name, const gchar *description)
 {
-	g_return_if_fail(step);
+	RaucProgressStep *step;
+
+	g_return_if_fail(name);
+	g_return_if_fail(description);
+
+	g_assert_cmpuint(context->progress_depth, >, 0);
+
+	step = &context->progress[context->progress_depth - 1];
+
+	/* ensure that progress step nesting is done correctly */
+	g_assert_cmpstr(step->name, ==, name);
 
-	g_free(step->name);
 	g_free(step->description);
-	g_free(step);
+	step->description = g_strdup(description);
+
+	r_context_send_progress(NULL, TRUE);
+}
+
+/* minimum time between two byte-level progress notifications */
+#define PROGRESS_BYTES_INTERVAL (G_USEC_PER_SEC / 2)
+
+static void r_context_send_progress_bytes(gboolean force)
+{
+	RaucProgressBytes *bytes = &context->progress_bytes;
+	RaucProgressStep *step;
+	gint64 now = g_get_monotonic_time();
+	gint64 eta = -1;
+
+	if (!force && now - bytes->last_time < PROGRESS_BYTES_INTERVAL)
+		return;
+
+	if (now > bytes->last_time) {
+		gdouble current = (bytes->done - bytes->last_done) * (gdouble) G_USEC_PER_SEC
+		                  / (now - bytes->last_time);
+
+		/* smooth out short-term fluctuations */
+		if (bytes->throughput > 0)
+			bytes->throughput = 0.7 * bytes->throughput + 0.3 * current;
+		else
+			bytes->throughput = current;
+	}
+	bytes->last_time = now;
+	bytes->last_done = bytes->done;
+
+	if (bytes->total >= bytes->done && bytes->throughput > 0)
+		eta = (bytes->total - bytes->done) / bytes->throughput;
+
+	/* weight the percentage of the accounted step by bytes, leaving 100%
+	 * to r_context_end_step() */
+	if (bytes->total && bytes->step_depth > 1
+	    && bytes->step_depth == context->progress_depth) {
+		gint percent;
+
+		step = &context->progress[bytes->step_depth - 1];
+		percent = MIN(bytes->done * 100 / bytes->total, 99);
+		if (step->substeps_total == 0 && percent > step->last_explicit_percent)
+			r_context_set_step_percentage(step->name, percent);
+	}
+
+	if (context->progress_bytes_callback)
+		context->progress_bytes_callback(bytes->done, bytes->total,
+				bytes->throughput, eta);
+}
+
+void r_context_begin_bytes(guint64 total)
+{
+	RaucProgressBytes *bytes;
+
+	if (!context)
+		return;
+
+	bytes = &context->progress_bytes;
+	g_return_if_fail(!bytes->active);
+
+	bytes->active = TRUE;
+	bytes->done = 0;
+	bytes->total = total;
+	bytes->step_depth = context->progress_depth;
+	bytes->last_time = g_get_monotonic_time();
+	bytes->last_done = 0;
+	bytes->throughput = 0;
+
+	if (context->progress_bytes_callback)
+		context->progress_bytes_callback(0, total, 0, -1);
+}
+
+void r_context_set_bytes_total(guint64 total)
+{
+	if (!context || !context->progress_bytes.active)
+		return;
+
+	context->progress_bytes.total = total;
+}
+
+void r_context_add_bytes(guint64 bytes)
+{
+	if (!context || !context->progress_bytes.active)
+		return;
+
+	context->progress_bytes.done += bytes;
+	r_context_send_progress_bytes(FALSE);
+}
+
+void r_context_end_bytes(void)
+{
+	RaucProgressBytes *bytes;
+
+	if (!context || !context->progress_bytes.active)
+		return;
+
+	bytes = &context->progress_bytes;
+	if (bytes->step_depth > 0 && bytes->step_depth <= context->progress_depth
+	    && context->progress[bytes->step_depth - 1].trace_event) {
+		g_mutex_lock(&context->trace_mutex);
+		context->progress[bytes->step_depth - 1].trace_event->bytes += bytes->done;
+		g_mutex_unlock(&context->trace_mutex);
+	}
+
+	r_context_send_progress_bytes(TRUE);
+	context->progress_bytes.active = FALSE;
+	context->progress_bytes.step_depth = 0;
 }
 
 void r_context_register_progress_callback(progress_callback progress_cb)
@@ -508,6 +661,139 @@ void r_context_register_progress_callback(progress_callback progress_cb)
 	context->progress_callback = progress_cb;
 }
 
+void r_context_register_progress_bytes_callback(progress_bytes_callback progress_bytes_cb)
+{
+	g_return_if_fail(progress_bytes_cb);
+
+	g_assert_null(context->progress_bytes_callback);
+
+	context->progress_bytes_callback = progress_bytes_cb;
+}
+
+static void trace_event_free(RaucTraceEvent *event)
+{
+	g_free(event->name);
+	g_free(event->description);
+	g_free(event);
+}
+
+void r_context_trace_start(void)
+{
+	g_mutex_lock(&context->trace_mutex);
+	g_clear_pointer(&context->trace, g_ptr_array_unref);
+	context->trace = g_ptr_array_new_with_free_func((GDestroyNotify) trace_event_free);
+	context->trace_start = g_get_monotonic_time();
+	context->trace_recording = TRUE;
+	g_mutex_unlock(&context->trace_mutex);
+}
+
+void r_context_trace_stop(void)
+{
+	context->trace_recording = FALSE;
+}
+
+RaucTraceEvent *r_context_trace_begin(const gchar *category, const gchar *name,
+		const gchar *description)
+{
+	g_return_val_if_fail(category, NULL);
+	g_return_val_if_fail(name, NULL);
+
+	return r_context_trace_add(category, name, description);
+}
+
+RaucTraceEvent *r_context_trace_subprocess(GPtrArray *args)
+{
+	g_autofree gchar *call = NULL;
+	g_autofree gchar *name = NULL;
+
+	g_return_val_if_fail(args && args->len > 0, NULL);
+
+	if (!context || !context->trace_recording)
+		return NULL;
+
+	/* skip sudo and the like */
+	for (guint i = 0; i < args->len && g_ptr_array_index(args, i); i++) {
+		const gchar *arg = g_ptr_array_index(args, i);
+
+		if (g_strcmp0(arg, "sudo") != 0 && !g_str_has_prefix(arg, "-")) {
+			name = g_path_get_basename(arg);
+			break;
+		}
+	}
+
+	call = g_strjoinv(" ", (gchar**) args->pdata);
+
+	return r_context_trace_add("subprocess", name ? name : call, call);
+}
+
+void r_context_trace_end(RaucTraceEvent *event, gboolean success)
+{
+	if (!event)
+		return;
+
+	g_mutex_lock(&context->trace_mutex);
+	event->end = g_get_monotonic_time();
+	event->success = success;
+	g_mutex_unlock(&context->trace_mutex);
+}
+
+static void trace_append_json_string(GString *str, const gchar *value)
+{
+	g_string_append_c(str, '"');
+	for (const gchar *c = value; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			g_string_append_printf(str, "\\%c", *c);
+		else if ((guchar) *c < 0x20)
+			g_string_append_printf(str, "\\u%04x", (guchar) *c);
+		else
+			g_string_append_c(str, *c);
+	}
+	g_string_append_c(str, '"');
+}
+
+gchar *r_context_trace_to_json(void)
+{
+	GString *str;
+	gint64 now = g_get_monotonic_time();
+
+	g_mutex_lock(&context->trace_mutex);
+
+	if (!context->trace) {
+		g_mutex_unlock(&context->trace_mutex);
+		return NULL;
+	}
+
+	str = g_string_new("{\"traceEvents\":[");
+	for (guint i = 0; i < context->trace->len; i++) {
+		RaucTraceEvent *event = g_ptr_array_index(context->trace, i);
+		gint64 end = event->end ? event->end : now;
+
+		if (i > 0)
+			g_string_append_c(str, ',');
+		g_string_append(str, "\n{\"name\":");
+		trace_append_json_string(str, event->name);
+		g_string_append(str, ",\"cat\":");
+		trace_append_json_string(str, event->category);
+		g_string_append_printf(str, ",\"ph\":\"X\",\"ts\":%" G_GINT64_FORMAT
+				",\"dur\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":1,\"args\":{",
+				event->start - context->trace_start, end - event->start, (gint) getpid());
+		if (event->description) {
+			g_string_append(str, "\"description\":");
+			trace_append_json_string(str, event->description);
+			g_string_append_c(str, ',');
+		}
+		if (event->bytes)
+			g_string_append_printf(str, "\"bytes\":%" G_GUINT64_FORMAT ",", event->bytes);
+		g_string_append_printf(str, "\"result\":\"%s\"}}",
+				!event->end ? "running" : event->success ? "success" : "failure");
+	}
+	g_string_append(str, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	g_mutex_unlock(&context->trace_mutex);
+
+	return g_string_free(str, FALSE);
+}
+
 RaucContext *r_context_conf(void)
 {
 	if (context == NULL) {
@@ -526,8 +812,10 @@ RaucContext *r_context_conf(void)
 
 		context = g_new0(RaucContext, 1);
 		context->configpath = g_strdup("/etc/rauc/system.conf");
-		context->progress = NULL;
 		context->install_info = g_new0(RContextInstallationInfo, 1);
+		g_mutex_init(&context->install_info->control_mutex);
+		g_cond_init(&context->install_info->control_cond);
+		g_mutex_init(&context->trace_mutex);
 	}
 
 	g_assert_false(context->busy);
@@ -0,0 +1,247 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <linux/fs.h>
+#include <linux/magic.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include "efivars.h"
+
+#define EFI_GLOBAL_VARIABLE_GUID "8be4df61-93ca-11d2-aa0d-00e098032b8c"
+
+#define EFI_VARIABLE_NON_VOLATILE 0x00000001
+#define EFI_VARIABLE_BOOTSERVICE_ACCESS 0x00000002
+#define EFI_VARIABLE_RUNTIME_ACCESS 0x00000004
+
+#define LOAD_OPTION_ACTIVE 0x00000001
+
+G_DEFINE_QUARK(r-efivars-error-quark, r_efivars_error)
+
+static gchar *efivar_path(const gchar *efivarfs, const gchar *name)
+{
+	g_autofree gchar *filename = g_strconcat(name, "-", EFI_GLOBAL_VARIABLE_GUID, NULL);
+
+	return g_build_filename(efivarfs, filename, NULL);
+}
+
+GBytes *r_efivars_read(const gchar *efivarfs, const gchar *name, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = NULL;
+	g_autofree gchar *contents = NULL;
+	gsize len;
+
+	g_return_val_if_fail(efivarfs, NULL);
+	g_return_val_if_fail(name, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	path = efivar_path(efivarfs, name);
+	if (!g_file_get_contents(path, &contents, &len, &ierror)) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+
+	/* content starts with 32 bit attributes */
+	if (len < 4) {
+		g_set_error(error, R_EFIVARS_ERROR, R_EFIVARS_ERROR_INVALID,
+				"EFI variable %s too short", name);
+		return NULL;
+	}
+
+	return g_bytes_new(contents + 4, len - 4);
+}
+
+/* efivarfs marks most variables immutable to protect against accidental
+ * removal, which also prevents writing them. Returns TRUE if the flag was
+ * changed. */
+static gboolean efivar_set_immutable(const gchar *path, gboolean immutable)
+{
+	gboolean changed = FALSE;
+	int fd, flags;
+
+	fd = g_open(path, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		return FALSE;
+
+	if (ioctl(fd, FS_IOC_GETFLAGS, &flags) == 0 && !!(flags & FS_IMMUTABLE_FL) != immutable) {
+		if (immutable)
+			flags |= FS_IMMUTABLE_FL;
+		else
+			flags &= ~FS_IMMUTABLE_FL;
+		if (ioctl(fd, FS_IOC_SETFLAGS, &flags) == 0)
+			changed = TRUE;
+		else
+			g_debug("Failed to change immutable flag of %s: %s", path, g_strerror(errno));
+	}
+
+	close(fd);
+	return changed;
+}
+
+static gboolean efivar_write_file(const gchar *path, const gchar *name,
+		const guint8 *buf, gsize len, GError **error)
+{
+	struct statfs sfs;
+	ssize_t ret;
+	int fd;
+
+	/* efivarfs replaces the whole variable with each write, truncating it
+	 * is not supported */
+	fd = g_open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to open %s: %s", path, g_strerror(errno));
+		return FALSE;
+	}
+
+	ret = write(fd, buf, len);
+	if (ret != (ssize_t) len) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to write EFI variable %s: %s", name, g_strerror(errno));
+		close(fd);
+		return FALSE;
+	}
+
+	/* other filesystems (e.g. for testing) keep stale trailing data */
+	if (fstatfs(fd, &sfs) == 0 && sfs.f_type != EFIVARFS_MAGIC && ftruncate(fd, len) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to write EFI variable %s: %s", name, g_strerror(errno));
+		close(fd);
+		return FALSE;
+	}
+
+	if (close(fd) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to write EFI variable %s: %s", name, g_strerror(errno));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+gboolean r_efivars_write(const gchar *efivarfs, const gchar *name,
+		const guint8 *data, gsize len, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = NULL;
+	g_autofree guint8 *buf = NULL;
+	guint32 attributes = GUINT32_TO_LE(EFI_VARIABLE_NON_VOLATILE |
+			EFI_VARIABLE_BOOTSERVICE_ACCESS |
+			EFI_VARIABLE_RUNTIME_ACCESS);
+	gboolean was_immutable;
+	gboolean res;
+
+	g_return_val_if_fail(efivarfs, FALSE);
+	g_return_val_if_fail(name, FALSE);
+	g_return_val_if_fail(data || len == 0, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	path = efivar_path(efivarfs, name);
+	was_immutable = efivar_set_immutable(path, FALSE);
+
+	/* efivarfs requires attributes and data in a single write */
+	buf = g_malloc(len + 4);
+	memcpy(buf, &attributes, 4);
+	memcpy(buf + 4, data, len);
+
+	res = efivar_write_file(path, name, buf, len + 4, &ierror);
+
+	/* keep the protection against accidental removal */
+	if (was_immutable)
+		efivar_set_immutable(path, TRUE);
+
+	if (!res) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gint compare_strings(gconstpointer a, gconstpointer b)
+{
+	return g_strcmp0(*(const gchar **) a, *(const gchar **) b);
+}
+
+GPtrArray *r_efivars_list_boot_entries(const gchar *efivarfs, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GDir) dir = NULL;
+	GPtrArray *nums = NULL;
+	const gchar *name;
+
+	g_return_val_if_fail(efivarfs, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	dir = g_dir_open(efivarfs, 0, &ierror);
+	if (!dir) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+
+	nums = g_ptr_array_new_with_free_func(g_free);
+	while ((name = g_dir_read_name(dir))) {
+		/* 'Boot' + 4 hex digits + '-' + GUID */
+		if (strlen(name) != 9 + strlen(EFI_GLOBAL_VARIABLE_GUID))
+			continue;
+		if (!g_str_has_prefix(name, "Boot") || !g_str_has_suffix(name, "-" EFI_GLOBAL_VARIABLE_GUID))
+			continue;
+		if (!g_ascii_isxdigit(name[4]) || !g_ascii_isxdigit(name[5]) ||
+		    !g_ascii_isxdigit(name[6]) || !g_ascii_isxdigit(name[7]))
+			continue;
+
+		g_ptr_array_add(nums, g_ascii_strup(name + 4, 4));
+	}
+
+	g_ptr_array_sort(nums, compare_strings);
+
+	return nums;
+}
+
+gchar *r_efivars_load_option_description(GBytes *option, gboolean *active, GError **error)
+{
+	GError *ierror = NULL;
+	const guint8 *data;
+	g_autofree gunichar2 *description = NULL;
+	gchar *utf8 = NULL;
+	guint32 attributes;
+	gsize len, nchars = 0;
+
+	g_return_val_if_fail(option, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	/* EFI_LOAD_OPTION: UINT32 Attributes, UINT16 FilePathListLength,
+	 * CHAR16 Description[], followed by device paths and optional data */
+	data = g_bytes_get_data(option, &len);
+	if (len < 6) {
+		g_set_error(error, R_EFIVARS_ERROR, R_EFIVARS_ERROR_INVALID,
+				"EFI load option too short");
+		return NULL;
+	}
+
+	memcpy(&attributes, data, 4);
+	if (active)
+		*active = (GUINT32_FROM_LE(attributes) & LOAD_OPTION_ACTIVE) != 0;
+
+	description = g_new0(gunichar2, (len - 6) / 2 + 1);
+	for (gsize pos = 6; pos + 1 < len; pos += 2) {
+		guint16 c;
+
+		memcpy(&c, data + pos, 2);
+		c = GUINT16_FROM_LE(c);
+		if (c == 0)
+			break;
+		description[nchars++] = c;
+	}
+
+	utf8 = g_utf16_to_utf8(description, nchars, NULL, NULL, &ierror);
+	if (!utf8) {
+		g_propagate_prefixed_error(error, ierror, "Invalid EFI load option description: ");
+		return NULL;
+	}
+
+	return utf8;
+}
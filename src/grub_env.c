@@ -0,0 +1,231 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "grub_env.h"
+
+#define GRUB_ENVBLK_SIGNATURE "# GRUB Environment Block\n"
+#define GRUB_ENVBLK_DEFAULT_SIZE 1024
+
+G_DEFINE_QUARK(r-grub-env-error-quark, r_grub_env_error)
+
+struct _RGrubEnv {
+	gchar *path;
+	gsize size;
+	/* variable names in order of appearance, owns the strings */
+	GPtrArray *keys;
+	/* maps names (owned by keys) to values */
+	GHashTable *vars;
+};
+
+static void grub_env_insert(RGrubEnv *env, gchar *key, gchar *value)
+{
+	gchar *existing = NULL;
+
+	if (g_hash_table_lookup_extended(env->vars, key, (gpointer *) &existing, NULL)) {
+		g_hash_table_insert(env->vars, existing, value);
+		g_free(key);
+		return;
+	}
+
+	g_ptr_array_add(env->keys, key);
+	g_hash_table_insert(env->vars, key, value);
+}
+
+/* Parses 'key=value\n' lines, where '\' escapes the following character */
+static gboolean parse_envblk(RGrubEnv *env, const gchar *data, gsize len, GError **error)
+{
+	gsize pos = strlen(GRUB_ENVBLK_SIGNATURE);
+
+	while (pos < len) {
+		g_autoptr(GString) value = NULL;
+		const gchar *sep;
+		gsize keystart = pos;
+
+		/* comments and padding */
+		if (data[pos] == '#' || data[pos] == '\n') {
+			while (pos < len && data[pos] != '\n')
+				pos++;
+			pos++;
+			continue;
+		}
+
+		sep = memchr(data + pos, '=', len - pos);
+		if (!sep || memchr(data + pos, '\n', sep - (data + pos))) {
+			g_set_error(error, R_GRUB_ENV_ERROR, R_GRUB_ENV_ERROR_INVALID,
+					"Invalid entry in %s at offset %" G_GSIZE_FORMAT, env->path, pos);
+			return FALSE;
+		}
+
+		value = g_string_new(NULL);
+		for (pos = sep - data + 1; pos < len && data[pos] != '\n'; pos++) {
+			if (data[pos] == '\\' && pos + 1 < len)
+				pos++;
+			g_string_append_c(value, data[pos]);
+		}
+		pos++;
+
+		grub_env_insert(env, g_strndup(data + keystart, sep - (data + keystart)),
+				g_string_free(g_steal_pointer(&value), FALSE));
+	}
+
+	return TRUE;
+}
+
+RGrubEnv *r_grub_env_load(const gchar *path, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *data = NULL;
+	RGrubEnv *env = NULL;
+	gsize len;
+
+	g_return_val_if_fail(path, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	if (!g_file_get_contents(path, &data, &len, &ierror)) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+
+	if (!g_str_has_prefix(data, GRUB_ENVBLK_SIGNATURE)) {
+		g_set_error(error, R_GRUB_ENV_ERROR, R_GRUB_ENV_ERROR_INVALID,
+				"%s is not a GRUB environment block", path);
+		return NULL;
+	}
+
+	env = g_new0(RGrubEnv, 1);
+	env->path = g_strdup(path);
+	env->size = MAX(len, GRUB_ENVBLK_DEFAULT_SIZE);
+	env->keys = g_ptr_array_new_with_free_func(g_free);
+	env->vars = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+
+	if (!parse_envblk(env, data, len, &ierror)) {
+		g_propagate_error(error, ierror);
+		g_clear_pointer(&env, r_grub_env_free);
+	}
+
+	return env;
+}
+
+const gchar *r_grub_env_get(RGrubEnv *env, const gchar *key)
+{
+	g_return_val_if_fail(env, NULL);
+	g_return_val_if_fail(key, NULL);
+
+	return g_hash_table_lookup(env->vars, key);
+}
+
+void r_grub_env_set(RGrubEnv *env, const gchar *key, const gchar *value)
+{
+	gchar *existing = NULL;
+
+	g_return_if_fail(env);
+	g_return_if_fail(key);
+
+	if (value) {
+		grub_env_insert(env, g_strdup(key), g_strdup(value));
+		return;
+	}
+
+	if (g_hash_table_lookup_extended(env->vars, key, (gpointer *) &existing, NULL)) {
+		g_hash_table_remove(env->vars, key);
+		g_ptr_array_remove(env->keys, existing);
+	}
+}
+
+static gboolean write_all_synced(int fd, const gchar *data, gsize len)
+{
+	while (len > 0) {
+		ssize_t ret = write(fd, data, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		data += ret;
+		len -= ret;
+	}
+
+	return fsync(fd) == 0;
+}
+
+gboolean r_grub_env_save(RGrubEnv *env, GError **error)
+{
+	g_autoptr(GString) block = g_string_new(GRUB_ENVBLK_SIGNATURE);
+	g_autofree gchar *tmppath = NULL;
+	g_autofree gchar *dirname = NULL;
+	int fd, dirfd;
+
+	g_return_val_if_fail(env, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	for (guint i = 0; i < env->keys->len; i++) {
+		const gchar *key = g_ptr_array_index(env->keys, i);
+		const gchar *value = g_hash_table_lookup(env->vars, key);
+
+		g_string_append_printf(block, "%s=", key);
+		for (const gchar *c = value; *c; c++) {
+			if (*c == '\\' || *c == '\n')
+				g_string_append_c(block, '\\');
+			g_string_append_c(block, *c);
+		}
+		g_string_append_c(block, '\n');
+	}
+
+	if (block->len > env->size) {
+		g_set_error(error, R_GRUB_ENV_ERROR, R_GRUB_ENV_ERROR_TOO_LARGE,
+				"Environment exceeds block size of %" G_GSIZE_FORMAT " bytes", env->size);
+		return FALSE;
+	}
+
+	/* pad to original size */
+	while (block->len < env->size)
+		g_string_append_c(block, '#');
+
+	tmppath = g_strconcat(env->path, ".new", NULL);
+	fd = g_open(tmppath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to open %s: %s", tmppath, g_strerror(errno));
+		return FALSE;
+	}
+
+	if (!write_all_synced(fd, block->str, block->len)) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to write %s: %s", tmppath, g_strerror(errno));
+		close(fd);
+		g_remove(tmppath);
+		return FALSE;
+	}
+	close(fd);
+
+	if (g_rename(tmppath, env->path) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to rename %s: %s", tmppath, g_strerror(errno));
+		g_remove(tmppath);
+		return FALSE;
+	}
+
+	/* make the rename itself persistent */
+	dirname = g_path_get_dirname(env->path);
+	dirfd = g_open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+	if (dirfd >= 0) {
+		fsync(dirfd);
+		close(dirfd);
+	}
+
+	return TRUE;
+}
+
+void r_grub_env_free(RGrubEnv *env)
+{
+	if (!env)
+		return;
+
+	g_free(env->path);
+	g_clear_pointer(&env->vars, g_hash_table_destroy);
+	g_clear_pointer(&env->keys, g_ptr_array_unref);
+	g_free(env);
+}
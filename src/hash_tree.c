@@ -0,0 +1,351 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "hash_tree.h"
+
+#define DIGEST_SIZE 32
+/* leaves hashed by one thread pool task */
+#define LEAVES_PER_TASK 16
+
+typedef struct {
+	int fd;
+	const gchar *filename;
+	guint64 size;
+	guint32 leaf_size;
+	guint8 *digests;
+	GMutex lock;
+	GError *error;
+} HashJob;
+
+static guint leaf_count(guint64 size, guint32 leaf_size)
+{
+	return (size + leaf_size - 1) / leaf_size;
+}
+
+static gboolean pread_full(int fd, guint8 *buf, gsize len, guint64 offset, const gchar *filename, GError **error)
+{
+	gsize done = 0;
+
+	while (done < len) {
+		ssize_t ret = pread(fd, buf + done, len - done, offset + done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+					"Failed reading %s at offset %" G_GUINT64_FORMAT ": %s",
+					filename, offset + done, g_strerror(errno));
+			return FALSE;
+		} else if (ret == 0) {
+			g_set_error(error, R_CHECKSUM_ERROR, R_CHECKSUM_ERROR_SIZE_MISMATCH,
+					"%s ended at offset %" G_GUINT64_FORMAT,
+					filename, offset + done);
+			return FALSE;
+		}
+		done += ret;
+	}
+
+	return TRUE;
+}
+
+static void hash_leaves_worker(gpointer data, gpointer user_data)
+{
+	HashJob *job = user_data;
+	guint first = GPOINTER_TO_UINT(data) - 1;
+	guint last = MIN(first + LEAVES_PER_TASK, leaf_count(job->size, job->leaf_size));
+	g_autofree guint8 *buf = g_malloc(job->leaf_size);
+	GError *ierror = NULL;
+
+	for (guint i = first; i < last; i++) {
+		guint64 offset = (guint64) i * job->leaf_size;
+		gsize len = MIN(job->leaf_size, job->size - offset);
+		gsize digest_len = DIGEST_SIZE;
+		g_autoptr(GChecksum) ctx = NULL;
+
+		if (!pread_full(job->fd, buf, len, offset, job->filename, &ierror)) {
+			g_mutex_lock(&job->lock);
+			if (!job->error)
+				job->error = ierror;
+			else
+				g_clear_error(&ierror);
+			g_mutex_unlock(&job->lock);
+			return;
+		}
+
+		ctx = g_checksum_new(G_CHECKSUM_SHA256);
+		g_checksum_update(ctx, buf, len);
+		g_checksum_get_digest(ctx, job->digests + (gsize) i * DIGEST_SIZE, &digest_len);
+	}
+}
+
+/* Hashes all leaves of filename into digests using one thread per CPU */
+static gboolean hash_leaves(const gchar *filename, guint64 size, guint32 leaf_size,
+		guint8 *digests, GError **error)
+{
+	GError *ierror = NULL;
+	GThreadPool *pool;
+	HashJob job = {
+		.filename = filename,
+		.size = size,
+		.leaf_size = leaf_size,
+		.digests = digests,
+	};
+	guint count = leaf_count(size, leaf_size);
+
+	job.fd = g_open(filename, O_RDONLY | O_CLOEXEC, 0);
+	if (job.fd < 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to open %s: %s", filename, g_strerror(errno));
+		return FALSE;
+	}
+
+	/* read what is stored, not what is cached */
+	posix_fadvise(job.fd, 0, 0, POSIX_FADV_DONTNEED);
+
+	g_mutex_init(&job.lock);
+	pool = g_thread_pool_new(hash_leaves_worker, &job, g_get_num_processors(), FALSE, &ierror);
+	if (!pool) {
+		g_propagate_error(error, ierror);
+		g_mutex_clear(&job.lock);
+		close(job.fd);
+		return FALSE;
+	}
+
+	for (guint i = 0; i < count; i += LEAVES_PER_TASK)
+		g_thread_pool_push(pool, GUINT_TO_POINTER(i + 1), NULL);
+
+	/* wait for all tasks */
+	g_thread_pool_free(pool, FALSE, TRUE);
+	g_mutex_clear(&job.lock);
+	close(job.fd);
+
+	if (job.error) {
+		g_propagate_error(error, job.error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+RaucHashTree *r_hash_tree_compute(const gchar *filename, guint64 size,
+		guint32 leaf_size, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(RaucHashTree) tree = NULL;
+	gsize len;
+	guint8 *digests;
+
+	g_return_val_if_fail(filename, NULL);
+	g_return_val_if_fail(leaf_size > 0, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	len = (gsize) leaf_count(size, leaf_size) * DIGEST_SIZE;
+	digests = g_malloc(len);
+	if (!hash_leaves(filename, size, leaf_size, digests, &ierror)) {
+		g_free(digests);
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+
+	tree = g_new0(RaucHashTree, 1);
+	tree->size = size;
+	tree->leaf_size = leaf_size;
+	tree->leaves = g_bytes_new_take(digests, len);
+
+	return g_steal_pointer(&tree);
+}
+
+struct _RaucHashTreeBuilder {
+	guint64 size;
+	guint32 leaf_size;
+	/* bytes already hashed into the current leaf */
+	guint32 leaf_fill;
+	GChecksum *ctx;
+	GByteArray *leaves;
+};
+
+RaucHashTreeBuilder *r_hash_tree_builder_new(guint32 leaf_size)
+{
+	RaucHashTreeBuilder *builder;
+
+	g_return_val_if_fail(leaf_size > 0, NULL);
+
+	builder = g_new0(RaucHashTreeBuilder, 1);
+	builder->leaf_size = leaf_size;
+	builder->ctx = g_checksum_new(G_CHECKSUM_SHA256);
+	builder->leaves = g_byte_array_new();
+
+	return builder;
+}
+
+static void builder_end_leaf(RaucHashTreeBuilder *builder)
+{
+	guint8 digest[DIGEST_SIZE];
+	gsize digest_len = DIGEST_SIZE;
+
+	g_checksum_get_digest(builder->ctx, digest, &digest_len);
+	g_byte_array_append(builder->leaves, digest, DIGEST_SIZE);
+	g_checksum_reset(builder->ctx);
+	builder->leaf_fill = 0;
+}
+
+void r_hash_tree_builder_update(RaucHashTreeBuilder *builder, const guint8 *data, gsize len)
+{
+	g_return_if_fail(builder);
+	g_return_if_fail(builder->leaves);
+	g_return_if_fail(data || len == 0);
+
+	builder->size += len;
+	while (len > 0) {
+		gsize chunk = MIN(len, (gsize) (builder->leaf_size - builder->leaf_fill));
+
+		g_checksum_update(builder->ctx, data, chunk);
+		builder->leaf_fill += chunk;
+		data += chunk;
+		len -= chunk;
+
+		if (builder->leaf_fill == builder->leaf_size)
+			builder_end_leaf(builder);
+	}
+}
+
+RaucHashTree *r_hash_tree_builder_end(RaucHashTreeBuilder *builder)
+{
+	RaucHashTree *tree;
+
+	g_return_val_if_fail(builder, NULL);
+	g_return_val_if_fail(builder->leaves, NULL);
+
+	/* the last leaf may be shorter */
+	if (builder->leaf_fill > 0)
+		builder_end_leaf(builder);
+
+	tree = g_new0(RaucHashTree, 1);
+	tree->size = builder->size;
+	tree->leaf_size = builder->leaf_size;
+	tree->leaves = g_byte_array_free_to_bytes(builder->leaves);
+	builder->leaves = NULL;
+
+	return tree;
+}
+
+void r_hash_tree_builder_free(RaucHashTreeBuilder *builder)
+{
+	if (!builder)
+		return;
+
+	g_checksum_free(builder->ctx);
+	if (builder->leaves)
+		g_byte_array_free(builder->leaves, TRUE);
+	g_free(builder);
+}
+
+guint r_hash_tree_leaf_count(const RaucHashTree *tree)
+{
+	g_return_val_if_fail(tree, 0);
+
+	return leaf_count(tree->size, tree->leaf_size);
+}
+
+gchar *r_hash_tree_get_root(const RaucHashTree *tree)
+{
+	g_return_val_if_fail(tree, NULL);
+
+	return g_compute_checksum_for_bytes(G_CHECKSUM_SHA256, tree->leaves);
+}
+
+gboolean r_hash_tree_check(const RaucHashTree *tree, const gchar *filename,
+		GArray **mismatches, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree guint8 *digests = NULL;
+	const guint8 *expected;
+	guint count;
+
+	g_return_val_if_fail(tree, FALSE);
+	g_return_val_if_fail(filename, FALSE);
+	g_return_val_if_fail(mismatches != NULL && *mismatches == NULL, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	count = r_hash_tree_leaf_count(tree);
+	digests = g_malloc((gsize) count * DIGEST_SIZE);
+	if (!hash_leaves(filename, tree->size, tree->leaf_size, digests, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	expected = g_bytes_get_data(tree->leaves, NULL);
+	*mismatches = g_array_new(FALSE, FALSE, sizeof(guint));
+	for (guint i = 0; i < count; i++) {
+		if (memcmp(digests + (gsize) i * DIGEST_SIZE, expected + (gsize) i * DIGEST_SIZE, DIGEST_SIZE) != 0)
+			g_array_append_val(*mismatches, i);
+	}
+
+	return TRUE;
+}
+
+gboolean r_hash_tree_save(const RaucHashTree *tree, const gchar *path, GError **error)
+{
+	gconstpointer data;
+	gsize len;
+
+	g_return_val_if_fail(tree, FALSE);
+	g_return_val_if_fail(path, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	data = g_bytes_get_data(tree->leaves, &len);
+
+	return g_file_set_contents(path, data, len, error);
+}
+
+RaucHashTree *r_hash_tree_load(const gchar *path, guint64 size, guint32 leaf_size,
+		const gchar *root, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(RaucHashTree) tree = NULL;
+	g_autofree gchar *digest = NULL;
+	gchar *data = NULL;
+	gsize len;
+
+	g_return_val_if_fail(path, NULL);
+	g_return_val_if_fail(leaf_size > 0, NULL);
+	g_return_val_if_fail(root, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	if (!g_file_get_contents(path, &data, &len, &ierror)) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+
+	tree = g_new0(RaucHashTree, 1);
+	tree->size = size;
+	tree->leaf_size = leaf_size;
+	tree->leaves = g_bytes_new_take(data, len);
+
+	if (len != (gsize) leaf_count(size, leaf_size) * DIGEST_SIZE) {
+		g_set_error(error, R_CHECKSUM_ERROR, R_CHECKSUM_ERROR_SIZE_MISMATCH,
+				"Hash tree %s has unexpected size %" G_GSIZE_FORMAT, path, len);
+		return NULL;
+	}
+
+	digest = r_hash_tree_get_root(tree);
+	if (g_strcmp0(digest, root) != 0) {
+		g_set_error(error, R_CHECKSUM_ERROR, R_CHECKSUM_ERROR_DIGEST_MISMATCH,
+				"Root digest of hash tree %s does not match", path);
+		return NULL;
+	}
+
+	return g_steal_pointer(&tree);
+}
+
+void r_hash_tree_free(RaucHashTree *tree)
+{
+	if (!tree)
+		return;
+
+	g_clear_pointer(&tree->leaves, g_bytes_unref);
+	g_free(tree);
+}
@@ -0,0 +1,142 @@
+#include <errno.h>
+#include <gio/gio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "hook_server.h"
+
+G_DEFINE_QUARK(r-hook-error-quark, r_hook_error)
+
+struct _RaucHookServer {
+	GSubprocess *sproc;
+	/* our end of the hook server's stdin socket */
+	int requests;
+	GDataInputStream *replies;
+};
+
+RaucHookServer *r_hook_server_start(const gchar *hook_name, gchar **env, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GSubprocessLauncher) launcher = NULL;
+	RaucHookServer *server;
+	GSubprocess *sproc;
+	int sockets[2];
+
+	g_return_val_if_fail(hook_name, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	/* Requests are sent over a socket instead of a pipe, so that writing to
+	 * an exited hook server can use MSG_NOSIGNAL and fails with EPIPE
+	 * instead of raising SIGPIPE. */
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) < 0) {
+		g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+				"failed to create hook server socket: %s", g_strerror(errno));
+		return NULL;
+	}
+
+	launcher = g_subprocess_launcher_new(G_SUBPROCESS_FLAGS_STDOUT_PIPE);
+	if (env)
+		g_subprocess_launcher_set_environ(launcher, env);
+	g_subprocess_launcher_take_stdin_fd(launcher, sockets[1]);
+
+	sproc = g_subprocess_launcher_spawn(launcher, &ierror, hook_name, "server", NULL);
+	if (sproc == NULL) {
+		g_propagate_prefixed_error(error, ierror, "failed to start hook server: ");
+		close(sockets[0]);
+		return NULL;
+	}
+
+	server = g_new0(RaucHookServer, 1);
+	server->sproc = sproc;
+	server->requests = sockets[0];
+	server->replies = g_data_input_stream_new(g_subprocess_get_stdout_pipe(sproc));
+
+	return server;
+}
+
+gboolean r_hook_server_call(RaucHookServer *server, const gchar *hook_cmd, gchar **vars, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GString) request = NULL;
+	g_autofree gchar *reply = NULL;
+	gsize sent = 0;
+
+	g_return_val_if_fail(server, FALSE);
+	g_return_val_if_fail(hook_cmd, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	request = g_string_new(hook_cmd);
+	g_string_append_c(request, '\n');
+	for (gchar **var = vars; var && *var; var++) {
+		/* each variable must fit in a single line */
+		if (strchr(*var, '\n')) {
+			g_set_error(error, R_HOOK_ERROR, R_HOOK_ERROR_PROTOCOL,
+					"Cannot pass value with newline to hook server: %s", *var);
+			return FALSE;
+		}
+		g_string_append(request, *var);
+		g_string_append_c(request, '\n');
+	}
+	g_string_append_c(request, '\n');
+
+	while (sent < request->len) {
+		ssize_t ret = send(server->requests, request->str + sent, request->len - sent, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+					"failed to send request to hook server: %s", g_strerror(errno));
+			return FALSE;
+		}
+		sent += ret;
+	}
+
+	reply = g_data_input_stream_read_line(server->replies, NULL, NULL, &ierror);
+	if (reply == NULL) {
+		if (ierror)
+			g_propagate_prefixed_error(error, ierror, "failed to read reply of hook server: ");
+		else
+			g_set_error(error, R_HOOK_ERROR, R_HOOK_ERROR_PROTOCOL,
+					"hook server exited without reply to %s", hook_cmd);
+		return FALSE;
+	}
+
+	if (g_strcmp0(reply, "ok") == 0)
+		return TRUE;
+
+	if (g_str_has_prefix(reply, "reject "))
+		g_set_error(error, R_HOOK_ERROR, R_HOOK_ERROR_REJECTED,
+				"%s", reply + strlen("reject "));
+	else if (g_str_has_prefix(reply, "error "))
+		g_set_error(error, R_HOOK_ERROR, R_HOOK_ERROR_FAILED,
+				"%s", reply + strlen("error "));
+	else
+		g_set_error(error, R_HOOK_ERROR, R_HOOK_ERROR_PROTOCOL,
+				"invalid reply of hook server: %s", reply);
+
+	return FALSE;
+}
+
+gboolean r_hook_server_stop(RaucHookServer *server, GError **error)
+{
+	GError *ierror = NULL;
+	gboolean res;
+
+	g_return_val_if_fail(server, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	/* end of input tells the hook server to exit */
+	shutdown(server->requests, SHUT_WR);
+	close(server->requests);
+
+	res = g_subprocess_wait_check(server->sproc, NULL, &ierror);
+	if (!res)
+		g_propagate_prefixed_error(error, ierror, "hook server failed: ");
+
+	g_object_unref(server->replies);
+	g_object_unref(server->sproc);
+	g_free(server);
+
+	return res;
+}
@@ -2,6 +2,7 @@
 #include <fcntl.h>
 #include <gio/gfiledescriptorbased.h>
 #include <gio/gio.h>
+#include <gio/gunixinputstream.h>
 #include <gio/gunixmounts.h>
 #include <gio/gunixoutputstream.h>
 #include <glib.h>
@@ -9,12 +10,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "bootchooser.h"
 #include "bundle.h"
 #include "context.h"
+#include "hash_tree.h"
+#include "hook_server.h"
 #include "install.h"
 #include "manifest.h"
 #include "mark.h"
@@ -28,6 +33,11 @@
 /* All exit codes of hook script above this mean 'rejected' */
 #define INSTALL_HOOK_REJECT_CODE 10
 
+/* file descriptor of the custom handler protocol channel in the handler */
+#define HANDLER_PROTOCOL_FD 3
+/* time a handler gets to exit after a cancel request */
+#define HANDLER_CANCEL_TIMEOUT (10 * G_USEC_PER_SEC)
+
 #define R_INSTALL_ERROR r_install_error_quark()
 
 GQuark r_install_error_quark(void)
@@ -178,14 +188,17 @@ gboolean determine_boot_states(GError **error)
 	gchar *name;
 	GError *ierror = NULL;
 
-	/* get boot state */
+	/* get boot state, reading the bootloader state only once */
+	r_boot_transaction_begin();
 	g_hash_table_iter_init(&iter, r_context()->config->slots);
 	while (g_hash_table_iter_next(&iter, (gpointer*) &name, (gpointer*) &slot)) {
 		if (slot->bootname && !r_boot_get_state(slot, &slot->boot_good, &ierror)) {
+			r_boot_transaction_abort();
 			g_propagate_error(error, ierror);
 			return FALSE;
 		}
 	}
+	r_boot_transaction_abort();
 
 	return TRUE;
 }
@@ -486,7 +499,58 @@ out:
 	return install_images;
 }
 
-static void parse_handler_output(gchar* line)
+/* state of the progress reported by a custom handler */
+typedef struct {
+	/* step the handler reports progress for, NULL to ignore progress */
+	const gchar *step;
+	/* image of the running byte accounting, NULL if none */
+	gchar *image;
+	guint64 bytes_done;
+	gint64 start_time;
+} HandlerProgress;
+
+static void handler_progress_end_image(HandlerProgress *progress)
+{
+	gdouble seconds;
+
+	if (!progress->image)
+		return;
+
+	r_context_end_bytes();
+
+	seconds = (g_get_monotonic_time() - progress->start_time) / (gdouble) G_USEC_PER_SEC;
+	g_message("Handler wrote %" G_GUINT64_FORMAT " bytes of image '%s' in %.1f s (%.1f MiB/s)",
+			progress->bytes_done, progress->image, seconds,
+			seconds > 0 ? progress->bytes_done / seconds / (1024 * 1024) : 0);
+
+	g_clear_pointer(&progress->image, g_free);
+}
+
+static void handler_progress_bytes(HandlerProgress *progress, const gchar *image, guint64 done, guint64 total)
+{
+	if (!progress->step)
+		return;
+
+	if (g_strcmp0(progress->image, image) != 0) {
+		handler_progress_end_image(progress);
+		progress->image = g_strdup(image);
+		progress->bytes_done = 0;
+		progress->start_time = g_get_monotonic_time();
+		r_context_begin_bytes(total);
+	} else {
+		r_context_set_bytes_total(total);
+	}
+
+	if (done > progress->bytes_done) {
+		r_context_add_bytes(done - progress->bytes_done);
+		progress->bytes_done = done;
+	}
+
+	if (total && done >= total)
+		handler_progress_end_image(progress);
+}
+
+static void parse_handler_output(gchar* line, HandlerProgress *progress)
 {
 	g_auto(GStrv) split = NULL;
 
@@ -510,6 +574,30 @@ static void parse_handler_output(gchar* line)
 		g_print("error: '%s'\n", split[2]);
 	} else if (g_strcmp0(split[1], "bootloader") == 0) {
 		g_print("error: '%s'\n", split[2]);
+	} else if (g_strcmp0(split[1], "progress") == 0 && split[2]) {
+		const RaucProgressStep *step;
+		gint percent = CLAMP(g_ascii_strtoll(split[2], NULL, 10), 0, 99);
+
+		if (!progress->step)
+			return;
+
+		/* progress must not go backwards (byte counts may have advanced
+		 * it already), 100% is set when the handler exits */
+		step = &r_context()->progress[r_context()->progress_depth - 1];
+		if (percent > step->last_explicit_percent)
+			r_context_set_step_percentage(progress->step, percent);
+	} else if (g_strcmp0(split[1], "phase") == 0 && split[2]) {
+		g_autofree gchar *phase = g_strjoinv(" ", &split[2]);
+
+		g_message("Handler phase: %s", phase);
+		if (progress->step) {
+			g_autofree gchar *description = g_strdup_printf("Update handler: %s", phase);
+			r_context_set_step_description(progress->step, description);
+		}
+	} else if (g_strcmp0(split[1], "bytes") == 0 && split[2] && split[3] && split[4]) {
+		handler_progress_bytes(progress, split[2],
+				g_ascii_strtoull(split[3], NULL, 10),
+				g_ascii_strtoull(split[4], NULL, 10));
 	} else {
 		g_print("Unknown command: %s\n", split[1]);
 	}
@@ -530,13 +618,21 @@ static gboolean verify_compatible(RaucManifest *manifest)
 	}
 }
 
+static void setenv_indexed(GSubprocessLauncher *launcher, const gchar *prefix, gint index, const gchar *value)
+{
+	gchar varname[64];
+
+	g_snprintf(varname, sizeof(varname), "%s_%i", prefix, index);
+	g_subprocess_launcher_setenv(launcher, varname, value, TRUE);
+}
+
 static void prepare_environment(GSubprocessLauncher *launcher, gchar *update_source, RaucManifest *manifest, GHashTable *target_group)
 {
 	GHashTableIter iter;
 	RaucSlot *slot;
 	gint slotcnt = 0;
-	g_autofree gchar *targetlist = NULL;
-	g_autofree gchar *slotlist = NULL;
+	g_autoptr(GString) targetlist = g_string_new(NULL);
+	g_autoptr(GString) slotlist = g_string_new(NULL);
 
 	g_subprocess_launcher_setenv(launcher, "RAUC_SYSTEM_CONFIG", r_context()->configpath, TRUE);
 	g_subprocess_launcher_setenv(launcher, "RAUC_CURRENT_BOOTNAME", r_context()->bootslot, TRUE);
@@ -545,91 +641,132 @@ static void prepare_environment(GSubprocessLauncher *launcher, gchar *update_sou
 
 	g_hash_table_iter_init(&iter, r_context()->config->slots);
 	while (g_hash_table_iter_next(&iter, NULL, (gpointer*) &slot)) {
-		gchar *varname;
-		gchar *tmp;
-		GHashTableIter iiter;
-		gpointer member;
-
 		slotcnt++;
 
-		tmp = g_strdup_printf("%s%i ", slotlist ? slotlist : "", slotcnt);
-		g_clear_pointer(&slotlist, g_free);
-		slotlist = tmp;
-
-		g_hash_table_iter_init(&iiter, target_group);
-		while (g_hash_table_iter_next(&iiter, NULL, &member)) {
-			if (slot != member) {
-				continue;
-			}
+		g_string_append_printf(slotlist, "%i ", slotcnt);
 
+		/* target group maps slot classes to target slots */
+		if (g_hash_table_lookup(target_group, slot->sclass) == slot) {
 			/* for target slots, get image name and add number to list */
 			for (GList *l = manifest->images; l != NULL; l = l->next) {
 				RaucImage *img = l->data;
 				if (g_str_equal(slot->sclass, img->slotclass)) {
-					varname = g_strdup_printf("RAUC_IMAGE_NAME_%i", slotcnt);
-					g_subprocess_launcher_setenv(launcher, varname, img->filename, TRUE);
-					g_clear_pointer(&varname, g_free);
-
-					varname = g_strdup_printf("RAUC_IMAGE_DIGEST_%i", slotcnt);
-					g_subprocess_launcher_setenv(launcher, varname, img->checksum.digest, TRUE);
-					g_clear_pointer(&varname, g_free);
-
-					varname = g_strdup_printf("RAUC_IMAGE_CLASS_%i", slotcnt);
-					g_subprocess_launcher_setenv(launcher, varname, img->slotclass, TRUE);
-					g_clear_pointer(&varname, g_free);
-
+					setenv_indexed(launcher, "RAUC_IMAGE_NAME", slotcnt, img->filename);
+					setenv_indexed(launcher, "RAUC_IMAGE_DIGEST", slotcnt, img->checksum.digest);
+					setenv_indexed(launcher, "RAUC_IMAGE_CLASS", slotcnt, img->slotclass);
 					break;
 				}
 			}
 
-			tmp = g_strdup_printf("%s%i ", targetlist ? targetlist : "", slotcnt);
-			g_clear_pointer(&targetlist, g_free);
-			targetlist = tmp;
+			g_string_append_printf(targetlist, "%i ", slotcnt);
 		}
 
-		varname = g_strdup_printf("RAUC_SLOT_NAME_%i", slotcnt);
-		g_subprocess_launcher_setenv(launcher, varname, slot->name, TRUE);
-		g_clear_pointer(&varname, g_free);
+		setenv_indexed(launcher, "RAUC_SLOT_NAME", slotcnt, slot->name);
+		setenv_indexed(launcher, "RAUC_SLOT_CLASS", slotcnt, slot->sclass);
+		setenv_indexed(launcher, "RAUC_SLOT_TYPE", slotcnt, slot->type);
+		setenv_indexed(launcher, "RAUC_SLOT_DEVICE", slotcnt, slot->device);
+		setenv_indexed(launcher, "RAUC_SLOT_BOOTNAME", slotcnt, slot->bootname ? slot->bootname : "");
+		setenv_indexed(launcher, "RAUC_SLOT_PARENT", slotcnt, slot->parent ? slot->parent->name : "");
+	}
+
+	g_subprocess_launcher_setenv(launcher, "RAUC_SLOTS", slotlist->str, TRUE);
+	g_subprocess_launcher_setenv(launcher, "RAUC_TARGET_SLOTS", targetlist->str, TRUE);
+}
+
+/* Builds the environment shared by all hooks of an installation */
+static gchar **prepare_hook_environment(RaucManifest *manifest)
+{
+	gchar **env = g_get_environ();
+
+	env = g_environ_setenv(env, "RAUC_SYSTEM_COMPATIBLE", r_context()->config->system_compatible, TRUE);
+	env = g_environ_setenv(env, "RAUC_MF_COMPATIBLE", manifest->update_compatible, TRUE);
+	env = g_environ_setenv(env, "RAUC_MF_VERSION", manifest->update_version ?: "", TRUE);
+	env = g_environ_setenv(env, "RAUC_MOUNT_PREFIX", r_context()->config->mount_prefix, TRUE);
 
-		varname = g_strdup_printf("RAUC_SLOT_CLASS_%i", slotcnt);
-		g_subprocess_launcher_setenv(launcher, varname, slot->sclass, TRUE);
-		g_clear_pointer(&varname, g_free);
+	if (r_context()->install_info->mounted_bundle) {
+		g_auto(GStrv) hashes = NULL;
+		g_autofree gchar *string = NULL;
+
+		hashes = get_pubkey_hashes(r_context()->install_info->mounted_bundle->verified_chain);
+		string = g_strjoinv(" ", hashes);
+		env = g_environ_setenv(env, "RAUC_BUNDLE_SPKI_HASHES", string, FALSE);
+	}
 
-		varname = g_strdup_printf("RAUC_SLOT_TYPE_%i", slotcnt);
-		g_subprocess_launcher_setenv(launcher, varname, slot->type, TRUE);
-		g_clear_pointer(&varname, g_free);
+	return env;
+}
+
+/* Reads from a handler output channel and parses all complete lines */
+static gboolean read_handler_lines(int fd, GString *buf, HandlerProgress *progress, gboolean *eof, GError **error)
+{
+	gchar chunk[4096];
+	gchar *newline;
+	ssize_t len;
 
-		varname = g_strdup_printf("RAUC_SLOT_DEVICE_%i", slotcnt);
-		g_subprocess_launcher_setenv(launcher, varname, slot->device, TRUE);
-		g_clear_pointer(&varname, g_free);
+	len = read(fd, chunk, sizeof(chunk));
+	if (len < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return TRUE;
+		g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+				"Failed to read handler output: %s", g_strerror(errno));
+		return FALSE;
+	}
 
-		varname = g_strdup_printf("RAUC_SLOT_BOOTNAME_%i", slotcnt);
-		g_subprocess_launcher_setenv(launcher, varname, slot->bootname ? slot->bootname : "", TRUE);
-		g_clear_pointer(&varname, g_free);
+	g_string_append_len(buf, chunk, len);
+	while ((newline = memchr(buf->str, '\n', buf->len))) {
+		*newline = '\0';
+		parse_handler_output(buf->str, progress);
+		g_string_erase(buf, 0, newline - buf->str + 1);
+	}
 
-		varname = g_strdup_printf("RAUC_SLOT_PARENT_%i", slotcnt);
-		g_subprocess_launcher_setenv(launcher, varname, slot->parent ? slot->parent->name : "", TRUE);
-		g_clear_pointer(&varname, g_free);
+	if (len == 0) {
+		/* unterminated last line */
+		if (buf->len)
+			parse_handler_output(buf->str, progress);
+		g_string_truncate(buf, 0);
+		*eof = TRUE;
 	}
 
-	g_subprocess_launcher_setenv(launcher, "RAUC_SLOTS", slotlist, TRUE);
-	g_subprocess_launcher_setenv(launcher, "RAUC_TARGET_SLOTS", targetlist, TRUE);
+	return TRUE;
 }
 
-static gboolean launch_and_wait_handler(gchar *update_source, gchar *handler_name, RaucManifest *manifest, GHashTable *target_group, GError **error)
+/* Runs a handler, progress reported by it is accounted to progress_step
+ * (which must not have substeps) if not NULL */
+static gboolean launch_and_wait_handler(gchar *update_source, gchar *handler_name, RaucManifest *manifest, GHashTable *target_group, const gchar *progress_step, GError **error)
 {
 	g_autoptr(GSubprocessLauncher) handlelaunch = NULL;
 	g_autoptr(GSubprocess) handleproc = NULL;
+	g_autoptr(GString) outbuf = g_string_new(NULL);
+	g_autoptr(GString) protobuf = g_string_new(NULL);
+	GCancellable *cancellable = r_context()->install_info->cancellable;
+	HandlerProgress progress = {
+		.step = progress_step,
+	};
 	GError *ierror = NULL;
 	gboolean res = FALSE;
-	GInputStream *instream = NULL;
-	GDataInputStream *datainstream = NULL;
-	gchar *outline;
+	gboolean out_eof = FALSE, proto_eof = FALSE;
+	gboolean cancel_pollable = FALSE;
+	gint64 cancel_deadline = 0;
+	GPollFD fds[3] = {{0}};
+	int sockets[2] = {-1, -1};
+	g_autofree gchar *call = NULL;
+	RaucTraceEvent *trace = NULL;
+
+	/* bidirectional protocol channel, see RAUC_HANDLER_FD */
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) < 0) {
+		g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+				"Failed to create handler protocol socket: %s", g_strerror(errno));
+		goto out;
+	}
 
 	handlelaunch = g_subprocess_launcher_new(G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDERR_MERGE);
 
 	prepare_environment(handlelaunch, update_source, manifest, target_group);
+	g_subprocess_launcher_setenv(handlelaunch, "RAUC_HANDLER_FD", G_STRINGIFY(HANDLER_PROTOCOL_FD), TRUE);
+	g_subprocess_launcher_take_fd(handlelaunch, sockets[1], HANDLER_PROTOCOL_FD);
+	sockets[1] = -1;
 
+	call = g_strjoin(" ", handler_name, manifest->handler_args, NULL);
+	trace = r_context_trace_begin("subprocess", handler_name, call);
 	handleproc = g_subprocess_launcher_spawn(
 			handlelaunch, &ierror,
 			handler_name,
@@ -640,20 +777,67 @@ static gboolean launch_and_wait_handler(gchar *update_source, gchar *handler_nam
 		goto out;
 	}
 
-	instream = g_subprocess_get_stdout_pipe(handleproc);
-	datainstream = g_data_input_stream_new(instream);
+	/* drop our copy of the handler's end to see EOF once it exits */
+	g_clear_object(&handlelaunch);
+
+	fds[0].fd = g_unix_input_stream_get_fd(G_UNIX_INPUT_STREAM(g_subprocess_get_stdout_pipe(handleproc)));
+	fds[0].events = G_IO_IN;
+	fds[1].fd = sockets[0];
+	fds[1].events = G_IO_IN;
+	if (cancellable)
+		cancel_pollable = g_cancellable_make_pollfd(cancellable, &fds[2]);
+	if (!cancel_pollable)
+		fds[2].fd = -1;
+
+	while (!out_eof || !proto_eof) {
+		gint timeout = -1;
+
+		/* give a cancelled handler some time to clean up */
+		if (cancel_deadline) {
+			timeout = MAX(cancel_deadline - g_get_monotonic_time(), 0) / 1000;
+			if (timeout == 0) {
+				g_message("Handler did not exit after cancel request");
+				break;
+			}
+		}
 
-	do {
-		outline = g_data_input_stream_read_line(datainstream, NULL, NULL, NULL);
-		if (!outline)
-			continue;
+		if (g_poll(fds, G_N_ELEMENTS(fds), timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			g_set_error(&ierror, G_IO_ERROR, g_io_error_from_errno(errno),
+					"Failed to wait for handler output: %s", g_strerror(errno));
+			break;
+		}
 
-		parse_handler_output(outline);
+		if (fds[2].revents) {
+			g_message("Requesting handler to cancel");
+			if (send(sockets[0], "cancel\n", 7, MSG_NOSIGNAL) < 0)
+				g_debug("Failed to send cancel request: %s", g_strerror(errno));
+			cancel_deadline = g_get_monotonic_time() + HANDLER_CANCEL_TIMEOUT;
+			fds[2].fd = -1;
+		}
 
-		g_free(outline);
-	} while (outline);
+		if (fds[0].revents && !read_handler_lines(fds[0].fd, outbuf, &progress, &out_eof, &ierror))
+			break;
+		if (out_eof)
+			fds[0].fd = -1;
+
+		if (fds[1].revents && !read_handler_lines(fds[1].fd, protobuf, &progress, &proto_eof, &ierror))
+			break;
+		if (proto_eof)
+			fds[1].fd = -1;
+	}
+
+	handler_progress_end_image(&progress);
+
+	if (ierror) {
+		g_subprocess_force_exit(handleproc);
+		g_subprocess_wait(handleproc, NULL, NULL);
+		g_propagate_error(error, ierror);
+		goto out;
+	}
 
-	res = g_subprocess_wait_check(handleproc, NULL, &ierror);
+	res = install_subprocess_wait_check(handleproc, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
 		goto out;
@@ -662,6 +846,13 @@ static gboolean launch_and_wait_handler(gchar *update_source, gchar *handler_nam
 	res = TRUE;
 
 out:
+	r_context_trace_end(trace, res);
+	if (cancel_pollable)
+		g_cancellable_release_fd(cancellable);
+	if (sockets[0] >= 0)
+		close(sockets[0]);
+	if (sockets[1] >= 0)
+		close(sockets[1]);
 	return res;
 }
 
@@ -675,19 +866,37 @@ static gboolean run_bundle_hook(RaucManifest *manifest, gchar* bundledir, const
 	GDataInputStream *datainstream = NULL;
 	gboolean res = FALSE;
 	gchar *outline, *hookreturnmsg = NULL;
+	RaucTraceEvent *trace = NULL;
 
 	g_assert_nonnull(manifest->hook_name);
 
 	hook_name = g_build_filename(bundledir, manifest->hook_name, NULL);
 
 	g_message("Running bundle hook %s", hook_cmd);
+	trace = r_context_trace_begin("hook", hook_cmd, hook_name);
+
+	if (r_context()->install_info->hook_server) {
+		res = r_hook_server_call(r_context()->install_info->hook_server, hook_cmd, NULL, &ierror);
+		if (g_error_matches(ierror, R_HOOK_ERROR, R_HOOK_ERROR_REJECTED)) {
+			g_set_error(error, R_INSTALL_ERROR, R_INSTALL_ERROR_REJECTED,
+					"Hook returned: %s", ierror->message);
+			g_clear_error(&ierror);
+		} else if (!res) {
+			g_propagate_prefixed_error(error, ierror, "failed to run bundle hook: ");
+		}
+		goto out;
+	}
 
 	launcher = g_subprocess_launcher_new(G_SUBPROCESS_FLAGS_STDERR_PIPE);
 
-	g_subprocess_launcher_setenv(launcher, "RAUC_SYSTEM_COMPATIBLE", r_context()->config->system_compatible, TRUE);
-	g_subprocess_launcher_setenv(launcher, "RAUC_MF_COMPATIBLE", manifest->update_compatible, TRUE);
-	g_subprocess_launcher_setenv(launcher, "RAUC_MF_VERSION", manifest->update_version ?: "", TRUE);
-	g_subprocess_launcher_setenv(launcher, "RAUC_MOUNT_PREFIX", r_context()->config->mount_prefix, TRUE);
+	if (r_context()->install_info->hook_env) {
+		g_subprocess_launcher_set_environ(launcher, r_context()->install_info->hook_env);
+	} else {
+		g_subprocess_launcher_setenv(launcher, "RAUC_SYSTEM_COMPATIBLE", r_context()->config->system_compatible, TRUE);
+		g_subprocess_launcher_setenv(launcher, "RAUC_MF_COMPATIBLE", manifest->update_compatible, TRUE);
+		g_subprocess_launcher_setenv(launcher, "RAUC_MF_VERSION", manifest->update_version ?: "", TRUE);
+		g_subprocess_launcher_setenv(launcher, "RAUC_MOUNT_PREFIX", r_context()->config->mount_prefix, TRUE);
+	}
 
 	sproc = g_subprocess_launcher_spawn(
 			launcher, &ierror,
@@ -714,7 +923,7 @@ static gboolean run_bundle_hook(RaucManifest *manifest, gchar* bundledir, const
 		}
 	} while (outline);
 
-	res = g_subprocess_wait_check(sproc, NULL, &ierror);
+	res = install_subprocess_wait_check(sproc, &ierror);
 	if (!res) {
 		/* Subprocess exited with code 1 */
 		if ((ierror->domain == G_SPAWN_EXIT_ERROR) && (ierror->code >= INSTALL_HOOK_REJECT_CODE)) {
@@ -737,6 +946,7 @@ static gboolean run_bundle_hook(RaucManifest *manifest, gchar* bundledir, const
 	}
 
 out:
+	r_context_trace_end(trace, res);
 	return res;
 }
 
@@ -765,7 +975,7 @@ static gboolean launch_and_wait_custom_handler(RaucInstallArgs *args, gchar* bun
 
 	handler_name = g_build_filename(bundledir, manifest->handler_name, NULL);
 
-	res = launch_and_wait_handler(bundledir, handler_name, manifest, target_group, error);
+	res = launch_and_wait_handler(bundledir, handler_name, manifest, target_group, "launch_and_wait_custom_handler", error);
 
 out:
 	r_context_end_step("launch_and_wait_custom_handler", res);
@@ -773,12 +983,63 @@ out:
 }
 
 
+/* Reads back an image written to a slot and compares it to the manifest */
+static gboolean verify_written_image(RaucImage *image, RaucSlot *slot, img_to_slot_handler handler, GError **error)
+{
+	GError *ierror = NULL;
+	gboolean res;
+
+	r_context_begin_step_formatted("verify_image", 0, "Verifying image on %s", slot->name);
+
+	if (!update_handler_writes_as_is(handler, image)) {
+		g_message("Skipping read-back verification of slot %s", slot->name);
+		r_context_end_step("verify_image", TRUE);
+		return TRUE;
+	}
+
+	/* separate byte accounting reports the read-back throughput on its own */
+	r_context_begin_bytes(image->checksum.size);
+	res = verify_device_checksum(&image->checksum, slot->device, &ierror);
+	r_context_end_bytes();
+	r_context_end_step("verify_image", res);
+	if (!res)
+		g_propagate_error(error, ierror);
+
+	return res;
+}
+
+/* Records the block hash tree of the written image for 'rauc verify-slot' */
+static void record_hash_tree(RaucSlot *slot, RaucSlotStatus *slot_state)
+{
+	GError *ierror = NULL;
+	/* computed by the update handler while writing the image as-is */
+	g_autoptr(RaucHashTree) tree = g_steal_pointer(&slot->hash_tree);
+	g_autofree gchar *path = get_slot_hash_tree_path(slot);
+
+	g_clear_pointer(&slot_state->hashtree_root, g_free);
+	slot_state->hashtree_leaf_size = 0;
+
+	if (!path || !tree)
+		return;
+
+	if (!r_hash_tree_save(tree, path, &ierror)) {
+		g_message("Not recording hash tree of slot %s: %s", slot->name, ierror->message);
+		g_clear_error(&ierror);
+		return;
+	}
+
+	slot_state->hashtree_root = r_hash_tree_get_root(tree);
+	slot_state->hashtree_leaf_size = tree->leaf_size;
+}
+
 static gboolean launch_and_wait_default_handler(RaucInstallArgs *args, gchar* bundledir, RaucManifest *manifest, GHashTable *target_group, GError **error)
 {
 	gchar *hook_name = NULL;
 	GError *ierror = NULL;
 	gboolean res = FALSE;
 	GList *install_images = NULL;
+	g_autoptr(GList) target_slots = NULL;
+	gint verify_steps = 0;
 	RaucImage *mfimage;
 
 	install_images = get_install_images(manifest, target_group, &ierror);
@@ -812,7 +1073,9 @@ static gboolean launch_and_wait_default_handler(RaucInstallArgs *args, gchar* bu
 		goto early_out;
 	}
 
-	/* Mark all parent destination slots non-bootable */
+	/* Mark all parent destination slots non-bootable. The changes are
+	 * written in one go before any slot is touched. */
+	r_boot_transaction_begin();
 	for (GList *l = install_images; l != NULL; l = l->next) {
 		RaucSlot *dest_slot = g_hash_table_lookup(target_group, ((RaucImage*)l->data)->slotclass);
 
@@ -826,6 +1089,7 @@ static gboolean launch_and_wait_default_handler(RaucInstallArgs *args, gchar* bu
 		res = r_boot_set_state(dest_slot, FALSE, &ierror);
 
 		if (!res) {
+			r_boot_transaction_abort();
 			g_set_error(error, R_INSTALL_ERROR, R_INSTALL_ERROR_MARK_NONBOOTABLE,
 					"Failed marking slot %s non-bootable: %s", dest_slot->name, ierror->message);
 			g_clear_error(&ierror);
@@ -833,11 +1097,32 @@ static gboolean launch_and_wait_default_handler(RaucInstallArgs *args, gchar* bu
 		}
 	}
 
+	res = r_boot_transaction_commit(&ierror);
+	if (!res) {
+		g_set_error(error, R_INSTALL_ERROR, R_INSTALL_ERROR_MARK_NONBOOTABLE,
+				"Failed marking target slots non-bootable: %s", ierror->message);
+		g_clear_error(&ierror);
+		goto early_out;
+	}
+
 	if (manifest->hook_name)
 		hook_name = g_build_filename(bundledir, manifest->hook_name, NULL);
 
-	r_context_begin_step("update_slots", "Updating slots", g_list_length(install_images) * 2);
+	/* read status of all target slots at once instead of one by one */
+	for (GList *l = install_images; l != NULL; l = l->next) {
+		RaucSlot *dest_slot = g_hash_table_lookup(target_group, ((RaucImage*) l->data)->slotclass);
+
+		if (dest_slot && !g_list_find(target_slots, dest_slot))
+			target_slots = g_list_prepend(target_slots, dest_slot);
+		if (dest_slot && dest_slot->verify_after_write)
+			verify_steps++;
+	}
+
+	r_context_begin_step("update_slots", "Updating slots", g_list_length(install_images) * 2 + verify_steps);
 	install_args_update(args, "Updating slots...");
+
+	load_slot_status_multi(target_slots);
+
 	for (GList *l = install_images; l != NULL; l = l->next) {
 		RaucSlot *dest_slot;
 		img_to_slot_handler update_handler = NULL;
@@ -847,6 +1132,12 @@ static gboolean launch_and_wait_default_handler(RaucInstallArgs *args, gchar* bu
 		mfimage = l->data;
 		dest_slot = g_hash_table_lookup(target_group, mfimage->slotclass);
 
+		res = install_checkpoint(&ierror);
+		if (!res) {
+			g_propagate_error(error, ierror);
+			goto out;
+		}
+
 		/* if image filename is relative, make it absolute */
 		if (!g_path_is_absolute(mfimage->filename)) {
 			gchar *filename = g_build_filename(bundledir, mfimage->filename, NULL);
@@ -919,6 +1210,10 @@ static gboolean launch_and_wait_default_handler(RaucInstallArgs *args, gchar* bu
 			/* Dummy step to indicate slot was skipped */
 			r_context_begin_step("skip_image", "Copying image skipped", 0);
 			r_context_end_step("skip_image", TRUE);
+			if (dest_slot->verify_after_write) {
+				r_context_begin_step("skip_verify", "Verifying image skipped", 0);
+				r_context_end_step("skip_verify", TRUE);
+			}
 
 			goto image_out;
 		}
@@ -939,7 +1234,9 @@ static gboolean launch_and_wait_default_handler(RaucInstallArgs *args, gchar* bu
 			g_message("Updating %s with %s", dest_slot->device, mfimage->filename);
 
 		r_context_begin_step_formatted("copy_image", 0, "Copying image to %s", dest_slot->name);
+		r_context_begin_bytes(mfimage->checksum.size);
 
+		g_clear_pointer(&dest_slot->hash_tree, r_hash_tree_free);
 		res = update_handler(
 				mfimage,
 				dest_slot,
@@ -948,10 +1245,23 @@ static gboolean launch_and_wait_default_handler(RaucInstallArgs *args, gchar* bu
 		if (!res) {
 			g_propagate_prefixed_error(error, ierror,
 					"Failed updating slot %s: ", dest_slot->name);
+			r_context_end_bytes();
 			r_context_end_step("copy_image", FALSE);
 			goto out;
 		}
 
+		r_context_end_bytes();
+		r_context_end_step("copy_image", TRUE);
+
+		if (dest_slot->verify_after_write) {
+			res = verify_written_image(mfimage, dest_slot, update_handler, &ierror);
+			if (!res) {
+				g_propagate_prefixed_error(error, ierror,
+						"Failed verifying slot %s: ", dest_slot->name);
+				goto out;
+			}
+		}
+
 		g_free(slot_state->bundle_compatible);
 		g_free(slot_state->bundle_version);
 		g_free(slot_state->bundle_description);
@@ -975,7 +1285,7 @@ static gboolean launch_and_wait_default_handler(RaucInstallArgs *args, gchar* bu
 
 		g_date_time_unref(now);
 
-		r_context_end_step("copy_image", TRUE);
+		record_hash_tree(dest_slot, slot_state);
 
 		install_args_update(args, g_strdup_printf("Updating slot %s status", dest_slot->name));
 		res = save_slot_status(dest_slot, &ierror);
@@ -990,7 +1300,9 @@ image_out:
 	}
 
 	if (r_context()->config->activate_installed) {
-		/* Mark all parent destination slots bootable */
+		/* Mark all parent destination slots bootable. The changes are
+		 * written in one go after all slots were handled. */
+		r_boot_transaction_begin();
 		for (GList *l = install_images; l != NULL; l = l->next) {
 			RaucSlot *dest_slot = g_hash_table_lookup(target_group, ((RaucImage*)l->data)->slotclass);
 
@@ -1000,19 +1312,40 @@ image_out:
 			g_message("Marking target slot %s as bootable...", dest_slot->name);
 			mark_active(dest_slot, &ierror);
 			if (g_error_matches(ierror, R_INSTALL_ERROR, R_INSTALL_ERROR_MARK_BOOTABLE)) {
+				r_boot_transaction_abort();
 				g_propagate_prefixed_error(error, ierror,
 						"Failed marking slot %s bootable: ", dest_slot->name);
 				res = FALSE;
 				goto out;
-			} else if (g_error_matches(ierror, R_INSTALL_ERROR, R_INSTALL_ERROR_FAILED)) {
+			} else if (ierror) {
+				r_boot_transaction_abort();
 				g_propagate_prefixed_error(error, ierror,
-						"Marked slot %s bootable, but failed to write status file: ",
+						"Unexpected error while trying to mark slot %s bootable: ",
 						dest_slot->name);
 				res = FALSE;
 				goto out;
-			} else if (ierror) {
+			}
+		}
+
+		res = r_boot_transaction_commit(&ierror);
+		if (!res) {
+			g_set_error(error, R_INSTALL_ERROR, R_INSTALL_ERROR_MARK_BOOTABLE,
+					"Failed marking target slots bootable: %s", ierror->message);
+			g_clear_error(&ierror);
+			goto out;
+		}
+
+		/* Only record the activation once the bootloader was updated */
+		for (GList *l = install_images; l != NULL; l = l->next) {
+			RaucSlot *dest_slot = g_hash_table_lookup(target_group, ((RaucImage*)l->data)->slotclass);
+
+			if (dest_slot->parent || !dest_slot->bootname)
+				continue;
+
+			mark_active_save_status(dest_slot, &ierror);
+			if (ierror) {
 				g_propagate_prefixed_error(error, ierror,
-						"Unexpected error while trying to mark slot %s bootable: ",
+						"Marked slot %s bootable, but failed to write status file: ",
 						dest_slot->name);
 				res = FALSE;
 				goto out;
@@ -1027,6 +1360,14 @@ image_out:
 	res = TRUE;
 
 out:
+	/* merge the journaled status of all updated slots at once */
+	if (!commit_slot_status(&ierror)) {
+		if (res)
+			g_propagate_error(error, ierror);
+		else
+			g_clear_error(&ierror);
+		res = FALSE;
+	}
 	//g_free(hook_name);
 	r_context_end_step("update_slots", res);
 early_out:
@@ -1086,6 +1427,7 @@ static gboolean launch_and_wait_network_handler(const gchar* base_url,
 
 	/* Mark all parent destination slots non-bootable */
 	g_message("Marking active slot as non-bootable...");
+	r_boot_transaction_begin();
 	for (gchar **cls = fileclasses; *cls != NULL; cls++) {
 		RaucSlot *slot = g_hash_table_lookup(target_group, *cls);
 
@@ -1098,6 +1440,7 @@ static gboolean launch_and_wait_network_handler(const gchar* base_url,
 		res = r_boot_set_state(slot, FALSE, &ierror);
 
 		if (!res) {
+			r_boot_transaction_abort();
 			g_set_error(error, R_INSTALL_ERROR, R_INSTALL_ERROR_MARK_NONBOOTABLE,
 					"Failed marking slot %s non-bootable: %s", slot->name, ierror->message);
 			g_clear_error(&ierror);
@@ -1105,6 +1448,14 @@ static gboolean launch_and_wait_network_handler(const gchar* base_url,
 		}
 	}
 
+	res = r_boot_transaction_commit(&ierror);
+	if (!res) {
+		g_set_error(error, R_INSTALL_ERROR, R_INSTALL_ERROR_MARK_NONBOOTABLE,
+				"Failed marking target slots non-bootable: %s", ierror->message);
+		g_clear_error(&ierror);
+		goto out;
+	}
+
 
 	// for slot in target_group
 	for (gchar **cls = fileclasses; *cls != NULL; cls++) {
@@ -1204,6 +1555,7 @@ slot_out:
 	if (r_context()->config->activate_installed) {
 		/* Mark all parent destination slots bootable */
 		g_message("Marking slots as bootable...");
+		r_boot_transaction_begin();
 		for (gchar **cls = fileclasses; *cls != NULL; cls++) {
 			RaucSlot *slot = g_hash_table_lookup(target_group, *cls);
 
@@ -1215,12 +1567,21 @@ slot_out:
 			res = r_boot_set_primary(slot, &ierror);
 
 			if (!res) {
+				r_boot_transaction_abort();
 				g_set_error(error, R_INSTALL_ERROR, R_INSTALL_ERROR_MARK_BOOTABLE,
 						"Failed marking slot %s bootable: %s", slot->name, ierror->message);
 				g_clear_error(&ierror);
 				goto out;
 			}
 		}
+
+		res = r_boot_transaction_commit(&ierror);
+		if (!res) {
+			g_set_error(error, R_INSTALL_ERROR, R_INSTALL_ERROR_MARK_BOOTABLE,
+					"Failed marking slots bootable: %s", ierror->message);
+			g_clear_error(&ierror);
+			goto out;
+		}
 	} else {
 		g_message("Leaving target slot non-bootable as requested by activate_installed == false.");
 	}
@@ -1306,9 +1667,25 @@ gboolean do_install_bundle(RaucInstallArgs *args, GError **error)
 		goto umount;
 	}
 
+	/* computed once, as hooks may be called several times per slot */
+	r_context()->install_info->hook_env = prepare_hook_environment(manifest);
+
+	if (manifest->hook_name && manifest->hook_persistent) {
+		g_autofree gchar *hook_name = g_build_filename(bundle->mount_point, manifest->hook_name, NULL);
+
+		g_message("Starting hook server %s", hook_name);
+		r_context()->install_info->hook_server = r_hook_server_start(hook_name,
+				r_context()->install_info->hook_env, &ierror);
+		if (!r_context()->install_info->hook_server) {
+			res = FALSE;
+			g_propagate_error(error, ierror);
+			goto umount;
+		}
+	}
+
 	if (r_context()->config->preinstall_handler) {
 		g_message("Starting pre install handler: %s", r_context()->config->preinstall_handler);
-		res = launch_and_wait_handler(bundle->mount_point, r_context()->config->preinstall_handler, manifest, target_group, &ierror);
+		res = launch_and_wait_handler(bundle->mount_point, r_context()->config->preinstall_handler, manifest, target_group, NULL, &ierror);
 		if (!res) {
 			g_propagate_prefixed_error(error, ierror, "Pre-install handler error: ");
 			goto umount;
@@ -1331,7 +1708,7 @@ gboolean do_install_bundle(RaucInstallArgs *args, GError **error)
 
 	if (r_context()->config->postinstall_handler) {
 		g_message("Starting post install handler: %s", r_context()->config->postinstall_handler);
-		res = launch_and_wait_handler(bundle->mount_point, r_context()->config->postinstall_handler, manifest, target_group, &ierror);
+		res = launch_and_wait_handler(bundle->mount_point, r_context()->config->postinstall_handler, manifest, target_group, NULL, &ierror);
 		if (!res) {
 			g_propagate_prefixed_error(error, ierror, "Post-install handler error: ");
 			goto umount;
@@ -1342,6 +1719,20 @@ gboolean do_install_bundle(RaucInstallArgs *args, GError **error)
 	res = TRUE;
 
 umount:
+	if (r_context()->install_info->hook_server) {
+		/* the hook server must exit before its bundle is unmounted */
+		if (!r_hook_server_stop(r_context()->install_info->hook_server, &ierror)) {
+			if (res) {
+				res = FALSE;
+				g_propagate_error(error, ierror);
+			} else {
+				g_message("Ignoring hook server error after installation error: %s", ierror->message);
+				g_clear_error(&ierror);
+			}
+		}
+		r_context()->install_info->hook_server = NULL;
+	}
+	g_clear_pointer(&r_context()->install_info->hook_env, g_strfreev);
 	if (bundle->mount_point) {
 		umount_bundle(bundle, NULL);
 	}
@@ -1423,7 +1814,7 @@ gboolean do_install_network(const gchar *url, GError **error)
 
 	if (r_context()->config->preinstall_handler) {
 		g_message("Starting pre install handler: %s", r_context()->config->preinstall_handler);
-		res = launch_and_wait_handler(base_url, r_context()->config->preinstall_handler, manifest, target_group, &ierror);
+		res = launch_and_wait_handler(base_url, r_context()->config->preinstall_handler, manifest, target_group, NULL, &ierror);
 		if (!res) {
 			g_propagate_prefixed_error(error, ierror, "Pre-install handler error: ");
 			goto out;
@@ -1441,7 +1832,7 @@ gboolean do_install_network(const gchar *url, GError **error)
 
 	if (r_context()->config->postinstall_handler) {
 		g_message("Starting post install handler: %s", r_context()->config->postinstall_handler);
-		res = launch_and_wait_handler(base_url, r_context()->config->postinstall_handler, manifest, target_group, &ierror);
+		res = launch_and_wait_handler(base_url, r_context()->config->postinstall_handler, manifest, target_group, NULL, &ierror);
 		if (!res) {
 			g_propagate_prefixed_error(error, ierror, "Post-install handler error: ");
 			goto out;
@@ -1474,6 +1865,92 @@ static gboolean install_done(gpointer data)
 	return G_SOURCE_REMOVE;
 }
 
+gboolean install_cancel(void)
+{
+	RContextInstallationInfo *info = r_context()->install_info;
+	gboolean res = FALSE;
+
+	g_mutex_lock(&info->control_mutex);
+	if (info->cancellable) {
+		g_message("Cancelling installation");
+		g_cancellable_cancel(info->cancellable);
+		/* wake up a paused installation to let it fail */
+		info->paused = FALSE;
+		g_cond_broadcast(&info->control_cond);
+		res = TRUE;
+	}
+	g_mutex_unlock(&info->control_mutex);
+
+	return res;
+}
+
+gboolean install_set_paused(gboolean paused)
+{
+	RContextInstallationInfo *info = r_context()->install_info;
+	gboolean res = FALSE;
+
+	g_mutex_lock(&info->control_mutex);
+	if (info->cancellable) {
+		g_message("%s installation", paused ? "Pausing" : "Resuming");
+		info->paused = paused;
+		g_cond_broadcast(&info->control_cond);
+		res = TRUE;
+	}
+	g_mutex_unlock(&info->control_mutex);
+
+	return res;
+}
+
+gboolean install_checkpoint(GError **error)
+{
+	RContextInstallationInfo *info = r_context()->install_info;
+	gboolean res;
+
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	g_mutex_lock(&info->control_mutex);
+	if (info->paused)
+		g_message("Installation paused");
+	while (info->paused)
+		g_cond_wait(&info->control_cond, &info->control_mutex);
+	res = !g_cancellable_set_error_if_cancelled(info->cancellable, error);
+	g_mutex_unlock(&info->control_mutex);
+
+	return res;
+}
+
+gboolean install_subprocess_wait_check(GSubprocess *sproc, GError **error)
+{
+	GError *ierror = NULL;
+
+	g_return_val_if_fail(sproc, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (g_subprocess_wait_check(sproc, r_context()->install_info->cancellable, &ierror))
+		return TRUE;
+
+	if (g_error_matches(ierror, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		/* do not leave it writing to the slot in the background */
+		g_subprocess_force_exit(sproc);
+		g_subprocess_wait(sproc, NULL, NULL);
+	}
+
+	g_propagate_error(error, ierror);
+	return FALSE;
+}
+
+/* Makes the installation controllable by install_cancel() and
+ * install_set_paused(), or ends this if cancellable is NULL */
+static void install_set_cancellable(GCancellable *cancellable)
+{
+	RContextInstallationInfo *info = r_context()->install_info;
+
+	g_mutex_lock(&info->control_mutex);
+	info->cancellable = cancellable;
+	info->paused = FALSE;
+	g_mutex_unlock(&info->control_mutex);
+}
+
 static gpointer install_thread(gpointer data)
 {
 	GError *ierror = NULL;
@@ -1483,8 +1960,11 @@ static gpointer install_thread(gpointer data)
 	/* clear LastError property */
 	set_last_error(g_strdup(""));
 
+	install_set_cancellable(args->cancellable);
+
 	g_debug("thread started for %s", args->name);
 	install_args_update(args, "started");
+	r_context_trace_start();
 
 	/* Special handling for network mode.
 	 * As bundle mode is our default, we only activate network mode when
@@ -1503,6 +1983,9 @@ static gpointer install_thread(gpointer data)
 		g_clear_error(&ierror);
 	}
 
+	install_set_cancellable(NULL);
+	r_context_trace_stop();
+
 	g_mutex_lock(&args->status_mutex);
 	args->status_result = result;
 	g_mutex_unlock(&args->status_mutex);
@@ -1520,6 +2003,7 @@ RaucInstallArgs *install_args_new(void)
 	g_mutex_init(&args->status_mutex);
 	g_queue_init(&args->status_messages);
 	args->status_result = -2;
+	args->cancellable = g_cancellable_new();
 
 	return args;
 }
@@ -1527,6 +2011,7 @@ RaucInstallArgs *install_args_new(void)
 void install_args_free(RaucInstallArgs *args)
 {
 	g_free(args->name);
+	g_clear_object(&args->cancellable);
 	g_mutex_clear(&args->status_mutex);
 	g_assert_cmpint(args->status_result, >=, 0);
 	g_assert_true(g_queue_is_empty(&args->status_messages));
@@ -7,10 +7,12 @@
 #endif
 #include <stdio.h>
 
+#include "bench.h"
 #include "bundle.h"
 #include "bootchooser.h"
 #include "config_file.h"
 #include "context.h"
+#include "hash_tree.h"
 #include "install.h"
 #include "rauc-installer-generated.h"
 #include "service.h"
@@ -23,9 +25,13 @@ GMainLoop *r_loop = NULL;
 int r_exit_status = 0;
 
 gboolean install_ignore_compatible = FALSE;
+gchar *install_trace = NULL;
 gboolean info_noverify, info_dumpcert = FALSE;
 gboolean status_detailed = FALSE;
 gchar *output_format = NULL;
+gchar **convert_fs_images = NULL;
+gint bench_size = 0;
+gchar *bench_url = NULL;
 
 static gboolean install_notify(gpointer data)
 {
@@ -140,6 +146,36 @@ static gchar *resolve_bundle_path(char *path)
 }
 
 
+/* Writes the timeline of the installation to install_trace, either from the
+ * service or from our own context */
+static void save_install_trace(RInstaller *installer)
+{
+	g_autofree gchar *trace = NULL;
+	GError *error = NULL;
+
+	if (installer) {
+		if (!r_installer_call_get_trace_sync(installer, &trace, NULL, &error)) {
+			g_printerr("Failed to get installation trace: %s\n", error->message);
+			g_error_free(error);
+			return;
+		}
+	} else {
+		trace = r_context_trace_to_json();
+		if (!trace) {
+			g_printerr("No installation trace recorded\n");
+			return;
+		}
+	}
+
+	if (!g_file_set_contents(install_trace, trace, -1, &error)) {
+		g_printerr("Failed to write installation trace: %s\n", error->message);
+		g_error_free(error);
+		return;
+	}
+
+	g_print("Installation trace written to %s\n", install_trace);
+}
+
 static gboolean install_start(int argc, char **argv)
 {
 	GBusType bus_type = (!g_strcmp0(g_getenv("DBUS_STARTER_BUS_TYPE"), "session"))
@@ -210,6 +246,8 @@ static gboolean install_start(int argc, char **argv)
 
 	g_main_loop_run(r_loop);
 
+	if (install_trace)
+		save_install_trace(installer);
 
 out_loop:
 	switch (args->status_result) {
@@ -377,6 +415,233 @@ out:
 	return TRUE;
 }
 
+static gboolean verify_slot_start(int argc, char **argv)
+{
+	GError *ierror = NULL;
+	g_autoptr(RaucHashTree) tree = NULL;
+	g_autoptr(GArray) mismatches = NULL;
+	g_autofree gchar *path = NULL;
+	RaucSlotStatus *status;
+	RaucSlot *slot;
+
+	g_debug("verify_slot_start");
+
+	if (argc < 3) {
+		g_printerr("A slot name must be provided\n");
+		r_exit_status = 1;
+		goto out;
+	}
+
+	if (argc > 3) {
+		g_printerr("Excess argument: %s\n", argv[3]);
+		r_exit_status = 1;
+		goto out;
+	}
+
+	slot = g_hash_table_lookup(r_context()->config->slots, argv[2]);
+	if (slot == NULL) {
+		g_printerr("No matching slot found for given slot name\n");
+		r_exit_status = 1;
+		goto out;
+	}
+
+	load_slot_status(slot);
+	status = slot->status;
+	path = get_slot_hash_tree_path(slot);
+	if (!path || !status->hashtree_root) {
+		g_printerr("No hash tree recorded for slot %s\n", slot->name);
+		r_exit_status = 1;
+		goto out;
+	}
+
+	tree = r_hash_tree_load(path, status->checksum.size, status->hashtree_leaf_size,
+			status->hashtree_root, &ierror);
+	if (tree == NULL) {
+		g_printerr("%s\n", ierror->message);
+		g_clear_error(&ierror);
+		r_exit_status = 1;
+		goto out;
+	}
+
+	if (!r_hash_tree_check(tree, slot->device, &mismatches, &ierror)) {
+		g_printerr("%s\n", ierror->message);
+		g_clear_error(&ierror);
+		r_exit_status = 1;
+		goto out;
+	}
+
+	if (mismatches->len == 0) {
+		g_print("Slot %s is intact (%u blocks of %u bytes checked)\n", slot->name,
+				r_hash_tree_leaf_count(tree), tree->leaf_size);
+		goto out;
+	}
+
+	g_print("Slot %s has %u block(s) of %u bytes that differ from the installed image:\n", slot->name,
+			mismatches->len, tree->leaf_size);
+	/* print adjacent blocks as one range */
+	for (guint i = 0; i < mismatches->len; ) {
+		guint first = g_array_index(mismatches, guint, i);
+		guint last = first;
+		guint64 end;
+
+		while (++i < mismatches->len && g_array_index(mismatches, guint, i) == last + 1)
+			last++;
+
+		end = MIN((guint64) (last + 1) * tree->leaf_size, tree->size);
+		g_print("  %" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT "\n",
+				(guint64) first * tree->leaf_size, end - 1);
+	}
+	r_exit_status = 1;
+
+out:
+	return TRUE;
+}
+
+static gchar *bench_formatter_readable(GPtrArray *results)
+{
+	GString *text = g_string_new(NULL);
+
+	g_string_append_printf(text, "%-10s %12s %10s %10s %8s %10s %10s\n",
+			"engine", "bytes", "seconds", "MB/s", "cpu", "syscalls", "peak rss");
+	for (guint i = 0; i < results->len; i++) {
+		RaucBenchResult *result = g_ptr_array_index(results, i);
+		g_autofree gchar *rss = g_format_size(result->peak_rss);
+
+		g_string_append_printf(text, "%-10s %12" G_GUINT64_FORMAT " %10.2f %10.1f %7.0f%% %10" G_GINT64_FORMAT " %10s\n",
+				result->name, result->bytes, result->seconds,
+				r_bench_result_throughput(result),
+				result->seconds > 0 ? 100 * result->cpu_seconds / result->seconds : 0,
+				result->syscalls, rss);
+	}
+
+	return g_string_free(text, FALSE);
+}
+
+static gchar *bench_formatter_shell(GPtrArray *results)
+{
+	GString *text = g_string_new(NULL);
+
+	for (guint i = 0; i < results->len; i++) {
+		RaucBenchResult *result = g_ptr_array_index(results, i);
+		g_autofree gchar *prefix = g_ascii_strup(result->name, -1);
+
+		g_strdelimit(prefix, "-", '_');
+		g_string_append_printf(text, "RAUC_BENCH_%s_BYTES=%" G_GUINT64_FORMAT "\n", prefix, result->bytes);
+		g_string_append_printf(text, "RAUC_BENCH_%s_SECONDS=%.3f\n", prefix, result->seconds);
+		g_string_append_printf(text, "RAUC_BENCH_%s_MBPS=%.1f\n", prefix, r_bench_result_throughput(result));
+		g_string_append_printf(text, "RAUC_BENCH_%s_CPU_SECONDS=%.3f\n", prefix, result->cpu_seconds);
+		g_string_append_printf(text, "RAUC_BENCH_%s_SYSCALLS=%" G_GINT64_FORMAT "\n", prefix, result->syscalls);
+		g_string_append_printf(text, "RAUC_BENCH_%s_PEAK_RSS=%" G_GUINT64_FORMAT "\n", prefix, result->peak_rss);
+	}
+
+	return g_string_free(text, FALSE);
+}
+
+static gchar *bench_formatter_json_base(GPtrArray *results, gboolean pretty)
+{
+#if ENABLE_JSON
+	g_autoptr(JsonGenerator) gen = NULL;
+	g_autoptr(JsonNode) root = NULL;
+	g_autoptr(JsonBuilder) builder = json_builder_new();
+
+	json_builder_begin_array(builder);
+	for (guint i = 0; i < results->len; i++) {
+		RaucBenchResult *result = g_ptr_array_index(results, i);
+
+		json_builder_begin_object(builder);
+		json_builder_set_member_name(builder, "engine");
+		json_builder_add_string_value(builder, result->name);
+		json_builder_set_member_name(builder, "bytes");
+		json_builder_add_int_value(builder, result->bytes);
+		json_builder_set_member_name(builder, "seconds");
+		json_builder_add_double_value(builder, result->seconds);
+		json_builder_set_member_name(builder, "mbps");
+		json_builder_add_double_value(builder, r_bench_result_throughput(result));
+		json_builder_set_member_name(builder, "cpu_seconds");
+		json_builder_add_double_value(builder, result->cpu_seconds);
+		json_builder_set_member_name(builder, "syscalls");
+		json_builder_add_int_value(builder, result->syscalls);
+		json_builder_set_member_name(builder, "peak_rss");
+		json_builder_add_int_value(builder, result->peak_rss);
+		json_builder_end_object(builder);
+	}
+	json_builder_end_array(builder);
+
+	gen = json_generator_new();
+	root = json_builder_get_root(builder);
+	json_generator_set_root(gen, root);
+	json_generator_set_pretty(gen, pretty);
+	return json_generator_to_data(gen, NULL);
+#else
+	g_error("json support is disabled");
+	return NULL;
+#endif
+}
+
+static gchar *bench_formatter_json(GPtrArray *results)
+{
+	return bench_formatter_json_base(results, FALSE);
+}
+
+static gchar *bench_formatter_json_pretty(GPtrArray *results)
+{
+	return bench_formatter_json_base(results, TRUE);
+}
+
+static gboolean bench_start(int argc, char **argv)
+{
+	GError *ierror = NULL;
+	g_autoptr(GPtrArray) results = NULL;
+	g_autofree gchar *text = NULL;
+	gchar* (*formatter)(GPtrArray *results) = NULL;
+	const gchar *dir = g_get_tmp_dir();
+
+	g_debug("bench_start");
+
+	if (argc > 3) {
+		g_printerr("Excess argument: %s\n", argv[3]);
+		r_exit_status = 1;
+		goto out;
+	}
+
+	if (argc == 3)
+		dir = argv[2];
+
+	if (bench_size < 0) {
+		g_printerr("Invalid size: %d\n", bench_size);
+		r_exit_status = 1;
+		goto out;
+	}
+
+	if (!output_format || g_strcmp0(output_format, "readable") == 0) {
+		formatter = bench_formatter_readable;
+	} else if (g_strcmp0(output_format, "shell") == 0) {
+		formatter = bench_formatter_shell;
+	} else if (ENABLE_JSON && g_strcmp0(output_format, "json") == 0) {
+		formatter = bench_formatter_json;
+	} else if (ENABLE_JSON && g_strcmp0(output_format, "json-pretty") == 0) {
+		formatter = bench_formatter_json_pretty;
+	} else {
+		g_printerr("Unknown output format: '%s'\n", output_format);
+		r_exit_status = 1;
+		goto out;
+	}
+
+	if (!r_bench_run(dir, bench_size ? (guint64) bench_size * 1024 * 1024 : R_BENCH_DEFAULT_SIZE,
+			bench_url, &results, &ierror)) {
+		g_printerr("%s\n", ierror->message);
+		g_clear_error(&ierror);
+		r_exit_status = 1;
+		goto out;
+	}
+
+	text = formatter(results);
+	g_print("%s\n", text);
+
+out:
+	return TRUE;
+}
+
 static gboolean resign_start(int argc, char **argv)
 {
 	g_autoptr(RaucBundle) bundle = NULL;
@@ -476,6 +741,7 @@ static gboolean convert_start(int argc, char **argv)
 {
 	RaucBundle *bundle = NULL;
 	GError *ierror = NULL;
+	gboolean res;
 	g_debug("convert start");
 
 	if (r_context()->certpath == NULL ||
@@ -513,7 +779,11 @@ static gboolean convert_start(int argc, char **argv)
 		goto out;
 	}
 
-	if (!create_casync_bundle(bundle, argv[3], &ierror)) {
+	if (convert_fs_images)
+		res = create_fs_image_bundle(bundle, argv[3], convert_fs_images, &ierror);
+	else
+		res = create_casync_bundle(bundle, argv[3], &ierror);
+	if (!res) {
 		g_printerr("Failed to create bundle: %s\n", ierror->message);
 		g_clear_error(&ierror);
 		r_exit_status = 1;
@@ -1471,12 +1741,9 @@ static gboolean status_start(int argc, char **argv)
 		}
 
 		if (status_detailed) {
-			GHashTableIter iter;
-			RaucSlot *slot;
+			g_autoptr(GList) slots = g_hash_table_get_values(r_context()->config->slots);
 
-			g_hash_table_iter_init(&iter, r_context()->config->slots);
-			while (g_hash_table_iter_next(&iter, NULL, (gpointer*) &slot))
-				load_slot_status(slot);
+			load_slot_status_multi(slots);
 		}
 
 		status_print = g_new0(RaucStatusPrint, 1);
@@ -1592,6 +1859,8 @@ typedef enum  {
 	STATUS,
 	INFO,
 	WRITE_SLOT,
+	VERIFY_SLOT,
+	BENCH,
 	SERVICE,
 } RaucCommandType;
 
@@ -1607,6 +1876,19 @@ typedef struct {
 
 GOptionEntry entries_install[] = {
 	{"ignore-compatible", '\0', 0, G_OPTION_ARG_NONE, &install_ignore_compatible, "disable compatible check", NULL},
+	{"trace", '\0', 0, G_OPTION_ARG_FILENAME, &install_trace, "write timeline of the installation to FILE", "FILE"},
+	{0}
+};
+
+GOptionEntry entries_convert[] = {
+	{"fs-image", '\0', 0, G_OPTION_ARG_STRING_ARRAY, &convert_fs_images, "convert tar archives of slot class to ext4 images of size", "SLOTCLASS:SIZE"},
+	{0}
+};
+
+GOptionEntry entries_bench[] = {
+	{"size", '\0', 0, G_OPTION_ARG_INT, &bench_size, "MiB of data to process per engine (default: 256)", "SIZE"},
+	{"url", '\0', 0, G_OPTION_ARG_STRING, &bench_url, "also benchmark downloading this URL", "URL"},
+	{"output-format", '\0', 0, G_OPTION_ARG_STRING, &output_format, "output format", "FORMAT"},
 	{0}
 };
 
@@ -1645,8 +1927,10 @@ static void cmdline_handler(int argc, char **argv)
 		{0}
 	};
 	GOptionGroup *install_group = g_option_group_new("install", "Install options:", "help dummy", NULL, NULL);
+	GOptionGroup *convert_group = g_option_group_new("convert", "Convert options:", "help dummy", NULL, NULL);
 	GOptionGroup *info_group = g_option_group_new("info", "Info options:", "help dummy", NULL, NULL);
 	GOptionGroup *status_group = g_option_group_new("status", "Status options:", "help dummy", NULL, NULL);
+	GOptionGroup *bench_group = g_option_group_new("bench", "Bench options:", "help dummy", NULL, NULL);
 
 	GError *error = NULL;
 	g_autofree gchar *text = NULL;
@@ -1657,11 +1941,13 @@ static void cmdline_handler(int argc, char **argv)
 		{BUNDLE, "bundle", "bundle <INPUTDIR> <BUNDLENAME>", "Create a bundle from a content directory", bundle_start, NULL, FALSE},
 		{RESIGN, "resign", "resign <BUNDLENAME>", "Resign an already signed bundle", resign_start, NULL, FALSE},
 		{EXTRACT, "extract", "extract <BUNDLENAME> <OUTPUTDIR>", "Extract the bundle content", extract_start, NULL, FALSE},
-		{CONVERT, "convert", "convert <INBUNDLE> <OUTBUNDLE>", "Convert to casync index bundle and store", convert_start, NULL, FALSE},
+		{CONVERT, "convert", "convert <INBUNDLE> <OUTBUNDLE>", "Convert to casync index bundle and store, or to filesystem images", convert_start, convert_group, FALSE},
 		{CHECKSUM, "checksum", "checksum <DIRECTORY>", "Deprecated", checksum_start, NULL, FALSE},
 		{INFO, "info", "info <FILE>", "Print bundle info", info_start, info_group, FALSE},
 		{STATUS, "status", "status", "Show system status", status_start, status_group, TRUE},
 		{WRITE_SLOT, "write-slot", "write-slot <SLOTNAME> <IMAGE>", "Write image to slot and bypass all update logic", write_slot_start, NULL, FALSE},
+		{VERIFY_SLOT, "verify-slot", "verify-slot <SLOTNAME>", "Check slot content against its recorded hash tree", verify_slot_start, NULL, FALSE},
+		{BENCH, "bench", "bench [DIRECTORY]", "Measure throughput of the install I/O paths", bench_start, bench_group, FALSE},
 #if ENABLE_SERVICE == 1
 		{SERVICE, "service", "service", "Start RAUC service", service_start, NULL, TRUE},
 #endif
@@ -1671,8 +1957,10 @@ static void cmdline_handler(int argc, char **argv)
 	RaucCommand *rcommand = NULL;
 
 	g_option_group_add_entries(install_group, entries_install);
+	g_option_group_add_entries(convert_group, entries_convert);
 	g_option_group_add_entries(info_group, entries_info);
 	g_option_group_add_entries(status_group, entries_status);
+	g_option_group_add_entries(bench_group, entries_bench);
 
 	context = g_option_context_new("<COMMAND>");
 	g_option_context_set_help_enabled(context, FALSE);
@@ -1683,12 +1971,14 @@ static void cmdline_handler(int argc, char **argv)
 			"  bundle\tCreate a bundle\n" \
 			"  resign\tResign an already signed bundle\n" \
 			"  extract\tExtract the bundle content\n" \
-			"  convert\tConvert classic to casync bundle\n" \
+			"  convert\tConvert classic to casync or filesystem image bundle\n" \
 			"  checksum\tUpdate a manifest with checksums (and optionally sign it)\n" \
 			"  install\tInstall a bundle\n" \
 			"  info\t\tShow file information\n" \
 			"  status\tShow status\n" \
 			"  write-slot\tWrite image to slot and bypass all update logic\n" \
+			"  verify-slot\tCheck slot content against its recorded hash tree\n" \
+			"  bench\t\tMeasure throughput of the install I/O paths\n" \
 			"\n" \
 			"Environment variables:\n"
 			"  RAUC_PKCS11_MODULE  Library filename for PKCS#11 module (signing only)\n" \
@@ -159,6 +159,17 @@ static gboolean parse_manifest(GKeyFile *key_file, RaucManifest **manifest, GErr
 	}
 	g_strfreev(bundle_hooks);
 
+	raucm->hook_persistent = g_key_file_get_boolean(key_file, "hooks", "persistent", &ierror);
+	if (g_error_matches(ierror, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND) ||
+	    g_error_matches(ierror, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND)) {
+		raucm->hook_persistent = FALSE;
+		g_clear_error(&ierror);
+	} else if (ierror) {
+		g_propagate_error(error, ierror);
+		goto free;
+	}
+	g_key_file_remove_key(key_file, "hooks", "persistent", NULL);
+
 	if (!check_remaining_keys(key_file, "hooks", &ierror)) {
 		g_propagate_error(error, ierror);
 		goto free;
@@ -334,6 +345,9 @@ gboolean save_manifest_file(const gchar *filename, RaucManifest *mf, GError **er
 	if (mf->hook_name)
 		g_key_file_set_string(key_file, "hooks", "filename", mf->hook_name);
 
+	if (mf->hook_persistent)
+		g_key_file_set_boolean(key_file, "hooks", "persistent", TRUE);
+
 	if (mf->hooks.install_check == TRUE) {
 		g_ptr_array_add(hooks, g_strdup("install-check"));
 	}
@@ -498,8 +512,16 @@ static gboolean verify_manifest_checksums(RaucManifest *manifest, const gchar *d
 	gboolean res = TRUE;
 	gboolean had_errors = FALSE;
 
+	guint64 total = 0;
+
 	r_context_begin_step("verify_manifest_checksums", "Verifying manifest checksums", 0);
 
+	for (GList *elem = manifest->images; elem != NULL; elem = elem->next)
+		total += ((RaucImage *) elem->data)->checksum.size;
+	for (GList *elem = manifest->files; elem != NULL; elem = elem->next)
+		total += ((RaucFile *) elem->data)->checksum.size;
+	r_context_begin_bytes(total);
+
 	for (GList *elem = manifest->images; elem != NULL; elem = elem->next) {
 		RaucImage *image = elem->data;
 		g_autofree gchar *filename = g_build_filename(dir, image->filename, NULL);
@@ -529,6 +551,7 @@ static gboolean verify_manifest_checksums(RaucManifest *manifest, const gchar *d
 		g_set_error(error, R_MANIFEST_ERROR, R_MANIFEST_ERROR_CHECKSUM, "Failed updating all checksums");
 	}
 
+	r_context_end_bytes();
 	r_context_end_step("verify_manifest_checksums", res);
 	return res;
 }
@@ -76,24 +76,30 @@ static RaucSlot* get_slot_by_identifier(const gchar *identifier, GError **error)
 
 void mark_active(RaucSlot *slot, GError **error)
 {
-	RaucSlotStatus *slot_state;
 	GError *ierror = NULL;
-	GDateTime *now;
-	gboolean res;
 
 	g_return_if_fail(slot);
 	g_return_if_fail(error == NULL || *error == NULL);
 
-	load_slot_status(slot);
-	slot_state = slot->status;
-
-	res = r_boot_set_primary(slot, &ierror);
-	if (!res) {
+	if (!r_boot_set_primary(slot, &ierror)) {
 		g_set_error(error, R_INSTALL_ERROR, R_INSTALL_ERROR_MARK_BOOTABLE,
 				"failed to activate slot %s: %s", slot->name, ierror->message);
 		g_error_free(ierror);
 		return;
 	}
+}
+
+void mark_active_save_status(RaucSlot *slot, GError **error)
+{
+	RaucSlotStatus *slot_state;
+	GError *ierror = NULL;
+	GDateTime *now;
+
+	g_return_if_fail(slot);
+	g_return_if_fail(error == NULL || *error == NULL);
+
+	load_slot_status(slot);
+	slot_state = slot->status;
 
 	g_free(slot_state->activated_timestamp);
 	now = g_date_time_new_now_utc();
@@ -101,14 +107,34 @@ void mark_active(RaucSlot *slot, GError **error)
 	slot_state->activated_count++;
 	g_date_time_unref(now);
 
-	res = save_slot_status(slot, &ierror);
-	if (!res) {
+	if (!save_slot_status(slot, &ierror)) {
 		g_set_error(error, R_INSTALL_ERROR, R_INSTALL_ERROR_FAILED, "%s", ierror->message);
 		g_error_free(ierror);
 		return;
 	}
 }
 
+/* Sets the boot state of a slot with all bootloader changes written at once */
+static gboolean mark_state(RaucSlot *slot, gboolean good, GError **error)
+{
+	GError *ierror = NULL;
+
+	r_boot_transaction_begin();
+
+	if (!r_boot_set_state(slot, good, &ierror)) {
+		r_boot_transaction_abort();
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	if (!r_boot_transaction_commit(&ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 gboolean mark_run(const gchar *state,
 		const gchar *slot_identifier,
 		gchar **slot_name,
@@ -129,13 +155,35 @@ gboolean mark_run(const gchar *state,
 	}
 
 	if (!g_strcmp0(state, "good")) {
-		res = r_boot_set_state(slot, TRUE, &ierror);
+		res = mark_state(slot, TRUE, &ierror);
 		*message = res ? g_strdup_printf("marked slot %s as good", slot->name) : g_strdup(ierror->message);
 	} else if (!g_strcmp0(state, "bad")) {
-		res = r_boot_set_state(slot, FALSE, &ierror);
+		res = mark_state(slot, FALSE, &ierror);
 		*message = res ? g_strdup_printf("marked slot %s as bad", slot->name) : g_strdup(ierror->message);
 	} else if (!g_strcmp0(state, "active")) {
+		/* write all bootloader changes of the activation at once */
+		r_boot_transaction_begin();
 		mark_active(slot, &ierror);
+		if (ierror) {
+			r_boot_transaction_abort();
+		} else if (!r_boot_transaction_commit(&ierror)) {
+			GError *commit_error = ierror;
+
+			ierror = NULL;
+			g_set_error(&ierror, R_INSTALL_ERROR, R_INSTALL_ERROR_MARK_BOOTABLE,
+					"failed to activate slot %s: %s", slot->name, commit_error->message);
+			g_error_free(commit_error);
+		}
+		/* the status is only updated once the bootloader changes were written */
+		if (!ierror)
+			mark_active_save_status(slot, &ierror);
+		if (!ierror && !commit_slot_status(&ierror)) {
+			GError *commit_error = ierror;
+
+			ierror = NULL;
+			g_set_error(&ierror, R_INSTALL_ERROR, R_INSTALL_ERROR_FAILED, "%s", commit_error->message);
+			g_error_free(commit_error);
+		}
 		if (g_error_matches(ierror, R_INSTALL_ERROR, R_INSTALL_ERROR_MARK_BOOTABLE)) {
 			res = FALSE;
 			*message = g_strdup(ierror->message);
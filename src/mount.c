@@ -10,6 +10,7 @@ gboolean r_mount_full(const gchar *source, const gchar *mountpoint, const gchar*
 {
 	g_autoptr(GSubprocess) sproc = NULL;
 	GError *ierror = NULL;
+	RaucTraceEvent *trace = NULL;
 	gboolean res = FALSE;
 	g_autoptr(GPtrArray) args = g_ptr_array_new_full(10, g_free);
 
@@ -35,6 +36,7 @@ gboolean r_mount_full(const gchar *source, const gchar *mountpoint, const gchar*
 	g_ptr_array_add(args, NULL);
 
 	r_debug_subprocess(args);
+	trace = r_context_trace_subprocess(args);
 	sproc = g_subprocess_newv((const gchar * const *)args->pdata,
 			G_SUBPROCESS_FLAGS_NONE, &ierror);
 	if (sproc == NULL) {
@@ -56,6 +58,7 @@ gboolean r_mount_full(const gchar *source, const gchar *mountpoint, const gchar*
 
 	res = TRUE;
 out:
+	r_context_trace_end(trace, res);
 	return res;
 }
 
@@ -69,6 +72,7 @@ gboolean r_umount(const gchar *filename, GError **error)
 {
 	g_autoptr(GSubprocess) sproc = NULL;
 	GError *ierror = NULL;
+	RaucTraceEvent *trace = NULL;
 	gboolean res = FALSE;
 	g_autoptr(GPtrArray) args = g_ptr_array_new_full(10, g_free);
 
@@ -81,6 +85,7 @@ gboolean r_umount(const gchar *filename, GError **error)
 	g_ptr_array_add(args, NULL);
 
 	r_debug_subprocess(args);
+	trace = r_context_trace_subprocess(args);
 	sproc = g_subprocess_newv((const gchar * const *)args->pdata,
 			G_SUBPROCESS_FLAGS_NONE, &ierror);
 	if (sproc == NULL) {
@@ -102,6 +107,7 @@ gboolean r_umount(const gchar *filename, GError **error)
 
 	res = TRUE;
 out:
+	r_context_trace_end(trace, res);
 	return res;
 }
 
@@ -136,11 +142,12 @@ out:
 	return mountpoint;
 }
 
-gboolean r_mount_slot(RaucSlot *slot, GError **error)
+static gboolean mount_slot(RaucSlot *slot, const gchar *options, GError **error)
 {
 	GError *ierror = NULL;
 	gboolean res = FALSE;
 	gchar *mount_point = NULL;
+	g_autofree gchar *mount_options = NULL;
 
 	g_assert_nonnull(slot);
 	g_assert_null(slot->mount_point);
@@ -165,7 +172,12 @@ gboolean r_mount_slot(RaucSlot *slot, GError **error)
 		goto out;
 	}
 
-	res = r_mount_full(slot->device, mount_point, slot->type, 0, slot->extra_mount_opts, &ierror);
+	if (options && slot->extra_mount_opts)
+		mount_options = g_strdup_printf("%s,%s", options, slot->extra_mount_opts);
+	else
+		mount_options = g_strdup(options ? options : slot->extra_mount_opts);
+
+	res = r_mount_full(slot->device, mount_point, slot->type, 0, mount_options, &ierror);
 	if (!res) {
 		res = FALSE;
 		g_propagate_prefixed_error(
@@ -183,6 +195,16 @@ out:
 	return res;
 }
 
+gboolean r_mount_slot(RaucSlot *slot, GError **error)
+{
+	return mount_slot(slot, NULL, error);
+}
+
+gboolean r_mount_slot_readonly(RaucSlot *slot, GError **error)
+{
+	return mount_slot(slot, "ro,noatime", error);
+}
+
 gboolean r_umount_slot(RaucSlot *slot, GError **error)
 {
 	GError *ierror = NULL;
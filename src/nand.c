@@ -0,0 +1,230 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <mtd/mtd-user.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "context.h"
+#include "install.h"
+#include "nand.h"
+
+G_DEFINE_QUARK(r-nand-error-quark, r_nand_error)
+
+static gssize read_full(int fd, guint8 *buf, gsize len)
+{
+	gsize done = 0;
+
+	while (done < len) {
+		ssize_t ret = read(fd, buf + done, len - done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (ret == 0)
+			break;
+		done += ret;
+	}
+
+	return done;
+}
+
+static gboolean block_is_bad(int fd, guint64 offset, GError **error)
+{
+	loff_t pos = offset;
+	int ret;
+
+	ret = ioctl(fd, MEMGETBADBLOCK, &pos);
+	if (ret < 0) {
+		/* flash without bad block support */
+		if (errno == EOPNOTSUPP)
+			return FALSE;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to get bad block status at 0x%" G_GINT64_MODIFIER "x: %s",
+				offset, g_strerror(errno));
+		return FALSE;
+	}
+
+	return ret > 0;
+}
+
+static void mark_block_bad(int fd, guint64 offset)
+{
+	loff_t pos = offset;
+
+	if (ioctl(fd, MEMSETBADBLOCK, &pos) < 0)
+		g_message("Failed to mark block at 0x%" G_GINT64_MODIFIER "x bad: %s",
+				offset, g_strerror(errno));
+}
+
+/* Erases a single block, writes and reads back the data */
+static gboolean write_block(int fd, const struct mtd_info_user *info, guint64 offset,
+		const guint8 *data, gsize len, guint8 *verify, GError **error)
+{
+	struct erase_info_user erase = {
+		.start = offset,
+		.length = info->erasesize,
+	};
+	gsize done = 0;
+
+	if (ioctl(fd, MEMERASE, &erase) < 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to erase block at 0x%" G_GINT64_MODIFIER "x: %s",
+				offset, g_strerror(errno));
+		return FALSE;
+	}
+
+	while (done < len) {
+		ssize_t ret = pwrite(fd, data + done, len - done, offset + done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+					"Failed to write block at 0x%" G_GINT64_MODIFIER "x: %s",
+					offset, g_strerror(errno));
+			return FALSE;
+		}
+		done += ret;
+	}
+
+	/* data read back is ECC corrected, so any difference is a failed write */
+	if (pread(fd, verify, len, offset) != (ssize_t) len || memcmp(data, verify, len) != 0) {
+		g_set_error(error, R_NAND_ERROR, R_NAND_ERROR_VERIFY,
+				"Verification of block at 0x%" G_GINT64_MODIFIER "x failed",
+				offset);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+gboolean r_nand_write_image(const gchar *image, const gchar *device,
+		const RaucChecksum *checksum, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GChecksum) ctx = NULL;
+	g_autofree guint8 *buf = NULL;
+	g_autofree guint8 *verify = NULL;
+	struct mtd_info_user info;
+	guint64 offset = 0;
+	gboolean res = FALSE;
+	int in_fd = -1, mtd_fd = -1;
+
+	g_return_val_if_fail(image, FALSE);
+	g_return_val_if_fail(device, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	mtd_fd = g_open(device, O_RDWR | O_CLOEXEC, 0);
+	if (mtd_fd < 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to open %s: %s", device, g_strerror(errno));
+		goto out;
+	}
+
+	if (ioctl(mtd_fd, MEMGETINFO, &info) < 0) {
+		g_set_error(error, R_NAND_ERROR, R_NAND_ERROR_NOT_SUPPORTED,
+				"%s is not an MTD device: %s", device, g_strerror(errno));
+		goto out;
+	}
+
+	if (info.type != MTD_NANDFLASH && info.type != MTD_MLCNANDFLASH) {
+		g_set_error(error, R_NAND_ERROR, R_NAND_ERROR_NOT_SUPPORTED,
+				"%s is not a NAND device", device);
+		goto out;
+	}
+
+	in_fd = g_open(image, O_RDONLY | O_CLOEXEC, 0);
+	if (in_fd < 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to open %s: %s", image, g_strerror(errno));
+		goto out;
+	}
+
+	buf = g_malloc(info.erasesize);
+	verify = g_malloc(info.erasesize);
+	if (checksum && checksum->digest)
+		ctx = g_checksum_new(checksum->type);
+
+	while (TRUE) {
+		gssize len;
+		gsize padded;
+
+		if (!install_checkpoint(&ierror)) {
+			g_propagate_prefixed_error(error, ierror,
+					"Stopped writing at offset 0x%" G_GINT64_MODIFIER "x: ", offset);
+			goto out;
+		}
+
+		len = read_full(in_fd, buf, info.erasesize);
+		if (len < 0) {
+			g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+					"Failed to read %s: %s", image, g_strerror(errno));
+			goto out;
+		} else if (len == 0) {
+			break;
+		}
+
+		if (ctx)
+			g_checksum_update(ctx, buf, len);
+
+		/* pad to full pages, as nandwrite --pad does */
+		padded = (len + info.writesize - 1) / info.writesize * info.writesize;
+		memset(buf + len, 0xff, padded - len);
+
+		/* find a block that takes the data */
+		while (TRUE) {
+			gboolean bad;
+
+			if (offset + info.erasesize > info.size) {
+				g_set_error(error, R_NAND_ERROR, R_NAND_ERROR_NO_SPACE,
+						"Image %s does not fit on %s", image, device);
+				goto out;
+			}
+
+			bad = block_is_bad(mtd_fd, offset, &ierror);
+			if (ierror) {
+				g_propagate_error(error, ierror);
+				goto out;
+			}
+			if (bad) {
+				g_message("Skipping bad block at 0x%" G_GINT64_MODIFIER "x", offset);
+				offset += info.erasesize;
+				continue;
+			}
+
+			if (write_block(mtd_fd, &info, offset, buf, padded, verify, &ierror))
+				break;
+
+			if (!g_error_matches(ierror, G_FILE_ERROR, G_FILE_ERROR_IO) &&
+			    !g_error_matches(ierror, R_NAND_ERROR, R_NAND_ERROR_VERIFY)) {
+				g_propagate_error(error, ierror);
+				goto out;
+			}
+
+			g_message("%s, marking block bad", ierror->message);
+			g_clear_error(&ierror);
+			mark_block_bad(mtd_fd, offset);
+			offset += info.erasesize;
+		}
+
+		offset += info.erasesize;
+		r_context_add_bytes(len);
+	}
+
+	if (ctx && g_strcmp0(g_checksum_get_string(ctx), checksum->digest) != 0) {
+		g_set_error(error, R_CHECKSUM_ERROR, R_CHECKSUM_ERROR_DIGEST_MISMATCH,
+				"Digest of data written to %s does not match", device);
+		goto out;
+	}
+
+	res = TRUE;
+
+out:
+	if (in_fd >= 0)
+		close(in_fd);
+	if (mtd_fd >= 0)
+		close(mtd_fd);
+	return res;
+}
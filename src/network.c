@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "context.h"
 #include "network.h"
 
 typedef struct {
@@ -18,6 +19,9 @@ typedef struct {
 
 	size_t pos;
 	size_t limit;
+
+	/* bytes already passed to progress accounting */
+	curl_off_t reported;
 } RaucTransfer;
 
 gboolean network_init(GError **error)
@@ -65,6 +69,13 @@ static int xfer_cb(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
 			return 1;
 	}
 
+	if (dltotal > 0)
+		r_context_set_bytes_total(dltotal);
+	if (dlnow > xfer->reported) {
+		r_context_add_bytes(dlnow - xfer->reported);
+		xfer->reported = dlnow;
+	}
+
 	return 0;
 }
 
@@ -91,6 +102,7 @@ static gboolean transfer(RaucTransfer *xfer, GError **error)
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, xfer);
 	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, xfer_cb);
 	curl_easy_setopt(curl, CURLOPT_XFERINFODATA, xfer);
+	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
 	curl_easy_setopt(curl, CURLOPT_FAILONERROR, xfer);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
 
@@ -1,4 +1,5 @@
 #include <gio/gio.h>
+#include <gio/gunixmounts.h>
 #include <glib-unix.h>
 #include <glib.h>
 #include <stdio.h>
@@ -17,6 +18,38 @@ GMainLoop *service_loop = NULL;
 RInstaller *r_installer = NULL;
 guint r_bus_name_id = 0;
 
+typedef struct {
+	guint id;
+	gchar *source;
+} RServiceJob;
+
+/* installations waiting to be started (RServiceJob) */
+static GQueue install_queue = G_QUEUE_INIT;
+static guint install_queue_last_id = 0;
+
+/* cached result of GetSlotStatus, NULL if it needs to be rebuilt */
+static GVariant *slot_status_snapshot = NULL;
+/* mounts present when the snapshot was taken */
+static gchar *slot_status_mounts = NULL;
+/* cached result of GetPrimary, invalidated together with the snapshot */
+static gchar *primary_snapshot = NULL;
+static GUnixMountMonitor *mount_monitor = NULL;
+
+static void service_invalidate_slot_status(void)
+{
+	g_clear_pointer(&slot_status_snapshot, g_variant_unref);
+	g_clear_pointer(&slot_status_mounts, g_free);
+	g_clear_pointer(&primary_snapshot, g_free);
+}
+
+static void service_job_free(RServiceJob *job)
+{
+	g_free(job->source);
+	g_free(job);
+}
+
+static gboolean service_queue_next(gpointer data);
+
 static gboolean service_install_notify(gpointer data)
 {
 	RaucInstallArgs *args = data;
@@ -48,40 +81,79 @@ static gboolean service_install_cleanup(gpointer data)
 
 	install_args_free(args);
 
+	/* slot and boot states have changed */
+	service_invalidate_slot_status();
+
+	/* runs after the context is not busy anymore */
+	if (!g_queue_is_empty(&install_queue))
+		g_idle_add(service_queue_next, NULL);
+
 	return G_SOURCE_REMOVE;
 }
 
-static gboolean r_on_handle_install(RInstaller *interface,
-		GDBusMethodInvocation  *invocation,
-		const gchar *source)
+static gboolean service_start_install(const gchar *source)
 {
 	RaucInstallArgs *args = install_args_new();
 	gboolean res;
 
-	g_print("input bundle: %s\n", source);
-
-	res = !r_context_get_busy();
-	if (!res)
-		goto out;
-
 	args->name = g_strdup(source);
 	args->notify = service_install_notify;
 	args->cleanup = service_install_cleanup;
 
+	service_invalidate_slot_status();
+
 	r_installer_set_operation(r_installer, "installing");
 	g_dbus_interface_skeleton_flush(G_DBUS_INTERFACE_SKELETON(r_installer));
 	res = install_run(args);
 	if (!res) {
-		goto out;
+		r_installer_set_operation(r_installer, "idle");
+		g_clear_pointer(&args, g_free);
 	}
-	args = NULL;
+
+	return res;
+}
+
+/* Starts the next queued installation, if any */
+static gboolean service_queue_next(gpointer data)
+{
+	RServiceJob *job;
+
+	if (r_context_get_busy())
+		return G_SOURCE_REMOVE;
+
+	while ((job = g_queue_pop_head(&install_queue))) {
+		gboolean res;
+
+		g_message("starting queued installation %u: %s", job->id, job->source);
+		res = service_start_install(job->source);
+		if (!res)
+			g_message("failed to start queued installation %u", job->id);
+		service_job_free(job);
+		if (res)
+			break;
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean r_on_handle_install(RInstaller *interface,
+		GDBusMethodInvocation  *invocation,
+		const gchar *source)
+{
+	gboolean res;
+
+	g_print("input bundle: %s\n", source);
+
+	res = !r_context_get_busy();
+	if (!res)
+		goto out;
+
+	res = service_start_install(source);
 
 out:
-	g_clear_pointer(&args, g_free);
 	if (res) {
 		r_installer_complete_install(interface, invocation);
 	} else {
-		r_installer_set_operation(r_installer, "idle");
 		g_dbus_method_invocation_return_error(invocation,
 				G_IO_ERROR,
 				G_IO_ERROR_FAILED_HANDLED,
@@ -91,6 +163,131 @@ out:
 	return TRUE;
 }
 
+static gboolean r_on_handle_cancel(RInstaller *interface,
+		GDBusMethodInvocation  *invocation)
+{
+	if (!install_cancel()) {
+		g_dbus_method_invocation_return_error(invocation,
+				G_IO_ERROR,
+				G_IO_ERROR_FAILED_HANDLED,
+				"no installation running");
+		return TRUE;
+	}
+
+	r_installer_complete_cancel(interface, invocation);
+
+	return TRUE;
+}
+
+static gboolean r_on_handle_pause(RInstaller *interface,
+		GDBusMethodInvocation  *invocation)
+{
+	if (!install_set_paused(TRUE)) {
+		g_dbus_method_invocation_return_error(invocation,
+				G_IO_ERROR,
+				G_IO_ERROR_FAILED_HANDLED,
+				"no installation running");
+		return TRUE;
+	}
+
+	r_installer_set_operation(r_installer, "paused");
+	g_dbus_interface_skeleton_flush(G_DBUS_INTERFACE_SKELETON(r_installer));
+	r_installer_complete_pause(interface, invocation);
+
+	return TRUE;
+}
+
+static gboolean r_on_handle_resume(RInstaller *interface,
+		GDBusMethodInvocation  *invocation)
+{
+	if (!install_set_paused(FALSE)) {
+		g_dbus_method_invocation_return_error(invocation,
+				G_IO_ERROR,
+				G_IO_ERROR_FAILED_HANDLED,
+				"no installation running");
+		return TRUE;
+	}
+
+	r_installer_set_operation(r_installer, "installing");
+	g_dbus_interface_skeleton_flush(G_DBUS_INTERFACE_SKELETON(r_installer));
+	r_installer_complete_resume(interface, invocation);
+
+	return TRUE;
+}
+
+static gboolean r_on_handle_queue_install(RInstaller *interface,
+		GDBusMethodInvocation  *invocation,
+		const gchar *source)
+{
+	g_autofree gchar *scheme = g_uri_parse_scheme(source);
+	RServiceJob *job;
+
+	g_print("queued bundle: %s\n", source);
+
+	/* reject obviously wrong local paths now instead of when the job
+	 * is started */
+	if (!scheme && !g_file_test(source, G_FILE_TEST_IS_REGULAR)) {
+		g_dbus_method_invocation_return_error(invocation,
+				G_IO_ERROR,
+				G_IO_ERROR_NOT_FOUND,
+				"Bundle %s not found", source);
+		return TRUE;
+	}
+
+	job = g_new0(RServiceJob, 1);
+	job->id = ++install_queue_last_id;
+	job->source = g_strdup(source);
+	g_queue_push_tail(&install_queue, job);
+
+	r_installer_complete_queue_install(interface, invocation, job->id);
+
+	service_queue_next(NULL);
+
+	return TRUE;
+}
+
+static gboolean r_on_handle_get_queue(RInstaller *interface,
+		GDBusMethodInvocation  *invocation)
+{
+	GVariantBuilder builder;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(us)"));
+	for (GList *l = install_queue.head; l != NULL; l = l->next) {
+		RServiceJob *job = l->data;
+
+		g_variant_builder_add(&builder, "(us)", job->id, job->source);
+	}
+
+	r_installer_complete_get_queue(interface, invocation, g_variant_builder_end(&builder));
+
+	return TRUE;
+}
+
+static gboolean r_on_handle_cancel_queued(RInstaller *interface,
+		GDBusMethodInvocation  *invocation,
+		guint id)
+{
+	for (GList *l = install_queue.head; l != NULL; l = l->next) {
+		RServiceJob *job = l->data;
+
+		if (job->id != id)
+			continue;
+
+		g_message("removed queued installation %u: %s", job->id, job->source);
+		g_queue_delete_link(&install_queue, l);
+		service_job_free(job);
+		r_installer_complete_cancel_queued(interface, invocation);
+		return TRUE;
+	}
+
+	g_dbus_method_invocation_return_error(invocation,
+			G_IO_ERROR,
+			G_IO_ERROR_NOT_FOUND,
+			"No queued installation with id %u", id);
+
+	return TRUE;
+}
+
 
 static gboolean r_on_handle_info(RInstaller *interface,
 		GDBusMethodInvocation  *invocation,
@@ -186,6 +383,7 @@ static gboolean r_on_handle_mark(RInstaller *interface,
 	}
 
 	res = mark_run(arg_state, arg_slot_identifier, &slot_name, &message);
+	service_invalidate_slot_status();
 
 out:
 	if (res) {
@@ -267,8 +465,48 @@ static GVariant* convert_slot_status_to_dict(RaucSlot *slot)
 	return g_variant_dict_end(&dict);
 }
 
+/*
+ * Returns a string describing all current mounts. Used to detect whether a
+ * mount change affects the slot status snapshot or was only caused by
+ * temporarily mounting slots.
+ */
+static gchar* get_mounts_fingerprint(void)
+{
+	GList *mountlist = g_unix_mounts_get(NULL);
+	GString *fingerprint = g_string_new(NULL);
+
+	for (GList *l = mountlist; l != NULL; l = l->next) {
+		GUnixMountEntry *m = (GUnixMountEntry*)l->data;
+
+		g_string_append_printf(fingerprint, "%s %s\n",
+				g_unix_mount_get_device_path(m),
+				g_unix_mount_get_mount_path(m));
+	}
+	g_list_free_full(mountlist, (GDestroyNotify)g_unix_mount_free);
+
+	return g_string_free(fingerprint, FALSE);
+}
+
+static void r_on_mounts_changed(GUnixMountMonitor *monitor, gpointer user_data)
+{
+	g_autofree gchar *mounts = NULL;
+
+	if (!slot_status_snapshot && !primary_snapshot)
+		return;
+
+	mounts = get_mounts_fingerprint();
+	if (!slot_status_mounts || g_strcmp0(mounts, slot_status_mounts) != 0) {
+		g_debug("Mounts changed, invalidating slot status snapshot");
+		service_invalidate_slot_status();
+	}
+}
+
 /*
  * Makes slot status information available via DBUS.
+ *
+ * The result is cached until the mounts change or the service installs or
+ * marks slots, unless the slot or boot states could not be determined.
+ * Returns a new reference.
  */
 static GVariant* create_slotstatus_array(void)
 {
@@ -278,25 +516,35 @@ static GVariant* create_slotstatus_array(void)
 	gint slot_count = 0;
 	GError *ierror = NULL;
 	gboolean res = FALSE;
+	gboolean complete = TRUE;
 	GHashTableIter iter;
 	RaucSlot *slot;
+	g_autoptr(GList) slots = NULL;
 
 	g_return_val_if_fail(r_installer, NULL);
 
+	if (slot_status_snapshot)
+		return g_variant_ref(slot_status_snapshot);
+
 	slot_status_tuples = g_new(GVariant*, slot_number);
 
 	res = determine_slot_states(&ierror);
 	if (!res) {
 		g_debug("Failed to determine slot states: %s\n", ierror->message);
 		g_clear_error(&ierror);
+		complete = FALSE;
 	}
 
 	res = determine_boot_states(&ierror);
 	if (!res) {
 		g_debug("Failed to determine boot states: %s\n", ierror->message);
 		g_clear_error(&ierror);
+		complete = FALSE;
 	}
 
+	slots = g_hash_table_get_values(r_context()->config->slots);
+	load_slot_status_multi(slots);
+
 	g_hash_table_iter_init(&iter, r_context()->config->slots);
 	while (g_hash_table_iter_next(&iter, NULL, (gpointer*) &slot)) {
 		GVariant* slot_status[2];
@@ -312,7 +560,14 @@ static GVariant* create_slotstatus_array(void)
 	slot_status_array = g_variant_new_array(G_VARIANT_TYPE("(sa{sv})"), slot_status_tuples, slot_number);
 	g_free(slot_status_tuples);
 
-	return slot_status_array;
+	/* retry on the next call instead of caching a partial result */
+	if (!complete)
+		return g_variant_ref_sink(slot_status_array);
+
+	slot_status_snapshot = g_variant_ref_sink(slot_status_array);
+	slot_status_mounts = get_mounts_fingerprint();
+
+	return g_variant_ref(slot_status_snapshot);
 }
 
 static gboolean r_on_handle_get_slot_status(RInstaller *interface,
@@ -323,7 +578,9 @@ static gboolean r_on_handle_get_slot_status(RInstaller *interface,
 	res = !r_context_get_busy();
 
 	if (res) {
-		r_installer_complete_get_slot_status(interface, invocation, create_slotstatus_array());
+		g_autoptr(GVariant) slot_status_array = create_slotstatus_array();
+
+		r_installer_complete_get_slot_status(interface, invocation, slot_status_array);
 	} else {
 		g_dbus_method_invocation_return_error(invocation,
 				G_IO_ERROR,
@@ -348,6 +605,11 @@ static gboolean r_on_handle_get_primary(RInstaller *interface,
 		return TRUE;
 	}
 
+	if (primary_snapshot) {
+		r_installer_complete_get_primary(interface, invocation, primary_snapshot);
+		return TRUE;
+	}
+
 	primary = r_boot_get_primary(&ierror);
 	if (!primary) {
 		g_dbus_method_invocation_return_error(invocation,
@@ -359,11 +621,30 @@ static gboolean r_on_handle_get_primary(RInstaller *interface,
 		return TRUE;
 	}
 
+	primary_snapshot = g_strdup(primary->name);
 	r_installer_complete_get_primary(interface, invocation, primary->name);
 
 	return TRUE;
 }
 
+static gboolean r_on_handle_get_trace(RInstaller *interface,
+		GDBusMethodInvocation  *invocation)
+{
+	g_autofree gchar *trace = r_context_trace_to_json();
+
+	if (!trace) {
+		g_dbus_method_invocation_return_error(invocation,
+				G_IO_ERROR,
+				G_IO_ERROR_NOT_FOUND,
+				"No installation trace recorded");
+		return TRUE;
+	}
+
+	r_installer_complete_get_trace(interface, invocation, trace);
+
+	return TRUE;
+}
+
 static gboolean auto_install(const gchar *source)
 {
 	RaucInstallArgs *args = install_args_new();
@@ -418,6 +699,16 @@ static void send_progress_callback(gint percentage,
 	g_dbus_interface_skeleton_flush(G_DBUS_INTERFACE_SKELETON(r_installer));
 }
 
+static void send_progress_bytes_callback(guint64 bytes_done,
+		guint64 bytes_total,
+		guint64 throughput,
+		gint64 eta)
+{
+	r_installer_set_progress_bytes(r_installer,
+			g_variant_new("(tttx)", bytes_done, bytes_total, throughput, eta));
+	g_dbus_interface_skeleton_flush(G_DBUS_INTERFACE_SKELETON(r_installer));
+}
+
 static void r_on_bus_acquired(GDBusConnection *connection,
 		const gchar     *name,
 		gpointer user_data)
@@ -430,6 +721,30 @@ static void r_on_bus_acquired(GDBusConnection *connection,
 			G_CALLBACK(r_on_handle_install),
 			NULL);
 
+	g_signal_connect(r_installer, "handle-cancel",
+			G_CALLBACK(r_on_handle_cancel),
+			NULL);
+
+	g_signal_connect(r_installer, "handle-pause",
+			G_CALLBACK(r_on_handle_pause),
+			NULL);
+
+	g_signal_connect(r_installer, "handle-resume",
+			G_CALLBACK(r_on_handle_resume),
+			NULL);
+
+	g_signal_connect(r_installer, "handle-queue-install",
+			G_CALLBACK(r_on_handle_queue_install),
+			NULL);
+
+	g_signal_connect(r_installer, "handle-get-queue",
+			G_CALLBACK(r_on_handle_get_queue),
+			NULL);
+
+	g_signal_connect(r_installer, "handle-cancel-queued",
+			G_CALLBACK(r_on_handle_cancel_queued),
+			NULL);
+
 	g_signal_connect(r_installer, "handle-info",
 			G_CALLBACK(r_on_handle_info),
 			NULL);
@@ -446,7 +761,12 @@ static void r_on_bus_acquired(GDBusConnection *connection,
 			G_CALLBACK(r_on_handle_get_primary),
 			NULL);
 
+	g_signal_connect(r_installer, "handle-get-trace",
+			G_CALLBACK(r_on_handle_get_trace),
+			NULL);
+
 	r_context_register_progress_callback(send_progress_callback);
+	r_context_register_progress_bytes_callback(send_progress_bytes_callback);
 
 	// Set initial Operation status to "idle"
 	r_installer_set_operation(r_installer, "idle");
@@ -520,6 +840,10 @@ gboolean r_service_run(void)
 	service_loop = g_main_loop_new(NULL, FALSE);
 	g_unix_signal_add(SIGTERM, r_on_signal, NULL);
 
+	mount_monitor = g_unix_mount_monitor_get();
+	g_signal_connect(mount_monitor, "mounts-changed",
+			G_CALLBACK(r_on_mounts_changed), NULL);
+
 	r_bus_name_id = g_bus_own_name(bus_type,
 			"de.pengutronix.rauc",
 			G_BUS_NAME_OWNER_FLAGS_NONE,
@@ -536,5 +860,12 @@ gboolean r_service_run(void)
 	g_main_loop_unref(service_loop);
 	service_loop = NULL;
 
+	g_clear_object(&mount_monitor);
+	service_invalidate_slot_status();
+
+	/* queued installations are not persistent */
+	while (!g_queue_is_empty(&install_queue))
+		service_job_free(g_queue_pop_head(&install_queue));
+
 	return service_return;
 }
@@ -0,0 +1,273 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "status_store.h"
+
+/* each record is '\n#record <length> <md5>\n' followed by <length> bytes of
+ * key file data, the leading newline allows finding the next record after a
+ * torn one */
+#define RECORD_MAGIC "#record "
+
+static gchar *journal_path(const gchar *path)
+{
+	return g_strconcat(path, ".journal", NULL);
+}
+
+static void merge_record(GKeyFile *key_file, GKeyFile *record)
+{
+	g_auto(GStrv) groups = g_key_file_get_groups(record, NULL);
+
+	for (gchar **group = groups; *group; group++) {
+		g_auto(GStrv) keys = g_key_file_get_keys(record, *group, NULL, NULL);
+
+		g_key_file_remove_group(key_file, *group, NULL);
+		for (gchar **key = keys; keys && *key; key++) {
+			g_autofree gchar *value = g_key_file_get_value(record, *group, *key, NULL);
+
+			g_key_file_set_value(key_file, *group, *key, value);
+		}
+	}
+}
+
+/* Parses a record at data[*pos] and advances *pos past it. Returns FALSE if
+ * the record is incomplete or corrupt. */
+static gboolean parse_record(GKeyFile *key_file, const gchar *data, gsize len, gsize *pos)
+{
+	g_autoptr(GKeyFile) record = NULL;
+	g_autofree gchar *header = NULL;
+	g_autofree gchar *digest = NULL;
+	g_auto(GStrv) fields = NULL;
+	const gchar *nl;
+	guint64 size;
+
+	nl = memchr(data + *pos, '\n', len - *pos);
+	if (!nl)
+		return FALSE;
+
+	header = g_strndup(data + *pos, nl - (data + *pos));
+	fields = g_strsplit(header + strlen(RECORD_MAGIC), " ", 2);
+	if (g_strv_length(fields) != 2)
+		return FALSE;
+
+	size = g_ascii_strtoull(fields[0], NULL, 10);
+	if (size > len - (nl + 1 - data))
+		return FALSE;
+
+	digest = g_compute_checksum_for_data(G_CHECKSUM_MD5, (const guchar *) nl + 1, size);
+	if (g_strcmp0(digest, fields[1]) != 0)
+		return FALSE;
+
+	record = g_key_file_new();
+	if (!g_key_file_load_from_data(record, nl + 1, size, G_KEY_FILE_NONE, NULL))
+		return FALSE;
+
+	merge_record(key_file, record);
+	*pos = nl + 1 - data + size;
+
+	return TRUE;
+}
+
+static void replay_journal(GKeyFile *key_file, const gchar *data, gsize len)
+{
+	gsize pos = 0;
+
+	while (pos < len) {
+		const gchar *next;
+
+		if (data[pos] == '\n') {
+			pos++;
+			continue;
+		}
+
+		if (g_str_has_prefix(data + pos, RECORD_MAGIC) &&
+		    parse_record(key_file, data, len, &pos))
+			continue;
+
+		/* skip to the next record after a torn write */
+		g_message("Skipping corrupt status journal record at offset %" G_GSIZE_FORMAT, pos);
+		next = g_strstr_len(data + pos + 1, len - pos - 1, "\n" RECORD_MAGIC);
+		if (!next)
+			break;
+		pos = next + 1 - data;
+	}
+}
+
+GKeyFile *r_status_store_load(const gchar *path, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GKeyFile) key_file = g_key_file_new();
+	g_autofree gchar *journal = NULL;
+	g_autofree gchar *data = NULL;
+	gsize len;
+
+	g_return_val_if_fail(path, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	if (!g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE, &ierror)) {
+		if (!g_error_matches(ierror, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+			g_propagate_error(error, ierror);
+			return NULL;
+		}
+		g_clear_error(&ierror);
+	}
+
+	journal = journal_path(path);
+	if (!g_file_get_contents(journal, &data, &len, &ierror)) {
+		if (!g_error_matches(ierror, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+			g_propagate_error(error, ierror);
+			return NULL;
+		}
+		g_clear_error(&ierror);
+		return g_steal_pointer(&key_file);
+	}
+
+	replay_journal(key_file, data, len);
+
+	return g_steal_pointer(&key_file);
+}
+
+static gboolean write_all(int fd, const gchar *data, gsize len)
+{
+	while (len > 0) {
+		ssize_t ret = write(fd, data, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		data += ret;
+		len -= ret;
+	}
+
+	return TRUE;
+}
+
+/* makes creating, renaming or removing a file in dirname(path) persistent */
+static void sync_parent_dir(const gchar *path)
+{
+	g_autofree gchar *dirname = g_path_get_dirname(path);
+	int dirfd;
+
+	dirfd = g_open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+	if (dirfd >= 0) {
+		fsync(dirfd);
+		close(dirfd);
+	}
+}
+
+gboolean r_status_store_append(const gchar *path, GKeyFile *record, GError **error)
+{
+	g_autofree gchar *journal = NULL;
+	g_autofree gchar *data = NULL;
+	g_autofree gchar *digest = NULL;
+	g_autoptr(GString) entry = NULL;
+	gboolean created;
+	struct stat st;
+	gsize len;
+	int fd;
+
+	g_return_val_if_fail(path, FALSE);
+	g_return_val_if_fail(record, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	data = g_key_file_to_data(record, &len, NULL);
+	digest = g_compute_checksum_for_data(G_CHECKSUM_MD5, (const guchar *) data, len);
+	entry = g_string_new(NULL);
+	g_string_printf(entry, "\n" RECORD_MAGIC "%" G_GSIZE_FORMAT " %s\n", len, digest);
+	g_string_append_len(entry, data, len);
+
+	journal = journal_path(path);
+	created = !g_file_test(journal, G_FILE_TEST_EXISTS);
+	fd = g_open(journal, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to open %s: %s", journal, g_strerror(errno));
+		return FALSE;
+	}
+
+	/* one write per record, synced before reporting success */
+	if (!write_all(fd, entry->str, entry->len) || fdatasync(fd) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to write %s: %s", journal, g_strerror(errno));
+		close(fd);
+		return FALSE;
+	}
+
+	if (fstat(fd, &st) != 0)
+		st.st_size = 0;
+	close(fd);
+
+	if (created)
+		sync_parent_dir(journal);
+
+	if (st.st_size > R_STATUS_STORE_MAX_JOURNAL_SIZE)
+		return r_status_store_commit(path, error);
+
+	return TRUE;
+}
+
+gboolean r_status_store_commit(const gchar *path, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GKeyFile) key_file = NULL;
+	g_autofree gchar *journal = NULL;
+	g_autofree gchar *tmppath = NULL;
+	g_autofree gchar *data = NULL;
+	gsize len;
+	int fd;
+
+	g_return_val_if_fail(path, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	journal = journal_path(path);
+	if (!g_file_test(journal, G_FILE_TEST_EXISTS))
+		return TRUE;
+
+	key_file = r_status_store_load(path, &ierror);
+	if (!key_file) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+	data = g_key_file_to_data(key_file, &len, NULL);
+
+	/* 1. write and sync the new key file next to the old one */
+	tmppath = g_strconcat(path, ".new", NULL);
+	fd = g_open(tmppath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to open %s: %s", tmppath, g_strerror(errno));
+		return FALSE;
+	}
+
+	if (!write_all(fd, data, len) || fsync(fd) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to write %s: %s", tmppath, g_strerror(errno));
+		close(fd);
+		g_remove(tmppath);
+		return FALSE;
+	}
+	close(fd);
+
+	/* 2. replace the key file, the journal still applies on top of it */
+	if (g_rename(tmppath, path) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to rename %s: %s", tmppath, g_strerror(errno));
+		g_remove(tmppath);
+		return FALSE;
+	}
+	sync_parent_dir(path);
+
+	/* 3. only now the journal can be dropped */
+	if (g_remove(journal) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to remove %s: %s", journal, g_strerror(errno));
+		return FALSE;
+	}
+	sync_parent_dir(journal);
+
+	return TRUE;
+}
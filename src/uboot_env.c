@@ -0,0 +1,361 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "uboot_env.h"
+
+G_DEFINE_QUARK(r-uboot-env-error-quark, r_uboot_env_error)
+
+typedef struct {
+	gchar *device;
+	guint64 offset;
+	gsize size;
+} RUbootEnvCopy;
+
+struct _RUbootEnv {
+	RUbootEnvCopy copies[2];
+	/* 1 for a single, 2 for a redundant environment */
+	guint ncopies;
+	/* copy the environment was loaded from */
+	guint current;
+	/* flags of current copy (redundant environment only) */
+	guint8 flags;
+	GHashTable *vars;
+};
+
+static guint32 crc32_table[256];
+
+static guint32 uboot_env_crc32(const guint8 *data, gsize len)
+{
+	guint32 crc = 0xffffffff;
+
+	if (crc32_table[1] == 0) {
+		for (guint32 i = 0; i < 256; i++) {
+			guint32 c = i;
+			for (gint k = 0; k < 8; k++)
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			crc32_table[i] = c;
+		}
+	}
+
+	for (gsize i = 0; i < len; i++)
+		crc = crc32_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+	return crc ^ 0xffffffff;
+}
+
+static gsize uboot_env_header_size(RUbootEnv *env)
+{
+	/* CRC32, followed by flags byte for redundant environments */
+	return env->ncopies == 2 ? 5 : 4;
+}
+
+static gboolean parse_fw_env_config(RUbootEnv *env, const gchar *config_path, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *contents = NULL;
+	g_auto(GStrv) lines = NULL;
+
+	if (!g_file_get_contents(config_path, &contents, NULL, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	lines = g_strsplit(contents, "\n", -1);
+	for (gchar **line = lines; *line; line++) {
+		g_auto(GStrv) fields = NULL;
+		RUbootEnvCopy *copy;
+		guint nfields;
+
+		g_strstrip(*line);
+		if (**line == '\0' || **line == '#')
+			continue;
+
+		fields = g_regex_split_simple("\\s+", *line, 0, 0);
+		nfields = g_strv_length(fields);
+		if (nfields < 3) {
+			g_set_error(error, R_UBOOT_ENV_ERROR, R_UBOOT_ENV_ERROR_CONFIG,
+					"Invalid line in %s: '%s'", config_path, *line);
+			return FALSE;
+		}
+
+		if (env->ncopies == 2) {
+			g_set_error(error, R_UBOOT_ENV_ERROR, R_UBOOT_ENV_ERROR_CONFIG,
+					"More than two environment copies in %s", config_path);
+			return FALSE;
+		}
+
+		/* MTD flash needs to be erased before writing, which is left to
+		 * fw_setenv */
+		if (g_str_has_prefix(fields[0], "/dev/mtd")) {
+			g_set_error(error, R_UBOOT_ENV_ERROR, R_UBOOT_ENV_ERROR_NOT_SUPPORTED,
+					"MTD environment storage %s not supported", fields[0]);
+			return FALSE;
+		}
+
+		copy = &env->copies[env->ncopies++];
+		copy->device = g_strdup(fields[0]);
+		copy->offset = g_ascii_strtoull(fields[1], NULL, 0);
+		copy->size = g_ascii_strtoull(fields[2], NULL, 0);
+		if (copy->size <= 5) {
+			g_set_error(error, R_UBOOT_ENV_ERROR, R_UBOOT_ENV_ERROR_CONFIG,
+					"Invalid environment size in %s: '%s'", config_path, fields[2]);
+			return FALSE;
+		}
+	}
+
+	if (env->ncopies == 0) {
+		g_set_error(error, R_UBOOT_ENV_ERROR, R_UBOOT_ENV_ERROR_CONFIG,
+				"No environment configured in %s", config_path);
+		return FALSE;
+	}
+
+	if (env->ncopies == 2 && env->copies[0].size != env->copies[1].size) {
+		g_set_error(error, R_UBOOT_ENV_ERROR, R_UBOOT_ENV_ERROR_CONFIG,
+				"Redundant environment copies differ in size in %s", config_path);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Reads a copy and returns its data area if the CRC matches */
+static guint8 *read_env_copy(RUbootEnv *env, guint index, guint8 *flags, GError **error)
+{
+	RUbootEnvCopy *copy = &env->copies[index];
+	gsize header = uboot_env_header_size(env);
+	g_autofree guint8 *buf = g_malloc(copy->size);
+	guint8 *data;
+	guint32 crc;
+	ssize_t ret;
+	int fd;
+
+	fd = g_open(copy->device, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to open %s: %s", copy->device, g_strerror(errno));
+		return NULL;
+	}
+
+	ret = pread(fd, buf, copy->size, copy->offset);
+	close(fd);
+	if (ret != (ssize_t) copy->size) {
+		g_set_error(error, R_UBOOT_ENV_ERROR, R_UBOOT_ENV_ERROR_FAILED,
+				"Failed to read environment from %s", copy->device);
+		return NULL;
+	}
+
+	memcpy(&crc, buf, sizeof(crc));
+	if (GUINT32_FROM_LE(crc) != uboot_env_crc32(buf + header, copy->size - header)) {
+		g_set_error(error, R_UBOOT_ENV_ERROR, R_UBOOT_ENV_ERROR_BAD_CRC,
+				"Bad CRC in environment on %s at offset 0x%" G_GINT64_MODIFIER "x",
+				copy->device, copy->offset);
+		return NULL;
+	}
+
+	if (flags && header == 5)
+		*flags = buf[4];
+
+	data = g_malloc(copy->size - header);
+	memcpy(data, buf + header, copy->size - header);
+
+	return data;
+}
+
+static void parse_env_data(RUbootEnv *env, const guint8 *data, gsize len)
+{
+	gsize pos = 0;
+
+	/* data is a list of 'key=value\0' entries, terminated by '\0' */
+	while (pos < len && data[pos] != '\0') {
+		const gchar *entry = (const gchar *) data + pos;
+		gsize entrylen = strnlen(entry, len - pos);
+		const gchar *sep = memchr(entry, '=', entrylen);
+
+		if (sep)
+			g_hash_table_insert(env->vars,
+					g_strndup(entry, sep - entry),
+					g_strndup(sep + 1, entrylen - (sep - entry) - 1));
+
+		pos += entrylen + 1;
+	}
+}
+
+/* Returns TRUE if flags a denote a more recent copy than flags b */
+static gboolean flags_newer(guint8 a, guint8 b)
+{
+	/* counter wraps around */
+	if (a == 0 && b == 0xff)
+		return TRUE;
+	if (a == 0xff && b == 0)
+		return FALSE;
+	return a > b;
+}
+
+RUbootEnv *r_uboot_env_load(const gchar *config_path, GError **error)
+{
+	GError *ierror = NULL;
+	RUbootEnv *env = NULL;
+	guint8 *data[2] = {NULL, NULL};
+	guint8 flags[2] = {0, 0};
+
+	g_return_val_if_fail(config_path, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	env = g_new0(RUbootEnv, 1);
+	env->vars = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+	if (!parse_fw_env_config(env, config_path, &ierror)) {
+		g_propagate_error(error, ierror);
+		g_clear_pointer(&env, r_uboot_env_free);
+		goto out;
+	}
+
+	for (guint i = 0; i < env->ncopies; i++) {
+		data[i] = read_env_copy(env, i, &flags[i], &ierror);
+		if (!data[i]) {
+			if (!g_error_matches(ierror, R_UBOOT_ENV_ERROR, R_UBOOT_ENV_ERROR_BAD_CRC)) {
+				g_propagate_error(error, ierror);
+				g_clear_pointer(&env, r_uboot_env_free);
+				goto out;
+			}
+			g_debug("%s", ierror->message);
+			g_clear_error(&ierror);
+		}
+	}
+
+	if (data[0] && data[1]) {
+		env->current = flags_newer(flags[1], flags[0]) ? 1 : 0;
+	} else if (data[1]) {
+		env->current = 1;
+	} else if (data[0]) {
+		env->current = 0;
+	} else {
+		g_set_error(error, R_UBOOT_ENV_ERROR, R_UBOOT_ENV_ERROR_BAD_CRC,
+				"No valid U-Boot environment found in %s", env->copies[0].device);
+		g_clear_pointer(&env, r_uboot_env_free);
+		goto out;
+	}
+
+	env->flags = flags[env->current];
+	parse_env_data(env, data[env->current],
+			env->copies[env->current].size - uboot_env_header_size(env));
+
+out:
+	g_free(data[0]);
+	g_free(data[1]);
+	return env;
+}
+
+const gchar *r_uboot_env_get(RUbootEnv *env, const gchar *key)
+{
+	g_return_val_if_fail(env, NULL);
+	g_return_val_if_fail(key, NULL);
+
+	return g_hash_table_lookup(env->vars, key);
+}
+
+GList *r_uboot_env_get_keys(RUbootEnv *env)
+{
+	g_return_val_if_fail(env, NULL);
+
+	return g_hash_table_get_keys(env->vars);
+}
+
+void r_uboot_env_set(RUbootEnv *env, const gchar *key, const gchar *value)
+{
+	g_return_if_fail(env);
+	g_return_if_fail(key);
+
+	if (value)
+		g_hash_table_insert(env->vars, g_strdup(key), g_strdup(value));
+	else
+		g_hash_table_remove(env->vars, key);
+}
+
+gboolean r_uboot_env_save(RUbootEnv *env, GError **error)
+{
+	gsize header, pos;
+	guint target;
+	RUbootEnvCopy *copy;
+	g_autofree guint8 *buf = NULL;
+	g_autoptr(GList) keys = NULL;
+	guint32 crc;
+	ssize_t ret;
+	int fd;
+
+	g_return_val_if_fail(env, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	header = uboot_env_header_size(env);
+	target = env->ncopies == 2 ? 1 - env->current : 0;
+	copy = &env->copies[target];
+	buf = g_malloc0(copy->size);
+
+	/* U-Boot exports its environment sorted by name as well */
+	keys = g_list_sort(g_hash_table_get_keys(env->vars), (GCompareFunc) g_strcmp0);
+	pos = header;
+	for (GList *l = keys; l != NULL; l = l->next) {
+		const gchar *key = l->data;
+		const gchar *value = g_hash_table_lookup(env->vars, key);
+		gsize keylen = strlen(key), valuelen = strlen(value);
+
+		/* keep room for the terminating '\0' of the list */
+		if (pos + keylen + valuelen + 2 >= copy->size) {
+			g_set_error(error, R_UBOOT_ENV_ERROR, R_UBOOT_ENV_ERROR_TOO_LARGE,
+					"Environment exceeds size of %" G_GSIZE_FORMAT " bytes", copy->size);
+			return FALSE;
+		}
+
+		memcpy(buf + pos, key, keylen);
+		pos += keylen;
+		buf[pos++] = '=';
+		memcpy(buf + pos, value, valuelen);
+		pos += valuelen + 1;
+	}
+
+	if (header == 5)
+		buf[4] = env->flags + 1;
+	crc = GUINT32_TO_LE(uboot_env_crc32(buf + header, copy->size - header));
+	memcpy(buf, &crc, sizeof(crc));
+
+	fd = g_open(copy->device, O_WRONLY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to open %s: %s", copy->device, g_strerror(errno));
+		return FALSE;
+	}
+
+	ret = pwrite(fd, buf, copy->size, copy->offset);
+	if (ret != (ssize_t) copy->size || fsync(fd) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to write environment to %s: %s", copy->device, g_strerror(errno));
+		close(fd);
+		return FALSE;
+	}
+
+	if (close(fd) != 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"Failed to close %s: %s", copy->device, g_strerror(errno));
+		return FALSE;
+	}
+
+	if (header == 5)
+		env->flags++;
+	env->current = target;
+
+	return TRUE;
+}
+
+void r_uboot_env_free(RUbootEnv *env)
+{
+	if (!env)
+		return;
+
+	for (guint i = 0; i < env->ncopies; i++)
+		g_free(env->copies[i].device);
+	g_clear_pointer(&env->vars, g_hash_table_destroy);
+	g_free(env);
+}
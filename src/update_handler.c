@@ -1,17 +1,26 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <glib/gstdio.h>
 #include <gio/gunixoutputstream.h>
 #include <mtd/ubi-user.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
+#include <unistd.h>
 
+#include "chunk_cache.h"
 #include "context.h"
+#include "hash_tree.h"
+#include "install.h"
 #include "mount.h"
+#include "nand.h"
 #include "signature.h"
 #include "update_handler.h"
 #include "emmc.h"
+#include "hook_server.h"
 #include "utils.h"
 
 
@@ -118,10 +127,18 @@ static gboolean ubifs_ioctl(RaucImage *image, int fd, GError **error)
 	return TRUE;
 }
 
-static gboolean copy_raw_image(RaucImage *image, GUnixOutputStream *outstream, GError **error)
+/* size of the blocks between which a copy can be paused or cancelled */
+#define COPY_BLOCK_SIZE (1024 * 1024)
+
+/* Copies the image to outstream. If tree is not NULL, the hash tree of the
+ * image is computed from the copied data and returned there. */
+static gboolean copy_raw_image(RaucImage *image, GUnixOutputStream *outstream, RaucHashTree **tree, GError **error)
 {
 	GError *ierror = NULL;
-	gssize size;
+	guint64 written = 0;
+	g_autofree guint8 *buf = NULL;
+	g_autoptr(RaucHashTreeBuilder) builder = NULL;
+	GCancellable *cancellable = r_context()->install_info->cancellable;
 	g_autoptr(GFile) srcimagefile = g_file_new_for_path(image->filename);
 	int out_fd = g_unix_output_stream_get_fd(outstream);
 
@@ -135,17 +152,47 @@ static gboolean copy_raw_image(RaucImage *image, GUnixOutputStream *outstream, G
 	/* Do not close fd automatically to give us the chance to call fsync() on it before closing */
 	g_unix_output_stream_set_close_fd(outstream, FALSE);
 
-	size = g_output_stream_splice((GOutputStream *) outstream, instream,
-			G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
-			NULL,
-			&ierror);
-	if (size == -1) {
-		g_propagate_prefixed_error(error, ierror,
-				"Failed splicing data: ");
-		return FALSE;
-	} else if (size != (gssize)image->checksum.size) {
+	if (tree)
+		builder = r_hash_tree_builder_new(R_HASH_TREE_LEAF_SIZE);
+
+	/* copy block-wise to be able to pause or stop at block boundaries */
+	buf = g_malloc(COPY_BLOCK_SIZE);
+	while (TRUE) {
+		gssize size;
+
+		if (!install_checkpoint(&ierror)) {
+			close(out_fd);
+			g_propagate_prefixed_error(error, ierror,
+					"Stopped writing at offset %"G_GUINT64_FORMAT ": ", written);
+			return FALSE;
+		}
+
+		size = g_input_stream_read(instream, buf, COPY_BLOCK_SIZE, cancellable, &ierror);
+		if (size == -1) {
+			close(out_fd);
+			g_propagate_prefixed_error(error, ierror,
+					"Failed reading data at offset %"G_GUINT64_FORMAT ": ", written);
+			return FALSE;
+		} else if (size == 0) {
+			break;
+		}
+
+		if (!g_output_stream_write_all((GOutputStream *) outstream, buf, size, NULL, cancellable, &ierror)) {
+			close(out_fd);
+			g_propagate_prefixed_error(error, ierror,
+					"Failed writing data at offset %"G_GUINT64_FORMAT ": ", written);
+			return FALSE;
+		}
+		if (builder)
+			r_hash_tree_builder_update(builder, buf, size);
+		written += size;
+		r_context_add_bytes(size);
+	}
+
+	if (written != image->checksum.size) {
+		close(out_fd);
 		g_set_error(error, R_UPDATE_ERROR, R_UPDATE_ERROR_FAILED,
-				"Written size (%"G_GSIZE_FORMAT ") != image size (%"G_GSIZE_FORMAT ")", size, (gssize)image->checksum.size);
+				"Written size (%"G_GUINT64_FORMAT ") != image size (%"G_GSIZE_FORMAT ")", written, (gssize)image->checksum.size);
 		return FALSE;
 	}
 
@@ -161,32 +208,246 @@ static gboolean copy_raw_image(RaucImage *image, GUnixOutputStream *outstream, G
 		return FALSE;
 	}
 
+	if (tree)
+		*tree = r_hash_tree_builder_end(builder);
+
 	return TRUE;
 }
 
-static gboolean casync_extract(RaucImage *image, gchar *dest, const gchar *seed, const gchar *store, GError **error)
+/* Returns a sysfs attribute of a UBI volume or NULL if unknown */
+static gchar *ubivol_sysfs_attr(int fd, const gchar *name)
+{
+	g_autofree gchar *path = NULL;
+	gchar *contents = NULL;
+	struct stat st;
+
+	if (fstat(fd, &st) != 0 || !S_ISCHR(st.st_mode))
+		return NULL;
+
+	path = g_strdup_printf("/sys/dev/char/%u:%u/%s",
+			major(st.st_rdev), minor(st.st_rdev), name);
+	if (!g_file_get_contents(path, &contents, NULL, NULL))
+		return NULL;
+
+	return g_strchomp(contents);
+}
+
+/* Returns the usable LEB size of a UBI volume or 0 if unknown */
+static gsize ubivol_leb_size(int fd)
+{
+	g_autofree gchar *contents = ubivol_sysfs_attr(fd, "usable_eb_size");
+
+	if (!contents)
+		return 0;
+
+	return g_ascii_strtoull(contents, NULL, 10);
+}
+
+/* Reads exactly len bytes at offset, returns FALSE on errors or end of file */
+static gboolean pread_full(int fd, guint8 *buf, gsize len, guint64 offset)
+{
+	while (len > 0) {
+		ssize_t ret = pread(fd, buf, len, offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return FALSE;
+		buf += ret;
+		len -= ret;
+		offset += ret;
+	}
+
+	return TRUE;
+}
+
+/* Checks if the volume already contains the image data. It is compared to
+ * the image chunk by chunk (in whole LEBs), so that reading stops at the
+ * first difference. Reading is much cheaper than erasing and writing all
+ * LEBs again. */
+static gboolean ubivol_content_matches(RaucImage *image, RaucSlot *slot, guint8 *buf, gsize bufsize)
+{
+	g_autofree guint8 *imgbuf = NULL;
+	g_autofree gchar *voltype = NULL;
+	guint64 offset = 0;
+	gboolean res = FALSE;
+	int fd, img_fd;
+
+	if (!image->checksum.size)
+		return FALSE;
+
+	fd = g_open(slot->device, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		return FALSE;
+
+	img_fd = g_open(image->filename, O_RDONLY | O_CLOEXEC, 0);
+	if (img_fd < 0)
+		goto out;
+
+	/* a static volume must not contain more data than the image */
+	voltype = ubivol_sysfs_attr(fd, "type");
+	if (g_strcmp0(voltype, "static") == 0) {
+		g_autofree gchar *data_bytes = ubivol_sysfs_attr(fd, "data_bytes");
+
+		if (!data_bytes || g_ascii_strtoull(data_bytes, NULL, 10) != image->checksum.size)
+			goto out;
+	}
+
+	imgbuf = g_malloc(bufsize);
+	while (offset < image->checksum.size) {
+		gsize size = MIN(bufsize, image->checksum.size - offset);
+
+		if (!pread_full(fd, buf, size, offset) ||
+		    !pread_full(img_fd, imgbuf, size, offset) ||
+		    memcmp(buf, imgbuf, size) != 0)
+			goto out;
+		offset += size;
+	}
+
+	res = TRUE;
+
+out:
+	if (img_fd >= 0)
+		close(img_fd);
+	close(fd);
+	return res;
+}
+
+/* Writes an image to a UBI volume in whole LEBs. The data is hashed while
+ * writing and the last chunk is only written if the digest matches, so that
+ * UBI leaves the volume marked as corrupted otherwise. */
+static gboolean write_ubi_volume(RaucImage *image, RaucSlot *dest_slot, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GUnixOutputStream) outstream = NULL;
+	g_autoptr(GInputStream) instream = NULL;
+	g_autoptr(GFile) srcimagefile = g_file_new_for_path(image->filename);
+	g_autoptr(GChecksum) ctx = NULL;
+	g_autofree guint8 *buf = NULL;
+	GCancellable *cancellable = r_context()->install_info->cancellable;
+	guint64 written = 0;
+	gsize leb_size, chunk_size;
+	int out_fd;
+
+	g_message("opening slot device %s", dest_slot->device);
+	outstream = open_slot_device(dest_slot, &out_fd, &ierror);
+	if (outstream == NULL) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	/* write whole LEBs, so UBI does not have to buffer partial ones */
+	leb_size = ubivol_leb_size(out_fd);
+	if (leb_size)
+		chunk_size = MAX(1, COPY_BLOCK_SIZE / leb_size) * leb_size;
+	else
+		chunk_size = COPY_BLOCK_SIZE;
+	buf = g_malloc(chunk_size);
+
+	if (!dest_slot->force_install_same &&
+	    ubivol_content_matches(image, dest_slot, buf, chunk_size)) {
+		g_message("Volume %s already contains the image, skipping write", dest_slot->device);
+		/* account the skipped data, so the progress reaches the image size */
+		r_context_add_bytes(image->checksum.size);
+		return TRUE;
+	}
+
+	instream = (GInputStream*)g_file_read(srcimagefile, NULL, &ierror);
+	if (instream == NULL) {
+		g_propagate_prefixed_error(error, ierror,
+				"Failed to open file for reading: ");
+		return FALSE;
+	}
+
+	if (!ubifs_ioctl(image, out_fd, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	if (image->checksum.digest)
+		ctx = g_checksum_new(image->checksum.type);
+
+	while (written < image->checksum.size) {
+		gsize size;
+
+		if (!install_checkpoint(&ierror)) {
+			g_propagate_prefixed_error(error, ierror,
+					"Stopped writing at offset %"G_GUINT64_FORMAT ": ", written);
+			return FALSE;
+		}
+
+		if (!g_input_stream_read_all(instream, buf, MIN(chunk_size, image->checksum.size - written),
+				&size, cancellable, &ierror)) {
+			g_propagate_prefixed_error(error, ierror,
+					"Failed reading data at offset %"G_GUINT64_FORMAT ": ", written);
+			return FALSE;
+		} else if (size == 0) {
+			g_set_error(error, R_UPDATE_ERROR, R_UPDATE_ERROR_FAILED,
+					"Image ended at offset %"G_GUINT64_FORMAT " before its expected size", written);
+			return FALSE;
+		}
+
+		if (ctx) {
+			g_checksum_update(ctx, buf, size);
+			if (written + size == image->checksum.size &&
+			    g_strcmp0(g_checksum_get_string(ctx), image->checksum.digest) != 0) {
+				g_set_error(error, R_CHECKSUM_ERROR, R_CHECKSUM_ERROR_DIGEST_MISMATCH,
+						"Digest of %s does not match, volume update not completed", image->filename);
+				return FALSE;
+			}
+		}
+
+		if (!g_output_stream_write_all((GOutputStream *) outstream, buf, size, NULL, cancellable, &ierror)) {
+			g_propagate_prefixed_error(error, ierror,
+					"Failed writing data at offset %"G_GUINT64_FORMAT ": ", written);
+			return FALSE;
+		}
+		written += size;
+		r_context_add_bytes(size);
+	}
+
+	if (fsync(out_fd) == -1) {
+		g_set_error(error, R_UPDATE_ERROR, R_UPDATE_ERROR_FAILED, "Syncing content to disk failed: %s", strerror(errno));
+		return FALSE;
+	}
+
+	if (!g_output_stream_close((GOutputStream *) outstream, NULL, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Closing output device failed: ");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Chunks missing in store are looked up in extra_store, if given */
+static gboolean casync_extract(RaucImage *image, gchar *dest, GPtrArray *seeds, const gchar *store, const gchar *extra_store, GError **error)
 {
 	g_autoptr(GSubprocess) sproc = NULL;
 	GError *ierror = NULL;
+	RaucTraceEvent *trace = NULL;
 	gboolean res = FALSE;
 	g_autoptr(GPtrArray) args = g_ptr_array_new_full(5, g_free);
 
 	g_ptr_array_add(args, g_strdup("casync"));
 	g_ptr_array_add(args, g_strdup("extract"));
-	if (seed) {
+	for (guint i = 0; seeds && i < seeds->len; i++) {
 		g_ptr_array_add(args, g_strdup("--seed"));
-		g_ptr_array_add(args, g_strdup(seed));
+		g_ptr_array_add(args, g_strdup(g_ptr_array_index(seeds, i)));
 	}
 	if (store) {
 		g_ptr_array_add(args, g_strdup("--store"));
 		g_ptr_array_add(args, g_strdup(store));
 	}
+	if (extra_store) {
+		g_ptr_array_add(args, g_strdup("--extra-store"));
+		g_ptr_array_add(args, g_strdup(extra_store));
+	}
 	g_ptr_array_add(args, g_strdup("--seed-output=no"));
 	g_ptr_array_add(args, g_strdup(image->filename));
 	g_ptr_array_add(args, g_strdup(dest));
 	g_ptr_array_add(args, NULL);
 
 	r_debug_subprocess(args);
+	trace = r_context_trace_subprocess(args);
 	sproc = g_subprocess_newv((const gchar * const *)args->pdata,
 			G_SUBPROCESS_FLAGS_NONE, &ierror);
 	if (sproc == NULL) {
@@ -197,7 +458,7 @@ static gboolean casync_extract(RaucImage *image, gchar *dest, const gchar *seed,
 		goto out;
 	}
 
-	res = g_subprocess_wait_check(sproc, NULL, &ierror);
+	res = install_subprocess_wait_check(sproc, &ierror);
 	if (!res) {
 		g_propagate_prefixed_error(
 				error,
@@ -207,91 +468,229 @@ static gboolean casync_extract(RaucImage *image, gchar *dest, const gchar *seed,
 	}
 
 out:
+	r_context_trace_end(trace, res);
 	return res;
 }
 
-static RaucSlot *get_active_slot_class_member(gchar *slotclass)
+/* Lower values are preferred as seeds: the booted slot is known to be good
+ * and most similar to the update, other active slots come next. */
+static gint seed_slot_rank(const RaucSlot *slot)
 {
+	if (slot->state == ST_BOOTED)
+		return 0;
+	if (slot->state == ST_ACTIVE)
+		return 1;
+	return 2;
+}
+
+static gint seed_slot_compare(gconstpointer a, gconstpointer b)
+{
+	const RaucSlot *sa = *(RaucSlot **) a;
+	const RaucSlot *sb = *(RaucSlot **) b;
+
+	return seed_slot_rank(sa) - seed_slot_rank(sb);
+}
+
+/* Returns all slots of a class except the one being written to, best seed
+ * candidates first. */
+static GPtrArray *get_seed_slot_class_members(const gchar *slotclass, const gchar *dest)
+{
+	GPtrArray *slots = g_ptr_array_new();
 	RaucSlot *iterslot;
 	GHashTableIter iter;
 
-	g_return_val_if_fail(slotclass, NULL);
+	g_return_val_if_fail(slotclass, slots);
 
 	g_hash_table_iter_init(&iter, r_context()->config->slots);
 	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&iterslot)) {
-		if (iterslot->state == ST_INACTIVE)
+		if (g_strcmp0(iterslot->sclass, slotclass) != 0)
+			continue;
+		if (g_strcmp0(iterslot->device, dest) == 0 ||
+		    g_strcmp0(iterslot->mount_point, dest) == 0)
+			continue;
+		if (!g_file_test(iterslot->device, G_FILE_TEST_EXISTS))
 			continue;
 
-		if (g_strcmp0(iterslot->sclass, slotclass) == 0) {
-			return iterslot;
+		g_ptr_array_add(slots, iterslot);
+	}
+
+	g_ptr_array_sort(slots, seed_slot_compare);
+
+	return slots;
+}
+
+/* Returns the ids of the chunks the given seed slots contain according to
+ * the indexes saved when they were installed. */
+static GHashTable *get_seeded_chunks(const gchar *cachedir, GPtrArray *seedslots)
+{
+	GHashTable *seeded = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	for (guint i = 0; i < seedslots->len; i++) {
+		RaucSlot *seedslot = g_ptr_array_index(seedslots, i);
+		g_autoptr(GPtrArray) ids = NULL;
+
+		load_slot_status(seedslot);
+		if (!seedslot->status || !seedslot->status->checksum.digest)
+			continue;
+
+		ids = r_chunk_cache_load_slot_index(cachedir, seedslot->name, seedslot->status->checksum.digest);
+		if (!ids)
+			continue;
+
+		for (guint j = 0; j < ids->len; j++)
+			g_hash_table_add(seeded, g_strdup(g_ptr_array_index(ids, j)));
+	}
+
+	return seeded;
+}
+
+/* Extracts via the local chunk cache. Chunks are taken from the seeds first,
+ * then from the cache and then from the original store. Only chunks not
+ * provided by the seeds are fetched into the cache. */
+static gboolean casync_extract_cached(RaucImage *image, RaucSlot *dest_slot, gchar *dest, GPtrArray *seeds, GPtrArray *seedslots, const gchar *store, GError **error)
+{
+	GError *ierror = NULL;
+	const gchar *cachedir = r_context()->config->chunk_cache_path;
+	g_autoptr(GHashTable) seeded = NULL;
+	RChunkCacheStats stats = {0};
+	gboolean res = FALSE;
+
+	seeded = get_seeded_chunks(cachedir, seedslots);
+	if (!r_chunk_cache_populate(cachedir, image->filename, store, seeded,
+			r_context()->config->chunk_cache_max_size, &stats, &ierror)) {
+		g_message("Chunk cache unusable, using store directly: %s", ierror->message);
+		g_clear_error(&ierror);
+		return casync_extract(image, dest, seeds, store, NULL, error);
+	}
+
+	g_message("Chunk cache: %u of %u chunks cached (%u%% hit rate), %u expected from seeds, %u fetched, %u not cached due to size limit",
+			stats.hits, stats.total,
+			stats.total ? stats.hits * 100 / stats.total : 100,
+			stats.seeded, stats.fetched, stats.uncached);
+
+	res = casync_extract(image, dest, seeds, cachedir, store, &ierror);
+	if (!res) {
+		g_warning("Extracting with chunk cache failed, purging cached chunks: %s", ierror->message);
+		g_clear_error(&ierror);
+		if (!r_chunk_cache_purge(cachedir, image->filename, &ierror)) {
+			g_warning("Failed purging chunk cache: %s", ierror->message);
+			g_clear_error(&ierror);
+		}
+		res = casync_extract(image, dest, seeds, store, NULL, &ierror);
+		if (!res) {
+			g_propagate_error(error, ierror);
+			goto out;
 		}
 	}
 
-	return NULL;
+	/* allows to use the slot as seed for the next installation */
+	if (dest_slot && image->checksum.digest &&
+	    !r_chunk_cache_save_slot_index(cachedir, dest_slot->name, image->checksum.digest, image->filename, &ierror)) {
+		g_message("Failed saving index of slot %s: %s", dest_slot->name, ierror->message);
+		g_clear_error(&ierror);
+	}
+
+out:
+	if (!r_chunk_cache_trim(cachedir, r_context()->config->chunk_cache_max_size, &ierror)) {
+		g_warning("Failed trimming chunk cache: %s", ierror->message);
+		g_clear_error(&ierror);
+	}
+	return res;
 }
 
-static gboolean casync_extract_image(RaucImage *image, gchar *dest, GError **error)
+static gboolean casync_extract_image(RaucImage *image, RaucSlot *dest_slot, gchar *dest, GError **error)
 {
 	GError *ierror = NULL;
 	gboolean res = FALSE;
-	RaucSlot *seedslot = NULL;
-	g_autofree gchar *seed = NULL;
+	gboolean dirtree = g_str_has_suffix(image->filename, ".caidx");
+	g_autoptr(GPtrArray) seedslots = NULL;
+	g_autoptr(GPtrArray) usedslots = g_ptr_array_new();
+	g_autoptr(GPtrArray) mounted = g_ptr_array_new();
+	g_autoptr(GPtrArray) seeds = g_ptr_array_new_with_free_func(g_free);
 	gchar *store = NULL;
-	gboolean seed_mounted = FALSE;
-
-	/* Prepare Seed */
-	seedslot = get_active_slot_class_member(image->slotclass);
-	if (!seedslot) {
-		g_warning("No seed slot available for %s", image->slotclass);
-		goto extract;
-	}
-
-	if (g_str_has_suffix(image->filename, ".caidx" )) {
-		/* We need to have the seed slot (bind) mounted to a distinct
-		 * path to allow seeding. E.g. using mount path '/' for the
-		 * rootfs slot seed is inaproppriate as it contains virtual
-		 * file systems, additional mounts, etc. */
-		if (!seedslot->mount_point) {
-			g_debug("Mounting %s to use as seed", seedslot->device);
-			res = r_mount_slot(seedslot, &ierror);
-			if (!res) {
-				g_warning("Failed mounting for seeding: %s", ierror->message);
-				g_clear_error(&ierror);
-				goto extract;
+
+	/* Prepare seeds */
+	seedslots = get_seed_slot_class_members(image->slotclass, dest);
+	for (guint i = 0; i < seedslots->len; i++) {
+		RaucSlot *seedslot = g_ptr_array_index(seedslots, i);
+
+		if (dirtree) {
+			/* We need to have the seed slot (bind) mounted to a distinct
+			 * path to allow seeding. E.g. using mount path '/' for the
+			 * rootfs slot seed is inaproppriate as it contains virtual
+			 * file systems, additional mounts, etc. */
+			if (!seedslot->mount_point) {
+				g_debug("Mounting %s to use as seed", seedslot->device);
+				if (!r_mount_slot(seedslot, &ierror)) {
+					g_warning("Failed mounting for seeding: %s", ierror->message);
+					g_clear_error(&ierror);
+					continue;
+				}
+				g_ptr_array_add(mounted, seedslot);
+			}
+
+			g_debug("Adding as casync directory tree seed: %s", seedslot->mount_point);
+			g_ptr_array_add(seeds, g_strdup(seedslot->mount_point));
+			g_ptr_array_add(usedslots, seedslot);
+		} else {
+			if (g_access(seedslot->device, R_OK) != 0) {
+				g_debug("Skipping unreadable seed %s", seedslot->device);
+				continue;
 			}
-			seed_mounted = TRUE;
+
+			g_debug("Adding as casync blob seed: %s", seedslot->device);
+			g_ptr_array_add(seeds, g_strdup(seedslot->device));
+			g_ptr_array_add(usedslots, seedslot);
 		}
+	}
 
-		g_debug("Adding as casync directory tree seed: %s", seedslot->mount_point);
-		seed = g_strdup(seedslot->mount_point);
-	} else {
-		g_debug("Adding as casync blob seed: %s", seedslot->device);
-		seed = g_strdup(seedslot->device);
+	/* Additional seeds configured in system.conf */
+	for (gchar **seed = r_context()->config->casync_seeds; seed && *seed; seed++) {
+		if (dirtree != g_file_test(*seed, G_FILE_TEST_IS_DIR))
+			continue;
+		if (g_access(*seed, R_OK) != 0)
+			continue;
+
+		g_debug("Adding as additional casync seed: %s", *seed);
+		g_ptr_array_add(seeds, g_strdup(*seed));
 	}
 
-extract:
+	if (seeds->len == 0)
+		g_warning("No seed available for %s", image->slotclass);
+	else
+		g_message("Using %u seed(s) for %s", seeds->len, image->slotclass);
+
 	/* Set store */
 	store = r_context()->install_info->mounted_bundle->storepath;
 	g_debug("Using store path: '%s'", store);
 
-	/* Call casync to extract */
-	res = casync_extract(image, dest, seed, store, &ierror);
+	/* Call casync to extract, plain archives (.catar) have no chunks */
+	if (r_context()->config->chunk_cache_path && !g_str_has_suffix(image->filename, ".catar")) {
+		res = casync_extract_cached(image, dest_slot, dest, seeds, usedslots, store, &ierror);
+	} else {
+		res = casync_extract(image, dest, seeds, store, NULL, &ierror);
+	}
 	if (!res) {
 		g_propagate_error(error, ierror);
 		goto out;
 	}
 
-	/* Cleanup seed */
-	if (seed_mounted) {
-		res = r_umount_slot(seedslot, &ierror);
-		if (!res) {
-			g_propagate_prefixed_error(error, ierror, "Failed unmounting seed slot: ");
-			goto out;
+out:
+	/* Cleanup seeds */
+	for (guint i = 0; i < mounted->len; i++) {
+		RaucSlot *seedslot = g_ptr_array_index(mounted, i);
+
+		if (!r_umount_slot(seedslot, &ierror)) {
+			if (res) {
+				g_propagate_prefixed_error(error, ierror, "Failed unmounting seed slot: ");
+				res = FALSE;
+			} else {
+				g_warning("Failed unmounting seed slot: %s", ierror->message);
+				g_clear_error(&ierror);
+			}
 		}
 	}
 
-	res = TRUE;
-out:
 	return res;
 }
 
@@ -312,7 +711,7 @@ static gboolean copy_raw_image_to_dev(RaucImage *image, RaucSlot *slot, GError *
 
 	/* copy */
 	g_message("writing data to device %s", slot->device);
-	res = copy_raw_image(image, outstream, &ierror);
+	res = copy_raw_image(image, outstream, &slot->hash_tree, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
 		goto out;
@@ -332,7 +731,7 @@ static gboolean write_image_to_dev(RaucImage *image, RaucSlot *slot, GError **er
 		g_message("Extracting %s to %s", image->filename, slot->device);
 
 		/* Extract caibx to device */
-		res = casync_extract_image(image, slot->device, &ierror);
+		res = casync_extract_image(image, slot, slot->device, &ierror);
 		if (!res) {
 			g_propagate_error(error, ierror);
 			goto out;
@@ -354,6 +753,7 @@ static gboolean ubifs_format_slot(RaucSlot *dest_slot, GError **error)
 {
 	g_autoptr(GSubprocess) sproc = NULL;
 	GError *ierror = NULL;
+	RaucTraceEvent *trace = NULL;
 	gboolean res = FALSE;
 	g_autoptr(GPtrArray) args = g_ptr_array_new_full(3, g_free);
 
@@ -363,6 +763,7 @@ static gboolean ubifs_format_slot(RaucSlot *dest_slot, GError **error)
 	g_ptr_array_add(args, NULL);
 
 	r_debug_subprocess(args);
+	trace = r_context_trace_subprocess(args);
 	sproc = g_subprocess_newv((const gchar * const *)args->pdata,
 			G_SUBPROCESS_FLAGS_NONE, &ierror);
 	if (sproc == NULL) {
@@ -373,7 +774,7 @@ static gboolean ubifs_format_slot(RaucSlot *dest_slot, GError **error)
 		goto out;
 	}
 
-	res = g_subprocess_wait_check(sproc, NULL, &ierror);
+	res = install_subprocess_wait_check(sproc, &ierror);
 	if (!res) {
 		g_propagate_prefixed_error(
 				error,
@@ -383,15 +784,40 @@ static gboolean ubifs_format_slot(RaucSlot *dest_slot, GError **error)
 	}
 
 out:
+	r_context_trace_end(trace, res);
 	return res;
 }
 
+/* Returns TRUE if the slot was discarded less than discard-interval days ago */
+static gboolean slot_discarded_recently(const RaucSlot *dest_slot)
+{
+	g_autoptr(GDateTime) discarded = NULL;
+	g_autoptr(GDateTime) now = NULL;
+	gint year, month, day, hour, minute, second;
+
+	if (!dest_slot->discard_interval || !dest_slot->status || !dest_slot->status->discarded_timestamp)
+		return FALSE;
+
+	if (sscanf(dest_slot->status->discarded_timestamp, "%d-%d-%dT%d:%d:%dZ",
+			    &year, &month, &day, &hour, &minute, &second) != 6)
+		return FALSE;
+
+	discarded = g_date_time_new_utc(year, month, day, hour, minute, second);
+	if (!discarded)
+		return FALSE;
+	now = g_date_time_new_now_utc();
+
+	return g_date_time_difference(now, discarded) < (GTimeSpan) dest_slot->discard_interval * G_TIME_SPAN_DAY;
+}
+
 static gboolean ext4_format_slot(RaucSlot *dest_slot, GError **error)
 {
 	g_autoptr(GSubprocess) sproc = NULL;
 	GError *ierror = NULL;
+	RaucTraceEvent *trace = NULL;
 	gboolean res = FALSE;
-	g_autoptr(GPtrArray) args = g_ptr_array_new_full(4, g_free);
+	gboolean discard = !slot_discarded_recently(dest_slot);
+	g_autoptr(GPtrArray) args = g_ptr_array_new_full(6, g_free);
 
 	g_ptr_array_add(args, g_strdup("mkfs.ext4"));
 	g_ptr_array_add(args, g_strdup("-F"));
@@ -399,10 +825,21 @@ static gboolean ext4_format_slot(RaucSlot *dest_slot, GError **error)
 		g_ptr_array_add(args, g_strdup("-L"));
 		g_ptr_array_add(args, g_strdup(dest_slot->name));
 	}
+	/* leave zeroing inode tables to the kernel after mounting, this takes
+	 * long on large or slow devices */
+	g_ptr_array_add(args, g_strdup("-E"));
+	if (discard) {
+		g_ptr_array_add(args, g_strdup("lazy_itable_init=1"));
+	} else {
+		g_message("Skipping discard of %s (last discard: %s)", dest_slot->device,
+				dest_slot->status->discarded_timestamp);
+		g_ptr_array_add(args, g_strdup("lazy_itable_init=1,nodiscard"));
+	}
 	g_ptr_array_add(args, g_strdup(dest_slot->device));
 	g_ptr_array_add(args, NULL);
 
 	r_debug_subprocess(args);
+	trace = r_context_trace_subprocess(args);
 	sproc = g_subprocess_newv((const gchar * const *)args->pdata,
 			G_SUBPROCESS_FLAGS_NONE, &ierror);
 	if (sproc == NULL) {
@@ -413,7 +850,7 @@ static gboolean ext4_format_slot(RaucSlot *dest_slot, GError **error)
 		goto out;
 	}
 
-	res = g_subprocess_wait_check(sproc, NULL, &ierror);
+	res = install_subprocess_wait_check(sproc, &ierror);
 	if (!res) {
 		g_propagate_prefixed_error(
 				error,
@@ -422,7 +859,16 @@ static gboolean ext4_format_slot(RaucSlot *dest_slot, GError **error)
 		goto out;
 	}
 
+	/* remembered in the slot status written after the installation */
+	if (discard && dest_slot->discard_interval && dest_slot->status) {
+		g_autoptr(GDateTime) now = g_date_time_new_now_utc();
+
+		g_free(dest_slot->status->discarded_timestamp);
+		dest_slot->status->discarded_timestamp = g_date_time_format(now, "%Y-%m-%dT%H:%M:%SZ");
+	}
+
 out:
+	r_context_trace_end(trace, res);
 	return res;
 }
 
@@ -430,6 +876,7 @@ static gboolean vfat_format_slot(RaucSlot *dest_slot, GError **error)
 {
 	g_autoptr(GSubprocess) sproc = NULL;
 	GError *ierror = NULL;
+	RaucTraceEvent *trace = NULL;
 	gboolean res = FALSE;
 	g_autoptr(GPtrArray) args = g_ptr_array_new_full(4, g_free);
 
@@ -442,6 +889,7 @@ static gboolean vfat_format_slot(RaucSlot *dest_slot, GError **error)
 	g_ptr_array_add(args, NULL);
 
 	r_debug_subprocess(args);
+	trace = r_context_trace_subprocess(args);
 	sproc = g_subprocess_newv((const gchar * const *)args->pdata,
 			G_SUBPROCESS_FLAGS_NONE, &ierror);
 	if (sproc == NULL) {
@@ -452,7 +900,7 @@ static gboolean vfat_format_slot(RaucSlot *dest_slot, GError **error)
 		goto out;
 	}
 
-	res = g_subprocess_wait_check(sproc, NULL, &ierror);
+	res = install_subprocess_wait_check(sproc, &ierror);
 	if (!res) {
 		g_propagate_prefixed_error(
 				error,
@@ -462,82 +910,7 @@ static gboolean vfat_format_slot(RaucSlot *dest_slot, GError **error)
 	}
 
 out:
-	return res;
-}
-
-static gboolean nand_format_slot(const gchar *device, GError **error)
-{
-	g_autoptr(GSubprocess) sproc = NULL;
-	GError *ierror = NULL;
-	gboolean res = FALSE;
-	g_autoptr(GPtrArray) args = g_ptr_array_new_full(5, g_free);
-
-	g_ptr_array_add(args, g_strdup("flash_erase"));
-	g_ptr_array_add(args, g_strdup("--quiet"));
-	g_ptr_array_add(args, g_strdup(device));
-	g_ptr_array_add(args, g_strdup("0"));
-	g_ptr_array_add(args, g_strdup("0"));
-	g_ptr_array_add(args, NULL);
-
-	r_debug_subprocess(args);
-	sproc = g_subprocess_newv((const gchar * const *)args->pdata,
-			G_SUBPROCESS_FLAGS_NONE, &ierror);
-	if (sproc == NULL) {
-		g_propagate_prefixed_error(
-				error,
-				ierror,
-				"failed to start flash_erase: ");
-		goto out;
-	}
-
-	res = g_subprocess_wait_check(sproc, NULL, &ierror);
-	if (!res) {
-		g_propagate_prefixed_error(
-				error,
-				ierror,
-				"failed to run flash_erase: ");
-		goto out;
-	}
-
-out:
-	return res;
-}
-
-static gboolean nand_write_slot(const gchar *image, const gchar *device, GError **error)
-{
-	g_autoptr(GSubprocess) sproc = NULL;
-	GError *ierror = NULL;
-	gboolean res = FALSE;
-	g_autoptr(GPtrArray) args = g_ptr_array_new_full(5, g_free);
-
-	g_ptr_array_add(args, g_strdup("nandwrite"));
-	g_ptr_array_add(args, g_strdup("--pad"));
-	g_ptr_array_add(args, g_strdup("--quiet"));
-	g_ptr_array_add(args, g_strdup(device));
-	g_ptr_array_add(args, g_strdup(image));
-	g_ptr_array_add(args, NULL);
-
-	r_debug_subprocess(args);
-	sproc = g_subprocess_newv((const gchar * const *)args->pdata,
-			G_SUBPROCESS_FLAGS_NONE, &ierror);
-	if (sproc == NULL) {
-		g_propagate_prefixed_error(
-				error,
-				ierror,
-				"failed to start nandwrite: ");
-		goto out;
-	}
-
-	res = g_subprocess_wait_check(sproc, NULL, &ierror);
-	if (!res) {
-		g_propagate_prefixed_error(
-				error,
-				ierror,
-				"failed to run nandwrite: ");
-		goto out;
-	}
-
-out:
+	r_context_trace_end(trace, res);
 	return res;
 }
 
@@ -545,6 +918,7 @@ static gboolean untar_image(RaucImage *image, gchar *dest, GError **error)
 {
 	g_autoptr(GSubprocess) sproc = NULL;
 	GError *ierror = NULL;
+	RaucTraceEvent *trace = NULL;
 	gboolean res = FALSE;
 	g_autoptr(GPtrArray) args = g_ptr_array_new_full(5, g_free);
 
@@ -557,6 +931,7 @@ static gboolean untar_image(RaucImage *image, gchar *dest, GError **error)
 	g_ptr_array_add(args, NULL);
 
 	r_debug_subprocess(args);
+	trace = r_context_trace_subprocess(args);
 	sproc = g_subprocess_newv((const gchar * const *)args->pdata,
 			G_SUBPROCESS_FLAGS_NONE, &ierror);
 	if (sproc == NULL) {
@@ -567,7 +942,7 @@ static gboolean untar_image(RaucImage *image, gchar *dest, GError **error)
 		goto out;
 	}
 
-	res = g_subprocess_wait_check(sproc, NULL, &ierror);
+	res = install_subprocess_wait_check(sproc, &ierror);
 	if (!res) {
 		g_propagate_prefixed_error(
 				error,
@@ -577,21 +952,23 @@ static gboolean untar_image(RaucImage *image, gchar *dest, GError **error)
 	}
 
 out:
+	r_context_trace_end(trace, res);
 	return res;
 }
 
-static gboolean unpack_archive(RaucImage *image, gchar *dest, GError **error)
+static gboolean unpack_archive(RaucImage *image, RaucSlot *dest_slot, GError **error)
 {
 	if (g_str_has_suffix(image->filename, ".caidx" ))
-		return casync_extract_image(image, dest, error);
+		return casync_extract_image(image, dest_slot, dest_slot->mount_point, error);
 	else if (g_str_has_suffix(image->filename, ".catar" ))
-		return casync_extract_image(image, dest, error);
+		return casync_extract_image(image, dest_slot, dest_slot->mount_point, error);
 	else
-		return untar_image(image, dest, error);
+		return untar_image(image, dest_slot->mount_point, error);
 }
 
 /**
- * Executes the per-slot hook script.
+ * Executes the per-slot hook script, or passes the hook to the hook server if
+ * the bundle uses one.
  *
  * @param hook_name file name of the hook script
  * @param hook_cmd first argument to the hook script
@@ -605,7 +982,9 @@ static gboolean run_slot_hook(const gchar *hook_name, const gchar *hook_cmd, Rau
 {
 	g_autoptr(GSubprocessLauncher) launcher = NULL;
 	g_autoptr(GSubprocess) sproc = NULL;
+	g_autoptr(GPtrArray) vars = NULL;
 	GError *ierror = NULL;
+	RaucTraceEvent *trace = NULL;
 	gboolean res = FALSE;
 
 	g_assert_nonnull(slot);
@@ -613,26 +992,39 @@ static gboolean run_slot_hook(const gchar *hook_name, const gchar *hook_cmd, Rau
 	g_assert_nonnull(slot->sclass);
 
 	g_message("Running slot hook %s for %s", hook_cmd, slot->name);
-
-	launcher = g_subprocess_launcher_new(G_SUBPROCESS_FLAGS_NONE);
-
-	g_subprocess_launcher_setenv(launcher, "RAUC_SLOT_NAME", slot->name, TRUE);
-	g_subprocess_launcher_setenv(launcher, "RAUC_SLOT_CLASS", slot->sclass, TRUE);
-	g_subprocess_launcher_setenv(launcher, "RAUC_SLOT_TYPE", slot->type, TRUE);
-	g_subprocess_launcher_setenv(launcher, "RAUC_SLOT_DEVICE", slot->device, TRUE);
-	g_subprocess_launcher_setenv(launcher, "RAUC_SLOT_BOOTNAME", slot->bootname ?: "", TRUE);
-	g_subprocess_launcher_setenv(launcher, "RAUC_SLOT_PARENT", slot->parent ? slot->parent->name : "", TRUE);
+	trace = r_context_trace_begin("hook", hook_cmd, hook_name);
+
+	vars = g_ptr_array_new_with_free_func(g_free);
+	g_ptr_array_add(vars, g_strconcat("RAUC_SLOT_NAME=", slot->name, NULL));
+	g_ptr_array_add(vars, g_strconcat("RAUC_SLOT_CLASS=", slot->sclass, NULL));
+	g_ptr_array_add(vars, g_strconcat("RAUC_SLOT_TYPE=", slot->type, NULL));
+	g_ptr_array_add(vars, g_strconcat("RAUC_SLOT_DEVICE=", slot->device, NULL));
+	g_ptr_array_add(vars, g_strconcat("RAUC_SLOT_BOOTNAME=", slot->bootname ?: "", NULL));
+	g_ptr_array_add(vars, g_strconcat("RAUC_SLOT_PARENT=", slot->parent ? slot->parent->name : "", NULL));
 	if (slot->mount_point) {
-		g_subprocess_launcher_setenv(launcher, "RAUC_SLOT_MOUNT_POINT", slot->mount_point, TRUE);
+		g_ptr_array_add(vars, g_strconcat("RAUC_SLOT_MOUNT_POINT=", slot->mount_point, NULL));
 	}
 	if (image) {
-		g_subprocess_launcher_setenv(launcher, "RAUC_IMAGE_NAME", image->filename, TRUE);
-		g_subprocess_launcher_setenv(launcher, "RAUC_IMAGE_DIGEST", image->checksum.digest, TRUE);
-		g_subprocess_launcher_setenv(launcher, "RAUC_IMAGE_CLASS", image->slotclass, TRUE);
+		g_ptr_array_add(vars, g_strconcat("RAUC_IMAGE_NAME=", image->filename, NULL));
+		g_ptr_array_add(vars, g_strconcat("RAUC_IMAGE_DIGEST=", image->checksum.digest, NULL));
+		g_ptr_array_add(vars, g_strconcat("RAUC_IMAGE_CLASS=", image->slotclass, NULL));
+	}
+	g_ptr_array_add(vars, g_strconcat("RAUC_MOUNT_PREFIX=", r_context()->config->mount_prefix, NULL));
+	g_ptr_array_add(vars, NULL);
+
+	if (r_context()->install_info->hook_server) {
+		res = r_hook_server_call(r_context()->install_info->hook_server, hook_cmd,
+				(gchar **) vars->pdata, &ierror);
+		if (!res)
+			g_propagate_prefixed_error(error, ierror, "failed to run slot hook: ");
+		goto out;
 	}
-	g_subprocess_launcher_setenv(launcher, "RAUC_MOUNT_PREFIX", r_context()->config->mount_prefix, TRUE);
 
-	if (r_context()->install_info->mounted_bundle) {
+	launcher = g_subprocess_launcher_new(G_SUBPROCESS_FLAGS_NONE);
+
+	if (r_context()->install_info->hook_env) {
+		g_subprocess_launcher_set_environ(launcher, r_context()->install_info->hook_env);
+	} else if (r_context()->install_info->mounted_bundle) {
 		gchar **hashes = NULL;
 		gchar *string = NULL;
 
@@ -644,6 +1036,13 @@ static gboolean run_slot_hook(const gchar *hook_name, const gchar *hook_cmd, Rau
 		g_free(string);
 	}
 
+	for (guint i = 0; i < vars->len - 1; i++) {
+		const gchar *var = g_ptr_array_index(vars, i);
+		g_autofree gchar *name = g_strndup(var, strchr(var, '=') - var);
+
+		g_subprocess_launcher_setenv(launcher, name, strchr(var, '=') + 1, TRUE);
+	}
+
 	sproc = g_subprocess_launcher_spawn(
 			launcher, &ierror,
 			hook_name,
@@ -657,7 +1056,7 @@ static gboolean run_slot_hook(const gchar *hook_name, const gchar *hook_cmd, Rau
 		goto out;
 	}
 
-	res = g_subprocess_wait_check(sproc, NULL, &ierror);
+	res = install_subprocess_wait_check(sproc, &ierror);
 	if (!res) {
 		g_propagate_prefixed_error(
 				error,
@@ -667,6 +1066,7 @@ static gboolean run_slot_hook(const gchar *hook_name, const gchar *hook_cmd, Rau
 	}
 
 out:
+	r_context_trace_end(trace, res);
 	return res;
 }
 
@@ -713,9 +1113,7 @@ out:
 
 static gboolean img_to_ubivol_handler(RaucImage *image, RaucSlot *dest_slot, const gchar *hook_name, GError **error)
 {
-	g_autoptr(GUnixOutputStream) outstream = NULL;
 	GError *ierror = NULL;
-	int out_fd;
 	gboolean res = FALSE;
 
 	/* run slot pre install hook if enabled */
@@ -727,24 +1125,8 @@ static gboolean img_to_ubivol_handler(RaucImage *image, RaucSlot *dest_slot, con
 		}
 	}
 
-	/* open */
-	g_message("opening slot device %s", dest_slot->device);
-	outstream = open_slot_device(dest_slot, &out_fd, &ierror);
-	if (outstream == NULL) {
-		res = FALSE;
-		g_propagate_error(error, ierror);
-		goto out;
-	}
-
-	/* ubifs ioctl */
-	res = ubifs_ioctl(image, out_fd, &ierror);
-	if (!res) {
-		g_propagate_error(error, ierror);
-		goto out;
-	}
-
-	/* copy */
-	res = copy_raw_image(image, outstream, &ierror);
+	/* write */
+	res = write_ubi_volume(image, dest_slot, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
 		goto out;
@@ -765,9 +1147,7 @@ out:
 
 static gboolean img_to_ubifs_handler(RaucImage *image, RaucSlot *dest_slot, const gchar *hook_name, GError **error)
 {
-	g_autoptr(GUnixOutputStream) outstream = NULL;
 	GError *ierror = NULL;
-	int out_fd;
 	gboolean res = FALSE;
 
 	/* run slot pre install hook if enabled */
@@ -779,24 +1159,8 @@ static gboolean img_to_ubifs_handler(RaucImage *image, RaucSlot *dest_slot, cons
 		}
 	}
 
-	/* open */
-	g_message("opening slot device %s", dest_slot->device);
-	outstream = open_slot_device(dest_slot, &out_fd, &ierror);
-	if (outstream == NULL) {
-		res = FALSE;
-		g_propagate_error(error, ierror);
-		goto out;
-	}
-
-	/* ubifs ioctl */
-	res = ubifs_ioctl(image, out_fd, &ierror);
-	if (!res) {
-		g_propagate_error(error, ierror);
-		goto out;
-	}
-
-	/* copy */
-	res = copy_raw_image(image, outstream, &ierror);
+	/* write */
+	res = write_ubi_volume(image, dest_slot, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
 		goto out;
@@ -849,7 +1213,7 @@ static gboolean archive_to_ubifs_handler(RaucImage *image, RaucSlot *dest_slot,
 
 	/* extract tar into mounted ubi volume */
 	g_message("Extracting %s to %s", image->filename, dest_slot->mount_point);
-	res = unpack_archive(image, dest_slot->mount_point, &ierror);
+	res = unpack_archive(image, dest_slot, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
 		goto unmount_out;
@@ -916,7 +1280,7 @@ static gboolean archive_to_ext4_handler(RaucImage *image, RaucSlot *dest_slot, c
 
 	/* extract tar into mounted ext4 volume */
 	g_message("Extracting %s to %s", image->filename, dest_slot->mount_point);
-	res = unpack_archive(image, dest_slot->mount_point, &ierror);
+	res = unpack_archive(image, dest_slot, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
 		goto unmount_out;
@@ -983,7 +1347,7 @@ static gboolean archive_to_vfat_handler(RaucImage *image, RaucSlot *dest_slot, c
 
 	/* extract tar into mounted vfat volume */
 	g_message("Extracting %s to %s", image->filename, dest_slot->mount_point);
-	res = unpack_archive(image, dest_slot->mount_point, &ierror);
+	res = unpack_archive(image, dest_slot, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
 		goto unmount_out;
@@ -1030,17 +1394,9 @@ static gboolean img_to_nand_handler(RaucImage *image, RaucSlot *dest_slot, const
 		}
 	}
 
-	/* erase */
-	g_message("erasing slot device %s", dest_slot->device);
-	res = nand_format_slot(dest_slot->device, &ierror);
-	if (!res) {
-		g_propagate_error(error, ierror);
-		goto out;
-	}
-
-	/* write */
+	/* erase and write block by block */
 	g_message("writing slot device %s", dest_slot->device);
-	res = nand_write_slot(image->filename, dest_slot->device, &ierror);
+	res = r_nand_write_image(image->filename, dest_slot->device, &image->checksum, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
 		goto out;
@@ -1178,7 +1534,7 @@ static gboolean img_to_boot_emmc_handler(RaucImage *image, RaucSlot *dest_slot,
 	/* copy */
 	g_message("Copying image to slot device partition %s",
 			part_slot->device);
-	res = copy_raw_image(image, outstream, &ierror);
+	res = copy_raw_image(image, outstream, NULL, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
 		goto out;
@@ -1377,3 +1733,14 @@ img_to_slot_handler get_update_handler(RaucImage *mfimage, RaucSlot *dest_slot,
 out:
 	return handler;
 }
+
+gboolean update_handler_writes_as_is(img_to_slot_handler handler, RaucImage *image)
+{
+	g_return_val_if_fail(image, FALSE);
+
+	if (handler != img_to_raw_handler && handler != img_to_fs_handler)
+		return FALSE;
+
+	/* casync images are extracted instead of copied */
+	return !g_str_has_suffix(image->filename, ".caibx");
+}
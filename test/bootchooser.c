@@ -1,9 +1,15 @@
 #include <stdio.h>
 #include <locale.h>
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
 
 #include <bootchooser.h>
 #include <context.h>
+#include <efivars.h>
+#include <grub_env.h>
+#include <mark.h>
+#include <uboot_env.h>
 #include <utils.h>
 
 #include "common.h"
@@ -180,6 +186,124 @@ bootstate.system1.priority=20\n\
 	g_assert_true(r_boot_set_primary(rootfs1, NULL));
 }
 
+/* Returns the number of barebox-state calls recorded in the log and clears it */
+static guint barebox_state_calls(const gchar *logpath)
+{
+	g_autofree gchar *contents = NULL;
+	guint calls = 0;
+
+	if (!g_file_get_contents(logpath, &contents, NULL, NULL))
+		return 0;
+	g_assert_cmpint(g_remove(logpath), ==, 0);
+
+	for (gchar *c = contents; *c; c++) {
+		if (*c == '\n')
+			calls++;
+	}
+
+	return calls;
+}
+
+static void bootchooser_barebox_multi(BootchooserFixture *fixture,
+		gconstpointer user_data)
+{
+	RaucSlot *rootfs0 = NULL, *rootfs1 = NULL, *rootfs2 = NULL, *primary = NULL;
+	g_autofree gchar *logpath = g_build_filename(fixture->tmpdir, "barebox-state.log", NULL);
+	GError *error = NULL;
+	gboolean good;
+
+	const gchar *cfg_file = "\
+[system]\n\
+compatible=FooCorp Super BarBazzer\n\
+bootloader=barebox\n\
+mountprefix=/mnt/myrauc/\n\
+\n\
+[keyring]\n\
+path=/etc/rauc/keyring/\n\
+\n\
+[slot.rootfs.0]\n\
+device=/dev/rootfs-0\n\
+type=ext4\n\
+bootname=system0\n\
+\n\
+[slot.rootfs.1]\n\
+device=/dev/rootfs-1\n\
+type=ext4\n\
+bootname=system1\n\
+\n\
+[slot.rootfs.2]\n\
+device=/dev/rootfs-2\n\
+type=ext4\n\
+bootname=system2\n";
+
+	gchar* pathname = write_tmp_file(fixture->tmpdir, "barebox_multi.conf", cfg_file, NULL);
+	g_assert_nonnull(pathname);
+
+	g_clear_pointer(&r_context_conf()->configpath, g_free);
+	r_context_conf()->configpath = pathname;
+	r_context();
+
+	rootfs0 = find_config_slot_by_device(r_context()->config, "/dev/rootfs-0");
+	g_assert_nonnull(rootfs0);
+	rootfs1 = find_config_slot_by_device(r_context()->config, "/dev/rootfs-1");
+	g_assert_nonnull(rootfs1);
+	rootfs2 = find_config_slot_by_device(r_context()->config, "/dev/rootfs-2");
+	g_assert_nonnull(rootfs2);
+
+	g_setenv("BAREBOX_STATE_LOG", logpath, TRUE);
+
+	/* the primary slot is determined from a single barebox-state call */
+	g_setenv("BAREBOX_STATE_VARS_PRE", " \
+bootstate.system0.remaining_attempts=0\n\
+bootstate.system0.priority=30\n\
+bootstate.system1.remaining_attempts=3\n\
+bootstate.system1.priority=10\n\
+bootstate.system2.remaining_attempts=3\n\
+bootstate.system2.priority=20\n\
+", TRUE);
+	primary = r_boot_get_primary(&error);
+	g_assert_no_error(error);
+	g_assert(primary == rootfs2);
+	g_assert_cmpuint(barebox_state_calls(logpath), ==, 1);
+
+	/* a slot whose state cannot be read is skipped by falling back to
+	 * reading each slot on its own */
+	g_setenv("BAREBOX_STATE_VARS_PRE", " \
+bootstate.system0.remaining_attempts=3\n\
+bootstate.system0.priority=10\n\
+bootstate.system1.remaining_attempts=3\n\
+bootstate.system1.priority=20\n\
+", TRUE);
+	primary = r_boot_get_primary(&error);
+	g_assert_no_error(error);
+	g_assert(primary == rootfs1);
+	g_assert_cmpuint(barebox_state_calls(logpath), ==, 4);
+
+	/* within a transaction, the states of all slots are read at once */
+	g_setenv("BAREBOX_STATE_VARS_PRE", " \
+bootstate.system0.remaining_attempts=3\n\
+bootstate.system0.priority=20\n\
+bootstate.system1.remaining_attempts=0\n\
+bootstate.system1.priority=10\n\
+bootstate.system2.remaining_attempts=3\n\
+bootstate.system2.priority=0\n\
+", TRUE);
+	r_boot_transaction_begin();
+	g_assert_true(r_boot_get_state(rootfs0, &good, &error));
+	g_assert_no_error(error);
+	g_assert_true(good);
+	g_assert_true(r_boot_get_state(rootfs1, &good, &error));
+	g_assert_no_error(error);
+	g_assert_false(good);
+	g_assert_true(r_boot_get_state(rootfs2, &good, &error));
+	g_assert_no_error(error);
+	g_assert_false(good);
+	r_boot_transaction_abort();
+	g_assert_cmpuint(barebox_state_calls(logpath), ==, 1);
+
+	g_unsetenv("BAREBOX_STATE_LOG");
+}
+
 static void bootchooser_barebox_asymmetric(BootchooserFixture *fixture,
 		gconstpointer user_data)
 {
@@ -317,6 +441,76 @@ bootname=B\n";
 	g_assert_true(res);
 }
 
+static void bootchooser_grub_native(BootchooserFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autoptr(GString) block = g_string_new("# GRUB Environment Block\nORDER=A B\nA_OK=1\nA_TRY=0\nB_OK=1\nB_TRY=0\nX=a\\\\b\\\nc\n");
+	g_autoptr(RGrubEnv) env = NULL;
+	g_autofree gchar *envpath = NULL;
+	g_autofree gchar *contents = NULL;
+	GError *ierror = NULL;
+	gboolean res = FALSE;
+	RaucSlot *slot;
+	gsize len;
+
+	const gchar *cfg_file = "\
+[system]\n\
+compatible=FooCorp Super BarBazzer\n\
+bootloader=grub\n\
+grubenv=grubenv.native\n\
+grubenv-native=true\n\
+mountprefix=/mnt/myrauc/\n\
+\n\
+[keyring]\n\
+path=/etc/rauc/keyring/\n\
+\n\
+[slot.rootfs.0]\n\
+device=/dev/rootfs-0\n\
+type=ext4\n\
+bootname=A\n\
+\n\
+[slot.rootfs.1]\n\
+device=/dev/rootfs-1\n\
+type=ext4\n\
+bootname=B\n";
+
+	gchar* pathname = write_tmp_file(fixture->tmpdir, "grub_native.conf", cfg_file, NULL);
+	g_assert_nonnull(pathname);
+
+	while (block->len < 1024)
+		g_string_append_c(block, '#');
+	envpath = write_tmp_file(fixture->tmpdir, "grubenv.native", block->str, NULL);
+	g_assert_nonnull(envpath);
+
+	g_clear_pointer(&r_context_conf()->configpath, g_free);
+	r_context_conf()->configpath = pathname;
+	r_context();
+
+	slot = find_config_slot_by_device(r_context()->config, "/dev/rootfs-0");
+	g_assert_nonnull(slot);
+
+	res = r_boot_set_state(slot, FALSE, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+
+	slot = find_config_slot_by_device(r_context()->config, "/dev/rootfs-1");
+	g_assert_nonnull(slot);
+
+	res = r_boot_set_primary(slot, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+
+	/* block size, order and escaped values are preserved */
+	g_assert_true(g_file_get_contents(envpath, &contents, &len, NULL));
+	g_assert_cmpuint(len, ==, 1024);
+	g_assert_true(g_str_has_prefix(contents, "# GRUB Environment Block\nORDER=B A\nA_OK=0\nA_TRY=0\nB_OK=1\nB_TRY=0\nX=a\\\\b\\\nc\n#"));
+
+	env = r_grub_env_load(envpath, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_nonnull(env);
+	g_assert_cmpstr(r_grub_env_get(env, "X"), ==, "a\\b\nc");
+}
+
 /* Write content to state storage for uboot fw_setenv / fw_printenv RAUC mock
  * tools. Content should be similar to:
  * "\
@@ -491,6 +685,307 @@ BOOT_B_LEFT=3\n\
 "));
 }
 
+static void bootchooser_uboot_transaction(BootchooserFixture *fixture,
+		gconstpointer user_data)
+{
+	RaucSlot *rootfs0 = NULL;
+	RaucSlot *rootfs1 = NULL;
+	gboolean good;
+	GError *error = NULL;
+
+	const gchar *cfg_file = "\
+[system]\n\
+compatible=FooCorp Super BarBazzer\n\
+bootloader=uboot\n\
+mountprefix=/mnt/myrauc/\n\
+\n\
+[keyring]\n\
+path=/etc/rauc/keyring/\n\
+\n\
+[slot.rootfs.0]\n\
+device=/dev/rootfs-0\n\
+type=ext4\n\
+bootname=A\n\
+\n\
+[slot.rootfs.1]\n\
+device=/dev/rootfs-1\n\
+type=ext4\n\
+bootname=B\n";
+
+	gchar* pathname = write_tmp_file(fixture->tmpdir, "uboot.conf", cfg_file, NULL);
+	g_assert_nonnull(pathname);
+
+	g_clear_pointer(&r_context_conf()->configpath, g_free);
+	r_context_conf()->configpath = pathname;
+	r_context();
+
+	rootfs0 = find_config_slot_by_device(r_context()->config, "/dev/rootfs-0");
+	g_assert_nonnull(rootfs0);
+	rootfs1 = find_config_slot_by_device(r_context()->config, "/dev/rootfs-1");
+	g_assert_nonnull(rootfs1);
+
+	test_uboot_initialize_state("\
+BOOT_ORDER=A B\n\
+BOOT_A_LEFT=3\n\
+BOOT_B_LEFT=3\n\
+");
+
+	/* changes are staged and seen by later reads of the same transaction */
+	r_boot_transaction_begin();
+	g_assert_true(r_boot_set_state(rootfs0, FALSE, NULL));
+	g_assert_true(r_boot_set_state(rootfs1, FALSE, NULL));
+	g_assert_true(r_boot_get_state(rootfs0, &good, NULL));
+	g_assert_false(good);
+	g_assert_true(test_uboot_post_state("\
+BOOT_ORDER=A B\n\
+BOOT_A_LEFT=3\n\
+BOOT_B_LEFT=3\n\
+"));
+
+	g_assert_true(r_boot_transaction_commit(&error));
+	g_assert_no_error(error);
+	g_assert_true(test_uboot_post_state("\
+BOOT_ORDER=\n\
+BOOT_A_LEFT=0\n\
+BOOT_B_LEFT=0\n\
+"));
+
+	/* values read once are served from the cache */
+	test_uboot_initialize_state("\
+BOOT_ORDER=A B\n\
+BOOT_A_LEFT=3\n\
+BOOT_B_LEFT=3\n\
+");
+	r_boot_transaction_begin();
+	g_assert_true(r_boot_get_state(rootfs0, &good, NULL));
+	g_assert_true(good);
+	test_uboot_initialize_state("\
+BOOT_ORDER=A B\n\
+BOOT_A_LEFT=3\n\
+BOOT_B_LEFT=0\n\
+");
+	g_assert_true(r_boot_get_state(rootfs1, &good, NULL));
+	g_assert_true(good);
+
+	/* aborting discards staged changes */
+	g_assert_true(r_boot_set_primary(rootfs1, NULL));
+	r_boot_transaction_abort();
+	g_assert_true(test_uboot_post_state("\
+BOOT_ORDER=A B\n\
+BOOT_A_LEFT=3\n\
+BOOT_B_LEFT=0\n\
+"));
+
+	/* without a transaction, the bootloader is read again */
+	g_assert_true(r_boot_get_state(rootfs1, &good, NULL));
+	g_assert_false(good);
+}
+
+/* Test: Activating a slot switches the primary even if its status cannot be
+ * written afterwards */
+static void bootchooser_mark_active_status_fails(BootchooserFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autofree gchar *slot_name = NULL;
+	g_autofree gchar *message = NULL;
+
+	const gchar *cfg_file = "\
+[system]\n\
+compatible=FooCorp Super BarBazzer\n\
+bootloader=uboot\n\
+mountprefix=/mnt/myrauc/\n\
+statusfile=/nonexistent/status.raucs\n\
+\n\
+[keyring]\n\
+path=/etc/rauc/keyring/\n\
+\n\
+[slot.rootfs.0]\n\
+device=/dev/rootfs-0\n\
+type=ext4\n\
+bootname=A\n\
+\n\
+[slot.rootfs.1]\n\
+device=/dev/rootfs-1\n\
+type=ext4\n\
+bootname=B\n";
+
+	gchar* pathname = write_tmp_file(fixture->tmpdir, "uboot.conf", cfg_file, NULL);
+	g_assert_nonnull(pathname);
+
+	g_clear_pointer(&r_context_conf()->configpath, g_free);
+	r_context_conf()->configpath = pathname;
+	r_context();
+
+	test_uboot_initialize_state("\
+BOOT_ORDER=A B\n\
+BOOT_A_LEFT=3\n\
+BOOT_B_LEFT=0\n\
+");
+
+	g_assert_true(mark_run("active", "rootfs.1", &slot_name, &message));
+	g_assert_nonnull(strstr(message, "activated slot rootfs.1, but failed to write status file"));
+	g_assert_true(test_uboot_post_state("\
+BOOT_ORDER=B A\n\
+BOOT_A_LEFT=3\n\
+BOOT_B_LEFT=3\n\
+"));
+}
+
+/* Writes one copy of a redundant environment with a valid CRC */
+static void test_uboot_write_env_copy(const gchar *path, goffset offset, gsize size,
+		guint8 flags, const gchar *const *vars)
+{
+	g_autofree guint8 *buf = g_malloc0(size);
+	guint32 crc = 0xffffffff;
+	gsize pos = 5;
+	FILE *f;
+
+	for (const gchar *const *var = vars; *var; var++) {
+		gsize len = strlen(*var) + 1;
+		g_assert_cmpuint(pos + len, <, size);
+		memcpy(buf + pos, *var, len);
+		pos += len;
+	}
+
+	for (gsize i = 5; i < size; i++) {
+		crc ^= buf[i];
+		for (gint k = 0; k < 8; k++)
+			crc = (crc & 1) ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+	}
+	crc = GUINT32_TO_LE(crc ^ 0xffffffff);
+	memcpy(buf, &crc, sizeof(crc));
+	buf[4] = flags;
+
+	f = fopen(path, "r+b");
+	g_assert_nonnull(f);
+	g_assert_cmpint(fseek(f, offset, SEEK_SET), ==, 0);
+	g_assert_cmpuint(fwrite(buf, 1, size, f), ==, size);
+	g_assert_cmpint(fclose(f), ==, 0);
+}
+
+/* Returns value of a variable in the native test environment */
+static gchar *test_uboot_native_get(const gchar *config, const gchar *key)
+{
+	g_autoptr(RUbootEnv) env = NULL;
+	GError *error = NULL;
+
+	env = r_uboot_env_load(config, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(env);
+
+	return g_strdup(r_uboot_env_get(env, key));
+}
+
+static void bootchooser_uboot_native(BootchooserFixture *fixture,
+		gconstpointer user_data)
+{
+	RaucSlot *rootfs0 = NULL;
+	RaucSlot *rootfs1 = NULL;
+	RaucSlot *primary = NULL;
+	g_autoptr(RUbootEnv) env = NULL;
+	g_autofree gchar *envfile = NULL;
+	g_autofree gchar *fwenvconfig = NULL;
+	g_autofree gchar *fwenvcontent = NULL;
+	g_autofree gchar *value = NULL;
+	g_autofree gchar *badconfig = NULL;
+	g_autofree gchar *badcontent = NULL;
+	gboolean good;
+	GError *error = NULL;
+	const gchar *initial_vars[] = {"BOOT_ORDER=A B", "BOOT_A_LEFT=3", "BOOT_B_LEFT=3", NULL};
+
+	const gchar *cfg_file = "\
+[system]\n\
+compatible=FooCorp Super BarBazzer\n\
+bootloader=uboot\n\
+uboot-env-config=fw_env.config\n\
+mountprefix=/mnt/myrauc/\n\
+\n\
+[keyring]\n\
+path=/etc/rauc/keyring/\n\
+\n\
+[slot.rootfs.0]\n\
+device=/dev/rootfs-0\n\
+type=ext4\n\
+bootname=A\n\
+\n\
+[slot.rootfs.1]\n\
+device=/dev/rootfs-1\n\
+type=ext4\n\
+bootname=B\n";
+
+	gchar* pathname = write_tmp_file(fixture->tmpdir, "uboot_native.conf", cfg_file, NULL);
+	g_assert_nonnull(pathname);
+
+	/* redundant environment, both copies in one file */
+	g_assert(test_prepare_dummy_file(fixture->tmpdir, "uboot.env", 0x4000, "/dev/zero") == 0);
+	envfile = g_build_filename(fixture->tmpdir, "uboot.env", NULL);
+	fwenvcontent = g_strdup_printf("# device offset size\n%s 0x0 0x2000\n%s 0x2000 0x2000\n",
+			envfile, envfile);
+	fwenvconfig = write_tmp_file(fixture->tmpdir, "fw_env.config", fwenvcontent, NULL);
+	g_assert_nonnull(fwenvconfig);
+
+	g_clear_pointer(&r_context_conf()->configpath, g_free);
+	r_context_conf()->configpath = pathname;
+	r_context();
+
+	rootfs0 = find_config_slot_by_device(r_context()->config, "/dev/rootfs-0");
+	g_assert_nonnull(rootfs0);
+	rootfs1 = find_config_slot_by_device(r_context()->config, "/dev/rootfs-1");
+	g_assert_nonnull(rootfs1);
+
+	/* loading fails if no copy has a valid CRC */
+	env = r_uboot_env_load(fwenvconfig, &error);
+	g_assert_error(error, R_UBOOT_ENV_ERROR, R_UBOOT_ENV_ERROR_BAD_CRC);
+	g_assert_null(env);
+	g_clear_error(&error);
+
+	/* a valid copy is used if the other one has a bad CRC */
+	test_uboot_write_env_copy(envfile, 0x2000, 0x2000, 1, initial_vars);
+	value = test_uboot_native_get(fwenvconfig, "BOOT_ORDER");
+	g_assert_cmpstr(value, ==, "A B");
+	g_free(value);
+
+	/* check rootfs.0 + rootfs.1 are considered good */
+	g_assert_true(r_boot_get_state(rootfs0, &good, NULL));
+	g_assert_true(good);
+	g_assert_true(r_boot_get_state(rootfs1, &good, NULL));
+	g_assert_true(good);
+
+	/* check rootfs.0 is marked bad (removed from BOOT_ORDER, BOOT_A_LEFT set to 0) */
+	g_assert_true(r_boot_set_state(rootfs0, FALSE, &error));
+	g_assert_no_error(error);
+	value = test_uboot_native_get(fwenvconfig, "BOOT_ORDER");
+	g_assert_cmpstr(value, ==, "B");
+	g_free(value);
+	value = test_uboot_native_get(fwenvconfig, "BOOT_A_LEFT");
+	g_assert_cmpstr(value, ==, "0");
+	g_free(value);
+	g_assert_true(r_boot_get_state(rootfs0, &good, NULL));
+	g_assert_false(good);
+
+	/* check rootfs.0 is marked primary (first in BOOT_ORDER, BOOT_A_LEFT reset to 3) */
+	g_assert_true(r_boot_set_primary(rootfs0, &error));
+	g_assert_no_error(error);
+	value = test_uboot_native_get(fwenvconfig, "BOOT_ORDER");
+	g_assert_cmpstr(value, ==, "A B");
+	g_free(value);
+	value = test_uboot_native_get(fwenvconfig, "BOOT_A_LEFT");
+	g_assert_cmpstr(value, ==, "3");
+
+	primary = r_boot_get_primary(&error);
+	g_assert_no_error(error);
+	g_assert(primary == rootfs0);
+
+	/* read errors are reported even if the other copy is valid */
+	badcontent = g_strdup_printf("%s 0x0 0x2000\n%s 0x4000 0x2000\n", envfile, envfile);
+	badconfig = write_tmp_file(fixture->tmpdir, "fw_env_bad.config", badcontent, NULL);
+	g_assert_nonnull(badconfig);
+	env = r_uboot_env_load(badconfig, &error);
+	g_assert_error(error, R_UBOOT_ENV_ERROR, R_UBOOT_ENV_ERROR_FAILED);
+	g_assert_null(env);
+	g_clear_error(&error);
+}
+
 static void bootchooser_uboot_asymmetric(BootchooserFixture *fixture,
 		gconstpointer user_data)
 {
@@ -631,6 +1126,125 @@ bootname=system1\n";
 }
 
 
+/* Writes a Boot#### load option with the given description */
+static void test_efi_write_boot_entry(const gchar *efivarfs, const gchar *num, const gchar *description)
+{
+	g_autoptr(GByteArray) option = g_byte_array_new();
+	g_autofree gchar *name = g_strconcat("Boot", num, NULL);
+	const guint8 header[] = {0x01, 0x00, 0x00, 0x00, 0x04, 0x00};
+	const guint8 end_of_path[] = {0x7f, 0xff, 0x04, 0x00};
+
+	g_byte_array_append(option, header, sizeof(header));
+	for (const gchar *c = description; ; c++) {
+		guint8 ucs2[] = {*c, 0x00};
+		g_byte_array_append(option, ucs2, sizeof(ucs2));
+		if (*c == '\0')
+			break;
+	}
+	g_byte_array_append(option, end_of_path, sizeof(end_of_path));
+
+	g_assert_true(r_efivars_write(efivarfs, name, option->data, option->len, NULL));
+}
+
+static void bootchooser_efi_efivarfs(BootchooserFixture *fixture,
+		gconstpointer user_data)
+{
+	RaucSlot *slot;
+	gboolean good;
+	RaucSlot *primary = NULL;
+	g_autofree gchar *efivarfs = NULL;
+	g_autoptr(GBytes) var = NULL;
+	GError *error = NULL;
+	const guint8 order[] = {0x01, 0x00, 0x02, 0x00, 0x03, 0x00, 0x00, 0x00};
+	const guint8 order_bad[] = {0x02, 0x00, 0x03, 0x00, 0x00, 0x00};
+	const guint8 order_good[] = {0x01, 0x00, 0x02, 0x00, 0x03, 0x00, 0x00, 0x00};
+	const guint8 next[] = {0x02, 0x00};
+
+	const gchar *cfg_file = "\
+[system]\n\
+compatible=FooCorp Super BarBazzer\n\
+bootloader=efi\n\
+efivarfs=efivars\n\
+mountprefix=/mnt/myrauc/\n\
+\n\
+[keyring]\n\
+path=/etc/rauc/keyring/\n\
+\n\
+[slot.rescue.0]\n\
+device=/dev/mtd4\n\
+type=raw\n\
+bootname=recover\n\
+readonly=true\n\
+\n\
+[slot.rootfs.0]\n\
+device=/dev/rootfs-0\n\
+type=ext4\n\
+bootname=system0\n\
+\n\
+[slot.rootfs.1]\n\
+device=/dev/rootfs-1\n\
+type=ext4\n\
+bootname=system1\n";
+
+	gchar* pathname = write_tmp_file(fixture->tmpdir, "efi_efivarfs.conf", cfg_file, NULL);
+	g_assert_nonnull(pathname);
+
+	efivarfs = g_build_filename(fixture->tmpdir, "efivars", NULL);
+	g_assert_cmpint(g_mkdir(efivarfs, 0755), ==, 0);
+	test_efi_write_boot_entry(efivarfs, "0000", "invalid");
+	test_efi_write_boot_entry(efivarfs, "0001", "system0");
+	test_efi_write_boot_entry(efivarfs, "0002", "system1");
+	test_efi_write_boot_entry(efivarfs, "0003", "recovery");
+	g_assert_true(r_efivars_write(efivarfs, "BootOrder", order, sizeof(order), NULL));
+
+	g_clear_pointer(&r_context_conf()->configpath, g_free);
+	r_context_conf()->configpath = pathname;
+	r_context();
+
+	slot = find_config_slot_by_device(r_context()->config, "/dev/rootfs-0");
+	g_assert_nonnull(slot);
+
+	g_assert_true(r_boot_get_state(slot, &good, NULL));
+	g_assert_true(good);
+	primary = r_boot_get_primary(&error);
+	g_assert_no_error(error);
+	g_assert(primary == slot);
+
+	/* marking bad removes entry from BootOrder */
+	g_assert_true(r_boot_set_state(slot, FALSE, &error));
+	g_assert_no_error(error);
+	var = r_efivars_read(efivarfs, "BootOrder", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_bytes_get_size(var), ==, sizeof(order_bad));
+	g_assert_cmpint(memcmp(g_bytes_get_data(var, NULL), order_bad, sizeof(order_bad)), ==, 0);
+	g_clear_pointer(&var, g_bytes_unref);
+	g_assert_true(r_boot_get_state(slot, &good, NULL));
+	g_assert_false(good);
+
+	/* marking good prepends it again */
+	g_assert_true(r_boot_set_state(slot, TRUE, &error));
+	g_assert_no_error(error);
+	var = r_efivars_read(efivarfs, "BootOrder", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_bytes_get_size(var), ==, sizeof(order_good));
+	g_assert_cmpint(memcmp(g_bytes_get_data(var, NULL), order_good, sizeof(order_good)), ==, 0);
+	g_clear_pointer(&var, g_bytes_unref);
+
+	/* marking primary sets BootNext */
+	slot = find_config_slot_by_device(r_context()->config, "/dev/rootfs-1");
+	g_assert_nonnull(slot);
+	g_assert_true(r_boot_set_primary(slot, &error));
+	g_assert_no_error(error);
+	var = r_efivars_read(efivarfs, "BootNext", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_bytes_get_size(var), ==, sizeof(next));
+	g_assert_cmpint(memcmp(g_bytes_get_data(var, NULL), next, sizeof(next)), ==, 0);
+
+	primary = r_boot_get_primary(&error);
+	g_assert_no_error(error);
+	g_assert(primary == slot);
+}
+
 int main(int argc, char *argv[])
 {
 	gchar *path;
@@ -646,6 +1260,10 @@ int main(int argc, char *argv[])
 			bootchooser_fixture_set_up, bootchooser_barebox,
 			bootchooser_fixture_tear_down);
 
+	g_test_add("/bootchoser/barebox-multi", BootchooserFixture, NULL,
+			bootchooser_fixture_set_up, bootchooser_barebox_multi,
+			bootchooser_fixture_tear_down);
+
 	g_test_add("/bootchoser/barebox-asymmetric", BootchooserFixture, NULL,
 			bootchooser_fixture_set_up, bootchooser_barebox_asymmetric,
 			bootchooser_fixture_tear_down);
@@ -654,6 +1272,10 @@ int main(int argc, char *argv[])
 			bootchooser_fixture_set_up, bootchooser_grub,
 			bootchooser_fixture_tear_down);
 
+	g_test_add("/bootchoser/grub-native", BootchooserFixture, NULL,
+			bootchooser_fixture_set_up, bootchooser_grub_native,
+			bootchooser_fixture_tear_down);
+
 	g_test_add("/bootchoser/uboot", BootchooserFixture, NULL,
 			bootchooser_fixture_set_up, bootchooser_uboot,
 			bootchooser_fixture_tear_down);
@@ -662,9 +1284,25 @@ int main(int argc, char *argv[])
 			bootchooser_fixture_set_up, bootchooser_uboot_asymmetric,
 			bootchooser_fixture_tear_down);
 
+	g_test_add("/bootchoser/uboot-transaction", BootchooserFixture, NULL,
+			bootchooser_fixture_set_up, bootchooser_uboot_transaction,
+			bootchooser_fixture_tear_down);
+
+	g_test_add("/bootchoser/mark-active-status-fails", BootchooserFixture, NULL,
+			bootchooser_fixture_set_up, bootchooser_mark_active_status_fails,
+			bootchooser_fixture_tear_down);
+
+	g_test_add("/bootchoser/uboot-native", BootchooserFixture, NULL,
+			bootchooser_fixture_set_up, bootchooser_uboot_native,
+			bootchooser_fixture_tear_down);
+
 	g_test_add("/bootchoser/efi", BootchooserFixture, NULL,
 			bootchooser_fixture_set_up, bootchooser_efi,
 			bootchooser_fixture_tear_down);
 
+	g_test_add("/bootchoser/efi-efivarfs", BootchooserFixture, NULL,
+			bootchooser_fixture_set_up, bootchooser_efi_efivarfs,
+			bootchooser_fixture_tear_down);
+
 	return g_test_run();
 }
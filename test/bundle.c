@@ -207,6 +207,163 @@ static void bundle_test_resign(BundleFixture *fixture,
 	g_clear_pointer(&bundle, free_bundle);
 }
 
+/* Creates a bundle with a tar archive for the rootfs slot class */
+static void bundle_fixture_set_up_tar_bundle(BundleFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autoptr(GSubprocess) sproc = NULL;
+	g_autoptr(RaucManifest) rm = g_new0(RaucManifest, 1);
+	g_autofree gchar *rootdir = NULL;
+	g_autofree gchar *archive = NULL;
+	g_autofree gchar *mfpath = NULL;
+	g_autofree gchar *hostname = NULL;
+	GError *error = NULL;
+	RaucImage *img;
+
+	fixture->tmpdir = g_dir_make_tmp("rauc-XXXXXX", NULL);
+	g_assert_nonnull(fixture->tmpdir);
+	fixture->contentdir = g_build_filename(fixture->tmpdir, "content", NULL);
+	fixture->bundlename = g_build_filename(fixture->tmpdir, "bundle.raucb", NULL);
+
+	rootdir = g_build_filename(fixture->tmpdir, "root", NULL);
+	g_assert(test_mkdir_relative(fixture->tmpdir, "root", 0777) == 0);
+	g_assert(test_mkdir_relative(fixture->tmpdir, "root/etc", 0777) == 0);
+	hostname = write_tmp_file(rootdir, "etc/hostname", "target\n", NULL);
+	g_assert_nonnull(hostname);
+	g_assert(test_mkdir_relative(fixture->tmpdir, "content", 0777) == 0);
+
+	archive = g_build_filename(fixture->contentdir, "rootfs.tar", NULL);
+	sproc = g_subprocess_new(G_SUBPROCESS_FLAGS_NONE, &error,
+			"tar", "cf", archive, "-C", rootdir, ".", NULL);
+	g_assert_no_error(error);
+	g_assert_true(g_subprocess_wait_check(sproc, NULL, &error));
+	g_assert_no_error(error);
+
+	g_assert(test_prepare_dummy_file(fixture->contentdir, "appfs.ext4",
+			64*1024, "/dev/urandom") == 0);
+
+	rm->update_compatible = g_strdup("Test Config");
+	rm->update_version = g_strdup("2011.03-2");
+	img = g_new0(RaucImage, 1);
+	img->slotclass = g_strdup("rootfs");
+	img->filename = g_strdup("rootfs.tar");
+	rm->images = g_list_append(rm->images, img);
+	img = g_new0(RaucImage, 1);
+	img->slotclass = g_strdup("appfs");
+	img->filename = g_strdup("appfs.ext4");
+	rm->images = g_list_append(rm->images, img);
+
+	mfpath = g_build_filename(fixture->contentdir, "manifest.raucm", NULL);
+	g_assert_true(save_manifest_file(mfpath, rm, &error));
+	g_assert_no_error(error);
+
+	test_create_bundle(fixture->contentdir, fixture->bundlename);
+}
+
+static void bundle_test_fs_image_invalid(BundleFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autofree gchar *outbundle = g_build_filename(fixture->tmpdir, "out.raucb", NULL);
+	const gchar *invalid[][2] = {
+		{"rootfs", NULL},
+		{":1M", NULL},
+		{"rootfs:0", NULL},
+		{"rootfs:12X", NULL},
+		{"rootfs:M", NULL},
+		/* hints must match a tar archive image */
+		{"appfs:1M", NULL},
+		{"bootfs:1M", NULL},
+	};
+	RaucBundle *bundle = NULL;
+	GError *error = NULL;
+
+	g_assert_true(check_bundle(fixture->bundlename, &bundle, TRUE, &error));
+	g_assert_no_error(error);
+
+	for (guint i = 0; i < G_N_ELEMENTS(invalid); i++) {
+		g_assert_false(create_fs_image_bundle(bundle, outbundle, (gchar **) invalid[i], &error));
+		g_assert_error(error, R_BUNDLE_ERROR, R_BUNDLE_ERROR_FS_IMAGE);
+		g_clear_error(&error);
+		g_assert_false(g_file_test(outbundle, G_FILE_TEST_EXISTS));
+	}
+
+	free_bundle(bundle);
+}
+
+static void bundle_test_fs_image(BundleFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autofree gchar *outbundle = g_build_filename(fixture->tmpdir, "out.raucb", NULL);
+	g_autofree gchar *outputdir = g_build_filename(fixture->tmpdir, "output", NULL);
+	g_autofree gchar *mfpath = g_build_filename(outputdir, "manifest.raucm", NULL);
+	g_autofree gchar *fspath = g_build_filename(outputdir, "rootfs.ext4", NULL);
+	g_autofree gchar *dumpe2fs = NULL;
+	g_autofree gchar *mkfs = NULL;
+	g_autoptr(RaucManifest) manifest = NULL;
+	g_autoptr(GSubprocess) sproc = NULL;
+	g_autoptr(GBytes) header = NULL;
+	const gchar *fs_sizes[] = {"rootfs:8M", NULL};
+	RaucBundle *bundle = NULL;
+	RaucImage *rootfs, *appfs;
+	GError *error = NULL;
+	GStatBuf st;
+
+	/* keeping file ownership needs root or fakeroot */
+	if (!test_running_as_root())
+		return;
+
+	mkfs = g_find_program_in_path("mkfs.ext4");
+	dumpe2fs = g_find_program_in_path("dumpe2fs");
+	if (!mkfs || !dumpe2fs) {
+		g_test_skip("mkfs.ext4 or dumpe2fs not available");
+		return;
+	}
+
+	g_assert_true(check_bundle(fixture->bundlename, &bundle, TRUE, &error));
+	g_assert_no_error(error);
+	g_assert_true(create_fs_image_bundle(bundle, outbundle, (gchar **) fs_sizes, &error));
+	g_assert_no_error(error);
+	g_clear_pointer(&bundle, free_bundle);
+
+	/* the destination must not be overwritten */
+	g_assert_true(check_bundle(fixture->bundlename, &bundle, TRUE, &error));
+	g_assert_no_error(error);
+	g_assert_false(create_fs_image_bundle(bundle, outbundle, (gchar **) fs_sizes, &error));
+	g_assert_error(error, G_FILE_ERROR, G_FILE_ERROR_EXIST);
+	g_clear_error(&error);
+	g_clear_pointer(&bundle, free_bundle);
+
+	g_assert_true(check_bundle(outbundle, &bundle, TRUE, &error));
+	g_assert_no_error(error);
+	g_assert_true(extract_bundle(bundle, outputdir, &error));
+	g_assert_no_error(error);
+	g_assert_true(verify_manifest(outputdir, NULL, &error));
+	g_assert_no_error(error);
+	g_clear_pointer(&bundle, free_bundle);
+
+	g_assert_true(load_manifest_file(mfpath, &manifest, &error));
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(manifest->images), ==, 2);
+	rootfs = g_list_nth_data(manifest->images, 0);
+	appfs = g_list_nth_data(manifest->images, 1);
+	g_assert_cmpstr(rootfs->filename, ==, "rootfs.ext4");
+	g_assert_cmpuint(rootfs->checksum.size, ==, 8*1024*1024);
+	g_assert_cmpstr(appfs->filename, ==, "appfs.ext4");
+	g_assert_cmpuint(appfs->checksum.size, ==, 64*1024);
+	g_assert_cmpint(g_stat(fspath, &st), ==, 0);
+	g_assert_cmpint(st.st_size, ==, 8*1024*1024);
+
+	/* features are pinned independent of the host's mke2fs.conf */
+	sproc = g_subprocess_new(G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDERR_SILENCE,
+			&error, dumpe2fs, "-h", fspath, NULL);
+	g_assert_no_error(error);
+	g_assert_true(g_subprocess_communicate(sproc, NULL, NULL, &header, NULL, &error));
+	g_assert_no_error(error);
+	g_assert_nonnull(g_strstr_len(g_bytes_get_data(header, NULL), g_bytes_get_size(header), "has_journal"));
+	g_assert_null(g_strstr_len(g_bytes_get_data(header, NULL), g_bytes_get_size(header), "metadata_csum"));
+	g_assert_null(g_strstr_len(g_bytes_get_data(header, NULL), g_bytes_get_size(header), "64bit"));
+}
+
 int main(int argc, char *argv[])
 {
 	setlocale(LC_ALL, "C");
@@ -242,5 +399,13 @@ int main(int argc, char *argv[])
 			bundle_fixture_set_up_bundle, bundle_test_resign,
 			bundle_fixture_tear_down);
 
+	g_test_add("/bundle/fs_image/invalid", BundleFixture, NULL,
+			bundle_fixture_set_up_tar_bundle, bundle_test_fs_image_invalid,
+			bundle_fixture_tear_down);
+
+	g_test_add("/bundle/fs_image", BundleFixture, NULL,
+			bundle_fixture_set_up_tar_bundle, bundle_test_fs_image,
+			bundle_fixture_tear_down);
+
 	return g_test_run();
 }
@@ -62,6 +62,35 @@ static void checksum_test1(void)
 	g_assert(checksum.size == 0);
 }
 
+static void checksum_test_device(void)
+{
+	RaucChecksum checksum = {};
+	GError *error = NULL;
+
+	checksum.type = G_CHECKSUM_SHA256;
+	checksum.digest = g_strdup(TEST_DIGEST_GOOD);
+	checksum.size = 32768;
+	g_assert_true(verify_device_checksum(&checksum, "test/install-content/appfs.img", &error));
+	g_assert_no_error(error);
+
+	/* only the given size is read back */
+	checksum.size = 4096;
+	g_assert_false(verify_device_checksum(&checksum, "test/install-content/appfs.img", &error));
+	g_assert_error(error, R_CHECKSUM_ERROR, R_CHECKSUM_ERROR_DIGEST_MISMATCH);
+	g_clear_error(&error);
+
+	checksum.size = 65536;
+	g_assert_false(verify_device_checksum(&checksum, "test/install-content/appfs.img", &error));
+	g_assert_error(error, R_CHECKSUM_ERROR, R_CHECKSUM_ERROR_SIZE_MISMATCH);
+	g_clear_error(&error);
+
+	g_assert_false(verify_device_checksum(&checksum, "test/_MISSING_", &error));
+	g_assert_error(error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+	g_clear_error(&error);
+
+	g_free(checksum.digest);
+}
+
 int main(int argc, char *argv[])
 {
 	setlocale(LC_ALL, "C");
@@ -69,6 +98,7 @@ int main(int argc, char *argv[])
 	g_test_init(&argc, &argv, NULL);
 
 	g_test_add_func("/checksum/test1", checksum_test1);
+	g_test_add_func("/checksum/device", checksum_test_device);
 
 	return g_test_run();
 }
@@ -0,0 +1,325 @@
+#include <locale.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <utime.h>
+
+#include "chunk_cache.h"
+#include "common.h"
+
+typedef struct {
+	gchar *tmpdir;
+	gchar *indexfile;
+	gchar *store;
+	gchar *cache;
+} ChunkCacheFixture;
+
+#define TEST_CHUNK_COUNT 4
+
+static void put_le64(GByteArray *array, guint64 value)
+{
+	guint64 le = GUINT64_TO_LE(value);
+
+	g_byte_array_append(array, (const guint8 *) &le, sizeof(le));
+}
+
+/* Writes an index referencing TEST_CHUNK_COUNT chunks (the last one twice)
+ * and a store containing the corresponding chunk files. */
+static void chunk_cache_fixture_set_up(ChunkCacheFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autoptr(GByteArray) index = g_byte_array_new();
+	guint64 table_size;
+	GError *error = NULL;
+
+	fixture->tmpdir = g_dir_make_tmp("rauc-XXXXXX", NULL);
+	g_assert_nonnull(fixture->tmpdir);
+	fixture->indexfile = g_build_filename(fixture->tmpdir, "image.caibx", NULL);
+	fixture->store = g_build_filename(fixture->tmpdir, "image.castr", NULL);
+	fixture->cache = g_build_filename(fixture->tmpdir, "cache", NULL);
+
+	put_le64(index, 48);
+	put_le64(index, 0x96824d9c7b129ff9ULL);
+	put_le64(index, 0);
+	put_le64(index, 16 * 1024);
+	put_le64(index, 64 * 1024);
+	put_le64(index, 256 * 1024);
+	put_le64(index, G_MAXUINT64);
+	put_le64(index, 0xe75b9e112f17417dULL);
+
+	for (guint i = 0; i <= TEST_CHUNK_COUNT; i++) {
+		guint8 id[32];
+		guint n = MIN(i, TEST_CHUNK_COUNT - 1);
+		g_autofree gchar *hex = g_malloc0(65);
+		g_autofree gchar *data = g_strnfill(1024 * (n + 1), 'x');
+		g_autofree gchar *path = NULL;
+		g_autofree gchar *dir = NULL;
+
+		memset(id, 0xa0 + n, sizeof(id));
+		put_le64(index, (i + 1) * 64 * 1024);
+		g_byte_array_append(index, id, sizeof(id));
+
+		for (guint j = 0; j < 32; j++)
+			g_snprintf(hex + j * 2, 3, "%02x", id[j]);
+		path = r_chunk_cache_chunk_path(fixture->store, hex);
+		dir = g_path_get_dirname(path);
+		g_assert_cmpint(g_mkdir_with_parents(dir, 0755), ==, 0);
+		g_assert_true(g_file_set_contents(path, data, -1, &error));
+		g_assert_no_error(error);
+	}
+
+	/* table size includes its header, items and this tail */
+	table_size = index->len - 48 + 40;
+	put_le64(index, 0);
+	put_le64(index, 0);
+	put_le64(index, 48);
+	put_le64(index, table_size);
+	put_le64(index, 0x4b4f050e5549ecd1ULL);
+
+	g_assert_true(g_file_set_contents(fixture->indexfile, (const gchar *) index->data, index->len, &error));
+	g_assert_no_error(error);
+}
+
+static void chunk_cache_fixture_tear_down(ChunkCacheFixture *fixture,
+		gconstpointer user_data)
+{
+	g_assert_true(test_rm_tree(fixture->tmpdir, ""));
+	g_free(fixture->indexfile);
+	g_free(fixture->store);
+	g_free(fixture->cache);
+	g_free(fixture->tmpdir);
+}
+
+static void chunk_cache_test_parse(ChunkCacheFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autoptr(GPtrArray) ids = NULL;
+	g_autofree gchar *broken = NULL;
+	GError *error = NULL;
+
+	ids = r_chunk_cache_parse_index(fixture->indexfile, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(ids);
+	g_assert_cmpuint(ids->len, ==, TEST_CHUNK_COUNT);
+	g_assert_cmpstr(g_ptr_array_index(ids, 0), ==,
+			"a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0a0");
+
+	broken = write_tmp_file(fixture->tmpdir, "broken.caibx", "not an index", NULL);
+	g_assert_nonnull(broken);
+	g_assert_null(r_chunk_cache_parse_index(broken, &error));
+	g_assert_error(error, R_CHUNK_CACHE_ERROR, R_CHUNK_CACHE_ERROR_INVALID_INDEX);
+	g_clear_error(&error);
+}
+
+static void chunk_cache_test_populate(ChunkCacheFixture *fixture,
+		gconstpointer user_data)
+{
+	RChunkCacheStats stats = {0};
+	GError *error = NULL;
+
+	g_assert_true(r_chunk_cache_populate(fixture->cache, fixture->indexfile,
+			fixture->store, NULL, G_MAXUINT64, &stats, &error));
+	g_assert_no_error(error);
+	g_assert_cmpuint(stats.total, ==, TEST_CHUNK_COUNT);
+	g_assert_cmpuint(stats.hits, ==, 0);
+	g_assert_cmpuint(stats.fetched, ==, TEST_CHUNK_COUNT);
+
+	/* second run must be served from the cache only */
+	g_assert_true(test_rm_tree(fixture->store, ""));
+	g_assert_true(r_chunk_cache_populate(fixture->cache, fixture->indexfile,
+			fixture->store, NULL, G_MAXUINT64, &stats, &error));
+	g_assert_no_error(error);
+	g_assert_cmpuint(stats.hits, ==, TEST_CHUNK_COUNT);
+	g_assert_cmpuint(stats.fetched, ==, 0);
+
+	/* purged chunks cannot be fetched again from the removed store */
+	g_assert_true(r_chunk_cache_purge(fixture->cache, fixture->indexfile, &error));
+	g_assert_no_error(error);
+	g_assert_false(r_chunk_cache_populate(fixture->cache, fixture->indexfile,
+			fixture->store, NULL, G_MAXUINT64, &stats, &error));
+	g_assert_error(error, R_CHUNK_CACHE_ERROR, R_CHUNK_CACHE_ERROR_MISSING_CHUNK);
+	g_clear_error(&error);
+}
+
+static void chunk_cache_test_verify(ChunkCacheFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autoptr(GPtrArray) ids = NULL;
+	g_autofree gchar *path = NULL;
+	RChunkCacheStats stats = {0};
+	GError *error = NULL;
+
+	g_assert_true(r_chunk_cache_populate(fixture->cache, fixture->indexfile,
+			fixture->store, NULL, G_MAXUINT64, &stats, &error));
+	g_assert_no_error(error);
+
+	ids = r_chunk_cache_parse_index(fixture->indexfile, &error);
+	g_assert_no_error(error);
+
+	/* a corrupted cached chunk is dropped and fetched again */
+	path = r_chunk_cache_chunk_path(fixture->cache, g_ptr_array_index(ids, 1));
+	g_assert_true(g_file_set_contents(path, "corrupted", -1, &error));
+	g_assert_no_error(error);
+
+	g_assert_true(r_chunk_cache_populate(fixture->cache, fixture->indexfile,
+			fixture->store, NULL, G_MAXUINT64, &stats, &error));
+	g_assert_no_error(error);
+	g_assert_cmpuint(stats.hits, ==, TEST_CHUNK_COUNT - 1);
+	g_assert_cmpuint(stats.fetched, ==, 1);
+
+	/* all chunks are valid now */
+	g_assert_true(test_rm_tree(fixture->store, ""));
+	g_assert_true(r_chunk_cache_populate(fixture->cache, fixture->indexfile,
+			fixture->store, NULL, G_MAXUINT64, &stats, &error));
+	g_assert_no_error(error);
+	g_assert_cmpuint(stats.hits, ==, TEST_CHUNK_COUNT);
+}
+
+static void chunk_cache_test_seeded(ChunkCacheFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autoptr(GPtrArray) ids = NULL;
+	g_autoptr(GHashTable) seeded = g_hash_table_new(g_str_hash, g_str_equal);
+	RChunkCacheStats stats = {0};
+	GError *error = NULL;
+
+	ids = r_chunk_cache_parse_index(fixture->indexfile, &error);
+	g_assert_no_error(error);
+
+	/* chunks provided by seeds are not fetched */
+	g_hash_table_add(seeded, g_ptr_array_index(ids, 0));
+	g_hash_table_add(seeded, g_ptr_array_index(ids, 2));
+
+	g_assert_true(r_chunk_cache_populate(fixture->cache, fixture->indexfile,
+			fixture->store, seeded, G_MAXUINT64, &stats, &error));
+	g_assert_no_error(error);
+	g_assert_cmpuint(stats.total, ==, TEST_CHUNK_COUNT);
+	g_assert_cmpuint(stats.seeded, ==, 2);
+	g_assert_cmpuint(stats.fetched, ==, 2);
+
+	for (guint i = 0; i < ids->len; i++) {
+		g_autofree gchar *path = r_chunk_cache_chunk_path(fixture->cache, g_ptr_array_index(ids, i));
+
+		g_assert(g_file_test(path, G_FILE_TEST_EXISTS) == (i == 1 || i == 3));
+	}
+}
+
+static void chunk_cache_test_max_size(ChunkCacheFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autoptr(GPtrArray) ids = NULL;
+	RChunkCacheStats stats = {0};
+	GError *error = NULL;
+
+	ids = r_chunk_cache_parse_index(fixture->indexfile, &error);
+	g_assert_no_error(error);
+
+	/* chunks are 1, 2, 3 and 4 KiB large, so only the first two fit */
+	g_assert_true(r_chunk_cache_populate(fixture->cache, fixture->indexfile,
+			fixture->store, NULL, 5 * 1024, &stats, &error));
+	g_assert_no_error(error);
+	g_assert_cmpuint(stats.fetched, ==, 2);
+	g_assert_cmpuint(stats.uncached, ==, 2);
+
+	for (guint i = 0; i < ids->len; i++) {
+		g_autofree gchar *path = r_chunk_cache_chunk_path(fixture->cache, g_ptr_array_index(ids, i));
+
+		g_assert(g_file_test(path, G_FILE_TEST_EXISTS) == (i < 2));
+	}
+}
+
+static void chunk_cache_test_slot_index(ChunkCacheFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autoptr(GPtrArray) ids = NULL;
+	GError *error = NULL;
+
+	g_assert_null(r_chunk_cache_load_slot_index(fixture->cache, "rootfs.0", "digest1"));
+
+	g_assert_true(r_chunk_cache_save_slot_index(fixture->cache, "rootfs.0", "digest1",
+			fixture->indexfile, &error));
+	g_assert_no_error(error);
+
+	ids = r_chunk_cache_load_slot_index(fixture->cache, "rootfs.0", "digest1");
+	g_assert_nonnull(ids);
+	g_assert_cmpuint(ids->len, ==, TEST_CHUNK_COUNT);
+	g_clear_pointer(&ids, g_ptr_array_unref);
+
+	/* the index only applies to the image it was saved for */
+	g_assert_null(r_chunk_cache_load_slot_index(fixture->cache, "rootfs.0", "digest2"));
+	g_assert_null(r_chunk_cache_load_slot_index(fixture->cache, "rootfs.1", "digest1"));
+
+	/* installing another image replaces the saved index */
+	g_assert_true(r_chunk_cache_save_slot_index(fixture->cache, "rootfs.0", "digest2",
+			fixture->indexfile, &error));
+	g_assert_no_error(error);
+	g_assert_null(r_chunk_cache_load_slot_index(fixture->cache, "rootfs.0", "digest1"));
+	ids = r_chunk_cache_load_slot_index(fixture->cache, "rootfs.0", "digest2");
+	g_assert_nonnull(ids);
+}
+
+static void chunk_cache_test_trim(ChunkCacheFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autoptr(GPtrArray) ids = NULL;
+	GError *error = NULL;
+
+	g_assert_true(r_chunk_cache_populate(fixture->cache, fixture->indexfile,
+			fixture->store, NULL, G_MAXUINT64, NULL, &error));
+	g_assert_no_error(error);
+
+	ids = r_chunk_cache_parse_index(fixture->indexfile, &error);
+	g_assert_no_error(error);
+
+	/* make the first chunk the least recently used one */
+	for (guint i = 0; i < ids->len; i++) {
+		g_autofree gchar *path = r_chunk_cache_chunk_path(fixture->cache, g_ptr_array_index(ids, i));
+		struct utimbuf times = {.actime = 1000 + i, .modtime = 1000 + i};
+
+		g_assert_cmpint(g_utime(path, &times), ==, 0);
+	}
+
+	/* chunks are 1, 2, 3 and 4 KiB large */
+	g_assert_true(r_chunk_cache_trim(fixture->cache, 9 * 1024, &error));
+	g_assert_no_error(error);
+
+	for (guint i = 0; i < ids->len; i++) {
+		g_autofree gchar *path = r_chunk_cache_chunk_path(fixture->cache, g_ptr_array_index(ids, i));
+
+		g_assert(g_file_test(path, G_FILE_TEST_EXISTS) == (i > 0));
+	}
+
+	g_assert_true(r_chunk_cache_trim(fixture->cache, 0, &error));
+	g_assert_no_error(error);
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/chunk_cache/parse", ChunkCacheFixture, NULL,
+			chunk_cache_fixture_set_up, chunk_cache_test_parse,
+			chunk_cache_fixture_tear_down);
+	g_test_add("/chunk_cache/populate", ChunkCacheFixture, NULL,
+			chunk_cache_fixture_set_up, chunk_cache_test_populate,
+			chunk_cache_fixture_tear_down);
+	g_test_add("/chunk_cache/verify", ChunkCacheFixture, NULL,
+			chunk_cache_fixture_set_up, chunk_cache_test_verify,
+			chunk_cache_fixture_tear_down);
+	g_test_add("/chunk_cache/seeded", ChunkCacheFixture, NULL,
+			chunk_cache_fixture_set_up, chunk_cache_test_seeded,
+			chunk_cache_fixture_tear_down);
+	g_test_add("/chunk_cache/max-size", ChunkCacheFixture, NULL,
+			chunk_cache_fixture_set_up, chunk_cache_test_max_size,
+			chunk_cache_fixture_tear_down);
+	g_test_add("/chunk_cache/slot-index", ChunkCacheFixture, NULL,
+			chunk_cache_fixture_set_up, chunk_cache_test_slot_index,
+			chunk_cache_fixture_tear_down);
+	g_test_add("/chunk_cache/trim", ChunkCacheFixture, NULL,
+			chunk_cache_fixture_set_up, chunk_cache_test_trim,
+			chunk_cache_fixture_tear_down);
+
+	return g_test_run();
+}
@@ -4,6 +4,7 @@
 
 #include <config_file.h>
 #include <context.h>
+#include <mount.h>
 
 #include "common.h"
 #include "utils.h"
@@ -83,6 +84,7 @@ type=ext4\n\
 bootname=system1\n\
 readonly=false\n\
 ignore-checksum=false\n\
+discard-interval=7\n\
 \n\
 [slot.appfs.0]\n\
 description=Application filesystem partition 0\n\
@@ -132,6 +134,7 @@ ignore-checksum=true\n";
 	g_assert_cmpstr(slot->type, ==, "ext4");
 	g_assert_false(slot->readonly);
 	g_assert_false(slot->force_install_same);
+	g_assert_cmpuint(slot->discard_interval, ==, 0);
 	g_assert_null(slot->parent);
 	g_assert(find_config_slot_by_device(config, "/dev/rootfs-0") == slot);
 
@@ -143,6 +146,7 @@ ignore-checksum=true\n";
 	g_assert_cmpstr(slot->type, ==, "ext4");
 	g_assert_false(slot->readonly);
 	g_assert_false(slot->force_install_same);
+	g_assert_cmpuint(slot->discard_interval, ==, 7);
 	g_assert_null(slot->parent);
 	g_assert(find_config_slot_by_device(config, "/dev/rootfs-1") == slot);
 
@@ -702,6 +706,40 @@ mountprefix=/mnt/myrauc/\n";
 	free_config(config);
 }
 
+static void config_file_casync_seeds(ConfigFileFixture *fixture,
+		gconstpointer user_data)
+{
+	RaucConfig *config;
+	GError *ierror = NULL;
+	g_autofree gchar* pathname = NULL;
+	g_autofree gchar* relative = NULL;
+
+	const gchar *cfg_file = "\
+[system]\n\
+compatible=FooCorp Super BarBazzer\n\
+bootloader=barebox\n\
+mountprefix=/mnt/myrauc/\n\
+\n\
+[casync]\n\
+seeds=/dev/seed;seeds/rootfs.img\n";
+
+	pathname = write_tmp_file(fixture->tmpdir, "casync_seeds.conf", cfg_file, NULL);
+	g_assert_nonnull(pathname);
+
+	g_assert_true(load_config(pathname, &config, &ierror));
+	g_assert_no_error(ierror);
+	g_assert_nonnull(config);
+
+	/* relative seeds are resolved against the config file directory */
+	relative = g_build_filename(fixture->tmpdir, "seeds/rootfs.img", NULL);
+	g_assert_nonnull(config->casync_seeds);
+	g_assert_cmpuint(g_strv_length(config->casync_seeds), ==, 2);
+	g_assert_cmpstr(config->casync_seeds[0], ==, "/dev/seed");
+	g_assert_cmpstr(config->casync_seeds[1], ==, relative);
+
+	free_config(config);
+}
+
 
 static void config_file_test_read_slot_status(void)
 {
@@ -724,6 +762,7 @@ static void config_file_test_write_slot_status(void)
 	ss->status = g_strdup("ok");
 	ss->checksum.type = G_CHECKSUM_SHA256;
 	ss->checksum.digest = g_strdup("dc626520dcd53a22f727af3ee42c770e56c97a64fe3adb063799d8ab032fe551");
+	ss->discarded_timestamp = g_strdup("2017-03-02T10:32:00Z");
 
 	write_slot_status("test/savedslot.raucs", ss, NULL);
 
@@ -737,6 +776,7 @@ static void config_file_test_write_slot_status(void)
 	g_assert_cmpint(ss->checksum.type, ==, G_CHECKSUM_SHA256);
 	g_assert_cmpstr(ss->checksum.digest, ==,
 			"dc626520dcd53a22f727af3ee42c770e56c97a64fe3adb063799d8ab032fe551");
+	g_assert_cmpstr(ss->discarded_timestamp, ==, "2017-03-02T10:32:00Z");
 
 	free_slot_status(ss);
 }
@@ -796,6 +836,162 @@ static void config_file_test_global_slot_status(ConfigFileFixture *fixture,
 		g_assert_cmpstr(slot->status->checksum.digest, ==,
 				"dc626520dcd53a22f727af3ee42c770e56c97a64fe3adb063799d8ab032fe551");
 	}
+
+	/* Merge journal into status file and check again */
+	g_assert_true(commit_slot_status(&ierror));
+	g_assert_no_error(ierror);
+
+	g_hash_table_iter_init(&iter, slots);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer*) &slot)) {
+		g_clear_pointer(&slot->status, free_slot_status);
+	}
+
+	g_hash_table_iter_init(&iter, slots);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer*) &slot)) {
+		load_slot_status(slot);
+		g_assert_nonnull(slot->status);
+		g_assert_cmpstr(slot->status->status, ==, "ok");
+	}
+}
+
+/* Creates an ext4 slot image with a slot status file of given bundle version */
+static gchar *create_slot_image(const gchar *tmpdir, const gchar *name, const gchar *version)
+{
+	g_autofree gchar *imagename = g_strdup_printf("%s.img", name);
+	gchar *imagepath = g_build_filename(tmpdir, imagename, NULL);
+	g_autofree gchar *mountpoint = g_build_filename(tmpdir, "tmpmount", NULL);
+	g_autofree gchar *statuspath = g_build_filename(mountpoint, "slot.raucs", NULL);
+	g_autoptr(GError) error = NULL;
+	RaucSlotStatus *ss = g_new0(RaucSlotStatus, 1);
+
+	g_assert(test_prepare_dummy_file(tmpdir, imagename, 1024*1024, "/dev/zero") == 0);
+	g_assert_true(test_make_filesystem(tmpdir, imagename));
+
+	g_assert(g_mkdir_with_parents(mountpoint, 0777) == 0);
+	g_assert_true(test_mount(imagepath, mountpoint));
+	ss->status = g_strdup("ok");
+	ss->bundle_version = g_strdup(version);
+	g_assert_true(write_slot_status(statuspath, ss, &error));
+	g_assert_no_error(error);
+	free_slot_status(ss);
+	g_assert_true(test_umount(tmpdir, "tmpmount"));
+
+	return imagepath;
+}
+
+static RaucSlot *new_test_slot(const gchar *name, const gchar *type, gchar *device)
+{
+	RaucSlot *slot = g_new0(RaucSlot, 1);
+
+	slot->name = g_intern_string(name);
+	slot->sclass = g_intern_string("rootfs");
+	slot->type = g_strdup(type);
+	slot->device = device;
+
+	return slot;
+}
+
+/* Test: Status loading of several slots skips loaded and non-mountable slots,
+ * reuses external mounts and mounts all pending slots concurrently */
+static void config_file_test_load_slot_status_multi(ConfigFileFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autofree gchar *extmount = g_build_filename(fixture->tmpdir, "external", NULL);
+	g_autofree gchar *extstatus = g_build_filename(extmount, "slot.raucs", NULL);
+	RaucSlot *loaded, *external, *raw, *pending_a, *pending_b;
+	g_autoptr(GList) slots = NULL;
+
+	/* mounting needs to run as root */
+	if (!test_running_as_root())
+		return;
+
+	g_free(r_context()->config->mount_prefix);
+	r_context()->config->mount_prefix = g_build_filename(fixture->tmpdir, "mnt", NULL);
+
+	/* the device does not exist, so loading it again would not work */
+	loaded = new_test_slot("loaded.0", "ext4", g_build_filename(fixture->tmpdir, "missing.img", NULL));
+	loaded->status = g_new0(RaucSlotStatus, 1);
+	loaded->status->bundle_version = g_strdup("loaded");
+
+	external = new_test_slot("external.0", "ext4", create_slot_image(fixture->tmpdir, "external", "external"));
+	g_assert(g_mkdir_with_parents(extmount, 0777) == 0);
+	g_assert_true(test_mount(external->device, extmount));
+	external->ext_mount_point = g_strdup(extmount);
+
+	raw = new_test_slot("raw.0", "raw", g_build_filename(fixture->tmpdir, "missing.img", NULL));
+	pending_a = new_test_slot("pending.0", "ext4", create_slot_image(fixture->tmpdir, "pending-a", "a"));
+	pending_b = new_test_slot("pending.1", "ext4", create_slot_image(fixture->tmpdir, "pending-b", "b"));
+
+	slots = g_list_append(slots, loaded);
+	slots = g_list_append(slots, external);
+	slots = g_list_append(slots, raw);
+	slots = g_list_append(slots, pending_a);
+	slots = g_list_append(slots, pending_b);
+
+	load_slot_status_multi(slots);
+
+	g_assert_cmpstr(loaded->status->bundle_version, ==, "loaded");
+	g_assert_null(loaded->mount_point);
+
+	/* the external mount is used and left in place */
+	g_assert_nonnull(external->status);
+	g_assert_cmpstr(external->status->bundle_version, ==, "external");
+	g_assert_null(external->mount_point);
+	g_assert_true(g_file_test(extstatus, G_FILE_TEST_IS_REGULAR));
+
+	g_assert_nonnull(raw->status);
+	g_assert_null(raw->status->bundle_version);
+	g_assert_null(raw->mount_point);
+
+	/* pending slots are mounted read-only and unmounted again */
+	g_assert_nonnull(pending_a->status);
+	g_assert_cmpstr(pending_a->status->bundle_version, ==, "a");
+	g_assert_null(pending_a->mount_point);
+	g_assert_nonnull(pending_b->status);
+	g_assert_cmpstr(pending_b->status->bundle_version, ==, "b");
+	g_assert_null(pending_b->mount_point);
+
+	g_assert_true(test_umount(fixture->tmpdir, "external"));
+
+	for (GList *l = slots; l != NULL; l = l->next) {
+		RaucSlot *slot = l->data;
+
+		g_free(slot->ext_mount_point);
+		r_free_slot(slot);
+	}
+}
+
+/* Test: A slot is mounted read-only for loading its status */
+static void config_file_test_mount_slot_readonly(ConfigFileFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autofree gchar *testfile = NULL;
+	g_autoptr(GError) error = NULL;
+	RaucSlot *slot;
+
+	/* mounting needs to run as root */
+	if (!test_running_as_root())
+		return;
+
+	g_free(r_context()->config->mount_prefix);
+	r_context()->config->mount_prefix = g_build_filename(fixture->tmpdir, "mnt", NULL);
+
+	slot = new_test_slot("rootfs.0", "ext4", create_slot_image(fixture->tmpdir, "rootfs", "1.0"));
+
+	g_assert_true(r_mount_slot_readonly(slot, &error));
+	g_assert_no_error(error);
+	g_assert_nonnull(slot->mount_point);
+
+	testfile = g_build_filename(slot->mount_point, "test", NULL);
+	g_assert_false(g_file_set_contents(testfile, "test", -1, &error));
+	g_assert_error(error, G_FILE_ERROR, G_FILE_ERROR_ROFS);
+	g_clear_error(&error);
+
+	g_assert_true(r_umount_slot(slot, &error));
+	g_assert_no_error(error);
+	g_assert_null(slot->mount_point);
+
+	r_free_slot(slot);
 }
 
 int main(int argc, char *argv[])
@@ -852,6 +1048,9 @@ int main(int argc, char *argv[])
 	g_test_add("/config-file/extra-mount-opts", ConfigFileFixture, NULL,
 			config_file_fixture_set_up, config_file_extra_mount_opts,
 			config_file_fixture_tear_down);
+	g_test_add("/config-file/casync-seeds", ConfigFileFixture, NULL,
+			config_file_fixture_set_up, config_file_casync_seeds,
+			config_file_fixture_tear_down);
 	g_test_add_func("/config-file/read-slot-status", config_file_test_read_slot_status);
 	g_test_add_func("/config-file/write-read-slot-status", config_file_test_write_slot_status);
 	g_test_add_func("/config-file/system-serial", config_file_system_serial);
@@ -861,6 +1060,12 @@ int main(int argc, char *argv[])
 	g_test_add("/config-file/global-slot-staus", ConfigFileFixture, NULL,
 			config_file_fixture_set_up_global, config_file_test_global_slot_status,
 			config_file_fixture_tear_down);
+	g_test_add("/config-file/load-slot-status-multi", ConfigFileFixture, NULL,
+			config_file_fixture_set_up, config_file_test_load_slot_status_multi,
+			config_file_fixture_tear_down);
+	g_test_add("/config-file/mount-slot-readonly", ConfigFileFixture, NULL,
+			config_file_fixture_set_up, config_file_test_mount_slot_readonly,
+			config_file_fixture_tear_down);
 
 	return g_test_run();
 }
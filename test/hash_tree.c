@@ -0,0 +1,195 @@
+#include <locale.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "checksum.h"
+#include "hash_tree.h"
+#include "common.h"
+
+#define TEST_IMAGE "test/install-content/appfs.img"
+#define TEST_IMAGE_SIZE 32768
+
+typedef struct {
+	gchar *tmpdir;
+	gchar *image;
+	gchar *treefile;
+} HashTreeFixture;
+
+static void hash_tree_fixture_set_up(HashTreeFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autofree gchar *contents = NULL;
+	GError *error = NULL;
+	gsize len;
+
+	fixture->tmpdir = g_dir_make_tmp("rauc-XXXXXX", NULL);
+	g_assert_nonnull(fixture->tmpdir);
+	fixture->image = g_build_filename(fixture->tmpdir, "slot.img", NULL);
+	fixture->treefile = g_build_filename(fixture->tmpdir, "slot.hashtree", NULL);
+
+	g_assert_true(g_file_get_contents(TEST_IMAGE, &contents, &len, &error));
+	g_assert_no_error(error);
+	g_assert_true(g_file_set_contents(fixture->image, contents, len, &error));
+	g_assert_no_error(error);
+}
+
+static void hash_tree_fixture_tear_down(HashTreeFixture *fixture,
+		gconstpointer user_data)
+{
+	g_assert_true(test_rm_tree(fixture->tmpdir, ""));
+	g_free(fixture->treefile);
+	g_free(fixture->image);
+	g_free(fixture->tmpdir);
+}
+
+static void corrupt_image(HashTreeFixture *fixture, goffset offset)
+{
+	FILE *image = g_fopen(fixture->image, "r+");
+	int c;
+
+	g_assert_nonnull(image);
+	g_assert_cmpint(fseek(image, offset, SEEK_SET), ==, 0);
+	c = fgetc(image);
+	g_assert_cmpint(c, !=, EOF);
+	g_assert_cmpint(fseek(image, offset, SEEK_SET), ==, 0);
+	g_assert_cmpint(fputc(~c & 0xff, image), !=, EOF);
+	fclose(image);
+}
+
+static void hash_tree_test_check(HashTreeFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autoptr(RaucHashTree) tree = NULL;
+	g_autoptr(GArray) mismatches = NULL;
+	GError *error = NULL;
+
+	/* last leaf is shorter */
+	tree = r_hash_tree_compute(TEST_IMAGE, TEST_IMAGE_SIZE, 5000, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(tree);
+	g_assert_cmpuint(r_hash_tree_leaf_count(tree), ==, 7);
+
+	g_assert_true(r_hash_tree_check(tree, fixture->image, &mismatches, &error));
+	g_assert_no_error(error);
+	g_assert_cmpuint(mismatches->len, ==, 0);
+	g_clear_pointer(&mismatches, g_array_unref);
+
+	corrupt_image(fixture, 5000);
+	corrupt_image(fixture, TEST_IMAGE_SIZE - 1);
+	g_assert_true(r_hash_tree_check(tree, fixture->image, &mismatches, &error));
+	g_assert_no_error(error);
+	g_assert_cmpuint(mismatches->len, ==, 2);
+	g_assert_cmpuint(g_array_index(mismatches, guint, 0), ==, 1);
+	g_assert_cmpuint(g_array_index(mismatches, guint, 1), ==, 6);
+	g_clear_pointer(&mismatches, g_array_unref);
+
+	/* data beyond the covered size is ignored */
+	g_clear_pointer(&tree, r_hash_tree_free);
+	tree = r_hash_tree_compute(TEST_IMAGE, 4096, 4096, &error);
+	g_assert_no_error(error);
+	g_assert_true(r_hash_tree_check(tree, fixture->image, &mismatches, &error));
+	g_assert_no_error(error);
+	g_assert_cmpuint(mismatches->len, ==, 0);
+	g_clear_pointer(&mismatches, g_array_unref);
+
+	/* covered size larger than the file */
+	g_clear_pointer(&tree, r_hash_tree_free);
+	tree = r_hash_tree_compute(TEST_IMAGE, 2 * TEST_IMAGE_SIZE, 4096, &error);
+	g_assert_error(error, R_CHECKSUM_ERROR, R_CHECKSUM_ERROR_SIZE_MISMATCH);
+	g_assert_null(tree);
+	g_clear_error(&error);
+}
+
+static void hash_tree_test_save_load(HashTreeFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autoptr(RaucHashTree) tree = NULL;
+	g_autoptr(RaucHashTree) loaded = NULL;
+	g_autofree gchar *root = NULL;
+	GError *error = NULL;
+
+	tree = r_hash_tree_compute(TEST_IMAGE, TEST_IMAGE_SIZE, 4096, &error);
+	g_assert_no_error(error);
+	root = r_hash_tree_get_root(tree);
+	g_assert_nonnull(root);
+
+	g_assert_true(r_hash_tree_save(tree, fixture->treefile, &error));
+	g_assert_no_error(error);
+
+	loaded = r_hash_tree_load(fixture->treefile, TEST_IMAGE_SIZE, 4096, root, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(loaded);
+	g_assert_true(g_bytes_equal(tree->leaves, loaded->leaves));
+	g_clear_pointer(&loaded, r_hash_tree_free);
+
+	/* size and leaf size must fit the file */
+	loaded = r_hash_tree_load(fixture->treefile, TEST_IMAGE_SIZE, 8192, root, &error);
+	g_assert_error(error, R_CHECKSUM_ERROR, R_CHECKSUM_ERROR_SIZE_MISMATCH);
+	g_assert_null(loaded);
+	g_clear_error(&error);
+
+	/* a damaged hash tree file is detected by its root */
+	g_assert_true(g_file_set_contents(fixture->treefile,
+			"0123456789012345678901234567890101234567890123456789012345678901"
+			"0123456789012345678901234567890101234567890123456789012345678901"
+			"0123456789012345678901234567890101234567890123456789012345678901"
+			"0123456789012345678901234567890101234567890123456789012345678901",
+			256, &error));
+	g_assert_no_error(error);
+	loaded = r_hash_tree_load(fixture->treefile, TEST_IMAGE_SIZE, 4096, root, &error);
+	g_assert_error(error, R_CHECKSUM_ERROR, R_CHECKSUM_ERROR_DIGEST_MISMATCH);
+	g_assert_null(loaded);
+	g_clear_error(&error);
+}
+
+static void hash_tree_test_builder(HashTreeFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autoptr(RaucHashTree) computed = NULL;
+	g_autoptr(RaucHashTree) built = NULL;
+	g_autoptr(RaucHashTreeBuilder) builder = NULL;
+	g_autofree gchar *contents = NULL;
+	GError *error = NULL;
+	gsize len, offset = 0;
+
+	computed = r_hash_tree_compute(TEST_IMAGE, TEST_IMAGE_SIZE, 5000, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(computed);
+
+	g_assert_true(g_file_get_contents(TEST_IMAGE, &contents, &len, &error));
+	g_assert_no_error(error);
+	g_assert_cmpuint(len, ==, TEST_IMAGE_SIZE);
+
+	/* blocks which do not match the leaf boundaries */
+	builder = r_hash_tree_builder_new(5000);
+	while (offset < len) {
+		gsize block = MIN(len - offset, 3000 + offset % 7);
+
+		r_hash_tree_builder_update(builder, (const guint8 *) contents + offset, block);
+		offset += block;
+	}
+	built = r_hash_tree_builder_end(builder);
+
+	g_assert_cmpuint(built->size, ==, TEST_IMAGE_SIZE);
+	g_assert_cmpuint(built->leaf_size, ==, 5000);
+	g_assert_true(g_bytes_equal(computed->leaves, built->leaves));
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/hash_tree/check", HashTreeFixture, NULL,
+			hash_tree_fixture_set_up, hash_tree_test_check,
+			hash_tree_fixture_tear_down);
+	g_test_add("/hash_tree/save-load", HashTreeFixture, NULL,
+			hash_tree_fixture_set_up, hash_tree_test_save_load,
+			hash_tree_fixture_tear_down);
+	g_test_add("/hash_tree/builder", HashTreeFixture, NULL,
+			hash_tree_fixture_set_up, hash_tree_test_builder,
+			hash_tree_fixture_tear_down);
+
+	return g_test_run();
+}
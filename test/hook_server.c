@@ -0,0 +1,133 @@
+#include <locale.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "hook_server.h"
+#include "common.h"
+
+#define TEST_HOOK "#!/bin/sh\n\
+test \"$1\" = server || exit 1\n\
+while read -r cmd; do\n\
+	while read -r var && test -n \"$var\"; do\n\
+		export \"$var\"\n\
+	done\n\
+	case \"$cmd\" in\n\
+		install-check) echo ok ;;\n\
+		reject) echo \"reject not compatible\" ;;\n\
+		slot-post-install) echo \"error $RAUC_SLOT_NAME $TEST_COMMON\" ;;\n\
+		quit) echo ok; exit 0 ;;\n\
+		*) echo \"invalid\" ;;\n\
+	esac\n\
+done\n\
+exit 0\n"
+
+typedef struct {
+	gchar *tmpdir;
+	gchar *hook;
+} HookServerFixture;
+
+static void hook_server_fixture_set_up(HookServerFixture *fixture,
+		gconstpointer user_data)
+{
+	GError *error = NULL;
+
+	fixture->tmpdir = g_dir_make_tmp("rauc-XXXXXX", NULL);
+	g_assert_nonnull(fixture->tmpdir);
+	fixture->hook = g_build_filename(fixture->tmpdir, "hook.sh", NULL);
+
+	g_assert_true(g_file_set_contents(fixture->hook, TEST_HOOK, -1, &error));
+	g_assert_no_error(error);
+	g_assert_cmpint(g_chmod(fixture->hook, 0755), ==, 0);
+}
+
+static void hook_server_fixture_tear_down(HookServerFixture *fixture,
+		gconstpointer user_data)
+{
+	g_assert_true(test_rm_tree(fixture->tmpdir, ""));
+	g_free(fixture->hook);
+	g_free(fixture->tmpdir);
+}
+
+static void hook_server_test_calls(HookServerFixture *fixture,
+		gconstpointer user_data)
+{
+	g_auto(GStrv) env = g_environ_setenv(g_get_environ(), "TEST_COMMON", "common", TRUE);
+	gchar *vars[] = {"RAUC_SLOT_NAME=rootfs.1", NULL};
+	gchar *bad_vars[] = {"RAUC_SLOT_NAME=root\nfs", NULL};
+	RaucHookServer *server;
+	GError *error = NULL;
+
+	server = r_hook_server_start(fixture->hook, env, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(server);
+
+	g_assert_true(r_hook_server_call(server, "install-check", NULL, &error));
+	g_assert_no_error(error);
+
+	g_assert_false(r_hook_server_call(server, "reject", NULL, &error));
+	g_assert_error(error, R_HOOK_ERROR, R_HOOK_ERROR_REJECTED);
+	g_assert_cmpstr(error->message, ==, "not compatible");
+	g_clear_error(&error);
+
+	/* per-call variables and the common environment are both passed */
+	g_assert_false(r_hook_server_call(server, "slot-post-install", vars, &error));
+	g_assert_error(error, R_HOOK_ERROR, R_HOOK_ERROR_FAILED);
+	g_assert_cmpstr(error->message, ==, "rootfs.1 common");
+	g_clear_error(&error);
+
+	g_assert_false(r_hook_server_call(server, "slot-post-install", bad_vars, &error));
+	g_assert_error(error, R_HOOK_ERROR, R_HOOK_ERROR_PROTOCOL);
+	g_clear_error(&error);
+
+	g_assert_false(r_hook_server_call(server, "unknown", NULL, &error));
+	g_assert_error(error, R_HOOK_ERROR, R_HOOK_ERROR_PROTOCOL);
+	g_clear_error(&error);
+
+	/* the same process still answers */
+	g_assert_true(r_hook_server_call(server, "install-check", NULL, &error));
+	g_assert_no_error(error);
+
+	g_assert_true(r_hook_server_stop(server, &error));
+	g_assert_no_error(error);
+}
+
+static void hook_server_test_exited(HookServerFixture *fixture,
+		gconstpointer user_data)
+{
+	RaucHookServer *server;
+	GError *error = NULL;
+
+	server = r_hook_server_start(fixture->hook, NULL, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(server);
+
+	g_assert_true(r_hook_server_call(server, "quit", NULL, &error));
+	g_assert_no_error(error);
+
+	/* calls to the exited hook server fail instead of raising SIGPIPE */
+	for (gint i = 0; i < 3; i++) {
+		g_assert_false(r_hook_server_call(server, "install-check", NULL, &error));
+		g_assert_nonnull(error);
+		g_clear_error(&error);
+	}
+
+	g_assert_true(r_hook_server_stop(server, &error));
+	g_assert_no_error(error);
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/hook_server/calls", HookServerFixture, NULL,
+			hook_server_fixture_set_up, hook_server_test_calls,
+			hook_server_fixture_tear_down);
+
+	g_test_add("/hook_server/exited", HookServerFixture, NULL,
+			hook_server_fixture_set_up, hook_server_test_exited,
+			hook_server_fixture_tear_down);
+
+	return g_test_run();
+}
@@ -59,7 +59,10 @@ for i in $RAUC_TARGET_SLOTS; do
 
 	# Copy image
 	echo "<< image $RAUC_IMAGE_NAME [START]"
+	echo "<< phase writing $RAUC_IMAGE_NAME" >&$RAUC_HANDLER_FD
 	cp $IMAGE_PATH $RAUC_SLOT_DEVICE
+	IMAGE_SIZE=$(stat -c %s $IMAGE_PATH)
+	echo "<< bytes $RAUC_IMAGE_NAME $IMAGE_SIZE $IMAGE_SIZE" >&$RAUC_HANDLER_FD
 	echo "<< image $RAUC_IMAGE_NAME [DONE]"
 
 	# Write slot status file
@@ -71,6 +74,8 @@ for i in $RAUC_TARGET_SLOTS; do
 done
 
 # Update boot priority
+echo "<< phase updating boot priority" >&$RAUC_HANDLER_FD
+echo "<< progress 90" >&$RAUC_HANDLER_FD
 for i in $RAUC_SLOTS; do
 	eval RAUC_SLOT_CLASS=\$RAUC_SLOT_CLASS_${i}
 	eval RAUC_SLOT_BOOTNAME=\$RAUC_SLOT_BOOTNAME_${i}
@@ -1038,6 +1038,71 @@ static void install_test_bundle(InstallFixture *fixture,
 	g_free(testfilepath);
 }
 
+/* progress reported while installing, see install_test_bundle_custom_handler() */
+static GPtrArray *progress_messages = NULL;
+static guint64 progress_bytes_done = 0;
+static guint64 progress_bytes_total = 0;
+
+static void install_progress_callback(gint percentage, const gchar *message,
+		gint nesting_depth)
+{
+	if (progress_messages && message)
+		g_ptr_array_add(progress_messages, g_strdup(message));
+}
+
+static void install_progress_bytes_callback(guint64 bytes_done, guint64 bytes_total,
+		guint64 throughput, gint64 eta)
+{
+	progress_bytes_done = bytes_done;
+	progress_bytes_total = bytes_total;
+}
+
+static gboolean progress_message_seen(const gchar *message)
+{
+	for (guint i = 0; i < progress_messages->len; i++) {
+		if (g_strcmp0(g_ptr_array_index(progress_messages, i), message) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Test: Phases and byte counts reported by the custom handler reach the
+ * progress step of the handler */
+static void install_test_bundle_custom_handler(InstallFixture *fixture,
+		gconstpointer user_data)
+{
+	RaucTraceEvent *handler_step = NULL;
+
+	/* needs to run as root */
+	if (!test_running_as_root())
+		return;
+
+	progress_messages = g_ptr_array_new_with_free_func(g_free);
+	progress_bytes_done = 0;
+	progress_bytes_total = 0;
+
+	r_context_trace_start();
+	install_test_bundle(fixture, user_data);
+	r_context_trace_stop();
+
+	g_assert_true(progress_message_seen("Update handler: writing rootfs.ext4"));
+	g_assert_true(progress_message_seen("Update handler: updating boot priority"));
+	g_clear_pointer(&progress_messages, g_ptr_array_unref);
+
+	g_assert_cmpuint(progress_bytes_total, >, 0);
+	g_assert_cmpuint(progress_bytes_done, ==, progress_bytes_total);
+
+	for (guint i = 0; i < r_context()->trace->len; i++) {
+		RaucTraceEvent *event = g_ptr_array_index(r_context()->trace, i);
+
+		if (g_strcmp0(event->name, "launch_and_wait_custom_handler") == 0)
+			handler_step = event;
+	}
+	g_assert_nonnull(handler_step);
+	g_assert_cmpuint(handler_step->bytes, ==, progress_bytes_total);
+}
+
 static void install_test_network(InstallFixture *fixture,
 		gconstpointer user_data)
 {
@@ -1298,6 +1363,10 @@ int main(int argc, char *argv[])
 	g_setenv("PATH", path, TRUE);
 	g_free(path);
 
+	r_context_conf();
+	r_context_register_progress_callback(install_progress_callback);
+	r_context_register_progress_bytes_callback(install_progress_bytes_callback);
+
 	g_test_init(&argc, &argv, NULL);
 
 	g_test_add("/install/bootname", InstallFixture, NULL,
@@ -1347,7 +1416,7 @@ int main(int argc, char *argv[])
 			install_fixture_tear_down);
 
 	g_test_add("/install/bundle-custom-handler", InstallFixture, NULL,
-			install_fixture_set_up_bundle_custom_handler, install_test_bundle,
+			install_fixture_set_up_bundle_custom_handler, install_test_bundle_custom_handler,
 			install_fixture_tear_down);
 
 	g_test_add("/install/bundle-hook/install-check", InstallFixture, NULL,
@@ -0,0 +1,217 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <mtd/mtd-user.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "common.h"
+#include "context.h"
+#include "nand.h"
+
+/* The NAND tests need a simulated device, as set up by uml-test-init:
+ *
+ *   modprobe nandsim first_id_byte=0x20 second_id_byte=0x33 \
+ *     badblocks=1 weakblocks=3:0
+ *
+ * Block 1 is bad from the start, erasing block 3 fails. */
+#define NAND_BAD_BLOCK 1
+#define NAND_WEAK_BLOCK 3
+
+typedef struct {
+	gchar *tmpdir;
+	const gchar *device;
+	struct mtd_info_user info;
+} NandFixture;
+
+static void nand_fixture_set_up(NandFixture *fixture,
+		gconstpointer user_data)
+{
+	fixture->tmpdir = g_dir_make_tmp("rauc-nand-XXXXXX", NULL);
+	g_assert_nonnull(fixture->tmpdir);
+}
+
+static void nand_fixture_set_up_device(NandFixture *fixture,
+		gconstpointer user_data)
+{
+	int fd;
+
+	nand_fixture_set_up(fixture, user_data);
+
+	fixture->device = g_getenv("RAUC_TEST_NAND");
+	if (!fixture->device)
+		return;
+
+	fd = g_open(fixture->device, O_RDONLY | O_CLOEXEC, 0);
+	g_assert_cmpint(fd, >=, 0);
+	g_assert_cmpint(ioctl(fd, MEMGETINFO, &fixture->info), ==, 0);
+	close(fd);
+}
+
+static void nand_fixture_tear_down(NandFixture *fixture,
+		gconstpointer user_data)
+{
+	g_assert_true(test_rm_tree(fixture->tmpdir, ""));
+	g_free(fixture->tmpdir);
+}
+
+static gboolean nand_device_available(NandFixture *fixture)
+{
+	if (!test_running_as_root())
+		return FALSE;
+
+	if (!fixture->device) {
+		g_test_skip("no simulated NAND device (RAUC_TEST_NAND) available");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean nand_block_is_bad(NandFixture *fixture, guint block)
+{
+	loff_t pos = (loff_t) block * fixture->info.erasesize;
+	int fd, ret;
+
+	fd = g_open(fixture->device, O_RDONLY | O_CLOEXEC, 0);
+	g_assert_cmpint(fd, >=, 0);
+	ret = ioctl(fd, MEMGETBADBLOCK, &pos);
+	g_assert_cmpint(ret, >=, 0);
+	close(fd);
+
+	return ret > 0;
+}
+
+static guint8 *nand_read_block(NandFixture *fixture, guint block)
+{
+	guint8 *buf = g_malloc(fixture->info.erasesize);
+	int fd;
+
+	fd = g_open(fixture->device, O_RDONLY | O_CLOEXEC, 0);
+	g_assert_cmpint(fd, >=, 0);
+	g_assert_cmpint(pread(fd, buf, fixture->info.erasesize,
+			(off_t) block * fixture->info.erasesize), ==, fixture->info.erasesize);
+	close(fd);
+
+	return buf;
+}
+
+/* Test: Writing to something that is not an MTD device is refused */
+static void nand_test_not_mtd(NandFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autofree gchar *image = NULL;
+	g_autofree gchar *device = NULL;
+	GError *error = NULL;
+
+	image = write_random_file(fixture->tmpdir, "image.img", 4096, 0x1234);
+	g_assert_nonnull(image);
+	device = write_random_file(fixture->tmpdir, "device.img", 65536, 0x5678);
+	g_assert_nonnull(device);
+
+	g_assert_false(r_nand_write_image(image, device, NULL, &error));
+	g_assert_error(error, R_NAND_ERROR, R_NAND_ERROR_NOT_SUPPORTED);
+	g_clear_error(&error);
+}
+
+/* Test: Blocks are erased and written, skipping bad blocks and marking
+ * blocks bad that fail to erase, and verified by reading them back */
+static void nand_test_write(NandFixture *fixture,
+		gconstpointer user_data)
+{
+	/* blocks expected to take the image data */
+	const guint blocks[] = {0, 2, 4};
+	g_autofree gchar *image = NULL;
+	g_autofree gchar *contents = NULL;
+	RaucChecksum checksum = {0};
+	GError *error = NULL;
+	gsize size, len;
+
+	if (!nand_device_available(fixture))
+		return;
+
+	/* the last block is only partly used and padded with 0xff */
+	size = 2 * fixture->info.erasesize + fixture->info.erasesize / 2 + 1;
+	image = write_random_file(fixture->tmpdir, "image.img", size, 0x1234);
+	g_assert_nonnull(image);
+	g_assert_true(g_file_get_contents(image, &contents, &len, &error));
+	g_assert_no_error(error);
+
+	checksum.type = G_CHECKSUM_SHA256;
+	checksum.digest = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (guint8 *) contents, len);
+
+	g_assert_true(nand_block_is_bad(fixture, NAND_BAD_BLOCK));
+
+	g_assert_true(r_nand_write_image(image, fixture->device, &checksum, &error));
+	g_assert_no_error(error);
+
+	/* the block that failed to erase was marked bad */
+	g_assert_true(nand_block_is_bad(fixture, NAND_WEAK_BLOCK));
+
+	for (guint i = 0; i < G_N_ELEMENTS(blocks); i++) {
+		g_autofree guint8 *data = nand_read_block(fixture, blocks[i]);
+		gsize offset = (gsize) i * fixture->info.erasesize;
+		gsize used = MIN(fixture->info.erasesize, size - offset);
+		gsize padded = (used + fixture->info.writesize - 1) / fixture->info.writesize * fixture->info.writesize;
+
+		g_assert_cmpint(memcmp(data, contents + offset, used), ==, 0);
+		for (gsize j = used; j < padded; j++)
+			g_assert_cmpuint(data[j], ==, 0xff);
+	}
+
+	/* a mismatching checksum of the written data is detected */
+	g_free(checksum.digest);
+	checksum.digest = g_strdup("0000000000000000000000000000000000000000000000000000000000000000");
+	g_assert_false(r_nand_write_image(image, fixture->device, &checksum, &error));
+	g_assert_error(error, R_CHECKSUM_ERROR, R_CHECKSUM_ERROR_DIGEST_MISMATCH);
+	g_clear_error(&error);
+
+	g_free(checksum.digest);
+}
+
+/* Test: An image larger than the good blocks of the device is refused */
+static void nand_test_no_space(NandFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autofree gchar *image = NULL;
+	GError *error = NULL;
+
+	if (!nand_device_available(fixture))
+		return;
+
+	/* the bad blocks make the whole device size too large */
+	image = write_random_file(fixture->tmpdir, "image.img", fixture->info.size, 0x1234);
+	g_assert_nonnull(image);
+
+	g_assert_false(r_nand_write_image(image, fixture->device, NULL, &error));
+	g_assert_error(error, R_NAND_ERROR, R_NAND_ERROR_NO_SPACE);
+	g_clear_error(&error);
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	r_context_conf()->configpath = g_strdup("test/test.conf");
+	r_context();
+
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/nand/not-mtd", NandFixture, NULL,
+			nand_fixture_set_up, nand_test_not_mtd,
+			nand_fixture_tear_down);
+
+	g_test_add("/nand/write", NandFixture, NULL,
+			nand_fixture_set_up_device, nand_test_write,
+			nand_fixture_tear_down);
+
+	g_test_add("/nand/no-space", NandFixture, NULL,
+			nand_fixture_set_up_device, nand_test_no_space,
+			nand_fixture_tear_down);
+
+	return g_test_run();
+}
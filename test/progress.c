@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <locale.h>
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -8,6 +9,9 @@
 
 gint callback_counter;
 gint last_percentage;
+gint bytes_callback_counter;
+guint64 last_bytes_done;
+guint64 last_bytes_total;
 
 static void test_progress_callback(gint percentage,
 		const gchar *message,
@@ -25,9 +29,22 @@ static void test_progress_callback(gint percentage,
 	last_percentage = percentage;
 }
 
+static void test_progress_bytes_callback(guint64 bytes_done,
+		guint64 bytes_total,
+		guint64 throughput,
+		gint64 eta)
+{
+	g_assert_cmpuint(bytes_done, >=, last_bytes_done);
+	g_assert_cmpint(eta, >=, -1);
+
+	bytes_callback_counter++;
+	last_bytes_done = bytes_done;
+	last_bytes_total = bytes_total;
+}
+
 static void progress_test_nesting(void)
 {
-	RaucProgressStep *step;
+	const RaucProgressStep *step;
 
 	/* reset global state */
 	callback_counter = 0;
@@ -41,15 +58,15 @@ static void progress_test_nesting(void)
 	r_context_begin_step("test_1.1.1", "testing step 1.1.1", 1);
 	r_context_begin_step("test_1.1.1.1", "testing step 1.1.1.1", 2);
 	r_context_begin_step("test_1.1.1.1.1", "testing step 1.1.1.1.1", 0);
-	g_assert_cmpint(g_list_length(r_context()->progress), ==, 5);
+	g_assert_cmpuint(r_context()->progress_depth, ==, 5);
 	r_context_end_step("test_1.1.1.1.1", TRUE);
 
 	r_context_begin_step("test_1.1.1.1.2", "testing step 1.1.1.1.2", 0);
-	g_assert_cmpint(g_list_length(r_context()->progress), ==, 5);
+	g_assert_cmpuint(r_context()->progress_depth, ==, 5);
 
-	/* test RaucProgressStep items in list */
-	for (guint i = 0; i < g_list_length(r_context()->progress); i++) {
-		step = g_list_nth_data(r_context()->progress, i);
+	/* test RaucProgressStep items on stack */
+	for (guint i = 0; i < r_context()->progress_depth; i++) {
+		step = &r_context()->progress[i];
 
 		g_assert_nonnull(step->description);
 		g_assert_nonnull(step->name);
@@ -65,7 +82,7 @@ static void progress_test_nesting(void)
 	r_context_end_step("test_1.1", TRUE);
 	r_context_end_step("test_1", TRUE);
 
-	g_assert_cmpint(g_list_length(r_context()->progress), ==, 0);
+	g_assert_cmpuint(r_context()->progress_depth, ==, 0);
 	g_assert_cmpint(last_percentage, ==, 100);
 
 	/* callback should have been called twice per step */
@@ -123,6 +140,149 @@ static void progress_test_explicit_percentage(void)
 	g_assert_cmpint(callback_counter, ==, 9);
 }
 
+static void progress_test_bytes(void)
+{
+	/* reset global state */
+	callback_counter = 0;
+	last_percentage = 0;
+	bytes_callback_counter = 0;
+	last_bytes_done = 0;
+
+	/* bytes outside of an accounted operation are ignored */
+	r_context_add_bytes(1000);
+	g_assert_cmpint(bytes_callback_counter, ==, 0);
+
+	r_context_begin_step("test_1", "testing step 1", 1);
+	r_context_begin_step("test_1.1", "testing step 1.1", 0);
+	r_context_begin_bytes(1000);
+	g_assert_cmpint(bytes_callback_counter, ==, 1);
+	g_assert_cmpuint(last_bytes_total, ==, 1000);
+
+	/* updates are rate-limited */
+	for (gint i = 0; i < 10; i++)
+		r_context_add_bytes(50);
+	g_assert_cmpint(bytes_callback_counter, ==, 1);
+
+	/* the final notification is always sent and updates the step
+	 * percentage */
+	r_context_end_bytes();
+	g_assert_cmpint(bytes_callback_counter, ==, 2);
+	g_assert_cmpuint(last_bytes_done, ==, 500);
+	g_assert_cmpint(last_percentage, ==, 50);
+
+	r_context_add_bytes(50);
+	g_assert_cmpint(bytes_callback_counter, ==, 2);
+
+	r_context_end_step("test_1.1", TRUE);
+	r_context_end_step("test_1", TRUE);
+	g_assert_cmpint(last_percentage, ==, 100);
+}
+
+static void progress_test_coalesce(void)
+{
+	/* reset global state */
+	callback_counter = 0;
+	last_percentage = 0;
+
+	r_context_begin_step("test_1", "testing step 1", 1);
+	r_context_begin_step("test_1.1", "testing step 1.1", 0);
+
+	/* only updates changing the reported percentage are emitted */
+	for (gint i = 1; i < 100; i++)
+		r_context_set_step_percentage("test_1.1", i / 10);
+	g_assert_cmpint(last_percentage, ==, 9);
+	g_assert_cmpint(callback_counter, ==, 2 + 9);
+
+	r_context_end_step("test_1.1", TRUE);
+	r_context_end_step("test_1", TRUE);
+	g_assert_cmpint(last_percentage, ==, 100);
+}
+
+static void progress_test_trace(void)
+{
+	g_autoptr(GPtrArray) args = g_ptr_array_new();
+	g_autofree gchar *json = NULL;
+	const RaucTraceEvent *step;
+	RaucTraceEvent *event;
+
+	/* reset global state */
+	callback_counter = 0;
+	last_percentage = 0;
+	bytes_callback_counter = 0;
+	last_bytes_done = 0;
+
+	/* nothing is recorded outside of an installation */
+	g_assert_null(r_context_trace_begin("test", "untraced", NULL));
+
+	r_context_trace_start();
+	r_context_begin_step("test_1", "testing step 1", 1);
+	r_context_begin_step("test_1.1", "testing step 1.1", 0);
+	r_context_begin_bytes(1000);
+	r_context_add_bytes(1000);
+	r_context_end_bytes();
+
+	g_ptr_array_add(args, "sudo");
+	g_ptr_array_add(args, "--non-interactive");
+	g_ptr_array_add(args, "mount");
+	g_ptr_array_add(args, "-o");
+	g_ptr_array_add(args, "\"quoted\"");
+	g_ptr_array_add(args, NULL);
+	event = r_context_trace_subprocess(args);
+	g_assert_nonnull(event);
+	g_assert_cmpstr(event->name, ==, "mount");
+	r_context_trace_end(event, FALSE);
+
+	r_context_end_step("test_1.1", TRUE);
+	r_context_end_step("test_1", TRUE);
+	r_context_trace_stop();
+
+	g_assert_null(r_context_trace_begin("test", "untraced", NULL));
+
+	g_assert_cmpuint(r_context()->trace->len, ==, 3);
+	step = g_ptr_array_index(r_context()->trace, 1);
+	g_assert_cmpstr(step->category, ==, "step");
+	g_assert_cmpstr(step->name, ==, "test_1.1");
+	g_assert_cmpuint(step->bytes, ==, 1000);
+	g_assert_true(step->success);
+	g_assert_cmpint(step->start, <=, event->start);
+	g_assert_cmpint(step->end, >=, event->end);
+	g_assert_false(event->success);
+
+	json = r_context_trace_to_json();
+	g_assert_nonnull(json);
+	g_assert_true(g_str_has_prefix(json, "{\"traceEvents\":["));
+	g_assert_nonnull(strstr(json, "{\"name\":\"test_1.1\",\"cat\":\"step\",\"ph\":\"X\","));
+	g_assert_nonnull(strstr(json, "\"bytes\":1000,\"result\":\"success\"}"));
+	g_assert_nonnull(strstr(json, "\"description\":\"sudo --non-interactive mount -o \\\"quoted\\\"\",\"result\":\"failure\"}"));
+}
+
+#define BENCHMARK_UPDATES 1000000
+
+static void progress_test_benchmark(void)
+{
+	gdouble elapsed;
+
+	/* reset global state */
+	callback_counter = 0;
+	last_percentage = 0;
+
+	r_context_begin_step("bench_1", "benchmark step 1", 1);
+	r_context_begin_step("bench_1.1", "benchmark step 1.1", 1);
+	r_context_begin_step("bench_1.1.1", "benchmark step 1.1.1", 0);
+
+	g_test_timer_start();
+	for (gint i = 0; i < BENCHMARK_UPDATES; i++)
+		r_context_set_step_percentage("bench_1.1.1", (gint64) i * 100 / BENCHMARK_UPDATES);
+	elapsed = g_test_timer_elapsed();
+
+	r_context_end_step("bench_1.1.1", TRUE);
+	r_context_end_step("bench_1.1", TRUE);
+	r_context_end_step("bench_1", TRUE);
+
+	g_test_minimized_result(elapsed * 1e9 / BENCHMARK_UPDATES,
+			"%.1f ns per percentage update", elapsed * 1e9 / BENCHMARK_UPDATES);
+}
+
 int main(int argc, char *argv[])
 {
 	setlocale(LC_ALL, "C");
@@ -132,12 +292,20 @@ int main(int argc, char *argv[])
 	r_context();
 
 	r_context_register_progress_callback(test_progress_callback);
+	r_context_register_progress_bytes_callback(test_progress_bytes_callback);
 
 	g_test_init(&argc, &argv, NULL);
 
 	g_test_add_func("/progress/test_nesting", progress_test_nesting);
 	g_test_add_func("/progress/test_unsuccessful_substep", progress_test_unsuccessful_substep);
 	g_test_add_func("/progress/test_explicit_percentage", progress_test_explicit_percentage);
+	g_test_add_func("/progress/test_bytes", progress_test_bytes);
+	g_test_add_func("/progress/test_coalesce", progress_test_coalesce);
+	g_test_add_func("/progress/test_trace", progress_test_trace);
+
+	/* run with -m perf */
+	if (g_test_perf())
+		g_test_add_func("/progress/benchmark", progress_test_benchmark);
 
 	return g_test_run();
 }
@@ -395,6 +395,16 @@ test_expect_success SERVICE "rauc status mark-active: via D-Bus" "
     status mark-active
 "
 
+test_expect_success "rauc bench" "
+  mkdir bench &&
+  rauc bench --size=1 --output-format=shell bench > bench.out &&
+  grep -q '^RAUC_BENCH_HASH_MBPS=' bench.out &&
+  grep -q '^RAUC_BENCH_HASH_TREE_BYTES=1048576$' bench.out &&
+  grep -q '^RAUC_BENCH_EXTRACT_SECONDS=' bench.out &&
+  test -z \"\$(ls bench)\" &&
+  rm -r bench bench.out
+"
+
 test_expect_success "rauc install invalid local paths" "
   test_must_fail rauc install foo &&
   test_must_fail rauc install foo.raucb &&
@@ -55,6 +55,72 @@ Exec="TEST_SERVICES "/rauc -c test/test.conf service\n", NULL);
 	g_test_dbus_up(fixture->dbus);
 }
 
+static void service_slot_status_fixture_set_up(ServiceFixture *fixture, gconstpointer user_data)
+{
+	g_autofree gchar *cwd = g_get_current_dir();
+	g_autofree gchar *path = NULL;
+	g_autofree gchar *state_path = NULL;
+	g_autofree gchar *conffile = NULL;
+	g_autofree gchar *servicefile = NULL;
+
+	fixture->tmpdir = g_dir_make_tmp("rauc-XXXXXX", NULL);
+
+	/* boot state is read from the fw_printenv mock on each uncached call */
+	path = g_strdup_printf("%s/test/bin:%s", cwd, g_getenv("PATH"));
+	g_setenv("PATH", path, TRUE);
+	state_path = g_build_filename(fixture->tmpdir, "uboot-state", NULL);
+	g_setenv("UBOOT_STATE_PATH", state_path, TRUE);
+	g_assert_true(g_file_set_contents(state_path, "\
+BOOT_ORDER=A B\n\
+BOOT_A_LEFT=3\n\
+BOOT_B_LEFT=3\n\
+", -1, NULL));
+
+	conffile = write_tmp_file(fixture->tmpdir, "system.conf", "\
+[system]\n\
+compatible=Test Config\n\
+bootloader=uboot\n\
+statusfile=central.raucs\n\
+\n\
+[slot.rescue.0]\n\
+device=images/rescue-0\n\
+type=ext4\n\
+readonly=true\n\
+\n\
+[slot.rootfs.0]\n\
+device=images/rootfs-0\n\
+type=ext4\n\
+bootname=A\n\
+\n\
+[slot.rootfs.1]\n\
+device=images/rootfs-1\n\
+type=ext4\n\
+bootname=B\n\
+\n\
+[slot.appfs.0]\n\
+device=images/appfs-0\n\
+type=ext4\n\
+parent=rootfs.0\n\
+\n\
+[slot.appfs.1]\n\
+device=images/appfs-1\n\
+type=ext4\n\
+parent=rootfs.1\n\
+", NULL);
+	g_assert_nonnull(conffile);
+
+	/* Write a D-Bus service file with current tmpdir */
+	servicefile = write_tmp_file(fixture->tmpdir, "de.pengutronix.rauc.service", g_strdup_printf("\
+[D-BUS Service]\n\
+Name=de.pengutronix.rauc\n\
+Exec="TEST_SERVICES "/rauc -c %s --override-boot-slot=A service\n", conffile), NULL);
+	g_assert_nonnull(servicefile);
+
+	fixture->dbus = g_test_dbus_new(G_TEST_DBUS_NONE);
+	g_test_dbus_add_service_dir(fixture->dbus, fixture->tmpdir);
+	g_test_dbus_up(fixture->dbus);
+}
+
 static void service_fixture_tear_down(ServiceFixture *fixture, gconstpointer user_data)
 {
 	g_test_dbus_down(fixture->dbus);
@@ -252,10 +318,34 @@ out:
 	g_free(version);
 }
 
+/* Asserts the boot-status of a slot in a GetSlotStatus result */
+static void assert_boot_status(GVariant *slot_status_array, const gchar *slotname, const gchar *expected)
+{
+	GVariantIter iter;
+	const gchar *name = NULL;
+	GVariant *dict = NULL;
+	gboolean found = FALSE;
+
+	g_variant_iter_init(&iter, slot_status_array);
+	while (g_variant_iter_loop(&iter, "(&s@a{sv})", &name, &dict)) {
+		const gchar *status = NULL;
+
+		if (g_strcmp0(name, slotname) != 0)
+			continue;
+
+		g_assert_true(g_variant_lookup(dict, "boot-status", "&s", &status));
+		g_assert_cmpstr(status, ==, expected);
+		found = TRUE;
+	}
+	g_assert_true(found);
+}
+
 static void service_test_slot_status(ServiceFixture *fixture, gconstpointer user_data)
 {
 	GError *error = NULL;
 	GVariant *slot_status_array = NULL;
+	GVariant *cached_status_array = NULL;
+	g_autofree gchar *state_path = NULL;
 
 	if (!ENABLE_SERVICE) {
 		g_test_skip("Test requires RAUC being configured with \"--enable-service\".");
@@ -281,10 +371,81 @@ static void service_test_slot_status(ServiceFixture *fixture, gconstpointer user
 	g_assert_no_error(error);
 	g_assert_nonnull(slot_status_array);
 	g_assert_cmpint(g_variant_n_children(slot_status_array), ==, 5);
+	assert_boot_status(slot_status_array, "rootfs.1", "good");
+
+	/* the bootloader marks rootfs.1 bad behind the service's back */
+	state_path = g_build_filename(fixture->tmpdir, "uboot-state", NULL);
+	g_assert_true(g_file_set_contents(state_path, "\
+BOOT_ORDER=A\n\
+BOOT_A_LEFT=3\n\
+BOOT_B_LEFT=0\n\
+", -1, NULL));
+
+	/* second call is answered from the snapshot, so it does not see that */
+	r_installer_call_get_slot_status_sync(installer,
+			&cached_status_array,
+			NULL,
+			&error);
+	g_assert_no_error(error);
+	g_assert_true(g_variant_equal(slot_status_array, cached_status_array));
+	assert_boot_status(cached_status_array, "rootfs.1", "good");
 
 out:
 	g_clear_pointer(&installer, g_object_unref);
 	g_variant_unref(slot_status_array);
+	g_clear_pointer(&cached_status_array, g_variant_unref);
+}
+
+static void service_test_queue(ServiceFixture *fixture, gconstpointer user_data)
+{
+	GError *error = NULL;
+	GVariant *jobs = NULL;
+	guint id = 0;
+
+	if (!ENABLE_SERVICE) {
+		g_test_skip("Test requires RAUC being configured with \"--enable-service\".");
+		return;
+	}
+
+	installer = r_installer_proxy_new_for_bus_sync(G_BUS_TYPE_SESSION,
+			G_DBUS_PROXY_FLAGS_NONE,
+			"de.pengutronix.rauc",
+			"/",
+			NULL,
+			NULL);
+
+	if (installer == NULL) {
+		g_error("failed to install proxy");
+		goto out;
+	}
+
+	/* nonexistent bundles are rejected right away */
+	g_assert_false(r_installer_call_queue_install_sync(installer,
+			"test/nonexistent.raucb",
+			&id,
+			NULL,
+			&error));
+	g_assert_nonnull(error);
+	g_clear_error(&error);
+
+	r_installer_call_get_queue_sync(installer,
+			&jobs,
+			NULL,
+			&error);
+	g_assert_no_error(error);
+	g_assert_nonnull(jobs);
+	g_assert_cmpint(g_variant_n_children(jobs), ==, 0);
+
+	g_assert_false(r_installer_call_cancel_queued_sync(installer,
+			42,
+			NULL,
+			&error));
+	g_assert_nonnull(error);
+	g_clear_error(&error);
+
+out:
+	g_clear_pointer(&installer, g_object_unref);
+	g_clear_pointer(&jobs, g_variant_unref);
 }
 
 int main(int argc, char *argv[])
@@ -302,7 +463,11 @@ int main(int argc, char *argv[])
 			service_fixture_tear_down);
 
 	g_test_add("/service/slot-status", ServiceFixture, NULL,
-			service_info_fixture_set_up, service_test_slot_status,
+			service_slot_status_fixture_set_up, service_test_slot_status,
+			service_fixture_tear_down);
+
+	g_test_add("/service/queue", ServiceFixture, NULL,
+			service_info_fixture_set_up, service_test_queue,
 			service_fixture_tear_down);
 
 	return g_test_run();
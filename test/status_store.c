@@ -0,0 +1,170 @@
+#include <locale.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "status_store.h"
+#include "common.h"
+
+typedef struct {
+	gchar *tmpdir;
+	gchar *statusfile;
+	gchar *journal;
+} StatusStoreFixture;
+
+static void status_store_fixture_set_up(StatusStoreFixture *fixture,
+		gconstpointer user_data)
+{
+	fixture->tmpdir = g_dir_make_tmp("rauc-XXXXXX", NULL);
+	g_assert_nonnull(fixture->tmpdir);
+	fixture->statusfile = g_build_filename(fixture->tmpdir, "status.raucs", NULL);
+	fixture->journal = g_strconcat(fixture->statusfile, ".journal", NULL);
+}
+
+static void status_store_fixture_tear_down(StatusStoreFixture *fixture,
+		gconstpointer user_data)
+{
+	g_assert_true(test_rm_tree(fixture->tmpdir, ""));
+	g_free(fixture->journal);
+	g_free(fixture->statusfile);
+	g_free(fixture->tmpdir);
+}
+
+static void append_status(StatusStoreFixture *fixture, const gchar *group,
+		const gchar *status)
+{
+	g_autoptr(GKeyFile) record = g_key_file_new();
+	GError *error = NULL;
+
+	g_key_file_set_string(record, group, "status", status);
+	g_assert_true(r_status_store_append(fixture->statusfile, record, &error));
+	g_assert_no_error(error);
+}
+
+static void status_store_test_journal(StatusStoreFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autoptr(GKeyFile) key_file = NULL;
+	g_autofree gchar *status = NULL;
+	GError *error = NULL;
+
+	g_assert_true(g_file_set_contents(fixture->statusfile,
+			"[slot.rootfs.0]\nstatus=ok\n\n[slot.rootfs.1]\nstatus=ok\n", -1, &error));
+	g_assert_no_error(error);
+
+	append_status(fixture, "slot.rootfs.1", "failed");
+	append_status(fixture, "slot.rootfs.1", "ok-again");
+
+	/* status file itself is not touched before committing */
+	key_file = r_status_store_load(fixture->statusfile, &error);
+	g_assert_no_error(error);
+	status = g_key_file_get_string(key_file, "slot.rootfs.1", "status", NULL);
+	g_assert_cmpstr(status, ==, "ok-again");
+	g_clear_pointer(&status, g_free);
+	status = g_key_file_get_string(key_file, "slot.rootfs.0", "status", NULL);
+	g_assert_cmpstr(status, ==, "ok");
+	g_clear_pointer(&status, g_free);
+	g_clear_pointer(&key_file, g_key_file_free);
+
+	g_assert_true(r_status_store_commit(fixture->statusfile, &error));
+	g_assert_no_error(error);
+	g_assert_false(g_file_test(fixture->journal, G_FILE_TEST_EXISTS));
+
+	/* plain key file contains the merged state */
+	key_file = g_key_file_new();
+	g_assert_true(g_key_file_load_from_file(key_file, fixture->statusfile, G_KEY_FILE_NONE, &error));
+	g_assert_no_error(error);
+	status = g_key_file_get_string(key_file, "slot.rootfs.1", "status", NULL);
+	g_assert_cmpstr(status, ==, "ok-again");
+}
+
+static void status_store_test_torn_record(StatusStoreFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autoptr(GKeyFile) key_file = NULL;
+	g_autofree gchar *contents = NULL;
+	g_autofree gchar *status = NULL;
+	GError *error = NULL;
+	FILE *journal;
+	gsize len;
+
+	append_status(fixture, "slot.rootfs.0", "first");
+	append_status(fixture, "slot.rootfs.0", "lost");
+
+	/* cut the last record short, as after a power loss */
+	g_assert_true(g_file_get_contents(fixture->journal, &contents, &len, &error));
+	g_assert_no_error(error);
+	g_assert_true(g_file_set_contents(fixture->journal, contents, len - 4, &error));
+	g_assert_no_error(error);
+
+	key_file = r_status_store_load(fixture->statusfile, &error);
+	g_assert_no_error(error);
+	status = g_key_file_get_string(key_file, "slot.rootfs.0", "status", NULL);
+	g_assert_cmpstr(status, ==, "first");
+	g_clear_pointer(&status, g_free);
+	g_clear_pointer(&key_file, g_key_file_free);
+
+	/* records appended after the torn one are still found */
+	append_status(fixture, "slot.rootfs.0", "third");
+	key_file = r_status_store_load(fixture->statusfile, &error);
+	g_assert_no_error(error);
+	status = g_key_file_get_string(key_file, "slot.rootfs.0", "status", NULL);
+	g_assert_cmpstr(status, ==, "third");
+
+	/* garbage in between is skipped as well */
+	journal = g_fopen(fixture->journal, "a");
+	g_assert_nonnull(journal);
+	fputs("#record 1000 0123\n[slot.rootfs.0]\nstatus=bogus\n", journal);
+	fclose(journal);
+	append_status(fixture, "slot.rootfs.0", "fourth");
+	g_clear_pointer(&status, g_free);
+	g_clear_pointer(&key_file, g_key_file_free);
+	key_file = r_status_store_load(fixture->statusfile, &error);
+	g_assert_no_error(error);
+	status = g_key_file_get_string(key_file, "slot.rootfs.0", "status", NULL);
+	g_assert_cmpstr(status, ==, "fourth");
+}
+
+static void status_store_test_compaction(StatusStoreFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autofree gchar *filler = g_strnfill(1024, 'x');
+	GError *error = NULL;
+	g_autoptr(GKeyFile) record = g_key_file_new();
+
+	g_key_file_set_string(record, "slot.rootfs.0", "description", filler);
+
+	/* the journal is merged automatically once it grows too large */
+	for (gint i = 0; i < 100; i++) {
+		g_assert_true(r_status_store_append(fixture->statusfile, record, &error));
+		g_assert_no_error(error);
+	}
+
+	g_assert_true(g_file_test(fixture->statusfile, G_FILE_TEST_EXISTS));
+	g_assert_true(r_status_store_commit(fixture->statusfile, &error));
+	g_assert_no_error(error);
+	g_assert_false(g_file_test(fixture->journal, G_FILE_TEST_EXISTS));
+
+	/* nothing to do without journal */
+	g_assert_true(r_status_store_commit(fixture->statusfile, &error));
+	g_assert_no_error(error);
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/status_store/journal", StatusStoreFixture, NULL,
+			status_store_fixture_set_up, status_store_test_journal,
+			status_store_fixture_tear_down);
+	g_test_add("/status_store/torn-record", StatusStoreFixture, NULL,
+			status_store_fixture_set_up, status_store_test_torn_record,
+			status_store_fixture_tear_down);
+	g_test_add("/status_store/compaction", StatusStoreFixture, NULL,
+			status_store_fixture_set_up, status_store_test_compaction,
+			status_store_fixture_tear_down);
+
+	return g_test_run();
+}
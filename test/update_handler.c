@@ -1,4 +1,5 @@
 #include <locale.h>
+#include <stdio.h>
 #include <glib.h>
 #include <gio/gio.h>
 #include <glib/gstdio.h>
@@ -25,6 +26,7 @@ typedef enum {
 	TEST_UPDATE_HANDLER_INSTALL_HOOK  = BIT(6),
 	TEST_UPDATE_HANDLER_NO_HOOK_FILE  = BIT(7),
 	TEST_UPDATE_HANDLER_HOOK_FAIL     = BIT(8),
+	TEST_UPDATE_HANDLER_CANCELLED     = BIT(9),
 } TestUpdateHandlerParams;
 
 typedef struct {
@@ -99,6 +101,229 @@ static void test_get_custom_update_handler(UpdateHandlerFixture *fixture, gconst
 	g_assert_nonnull(handler);
 }
 
+/* Test update_handler/writes_as_is:
+ *
+ * Only images copied unmodified to the slot device may be read back for
+ * verification, all other image and slot types must be skipped.
+ */
+static void test_update_handler_writes_as_is(UpdateHandlerFixture *fixture, gconstpointer user_data)
+{
+	struct {
+		const gchar *filename;
+		const gchar *slottype;
+		gboolean install_hook;
+		gboolean as_is;
+	} cases[] = {
+		{"rootfs.img", "raw", FALSE, TRUE},
+		{"rootfs.ext4", "ext4", FALSE, TRUE},
+		{"rootfs.squashfs", "raw", FALSE, TRUE},
+		{"rootfs.img", "raw", TRUE, FALSE},
+		{"rootfs.ext4.caibx", "ext4", FALSE, FALSE},
+		{"rootfs.img.caibx", "raw", FALSE, FALSE},
+		{"rootfs.catar", "ext4", FALSE, FALSE},
+		{"rootfs.caidx", "ext4", FALSE, FALSE},
+		{"rootfs.tar.gz", "ext4", FALSE, FALSE},
+		{"rootfs.img", "nand", FALSE, FALSE},
+		{"rootfs.ubifs", "ubivol", FALSE, FALSE},
+#if ENABLE_EMMC_BOOT_SUPPORT == 1
+		{"bootloader.img", "boot-emmc", FALSE, FALSE},
+#endif
+	};
+
+	for (guint i = 0; i < G_N_ELEMENTS(cases); i++) {
+		g_autoptr(RaucImage) image = g_new0(RaucImage, 1);
+		g_autoptr(RaucSlot) targetslot = g_new0(RaucSlot, 1);
+		img_to_slot_handler handler;
+		GError *ierror = NULL;
+
+		image->slotclass = g_strdup("rootfs");
+		image->filename = g_strdup(cases[i].filename);
+		image->hooks.install = cases[i].install_hook;
+
+		targetslot->name = g_strdup("rootfs.0");
+		targetslot->sclass = g_strdup("rootfs");
+		targetslot->device = g_strdup("/dev/null");
+		targetslot->type = g_strdup(cases[i].slottype);
+
+		handler = get_update_handler(image, targetslot, &ierror);
+		g_assert_no_error(ierror);
+		g_assert_nonnull(handler);
+		g_test_message("%s to %s slot", cases[i].filename, cases[i].slottype);
+		g_assert_cmpint(update_handler_writes_as_is(handler, image), ==, cases[i].as_is);
+	}
+}
+
+/* Test update_handler/ubivol_unchanged:
+ *
+ * Writing to a UBI volume is skipped if it already contains the image. As
+ * the test slot is a regular file, the volume update ioctl fails if RAUC
+ * tries to write, which shows that the write path was taken.
+ */
+static void test_update_handler_ubivol_unchanged(UpdateHandlerFixture *fixture, gconstpointer user_data)
+{
+	g_autoptr(RaucImage) image = g_new0(RaucImage, 1);
+	g_autoptr(RaucSlot) targetslot = g_new0(RaucSlot, 1);
+	g_autofree gchar *tmpdir = NULL;
+	g_autofree gchar *slotpath = NULL;
+	img_to_slot_handler handler;
+	GError *ierror = NULL;
+	FILE *f;
+	gint last;
+	/* not a multiple of the 1 MiB copy block size */
+	gsize size = 2 * 1024 * 1024 + 4096;
+
+	tmpdir = g_dir_make_tmp("rauc-XXXXXX", NULL);
+	g_assert_nonnull(tmpdir);
+
+	image->slotclass = g_strdup("rootfs");
+	image->filename = write_random_file(tmpdir, "image.ubifs", size, 0x1234);
+	g_assert_nonnull(image->filename);
+	image->checksum.size = size;
+
+	targetslot->name = g_strdup("rootfs.0");
+	targetslot->sclass = g_strdup("rootfs");
+	targetslot->type = g_strdup("ubivol");
+	r_context();
+
+	handler = get_update_handler(image, targetslot, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_nonnull(handler);
+
+	/* same content: the write is skipped */
+	slotpath = write_random_file(tmpdir, "ubivol-0", size, 0x1234);
+	g_assert_nonnull(slotpath);
+	targetslot->device = g_strdup(slotpath);
+	g_assert_true(handler(image, targetslot, NULL, &ierror));
+	g_assert_no_error(ierror);
+
+	/* forcing the installation writes the volume */
+	targetslot->force_install_same = TRUE;
+	g_assert_false(handler(image, targetslot, NULL, &ierror));
+	g_assert_error(ierror, R_UPDATE_ERROR, R_UPDATE_ERROR_FAILED);
+	g_clear_error(&ierror);
+	targetslot->force_install_same = FALSE;
+
+	/* different content in the last chunk: the volume is written */
+	g_clear_pointer(&slotpath, g_free);
+	g_clear_pointer(&targetslot->device, g_free);
+	slotpath = write_random_file(tmpdir, "ubivol-1", size, 0x1234);
+	g_assert_nonnull(slotpath);
+	f = fopen(slotpath, "r+b");
+	g_assert_nonnull(f);
+	g_assert_cmpint(fseek(f, size - 1, SEEK_SET), ==, 0);
+	last = fgetc(f);
+	g_assert_cmpint(last, !=, EOF);
+	g_assert_cmpint(fseek(f, size - 1, SEEK_SET), ==, 0);
+	g_assert_cmpint(fputc(last ^ 0xff, f), !=, EOF);
+	g_assert_cmpint(fclose(f), ==, 0);
+	targetslot->device = g_strdup(slotpath);
+	g_assert_false(handler(image, targetslot, NULL, &ierror));
+	g_assert_error(ierror, R_UPDATE_ERROR, R_UPDATE_ERROR_FAILED);
+	g_clear_error(&ierror);
+
+	/* shorter volume: the volume is written */
+	g_clear_pointer(&slotpath, g_free);
+	g_clear_pointer(&targetslot->device, g_free);
+	slotpath = write_random_file(tmpdir, "ubivol-2", size / 2, 0x1234);
+	g_assert_nonnull(slotpath);
+	targetslot->device = g_strdup(slotpath);
+	g_assert_false(handler(image, targetslot, NULL, &ierror));
+	g_assert_error(ierror, R_UPDATE_ERROR, R_UPDATE_ERROR_FAILED);
+	g_clear_error(&ierror);
+
+	g_assert_true(test_rm_tree(tmpdir, ""));
+}
+
+/* Runs the tar to ext4 handler with a mkfs.ext4 that records its arguments
+ * and fails, returns the arguments */
+static gchar *run_ext4_format(const gchar *tmpdir, img_to_slot_handler handler,
+		RaucImage *image, RaucSlot *targetslot)
+{
+	g_autofree gchar *logpath = g_build_filename(tmpdir, "mkfs.log", NULL);
+	gchar *contents = NULL;
+	GError *ierror = NULL;
+
+	g_assert_false(handler(image, targetslot, NULL, &ierror));
+	g_assert_nonnull(ierror);
+	g_clear_error(&ierror);
+
+	g_assert_true(g_file_get_contents(logpath, &contents, NULL, NULL));
+	g_assert_cmpint(g_unlink(logpath), ==, 0);
+
+	return contents;
+}
+
+/* Test update_handler/ext4_format:
+ *
+ * Checks the arguments passed to mkfs.ext4 when formatting an ext4 slot with
+ * and without a recent discard.
+ */
+static void test_update_handler_ext4_format(UpdateHandlerFixture *fixture, gconstpointer user_data)
+{
+	g_autoptr(RaucImage) image = g_new0(RaucImage, 1);
+	g_autoptr(RaucSlot) targetslot = g_new0(RaucSlot, 1);
+	g_autoptr(GDateTime) now = g_date_time_new_now_utc();
+	g_autofree gchar *tmpdir = NULL;
+	g_autofree gchar *mkfs = NULL;
+	g_autofree gchar *path = NULL;
+	g_autofree gchar *testpath = NULL;
+	g_autofree gchar *expected = NULL;
+	img_to_slot_handler handler;
+	GError *ierror = NULL;
+	gchar *args;
+
+	tmpdir = g_dir_make_tmp("rauc-XXXXXX", NULL);
+	g_assert_nonnull(tmpdir);
+
+	mkfs = write_tmp_file(tmpdir, "mkfs.ext4", "#!/bin/sh\necho \"$*\" > \"$(dirname \"$0\")/mkfs.log\"\nexit 1\n", NULL);
+	g_assert_nonnull(mkfs);
+	g_assert_cmpint(g_chmod(mkfs, 0755), ==, 0);
+	path = g_strdup(g_getenv("PATH"));
+	testpath = g_strdup_printf("%s:%s", tmpdir, path);
+	g_setenv("PATH", testpath, TRUE);
+
+	image->slotclass = g_strdup("rootfs");
+	image->filename = g_strdup("rootfs.tar");
+
+	targetslot->name = g_strdup("rootfs.0");
+	targetslot->sclass = g_strdup("rootfs");
+	targetslot->type = g_strdup("ext4");
+	targetslot->device = g_build_filename(tmpdir, "rootfs-0", NULL);
+	targetslot->status = g_new0(RaucSlotStatus, 1);
+	r_context();
+
+	handler = get_update_handler(image, targetslot, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_nonnull(handler);
+
+	/* without discard-interval, the slot is always discarded */
+	expected = g_strdup_printf("-F -L rootfs.0 -E lazy_itable_init=1 %s\n", targetslot->device);
+	args = run_ext4_format(tmpdir, handler, image, targetslot);
+	g_assert_cmpstr(args, ==, expected);
+	g_free(args);
+
+	/* a discard within the interval is not repeated */
+	targetslot->discard_interval = 7;
+	targetslot->status->discarded_timestamp = g_date_time_format(now, "%Y-%m-%dT%H:%M:%SZ");
+	g_free(expected);
+	expected = g_strdup_printf("-F -L rootfs.0 -E lazy_itable_init=1,nodiscard %s\n", targetslot->device);
+	args = run_ext4_format(tmpdir, handler, image, targetslot);
+	g_assert_cmpstr(args, ==, expected);
+	g_free(args);
+
+	/* an older discard is repeated */
+	g_free(targetslot->status->discarded_timestamp);
+	targetslot->status->discarded_timestamp = g_strdup("2017-03-02T10:32:00Z");
+	g_free(expected);
+	expected = g_strdup_printf("-F -L rootfs.0 -E lazy_itable_init=1 %s\n", targetslot->device);
+	args = run_ext4_format(tmpdir, handler, image, targetslot);
+	g_assert_cmpstr(args, ==, expected);
+	g_free(args);
+
+	g_setenv("PATH", path, TRUE);
+	g_assert_true(test_rm_tree(tmpdir, ""));
+}
+
 #define SLOT_SIZE (10*1024*1024)
 #define IMAGE_SIZE (10*1024*1024)
 #define FILE_SIZE (10*1024)
@@ -323,9 +548,18 @@ no_image:
 	g_assert_no_error(ierror);
 	g_assert_nonnull(handler);
 
+	/* simulate an installation cancelled before writing */
+	if (test_pair->params & TEST_UPDATE_HANDLER_CANCELLED) {
+		r_context()->install_info->cancellable = g_cancellable_new();
+		g_cancellable_cancel(r_context()->install_info->cancellable);
+	}
+
 	/* Run to perform an update */
 	res = handler(image, targetslot, hookpath, &ierror);
 
+	if (test_pair->params & TEST_UPDATE_HANDLER_CANCELLED)
+		g_clear_object(&r_context()->install_info->cancellable);
+
 	if (test_pair->params & TEST_UPDATE_HANDLER_EXPECT_FAIL) {
 		g_assert_error(ierror, test_pair->err_domain, test_pair->err_code);
 		g_assert_false(res);
@@ -451,6 +685,8 @@ int main(int argc, char *argv[])
 		{"vfat", "tar.bz2", TEST_UPDATE_HANDLER_HOOKS | TEST_UPDATE_HANDLER_POST_HOOK | TEST_UPDATE_HANDLER_HOOK_FAIL | TEST_UPDATE_HANDLER_EXPECT_FAIL, G_SPAWN_EXIT_ERROR, 1},
 		{"vfat", "tar.bz2", TEST_UPDATE_HANDLER_HOOKS | TEST_UPDATE_HANDLER_INSTALL_HOOK | TEST_UPDATE_HANDLER_HOOK_FAIL | TEST_UPDATE_HANDLER_EXPECT_FAIL, G_SPAWN_EXIT_ERROR, 1},
 
+		{"raw", "img", TEST_UPDATE_HANDLER_CANCELLED | TEST_UPDATE_HANDLER_EXPECT_FAIL, G_IO_ERROR, G_IO_ERROR_CANCELLED},
+
 		{0}
 	};
 	setlocale(LC_ALL, "C");
@@ -783,5 +1019,33 @@ int main(int argc, char *argv[])
 			test_update_handler,
 			update_handler_fixture_tear_down);
 
+	g_test_add("/update_handler/update_handler/img_to_raw/cancelled",
+			UpdateHandlerFixture,
+			&testpair_matrix[51],
+			update_handler_fixture_set_up,
+			test_update_handler,
+			update_handler_fixture_tear_down);
+
+	g_test_add("/update_handler/ubivol_unchanged",
+			UpdateHandlerFixture,
+			NULL,
+			NULL,
+			test_update_handler_ubivol_unchanged,
+			NULL);
+
+	g_test_add("/update_handler/writes_as_is",
+			UpdateHandlerFixture,
+			NULL,
+			NULL,
+			test_update_handler_writes_as_is,
+			NULL);
+
+	g_test_add("/update_handler/ext4_format",
+			UpdateHandlerFixture,
+			NULL,
+			NULL,
+			test_update_handler_ext4_format,
+			NULL);
+
 	return g_test_run();
 }